@@ -3,7 +3,10 @@
 
 // Qt headers.
 #include <QCheckBox>
+#include <QDoubleSpinBox>
+#include <QFormLayout>
 #include <QPushButton>
+#include <QSpinBox>
 #include <QVBoxLayout>
 
 // Other header files.
@@ -68,6 +71,18 @@ MapRenderSettingsWidget::MapRenderSettingsWidget(MapWidget* mapWidget) : QWidget
             debugBtn->setText(name);
         });
 
+    // Set up the checkbox for showing frame times and loading stats in debug mode.
+    QCheckBox *perfOverlayCheckbox = new QCheckBox("Performance overlay", this);
+    perfOverlayCheckbox->setCheckState(mapWidget->isShowingPerformanceOverlay() ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(perfOverlayCheckbox);
+    QObject::connect(
+        perfOverlayCheckbox,
+        &QCheckBox::checkStateChanged,
+        mapWidget,
+        [=](Qt::CheckState boxIsChecked) {
+            mapWidget->setShouldShowPerformanceOverlay(boxIsChecked == Qt::Checked);
+        });
+
     // Set up the toggle map tile type button.
     QString renderBtnName = getRenderingTileBtnLabel(mapWidget);
     QPushButton *renderBtn = new QPushButton(renderBtnName, this);
@@ -118,4 +133,90 @@ MapRenderSettingsWidget::MapRenderSettingsWidget(MapWidget* mapWidget) : QWidget
         [=](Qt::CheckState boxIsChecked) {
             mapWidget->setShouldDrawText(boxIsChecked == Qt::Checked);
         });
+
+    // Set up the checkbox and text for caching rasterized tiles.
+    QCheckBox *bitmapCacheCheckbox = new QCheckBox("Cache tile bitmaps", this);
+    bitmapCacheCheckbox->setCheckState(mapWidget->isCachingTileBitmaps() ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(bitmapCacheCheckbox);
+    QObject::connect(
+        bitmapCacheCheckbox,
+        &QCheckBox::checkStateChanged,
+        mapWidget,
+        [=](Qt::CheckState boxIsChecked) {
+            mapWidget->setShouldCacheTileBitmaps(boxIsChecked == Qt::Checked);
+        });
+
+    // Set up the checkbox and text for painting tiles on worker threads.
+    QCheckBox *parallelCheckbox = new QCheckBox("Paint tiles in parallel", this);
+    parallelCheckbox->setCheckState(mapWidget->isRenderingTilesInParallel() ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(parallelCheckbox);
+    QObject::connect(
+        parallelCheckbox,
+        &QCheckBox::checkStateChanged,
+        mapWidget,
+        [=](Qt::CheckState boxIsChecked) {
+            mapWidget->setShouldRenderTilesInParallel(boxIsChecked == Qt::Checked);
+        });
+
+    // Set up the checkbox and text for drawing raster tiles while vector tiles load.
+    QCheckBox *placeholderCheckbox = new QCheckBox("Raster placeholders", this);
+    placeholderCheckbox->setCheckState(mapWidget->isUsingRasterPlaceholders() ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(placeholderCheckbox);
+    QObject::connect(
+        placeholderCheckbox,
+        &QCheckBox::checkStateChanged,
+        mapWidget,
+        [=](Qt::CheckState boxIsChecked) {
+            mapWidget->setShouldUseRasterPlaceholders(boxIsChecked == Qt::Checked);
+        });
+
+    // Set up the checkbox and text for scaling tiles while a zoom is in progress.
+    QCheckBox *zoomScaleCheckbox = new QCheckBox("Scale tiles while zooming", this);
+    zoomScaleCheckbox->setCheckState(mapWidget->isScalingTilesWhileZooming() ? Qt::Checked : Qt::Unchecked);
+    layout->addWidget(zoomScaleCheckbox);
+
+    // Set up how long zooming has to pause before the tiles are rendered crisply again,
+    // and the resolution of the scaled tiles in the meantime.
+    QFormLayout *zoomLayout = new QFormLayout;
+    layout->addLayout(zoomLayout);
+    QSpinBox *settleDelaySpinBox = new QSpinBox(this);
+    settleDelaySpinBox->setRange(0, 2000);
+    settleDelaySpinBox->setSingleStep(50);
+    settleDelaySpinBox->setSuffix(" ms");
+    settleDelaySpinBox->setValue(mapWidget->getZoomSettleDelayMs());
+    zoomLayout->addRow("Zoom settle delay", settleDelaySpinBox);
+    QDoubleSpinBox *previewResolutionSpinBox = new QDoubleSpinBox(this);
+    previewResolutionSpinBox->setRange(0.25, 1.0);
+    previewResolutionSpinBox->setSingleStep(0.25);
+    previewResolutionSpinBox->setValue(mapWidget->getZoomPreviewResolution());
+    zoomLayout->addRow("Zoom preview quality", previewResolutionSpinBox);
+
+    auto updateZoomControls = [=]() {
+        const bool enabled = mapWidget->isScalingTilesWhileZooming();
+        settleDelaySpinBox->setEnabled(enabled);
+        previewResolutionSpinBox->setEnabled(enabled);
+    };
+    updateZoomControls();
+    QObject::connect(
+        zoomScaleCheckbox,
+        &QCheckBox::checkStateChanged,
+        mapWidget,
+        [=](Qt::CheckState boxIsChecked) {
+            mapWidget->setShouldScaleTilesWhileZooming(boxIsChecked == Qt::Checked);
+            updateZoomControls();
+        });
+    QObject::connect(
+        settleDelaySpinBox,
+        &QSpinBox::valueChanged,
+        mapWidget,
+        [=](int delayMs) {
+            mapWidget->setZoomSettleDelayMs(delayMs);
+        });
+    QObject::connect(
+        previewResolutionSpinBox,
+        &QDoubleSpinBox::valueChanged,
+        mapWidget,
+        [=](double resolution) {
+            mapWidget->setZoomPreviewResolution(resolution);
+        });
 }
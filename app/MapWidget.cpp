@@ -3,15 +3,26 @@
 
 // Qt header files.
 #include <QCoreApplication>
+#include <QFontDatabase>
 #include <QKeyEvent>
 #include <QtMath>
 #include <QPainter>
+#include <QScreen>
+#ifdef BACH_OPENGL_MAPWIDGET
+#include <QSurfaceFormat>
+#endif
 #include <QtMath>
 #include <QWheelEvent>
 
+// STL header files.
+#include <algorithm>
+#include <array>
+
 // Other header files.
 #include "MapWidget.h"
 #include "Rendering.h"
+#include "TileBitmapCache.h"
+#include "Tracing.h"
 
 /*!
  * \brief The TileType enum determines what tile type to render.
@@ -30,11 +41,35 @@ enum class TileType {
  *
  * \param parent The QWidget to attach the MapWidget to.
  */
-MapWidget::MapWidget(QWidget *parent) : QWidget(parent)
+MapWidget::MapWidget(QWidget *parent) : MapWidgetBase(parent)
 {
+#ifdef BACH_OPENGL_MAPWIDGET
+    // QPainter only antialiases through OpenGL on a multisampled surface.
+    QSurfaceFormat surfaceFormat = format();
+    surfaceFormat.setSamples(4);
+    setFormat(surfaceFormat);
+    // Keep the framebuffer between frames, so that a frame only has to draw the region it repaints.
+    setUpdateBehavior(QOpenGLWidget::PartialUpdate);
+#endif
+
     // Establish and install the keypress filter.
     this->keyPressFilter = std::make_unique<KeyPressFilter>(this);
     QCoreApplication::instance()->installEventFilter(this->keyPressFilter.get());
+
+    this->labelPlacement = std::make_unique<Bach::LabelPlacementState>();
+    this->renderScratch = std::make_unique<Bach::RenderFrameScratch>();
+
+    // Tile arrivals are drawn by the next frame, which is at most one display refresh away.
+    frameTimer.setSingleShot(true);
+    frameTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&frameTimer, &QTimer::timeout, this, &MapWidget::drawTileArrivals);
+
+    // Once the zoom has settled, the tiles are rasterized again at the current zoom.
+    zoomSettleTimer.setSingleShot(true);
+    zoomSettleTimer.setInterval(defaultZoomSettleDelayMs);
+    QObject::connect(&zoomSettleTimer, &QTimer::timeout, this, [this]() { update(); });
+
+    frameClock.start();
 }
 
 /*!
@@ -76,7 +111,7 @@ void MapWidget::keyPressEvent(QKeyEvent* event)
     else if (event->key() == Qt::Key::Key_S)
         zoomOut();
     else
-        QWidget::keyPressEvent(event);
+        MapWidgetBase::keyPressEvent(event);
 }
 
 /*!
@@ -206,23 +241,90 @@ void MapWidget::wheelEvent(QWheelEvent *event) {
 }
 
 
+#ifdef BACH_OPENGL_MAPWIDGET
+/*!
+ * \brief MapWidget::paintEvent
+ * Hands the region of the paint event over to paintGL, which has no access to the event.
+ */
+void MapWidget::paintEvent(QPaintEvent *event)
+{
+    glPaintRegion = event->region();
+    MapWidgetBase::paintEvent(event);
+    glPaintRegion = std::nullopt;
+}
+
+/*!
+ * \brief MapWidget::paintGL
+ * Draws the map through OpenGL.
+ *
+ * The framebuffer is kept between frames, see the constructor, so like the raster
+ * backend only the region of the paint event is drawn again.
+ */
+void MapWidget::paintGL()
+{
+    const QRegion paintRegion = glPaintRegion.value_or(QRegion{ rect() });
+    QPainter painter(this);
+    // Unlike on a QWidget, the painter is not clipped to the paint event.
+    painter.setClipRegion(paintRegion);
+    paintMap(painter, paintRegion);
+}
+#else
 void MapWidget::paintEvent(QPaintEvent *event)
 {
-    QVector<TileCoord> visibleTiles = calcVisibleTiles();
-    std::set<TileCoord> tilesRequested{ visibleTiles.begin(), visibleTiles.end()};
+    QPainter painter(this);
+    paintMap(painter, event->region());
+}
+#endif
+
+/*!
+ * \brief MapWidget::paintMap
+ * Requests the visible tiles and draws them.
+ *
+ * \param painter The painter to draw into, already set up for this widget.
+ * \param paintRegion The part of the widget to draw. Tiles outside it are skipped.
+ */
+void MapWidget::paintMap(QPainter &painter, const QRegion &paintRegion)
+{
+    // The window is shown before the stylesheet is loaded, see main.cpp.
+    // There is nothing to draw until the tiles can be requested.
+    if (!requestTilesFn) {
+        painter.fillRect(paintRegion.boundingRect(), palette().window());
+        return;
+    }
+
+    const qint64 frameStartNs = frameClock.nsecsElapsed();
+    const bool showOverlay = isShowingDebug() && isShowingPerformanceOverlay();
+    const PerformanceOverlayScopeTimes scopeTimesAtFrameStart =
+        showOverlay ? readPerformanceOverlayScopeTimes() : PerformanceOverlayScopeTimes{};
+
+    const QVector<TileCoord> visibleTiles = calcVisibleTiles();
+    lastTileScreenRects = Bach::calcTileScreenRects(
+        width(),
+        height(),
+        x,
+        y,
+        getViewportZoomLevel(),
+        getMapZoomLevel());
+    {
+        // Any tile that arrived until now is drawn by this frame.
+        QMutexLocker lock { &tileArrivalsLock };
+        tileArrivals.clear();
+    }
     // This signal should run every time a new tile is loaded later.
     auto signalFn = [this](TileCoord newTile) {
-        // Possible optimization:
-        // Check if this new tile is relevant anymore, and only
-        // issue redraw if it is.
-        update();
+        handleTileArrival(newTile);
     };
     // Request tiles.
     QScopedPointer<Bach::RequestTilesResult> requestResult = requestTilesFn(
-        tilesRequested,
+        visibleTiles,
         signalFn);
+    const qint64 requestEndNs = frameClock.nsecsElapsed();
 
-    QPainter painter(this);
+    // Tiles that are still loading are drawn from tiles of other zoom levels meanwhile.
+    QMap<TileCoord, const VectorTile*> vectorTiles = requestResult->vectorMap();
+    vectorTiles.insert(requestResult->fallbackVectorMap());
+    QMap<TileCoord, const QImage*> rasterTiles = requestResult->rasterImageMap();
+    rasterTiles.insert(requestResult->fallbackRasterImageMap());
 
     if (isRenderingVector()) {
         // Set up the paint settings based on the MapWidget configuration.
@@ -230,6 +332,20 @@ void MapWidget::paintEvent(QPaintEvent *event)
         paintSettings.drawFill = isRenderingFill();
         paintSettings.drawLines = isRenderingLines();
         paintSettings.drawText = isRenderingText();
+        paintSettings.rasterizeTilesInParallel = isRenderingTilesInParallel();
+        // Polygons this small would only tint a single pixel slightly.
+        paintSettings.minFeaturePixelSize = 0.5;
+
+        // While zooming, draw the tiles from images that are reused for every frame of the gesture.
+        Bach::TileBitmapCache *bitmapCache = tileBitmapCache.get();
+        if (isScalingTilesWhileZooming() && isZoomInProgress()) {
+            paintSettings.zoomPreviewResolution = getZoomPreviewResolution();
+            if (bitmapCache == nullptr) {
+                if (zoomPreviewCache == nullptr)
+                    zoomPreviewCache = std::make_unique<Bach::TileBitmapCache>();
+                bitmapCache = zoomPreviewCache.get();
+            }
+        }
 
         // Then run the function to paint all vector tiles into this MapWidget.
         Bach::paintVectorTiles(
@@ -238,10 +354,22 @@ void MapWidget::paintEvent(QPaintEvent *event)
             y,
             getViewportZoomLevel(),
             getMapZoomLevel(),
-            requestResult->vectorMap(),
+            vectorTiles,
             requestResult->styleSheet(),
             paintSettings,
-            isShowingDebug());
+            isShowingDebug(),
+            bitmapCache,
+            labelPlacement.get(),
+            &paintRegion,
+            &requestResult->overzoomMap(),
+            renderScratch.get(),
+            isUsingRasterPlaceholders() ? &requestResult->rasterImageMap() : nullptr);
+
+        // Labels placed for the repainted tiles may reach into the rest of the widget.
+        if (!labelPlacement->pendingRepaint.isEmpty()) {
+            update(labelPlacement->pendingRepaint);
+            labelPlacement->pendingRepaint = {};
+        }
     } else {
         Bach::paintRasterTiles(
             painter,
@@ -249,10 +377,216 @@ void MapWidget::paintEvent(QPaintEvent *event)
             y,
             getViewportZoomLevel(),
             getMapZoomLevel(),
-            requestResult->rasterImageMap(),
+            rasterTiles,
             requestResult->styleSheet(),
-            isShowingDebug());
+            isShowingDebug(),
+            &paintRegion,
+            &requestResult->rasterMipLevelMap());
+    }
+
+    if (showOverlay) {
+        const qint64 frameEndNs = frameClock.nsecsElapsed();
+        FrameTiming timing;
+        timing.endMs = frameEndNs / 1000000;
+        timing.requestMs = (requestEndNs - frameStartNs) / 1e6;
+        timing.paintMs = (frameEndNs - requestEndNs) / 1e6;
+        recentFrameTimings.push_back(timing);
+        while (recentFrameTimings.front().endMs < timing.endMs - 1000)
+            recentFrameTimings.pop_front();
+
+        paintPerformanceOverlay(painter, paintRegion, scopeTimesAtFrameStart);
+    }
+}
+
+/*!
+ * \brief MapWidget::readPerformanceOverlayScopeTimes
+ * \return The total time spent in each of the performanceOverlayScopes so far, in nanoseconds.
+ * Zero for every scope unless tracing is compiled in and enabled.
+ */
+MapWidget::PerformanceOverlayScopeTimes MapWidget::readPerformanceOverlayScopeTimes()
+{
+    PerformanceOverlayScopeTimes out {};
+    if (!Bach::Tracing::isCompiledIn() || !Bach::Tracing::isEnabled())
+        return out;
+    for (size_t i = 0; i < performanceOverlayScopes.size(); i++)
+        out[i] = Bach::Tracing::scopeTotal(performanceOverlayScopes[i]).durationNs;
+    return out;
+}
+
+/*!
+ * \brief MapWidget::paintPerformanceOverlay
+ * Draws the frame rate, frame times, label counts and tile loading stats
+ * of the latest frames into the top-left corner of the widget.
+ *
+ * If the overlay reaches outside the paint region, that part is
+ * repainted by a follow-up frame, so that the numbers stay current.
+ *
+ * \param painter The painter the map was drawn with.
+ * \param paintRegion The part of the widget drawn by this frame.
+ * \param scopeTimesAtFrameStart The totals of the traced scopes when this frame started,
+ * see readPerformanceOverlayScopeTimes.
+ */
+void MapWidget::paintPerformanceOverlay(
+    QPainter &painter,
+    const QRegion &paintRegion,
+    const PerformanceOverlayScopeTimes &scopeTimesAtFrameStart)
+{
+    QStringList lines;
+
+    // Frame rate and frame times, averaged over the frames of the last second.
+    double requestMsSum = 0;
+    double paintMsSum = 0;
+    for (const FrameTiming &timing : recentFrameTimings) {
+        requestMsSum += timing.requestMs;
+        paintMsSum += timing.paintMs;
+    }
+    const int frameCount = (int)recentFrameTimings.size();
+    lines << QString("FPS: %1").arg(frameCount);
+    lines << QString("Frame: %1 ms (request %2 ms, paint %3 ms)")
+        .arg((requestMsSum + paintMsSum) / frameCount, 0, 'f', 2)
+        .arg(requestMsSum / frameCount, 0, 'f', 2)
+        .arg(paintMsSum / frameCount, 0, 'f', 2);
+
+    // The traced scopes break the paint time down further. Scopes on worker threads
+    // are included, so the sum can exceed the frame time when painting in parallel.
+    if (Bach::Tracing::isCompiledIn() && Bach::Tracing::isEnabled()) {
+        // The time spent in each scope during this frame is how much its total grew.
+        // Tracing::clear resets the totals, so the difference may be negative.
+        const PerformanceOverlayScopeTimes scopeTimesNow = readPerformanceOverlayScopeTimes();
+        std::array<double, performanceOverlayScopes.size()> scopeMs {};
+        for (size_t i = 0; i < scopeMs.size(); i++)
+            scopeMs[i] = qMax<qint64>(scopeTimesNow[i] - scopeTimesAtFrameStart[i], 0) / 1e6;
+        lines << QString("Fill %1 ms, line %2 ms, symbol %3 ms, labels %4 ms")
+            .arg(scopeMs[0], 0, 'f', 2)
+            .arg(scopeMs[1], 0, 'f', 2)
+            .arg(scopeMs[2], 0, 'f', 2)
+            .arg(scopeMs[3], 0, 'f', 2);
+    }
+
+    if (isRenderingVector()) {
+        int textCount = 0;
+        int curvedTextCount = 0;
+        for (const auto &[coord, tileLabels] : labelPlacement->tiles) {
+            textCount += tileLabels.texts.size();
+            curvedTextCount += tileLabels.curvedTexts.size();
+        }
+        lines << QString("Labels: %1 (%2 curved)").arg(textCount + curvedTextCount).arg(curvedTextCount);
+    }
+
+    if (tileBitmapCache != nullptr) {
+        const qint64 hits = tileBitmapCache->hitCount();
+        const qint64 lookups = hits + tileBitmapCache->missCount();
+        lines << QString("Tile bitmaps: %1 MB, %2% hits")
+            .arg(tileBitmapCache->sizeInBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+            .arg(lookups == 0 ? 0.0 : 100.0 * hits / lookups, 0, 'f', 1);
+    }
+
+    if (debugStatsFn)
+        lines << debugStatsFn();
+
+    painter.save();
+    painter.resetTransform();
+    painter.setClipping(false);
+    painter.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    const QFontMetrics metrics = painter.fontMetrics();
+    const int margin = 6;
+    int textWidth = 0;
+    for (const QString &line : lines)
+        textWidth = qMax(textWidth, metrics.horizontalAdvance(line));
+    const QRect overlayRect {
+        margin,
+        margin,
+        textWidth + 2 * margin,
+        (int)lines.size() * metrics.height() + 2 * margin };
+
+    painter.fillRect(overlayRect, QColor(0, 0, 0, 180));
+    painter.setPen(Qt::white);
+    for (int i = 0; i < lines.size(); i++) {
+        painter.drawText(
+            overlayRect.left() + margin,
+            overlayRect.top() + margin + i * metrics.height() + metrics.ascent(),
+            lines[i]);
+    }
+    painter.restore();
+
+    // Whatever this frame did not repaint of the old and new overlay is stale now.
+    const QRegion staleRegion = QRegion{ overlayRect.united(performanceOverlayRect) } - paintRegion;
+    performanceOverlayRect = overlayRect;
+    if (!staleRegion.isEmpty())
+        update(staleRegion);
+}
+
+/*!
+ * \brief MapWidget::handleTileArrival
+ * Queues a loaded tile to be drawn by the next frame.
+ *
+ * Only the first arrival since the last frame wakes the GUI thread,
+ * the rest of a burst are collected until the frame is drawn.
+ *
+ * \param tile The tile that finished loading.
+ *
+ * \threadsafe
+ */
+void MapWidget::handleTileArrival(TileCoord tile)
+{
+    {
+        QMutexLocker lock { &tileArrivalsLock };
+        tileArrivals.insert(tile);
+        if (frameScheduled)
+            return;
+        frameScheduled = true;
     }
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            // Align the frames to the refresh rate of the display we are on.
+            const qreal refreshRate = screen() != nullptr ? screen()->refreshRate() : 60;
+            const int frameIntervalMs = qMax(1, qRound(1000 / qMax(refreshRate, (qreal)1)));
+            if (!frameTimer.isActive())
+                frameTimer.start(frameIntervalMs);
+        },
+        Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ * \brief tilesOverlap
+ * \return Returns true if one of the tiles covers the other.
+ * This includes the tiles of other zoom levels drawn in place of tiles that are still loading.
+ */
+static bool tilesOverlap(TileCoord a, TileCoord b)
+{
+    const TileCoord &coarse = a.zoom <= b.zoom ? a : b;
+    const TileCoord &fine = a.zoom <= b.zoom ? b : a;
+    const int zoomDiff = fine.zoom - coarse.zoom;
+    return (fine.x >> zoomDiff) == coarse.x && (fine.y >> zoomDiff) == coarse.y;
+}
+
+/*!
+ * \brief MapWidget::drawTileArrivals
+ * Redraws the map once for all the tiles that arrived since the last frame.
+ *
+ * Only the on-screen area of the visible tiles that the arrivals affect is repainted.
+ * Tiles that are no longer visible, like prefetched tiles, don't cause a redraw.
+ */
+void MapWidget::drawTileArrivals()
+{
+    std::set<TileCoord> arrivals;
+    {
+        QMutexLocker lock { &tileArrivalsLock };
+        arrivals.swap(tileArrivals);
+        frameScheduled = false;
+    }
+
+    QRegion dirtyRegion;
+    for (const TileCoord &tile : arrivals) {
+        for (auto it = lastTileScreenRects.cbegin(); it != lastTileScreenRects.cend(); it++) {
+            if (tilesOverlap(tile, it.key()))
+                dirtyRegion += it.value();
+        }
+    }
+    if (!dirtyRegion.isEmpty())
+        update(dirtyRegion);
 }
 
 /*!
@@ -321,6 +655,8 @@ void MapWidget::genericZoom(bool magnify)
         viewportZoomLevel += 0.1;
     else
         viewportZoomLevel -= 0.1;
+    if (scaleTilesWhileZooming)
+        zoomSettleTimer.start();
     update();
 }
 
@@ -467,6 +803,107 @@ void MapWidget::setShouldDrawText(bool drawText)
     update();
 }
 
+/*!
+ * \brief MapWidget::setShouldCacheTileBitmaps
+ * Controls if the fill and line layers of each tile should be rasterized once
+ * and reused on later repaints.
+ *
+ * \param cacheTileBitmaps indicates if tile bitmaps should be cached (true) or not (false).
+ */
+void MapWidget::setShouldCacheTileBitmaps(bool cacheTileBitmaps)
+{
+    if (cacheTileBitmaps && tileBitmapCache == nullptr)
+        tileBitmapCache = std::make_unique<Bach::TileBitmapCache>();
+    else if (!cacheTileBitmaps)
+        tileBitmapCache = nullptr;
+    update();
+}
+
+/*!
+ * \brief MapWidget::setShouldRenderTilesInParallel
+ * Controls if the fill and line layers of each tile should be painted on worker threads.
+ *
+ * \param inParallel indicates if tiles should be painted on worker threads (true) or not (false).
+ */
+void MapWidget::setShouldRenderTilesInParallel(bool inParallel)
+{
+    renderTilesInParallel = inParallel;
+    update();
+}
+
+/*!
+ * \brief MapWidget::setShouldUseRasterPlaceholders
+ * Controls if vector tiles that are still loading or being parsed should be drawn
+ * from their raster tile meanwhile. Raster tiles are quick to decode, so on a slow CPU
+ * the map fills in well before the vector tiles are ready.
+ *
+ * \param usePlaceholders indicates if raster tiles should stand in for vector tiles (true) or not (false).
+ */
+void MapWidget::setShouldUseRasterPlaceholders(bool usePlaceholders)
+{
+    useRasterPlaceholders = usePlaceholders;
+    update();
+}
+
+/*!
+ * \brief MapWidget::setShouldScaleTilesWhileZooming
+ * Controls if tiles should be scaled from images rasterized once per map zoom level
+ * while zooming, instead of being rasterized again every frame.
+ * The tiles are rasterized at the current zoom once the zoom has settled.
+ *
+ * \param scaleWhileZooming indicates if tiles should be scaled while zooming (true) or not (false).
+ */
+void MapWidget::setShouldScaleTilesWhileZooming(bool scaleWhileZooming)
+{
+    scaleTilesWhileZooming = scaleWhileZooming;
+    if (!scaleWhileZooming) {
+        zoomSettleTimer.stop();
+        zoomPreviewCache = nullptr;
+    }
+    update();
+}
+
+/*!
+ * \brief MapWidget::setZoomSettleDelayMs
+ * Sets how long after the latest zoom step the zoom is considered settled,
+ * and the tiles are rasterized at the current zoom.
+ *
+ * \param delayMs The delay in milliseconds.
+ */
+void MapWidget::setZoomSettleDelayMs(int delayMs)
+{
+    zoomSettleTimer.setInterval(qMax(delayMs, 0));
+}
+
+/*!
+ * \brief MapWidget::setZoomPreviewResolution
+ * Sets the resolution of the images that tiles are scaled from while zooming.
+ *
+ * \param resolution The resolution as a fraction of the display resolution, range (0, 1].
+ * Lower values are faster but blurrier.
+ */
+void MapWidget::setZoomPreviewResolution(double resolution)
+{
+    zoomPreviewResolution = std::clamp(resolution, 0.1, 1.0);
+    // The images of the old resolution are of no use anymore.
+    if (zoomPreviewCache != nullptr)
+        zoomPreviewCache->clear();
+    update();
+}
+
+/*!
+ * \brief MapWidget::setShouldShowPerformanceOverlay
+ * Controls if the debug mode also shows frame times and tile loading stats.
+ *
+ * \param showOverlay indicates if the overlay should be shown (true) or not (false).
+ */
+void MapWidget::setShouldShowPerformanceOverlay(bool showOverlay)
+{
+    showPerformanceOverlay = showOverlay;
+    recentFrameTimings.clear();
+    update();
+}
+
 /*!
  * \brief MapWidget::toggleIsShowingDebug
  * Toggles if the debug menu and lines should be shown or not.
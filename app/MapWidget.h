@@ -5,17 +5,47 @@
 #define MAPWIDGET_H
 
 // Qt header files.
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QPainter>
+#include <QRect>
 #include <QScopedPointer>
+#include <QTimer>
 #include <QWidget>
+#ifdef BACH_OPENGL_MAPWIDGET
+#include <QOpenGLWidget>
+#endif
 
 // STL header files.
+#include <array>
+#include <deque>
 #include <functional>
+#include <optional>
 #include <set>
 
 // Other header files.
 #include "RequestTilesResult.h"
 #include "TileCoord.h"
 
+namespace Bach {
+    class TileBitmapCache;
+    struct LabelPlacementState;
+    struct RenderFrameScratch;
+}
+
+/*
+ * The widget the map is drawn into. With BACH_OPENGL_MAPWIDGET defined, QPainter
+ * draws through OpenGL, so filling, stroking and compositing the tile images
+ * run on the GPU instead of the CPU. Only the paint engine changes: the tiles are
+ * still drawn from their QPainterPaths, there are no tile meshes on the GPU.
+ */
+#ifdef BACH_OPENGL_MAPWIDGET
+using MapWidgetBase = QOpenGLWidget;
+#else
+using MapWidgetBase = QWidget;
+#endif
+
 /*!
  * \class MapWidget
  * \brief The MapWidget class is responsible for displaying a map.
@@ -23,7 +53,7 @@
  * It should be used as a smaller widget within a larger Widget hierarchy.
  * The MapWidget has a built-in viewport configuration (zoom level and center coordinates).
  */
-class MapWidget : public QWidget
+class MapWidget : public MapWidgetBase
 {
     Q_OBJECT
 
@@ -71,6 +101,40 @@ private:
     // Controls whether debug lines should be shown.
     bool showDebug = false;
 
+    // If true, the debug mode also shows frame times and tile loading stats on top of the map.
+    bool showPerformanceOverlay = true;
+
+    // How long the parts of a single frame took, in milliseconds.
+    struct FrameTiming {
+        // When the frame ended, as read from 'frameClock'.
+        qint64 endMs = 0;
+        double requestMs = 0;
+        double paintMs = 0;
+    };
+    // Runs for the lifetime of the widget, so frames can be put on a timeline.
+    QElapsedTimer frameClock;
+    // The frames of about the last second, oldest first.
+    std::deque<FrameTiming> recentFrameTimings;
+    // Where the performance overlay was drawn by the latest frame.
+    QRect performanceOverlayRect;
+
+    // The traced scopes that the performance overlay breaks the paint time down into.
+    static constexpr std::array<const char*, 4> performanceOverlayScopes {
+        "paintVectorTile::fill",
+        "paintVectorTile::line",
+        "paintVectorTile::symbol",
+        "updateLabelPlacement",
+    };
+    using PerformanceOverlayScopeTimes = std::array<qint64, performanceOverlayScopes.size()>;
+    // Reads the total time spent in each of the performanceOverlayScopes so far, see Bach::Tracing::scopeTotal.
+    static PerformanceOverlayScopeTimes readPerformanceOverlayScopeTimes();
+
+    // Draws the frame times and stats of the latest frames into the top-left corner.
+    void paintPerformanceOverlay(
+        QPainter &painter,
+        const QRegion &paintRegion,
+        const PerformanceOverlayScopeTimes &scopeTimesAtFrameStart);
+
     // If set to true, we should be rendering vector graphics.
     // If set to false, we should be rendering raster graphics.
     bool renderVectorTile = true;
@@ -84,12 +148,71 @@ private:
     // If true, render line-elements.
     bool renderText = true;
 
+    // If set, the fill and line layers of each tile are rasterized once
+    // and reused while panning. Null when bitmap caching is disabled.
+    std::unique_ptr<Bach::TileBitmapCache> tileBitmapCache;
+
+    // If true, the fill and line layers of each tile are painted on worker threads.
+    bool renderTilesInParallel = false;
+
+    // If true, vector tiles that are still loading are drawn from their raster tile meanwhile.
+    bool useRasterPlaceholders = false;
+
+    // If true, tiles are scaled from images rasterized once per map zoom level
+    // while a zoom gesture is in progress, and rasterized crisply once it settles.
+    bool scaleTilesWhileZooming = true;
+    // Resolution of the images drawn while zooming, as a fraction of the display resolution.
+    double zoomPreviewResolution = 1.0;
+    // Runs from the latest zoom step until the zoom is considered settled.
+    QTimer zoomSettleTimer;
+    // Holds the images drawn while zooming when tileBitmapCache is disabled.
+    std::unique_ptr<Bach::TileBitmapCache> zoomPreviewCache;
+
+    // The labels placed during the previous frame. Keeps labels in place while panning.
+    std::unique_ptr<Bach::LabelPlacementState> labelPlacement;
+    // The temporary buffers of the previous frame, reused by the next one to avoid allocating them again.
+    std::unique_ptr<Bach::RenderFrameScratch> renderScratch;
+
+    // The tiles requested by the latest frame, along with where they are on screen.
+    // Lets a tile arrival repaint only the tiles it affects.
+    QMap<TileCoord, QRect> lastTileScreenRects;
+
+    // Tiles that finished loading since the last frame.
+    // A whole burst of them is drawn by a single frame.
+    //
+    // IMPORTANT! Only use when 'tileArrivalsLock' is locked!
+    std::set<TileCoord> tileArrivals;
+    // IMPORTANT! Only use when 'tileArrivalsLock' is locked!
+    bool frameScheduled = false;
+    // Tiles are loaded on other threads, so the arrivals need a lock.
+    QMutex tileArrivalsLock;
+    // Fires once per display refresh while tiles keep arriving.
+    QTimer frameTimer;
+
+    // Can be called from any thread.
+    void handleTileArrival(TileCoord tile);
+    void drawTileArrivals();
+
+    // Draws the map into the given region of the widget.
+    void paintMap(QPainter &painter, const QRegion &paintRegion);
+#ifdef BACH_OPENGL_MAPWIDGET
+    // The region of the paint event that paintGL is drawing for, see MapWidget::paintEvent.
+    // Unset if paintGL was called outside of a paint event, then the whole widget is drawn.
+    std::optional<QRegion> glPaintRegion;
+#endif
+
 public:
+    // How long after the latest zoom step the zoom is considered settled, by default.
+    static constexpr int defaultZoomSettleDelayMs = 150;
+
     MapWidget(QWidget *parent = nullptr);
     ~MapWidget();
 
     // Application events.
     void paintEvent(QPaintEvent*) override;
+#ifdef BACH_OPENGL_MAPWIDGET
+    void paintGL() override;
+#endif
     void keyPressEvent(QKeyEvent*) override;
     void mousePressEvent(QMouseEvent*) override;
     void mouseMoveEvent(QMouseEvent*) override;
@@ -151,17 +274,22 @@ public:
      * May have custom logic in destructor.
      * MapWidget should release this object as early as possible.
      *
-     * \param First parameter is a set of TileCoordinates to request.
+     * \param First parameter is the list of TileCoordinates to request, in the order they are visible.
      *
      * \param Second parameter is a callback to signal when a tile is loaded later.
      *        For this widget, it will signal the widget to redraw itself with the new result.
      */
     using RequestTilesFnT =
         QScopedPointer<Bach::RequestTilesResult>(
-            const std::set<TileCoord>&,
+            const QVector<TileCoord>&,
             std::function<void(TileCoord)>);
     std::function<RequestTilesFnT> requestTilesFn;
 
+    /*! Returns extra lines of text for the performance overlay,
+     * such as the counters of the tile source. Optional.
+     */
+    std::function<QStringList()> debugStatsFn;
+
     // Handle what should be rendered or not to the viewport.
     bool isShowingDebug() const { return showDebug; }
     bool isRenderingVector() const { return renderVectorTile; }
@@ -171,6 +299,21 @@ public:
     void setShouldDrawLines(bool);
     bool isRenderingText() const { return renderText; }
     void setShouldDrawText(bool);
+    bool isCachingTileBitmaps() const { return tileBitmapCache != nullptr; }
+    void setShouldCacheTileBitmaps(bool);
+    bool isRenderingTilesInParallel() const { return renderTilesInParallel; }
+    void setShouldRenderTilesInParallel(bool);
+    bool isUsingRasterPlaceholders() const { return useRasterPlaceholders; }
+    void setShouldUseRasterPlaceholders(bool);
+    bool isScalingTilesWhileZooming() const { return scaleTilesWhileZooming; }
+    void setShouldScaleTilesWhileZooming(bool);
+    int getZoomSettleDelayMs() const { return zoomSettleTimer.interval(); }
+    void setZoomSettleDelayMs(int);
+    double getZoomPreviewResolution() const { return zoomPreviewResolution; }
+    void setZoomPreviewResolution(double);
+    bool isZoomInProgress() const { return zoomSettleTimer.isActive(); }
+    bool isShowingPerformanceOverlay() const { return showPerformanceOverlay; }
+    void setShouldShowPerformanceOverlay(bool);
 
 public slots:
     // Swap between debug and regular mode in the GUI.
@@ -3,11 +3,17 @@
 
 // Qt header files.
 #include <QApplication>
+#include <QDir>
 #include <QMessageBox>
+#include <QThreadPool>
+
+// STL header files.
+#include <memory>
 
 // Other header files.
 #include "MainWindow.h"
 #include "TileLoader.h"
+#include "Tracing.h"
 #include "Utilities.h"
 
 // Helper function to let the program shut down easily if there are errors
@@ -24,12 +30,108 @@
     std::exit(EXIT_FAILURE);
 }
 
+/*
+ * Applies the tile loading settings of the application.
+ */
+static void configureTileLoader(Bach::TileLoader &tileLoader)
+{
+    // Bound the in-memory tile cache, otherwise every tile visited
+    // during the session stays in memory until we quit.
+    Bach::TileMemoryLimits tileMemoryLimits;
+    tileMemoryLimits.maxTileCount = 2048;
+    tileMemoryLimits.maxBytes = 512ll * 1024 * 1024;
+    // Tiles that scrolled away are kept as their compressed bytes, which fit
+    // several times more of the map in the same budget than parsed tiles.
+    tileMemoryLimits.maxParsedVectorTiles = 256;
+    tileMemoryLimits.compressDemotedVectorTiles = true;
+    tileLoader.setTileMemoryLimits(tileMemoryLimits);
+
+    // Same for the tile cache folder, which otherwise grows with every tile ever downloaded.
+    Bach::TileDiskCacheLimits diskCacheLimits;
+    diskCacheLimits.maxBytes = 1024ll * 1024 * 1024;
+    tileLoader.setDiskCacheLimits(diskCacheLimits);
+
+    // After zooming out, draw the tiles we already have of the
+    // previous zoom level until the new tiles are loaded.
+    tileLoader.setUseDescendantFallbacks(true);
+
+    // Only decode the tile layers our style sheet draws, and leave the geometry
+    // encoded until a layer is drawn for the first time.
+    tileLoader.setDecodeStyledLayersOnly(true);
+    Bach::TileParseOptions parseOptions;
+    parseOptions.deferGeometry = true;
+    tileLoader.setTileParseOptions(parseOptions);
+
+    // Show the base map of a tile, such as water and landcover,
+    // while the roads and labels of a large tile are still being parsed.
+    tileLoader.setStreamVectorTileLayers(true);
+
+    // Shape the labels of every tile on the worker threads, so that
+    // painting a tile for the first time only has to place them.
+    tileLoader.setPrepareTileLabels(true);
+
+    // Load the tiles around the viewport ahead of time, so that
+    // panning and zooming don't start from an empty map.
+    Bach::TilePrefetchPolicy prefetchPolicy;
+    prefetchPolicy.enabled = true;
+    tileLoader.setPrefetchPolicy(prefetchPolicy);
+}
+
+/*
+ * Set up the functions that forward requests from the
+ * MapWidget into the TileLoader. These lambdas tie the
+ * two components together.
+ */
+static void connectMapWidget(MapWidget *mapWidget, Bach::TileLoader &tileLoader)
+{
+    // Every MapWidget is a client of its own, so that several views
+    // of the same TileLoader don't cancel each other's tiles.
+    const Bach::TileLoader::ClientId client = tileLoader.addClient();
+    mapWidget->requestTilesFn = [&tileLoader, client](auto tileList, auto tileLoadedCallback) {
+        return tileLoader.requestTiles(tileList, tileLoadedCallback, true, client);
+    };
+    QObject::connect(mapWidget, &QObject::destroyed, [&tileLoader, client]() {
+        tileLoader.removeClient(client);
+    });
+    // Show the counters of the TileLoader in the performance overlay of the debug mode.
+    mapWidget->debugStatsFn = [&tileLoader]() {
+        const Bach::TileMemoryStats stats = tileLoader.getTileMemoryStats();
+        const qint64 lookups = stats.hits + stats.misses;
+        return QStringList {
+            QString("Tiles in memory: %1 (%2 MB)")
+                .arg(stats.tileCount)
+                .arg(stats.byteSize / (1024.0 * 1024.0), 0, 'f', 1),
+            QString("Loading: %1 tiles, %2 downloads in flight")
+                .arg(stats.pendingTileCount)
+                .arg(stats.activeDownloads),
+            QString("Memory hits: %1%, evictions: %2")
+                .arg(lookups == 0 ? 0.0 : 100.0 * stats.hits / lookups, 0, 'f', 1)
+                .arg(stats.evictions),
+            QString("Demoted: %1 tiles, %2 parsed again")
+                .arg(stats.demotedTileCount)
+                .arg(stats.promotions),
+            QString("Prefetch hits: %1 / %2")
+                .arg(stats.prefetchHits)
+                .arg(stats.prefetchLoads),
+        };
+    };
+}
+
 // The main program.
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
     QCoreApplication::setApplicationName("qt_thesis_app");
 
+    // With tracing compiled in, the latest trace events can be saved for chrome://tracing or Perfetto.
+    const QString traceFilePath = qEnvironmentVariable("BACH_TRACE_FILE");
+    if (Bach::Tracing::isCompiledIn() && !traceFilePath.isEmpty()) {
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, [traceFilePath]() {
+            if (Bach::Tracing::writeChromeTrace(traceFilePath))
+                qDebug() << "Trace written to" << traceFilePath;
+        });
+    }
+
     // Print the cache folder to the terminal.
     qDebug() << "Current file cache can be found in: " << Bach::TileLoader::getGeneralCacheFolder();
 
@@ -44,66 +146,107 @@ int main(int argc, char *argv[])
     // The style sheet type to load (can be many different types).
     MapType mapType = MapType::BasicV2;
 
-    std::optional<QJsonDocument> styleSheetJsonResult = Bach::loadStyleSheetJson(
-        mapType,
-        mapTilerKeyOpt);
-    if (!styleSheetJsonResult.has_value()) {
-        earlyShutdown("Unable to load stylesheet from disk/web.");
-    }
-    const QJsonDocument &styleSheetJson = styleSheetJsonResult.value();
-
-    // Parse the stylesheet into data that can be rendered.
-    std::optional<StyleSheet> parsedStyleSheetResult = StyleSheet::fromJson(styleSheetJson);
-    // If the stylesheet can't be parsed, there is nothing to render. Shut down.
-    if (!parsedStyleSheetResult.has_value()) {
-        earlyShutdown("Unable to parse stylesheet JSON into a parsed StyleSheet object.");
-    }
-    StyleSheet &styleSheet = parsedStyleSheetResult.value();
+    // Created once the stylesheet is loaded. Until then the map stays empty.
+    std::unique_ptr<Bach::TileLoader> tileLoaderPtr;
 
-    // Load useful links from the stylesheet.
+    // The URL templates to download tiles from, once they are resolved.
     // This only matters if one is online and has a MapTiler key.
-
-    // Tracks whether or not to download data from web.
-    bool useWeb = hasMapTilerKey;
+    // Only used on the GUI thread.
     QString pbfUrlTemplate;
     QString pngUrlTemplate;
-    if (useWeb) {
-        ParsedLink pbfUrlTemplateResult = Bach::getPbfUrlTemplate(styleSheetJson, "maptiler_planet");
-        ParsedLink rasterUrlTemplateResult = Bach::getRasterUrlTemplate(mapType, mapTilerKeyOpt);
-        if (pbfUrlTemplateResult.resultType != ResultType::Success)
-            useWeb = false;
-        else if (rasterUrlTemplateResult.resultType != ResultType::Success)
-            useWeb = false;
-        else {
-            pbfUrlTemplate = pbfUrlTemplateResult.link;
-            pngUrlTemplate = rasterUrlTemplateResult.link;
-        }
-    }
-
-    // Create TileLoader based on whether one can access online data or not.
-    std::unique_ptr<Bach::TileLoader> tileLoaderPtr;
-    if (useWeb) {
-        tileLoaderPtr = Bach::TileLoader::fromTileUrlTemplate(
-            pbfUrlTemplate,
-            pngUrlTemplate,
-            std::move(styleSheet));
-    } else {
-        tileLoaderPtr = Bach::TileLoader::newLocalOnly(std::move(styleSheet));
-    }
-    Bach::TileLoader &tileLoader = *tileLoaderPtr;
+    // The highest zoom level of the vector tiles, read from the same tilesheet as the template.
+    std::optional<int> sourceMaxZoom;
 
-    // Creates the Widget that displays the map.
+    // Creates the Widget that displays the map, and show the window right away.
     auto *mapWidget = new MapWidget;
-    // Set up the function that forwards requests from the
-    // MapWidget into the TileLoader. This lambda does the
-    // two components together.
-    mapWidget->requestTilesFn = [&](auto tileList, auto tileLoadedCallback) {
-        return tileLoader.requestTiles(tileList, tileLoadedCallback, true);
-    };
-
-    // Main window setup
     auto app = Bach::MainWindow(mapWidget);
     app.show();
 
+    // Lets the TileLoader download tiles as soon as the vector tile template is known.
+    // The raster template may come later, the vector tiles don't wait for it.
+    auto applyUrlTemplates = [&]() {
+        if (tileLoaderPtr == nullptr || pbfUrlTemplate.isEmpty())
+            return;
+        // Zoom levels the source doesn't have are drawn from the deepest tiles it has.
+        tileLoaderPtr->setSourceMaxZoom(sourceMaxZoom);
+        tileLoaderPtr->setTileUrlTemplates(pbfUrlTemplate, pngUrlTemplate);
+        // Request the visible tiles again, this time from the web.
+        mapWidget->update();
+    };
+
+    // Startup runs as tasks that overlap each other: loading the stylesheet, resolving
+    // the vector tile template from the tilesheet it links to, and resolving the raster
+    // tile template. Each of them may block on a network request.
+    // Their results are handed to the GUI thread through the event loop.
+    //
+    // Declared last so that it waits for its tasks before everything they use is destroyed.
+    QThreadPool startupThreadPool;
+    startupThreadPool.setMaxThreadCount(3);
+
+    if (hasMapTilerKey) {
+        startupThreadPool.start([&]() {
+            ParsedLink rasterUrlTemplateResult = Bach::getRasterUrlTemplate(mapType, mapTilerKeyOpt);
+            QMetaObject::invokeMethod(&app, [&, rasterUrlTemplateResult]() {
+                if (rasterUrlTemplateResult.resultType != ResultType::Success)
+                    return;
+                pngUrlTemplate = rasterUrlTemplateResult.link;
+                applyUrlTemplates();
+            }, Qt::QueuedConnection);
+        });
+    }
+
+    startupThreadPool.start([&]() {
+        HttpResponse styleSheetBytes = Bach::loadStyleSheetBytes(
+            mapType,
+            mapTilerKeyOpt);
+        if (styleSheetBytes.resultType != ResultType::Success) {
+            QMetaObject::invokeMethod(&app, []() {
+                earlyShutdown("Unable to load stylesheet from disk/web.");
+            }, Qt::QueuedConnection);
+            return;
+        }
+
+        // The vector tile template only needs the JSON, so it is resolved while the stylesheet is parsed.
+        if (hasMapTilerKey) {
+            startupThreadPool.start([&, styleSheetJsonBytes = styleSheetBytes.response]() {
+                const QJsonDocument styleSheetJson = QJsonDocument::fromJson(styleSheetJsonBytes);
+                ParsedLink pbfUrlTemplateResult = Bach::getPbfUrlTemplate(styleSheetJson, "maptiler_planet");
+                std::optional<int> pbfMaxZoom = Bach::getVectorTileSourceMaxZoom(styleSheetJson, "maptiler_planet");
+                QMetaObject::invokeMethod(&app, [&, pbfUrlTemplateResult, pbfMaxZoom]() {
+                    if (pbfUrlTemplateResult.resultType != ResultType::Success) {
+                        qWarning() << "Unable to resolve the vector tile URL, only showing cached tiles.";
+                        return;
+                    }
+                    pbfUrlTemplate = pbfUrlTemplateResult.link;
+                    sourceMaxZoom = pbfMaxZoom;
+                    applyUrlTemplates();
+                }, Qt::QueuedConnection);
+            });
+        }
+
+        // Parse the stylesheet into data that can be rendered.
+        // After the first run, this loads the binary stylesheet stored next to the cached JSON instead.
+        const QString styleSheetBinaryPath =
+            Bach::TileLoader::getGeneralCacheFolder() + QDir::separator() +
+            Bach::styleSheetBinaryCacheFileName;
+        auto parsedStyleSheetResult = std::make_shared<std::optional<StyleSheet>>(
+            StyleSheet::fromJsonBytesCached(styleSheetBytes.response, styleSheetBinaryPath));
+
+        QMetaObject::invokeMethod(&app, [&, parsedStyleSheetResult]() {
+            // If the stylesheet can't be parsed, there is nothing to render. Shut down.
+            if (!parsedStyleSheetResult->has_value()) {
+                earlyShutdown("Unable to parse stylesheet JSON into a parsed StyleSheet object.");
+            }
+
+            // Start out with the tile cache only. Downloading is turned on
+            // once the URL templates are resolved, see applyUrlTemplates.
+            tileLoaderPtr = Bach::TileLoader::newLocalOnly(std::move(parsedStyleSheetResult->value()));
+            configureTileLoader(*tileLoaderPtr);
+            connectMapWidget(mapWidget, *tileLoaderPtr);
+            applyUrlTemplates();
+            mapWidget->update();
+        }, Qt::QueuedConnection);
+    });
+
     return a.exec();
 }
@@ -94,10 +94,7 @@ void Evaluator::setupExpressionMap()
 QVariant Evaluator::get(const QJsonArray & array, const AbstractLayerFeature *feature, int mapZoomLevel, float vpZoomLevel)
 {
     QString property = array.at(1).toString();
-    if(feature->featureMetaData.contains(property))
-        return feature->featureMetaData[property];
-    else
-        return {};
+    return feature->property(property);
 }
 
 /*!
@@ -114,7 +111,7 @@ QVariant Evaluator::get(const QJsonArray & array, const AbstractLayerFeature *fe
 QVariant Evaluator::has(const QJsonArray &array, const AbstractLayerFeature *feature, int mapZoomLevel, float vpZoomLevel)
 {
     QString property = array.at(1).toString();
-    return feature->featureMetaData.contains(property);
+    return feature->hasProperty(property);
 }
 
 /*!
@@ -131,8 +128,9 @@ QVariant Evaluator::has(const QJsonArray &array, const AbstractLayerFeature *fea
 QVariant Evaluator::in(const QJsonArray &array, const AbstractLayerFeature *feature, int mapZoomLevel, float vpZoomLevel)
 {
     QString keyword = array.at(1).toString();
-    if (feature->featureMetaData.contains(keyword)){
-        QVariant value = feature->featureMetaData[keyword];
+    const QVariant *valuePtr = feature->findProperty(keyword);
+    if (valuePtr != nullptr){
+        const QVariant &value = *valuePtr;
 
         // The range of values to be checked is in the array from elemet 2 to n.
         auto temp = array.toVariantList().sliced(2).contains(value);
@@ -191,21 +189,21 @@ QVariant Evaluator::compare(const QJsonArray &array, const AbstractLayerFeature
     if (array.at(1).isArray()){
         // Check if the operation opperand is a simple value or an expression in itself
         // that will need resolving to extract the value.
-        static QJsonArray operand1Arr = array.at(1).toArray();
+        QJsonArray operand1Arr = array.at(1).toArray();
         QString temp = resolveExpression(operand1Arr, feature, mapZoomLevel, vpZoomLevel).toString();
 
         if (temp == "$type")
             //"type" is not a part of the feature's metadata so it is a special case.
             operand1 = getType(feature);
         else
-            operand1 = feature->featureMetaData.contains(temp) ? feature->featureMetaData[temp] : QVariant();
+            operand1 = feature->property(temp);
     } else {
         QString temp = array.at(1).toString();
         if (temp == "$type")
             // Type is not a part of the feature's metadata so it is a special case.
             operand1 = getType(feature);
         else
-            operand1 = feature->featureMetaData.contains(temp) ? feature->featureMetaData[temp] : QVariant();
+            operand1 = feature->property(temp);
     }
 
     operand2 = array.at(2).toVariant();
@@ -232,7 +230,7 @@ QVariant Evaluator::greater(const QJsonArray &array, const AbstractLayerFeature
     QVariant operand2;
     if (array.at(1).isArray()) {
         //If the operand is an expression, resolve it to get the operand value.
-        static QJsonArray operand1Arr = array.at(1).toArray();
+        QJsonArray operand1Arr = array.at(1).toArray();
         operand1 = resolveExpression(operand1Arr, feature, mapZoomLevel, vpZoomLevel);
     } else {
         operand1 = array.at(1).toVariant();
@@ -240,7 +238,7 @@ QVariant Evaluator::greater(const QJsonArray &array, const AbstractLayerFeature
 
     if (array.at(2).isArray()){
         // If the operand is an expression, resolve it to get the operand value.
-        static QJsonArray operand2Arr = array.at(2).toArray();
+        QJsonArray operand2Arr = array.at(2).toArray();
         operand2 = resolveExpression(operand2Arr, feature, mapZoomLevel, vpZoomLevel);
     } else {
         operand2 = array.at(2).toVariant();
@@ -435,11 +433,346 @@ QVariant Evaluator::interpolate(
     }
 }
 
+/*
+ * ----------------------------------------------------------------------------
+ */
 
+/*!
+ * \internal
+ * \brief The CompiledExpression::Node struct
+ * A single operation in a compiled expression.
+ *
+ * Which fields are used depends on the operation.
+ * Each operation mirrors the matching Evaluator function.
+ */
+struct Bach::CompiledExpression::Node {
+    enum class Op {
+        // Unsupported or malformed expression, evaluates to an invalid QVariant.
+        invalid,
+        // A constant value that is not an expression.
+        literal,
+        get,
+        has,
+        in,
+        compare,
+        greater,
+        all,
+        case_,
+        coalesce,
+        match,
+        interpolate,
+    };
+
+    Op op = Op::invalid;
+
+    // Used by in and compare.
+    bool negate = false;
+
+    // The property key for get, has, in, and compare when the key is constant.
+    QString key;
+    // Set for compare when the key is the special "$type" keyword.
+    bool keyIsType = false;
+    // Set for compare when the key is computed by children[0].
+    bool keyIsExpression = false;
+
+    // The value for literal, the constant operand for compare,
+    // or the fallback value for case and match.
+    QVariant value;
+
+    // The candidates for in, and the outputs for case.
+    QVariantList values;
+
+    // The labels of each branch for match.
+    std::vector<QVariantList> labels;
+
+    // The zoom stops for interpolate.
+    std::vector<double> stopInputs;
+
+    // Set for operations that read the viewport zoom level.
+    // None of the supported operations do so yet, "zoom" is resolved with the map zoom level.
+    bool readsViewportZoom = false;
+
+    // Sub-expressions. Their meaning depends on the operation.
+    std::vector<Node> children;
+};
+
+using CompiledNode = Bach::CompiledExpression::Node;
+
+static CompiledNode compileNode(const QJsonArray &expression);
 
+/*!
+ * \internal
+ * \brief compileValue
+ * Compiles a value that is either a nested expression or a constant.
+ *
+ * \param value the JSON value to compile.
+ * \param numeric whether a constant should be converted to a double,
+ * matching the places where the Evaluator calls toDouble() on constants.
+ */
+static CompiledNode compileValue(const QJsonValue &value, bool numeric = false)
+{
+    if (value.isArray())
+        return compileNode(value.toArray());
 
+    CompiledNode node;
+    node.op = CompiledNode::Op::literal;
+    node.value = numeric ? QVariant(value.toDouble()) : value.toVariant();
+    return node;
+}
 
+/*!
+ * \internal
+ * \brief compileNode
+ * Compiles a single expression and all its sub-expressions.
+ * Follows the same dispatch rules as Evaluator::resolveExpression.
+ */
+static CompiledNode compileNode(const QJsonArray &array)
+{
+    using Op = CompiledNode::Op;
+    CompiledNode node;
+    if (array.empty())
+        return node;
+
+    static const QMap<QString, Op> operations = {
+        { "get", Op::get },
+        { "has", Op::has },
+        { "in", Op::in },
+        { "!=", Op::compare },
+        { "==", Op::compare },
+        { ">", Op::greater },
+        { "all", Op::all },
+        { "case", Op::case_ },
+        { "coalesce", Op::coalesce },
+        { "match", Op::match },
+        { "interpolate", Op::interpolate },
+    };
+
+    QString operation = array.begin()->toString();
+    if (operation == "!=") {
+        node.op = Op::compare;
+    } else if (operation.startsWith("!")) {
+        node.op = operations.value(operation.sliced(1), Op::invalid);
+    } else {
+        node.op = operations.value(operation, Op::invalid);
+    }
 
+    switch (node.op) {
+    case Op::get:
+    case Op::has:
+        node.key = array.at(1).toString();
+        break;
+    case Op::in:
+        node.key = array.at(1).toString();
+        node.negate = operation.startsWith("!");
+        if (array.size() > 2)
+            node.values = array.toVariantList().sliced(2);
+        break;
+    case Op::compare:
+        node.negate = operation == "!=";
+        if (array.at(1).isArray()) {
+            node.keyIsExpression = true;
+            node.children.push_back(compileNode(array.at(1).toArray()));
+        } else {
+            node.key = array.at(1).toString();
+            node.keyIsType = node.key == "$type";
+        }
+        node.value = array.at(2).toVariant();
+        break;
+    case Op::greater:
+        node.children.push_back(compileValue(array.at(1)));
+        node.children.push_back(compileValue(array.at(2)));
+        break;
+    case Op::all:
+    case Op::coalesce:
+        for (int i = 1; i < array.size(); i++)
+            node.children.push_back(compileNode(array.at(i).toArray()));
+        break;
+    case Op::case_:
+        // Conditions that are not expressions are never true, so they are left out.
+        for (int i = 1; i < array.size() - 2; i += 2) {
+            if (array.at(i).isArray()) {
+                node.children.push_back(compileNode(array.at(i).toArray()));
+                node.values.append(array.at(i + 1).toVariant());
+            }
+        }
+        node.value = array.last().toVariant();
+        break;
+    case Op::match:
+        // children[0] is the input, followed by the output of each branch.
+        node.children.push_back(compileNode(array.at(1).toArray()));
+        for (int i = 2; i < array.size() - 2; i += 2) {
+            if (array.at(i).isArray())
+                node.labels.push_back(array.at(i).toArray().toVariantList());
+            else
+                node.labels.push_back({ array.at(i).toVariant() });
+            node.children.push_back(compileValue(array.at(i + 1)));
+        }
+        node.value = array.last().toVariant();
+        break;
+    case Op::interpolate:
+        // Element 3 onwards are pairs of zoom stops and outputs.
+        if (array.size() < 5 || (array.size() - 3) % 2 != 0) {
+            node.op = Op::invalid;
+            break;
+        }
+        for (int i = 3; i < array.size(); i += 2) {
+            node.stopInputs.push_back(array.at(i).toDouble());
+            node.children.push_back(compileValue(array.at(i + 1), true));
+        }
+        break;
+    default:
+        break;
+    }
+    return node;
+}
 
+/*!
+ * \internal
+ * \brief evaluateNode
+ * Evaluates a compiled expression node for a feature.
+ */
+static QVariant evaluateNode(
+    const CompiledNode &node,
+    const AbstractLayerFeature *feature,
+    int mapZoomLevel,
+    float vpZoomLevel)
+{
+    using Op = CompiledNode::Op;
+    switch (node.op) {
+    case Op::literal:
+        return node.value;
+    case Op::get:
+        return feature->property(node.key);
+    case Op::has:
+        return feature->hasProperty(node.key);
+    case Op::in: {
+        const QVariant *value = feature->findProperty(node.key);
+        if (value == nullptr)
+            return false;
+        bool temp = node.values.contains(*value);
+        return node.negate ? !temp : temp;
+    }
+    case Op::compare: {
+        QVariant operand1;
+        if (node.keyIsExpression) {
+            QString key = evaluateNode(node.children[0], feature, mapZoomLevel, vpZoomLevel).toString();
+            operand1 = key == "$type" ? QVariant(getType(feature)) : feature->property(key);
+        } else if (node.keyIsType) {
+            operand1 = getType(feature);
+        } else {
+            operand1 = feature->property(node.key);
+        }
+        return node.negate ? operand1 != node.value : operand1 == node.value;
+    }
+    case Op::greater: {
+        QVariant operand1 = evaluateNode(node.children[0], feature, mapZoomLevel, vpZoomLevel);
+        QVariant operand2 = evaluateNode(node.children[1], feature, mapZoomLevel, vpZoomLevel);
+        if (operand1.typeId() == QMetaType::QString)
+            return operand1.toString() > operand2.toString();
+        else
+            return operand1.toDouble() > operand2.toDouble();
+    }
+    case Op::all:
+        for (const CompiledNode &child : node.children) {
+            if (!evaluateNode(child, feature, mapZoomLevel, vpZoomLevel).toBool())
+                return false;
+        }
+        return true;
+    case Op::case_:
+        for (size_t i = 0; i < node.children.size(); i++) {
+            if (evaluateNode(node.children[i], feature, mapZoomLevel, vpZoomLevel).toBool())
+                return node.values[i];
+        }
+        return node.value;
+    case Op::coalesce:
+        for (const CompiledNode &child : node.children) {
+            QVariant returnVariant = evaluateNode(child, feature, mapZoomLevel, vpZoomLevel);
+            if (returnVariant.isValid())
+                return returnVariant;
+        }
+        return {};
+    case Op::match: {
+        QVariant input = evaluateNode(node.children[0], feature, mapZoomLevel, vpZoomLevel);
+        for (size_t i = 0; i < node.labels.size(); i++) {
+            if (node.labels[i].contains(input))
+                return evaluateNode(node.children[i + 1], feature, mapZoomLevel, vpZoomLevel);
+        }
+        return node.value;
+    }
+    case Op::interpolate: {
+        const std::vector<double> &stops = node.stopInputs;
+        if (mapZoomLevel <= stops.front())
+            return evaluateNode(node.children.front(), feature, mapZoomLevel, vpZoomLevel);
+        if (mapZoomLevel >= stops.back())
+            return evaluateNode(node.children.back(), feature, mapZoomLevel, vpZoomLevel);
+
+        // Find the first stop that is not below the zoom level, and lerp from the previous one.
+        size_t index = 1;
+        while (mapZoomLevel > stops[index])
+            index++;
+        float stopOutput1 = evaluateNode(node.children[index - 1], feature, mapZoomLevel, vpZoomLevel).toFloat();
+        float stopOutput2 = evaluateNode(node.children[index], feature, mapZoomLevel, vpZoomLevel).toFloat();
+        return lerp(
+            QPair<float, float>(stops[index - 1], stopOutput1),
+            QPair<float, float>(stops[index], stopOutput2),
+            mapZoomLevel);
+    }
+    default:
+        return {};
+    }
+}
+
+/*!
+ * \internal
+ * \brief nodeUsesViewportZoom
+ * \return true if the node or any of its sub-expressions read the viewport zoom level.
+ */
+static bool nodeUsesViewportZoom(const CompiledNode &node)
+{
+    if (node.readsViewportZoom)
+        return true;
+    for (const CompiledNode &child : node.children) {
+        if (nodeUsesViewportZoom(child))
+            return true;
+    }
+    return false;
+}
 
+/*!
+ * \brief Bach::CompiledExpression::compile
+ * Compiles a style expression so that it can be evaluated repeatedly without being parsed again.
+ *
+ * \param expression The QJson array containing the expression to compile.
+ * \return the compiled expression. Empty if the expression was empty.
+ */
+Bach::CompiledExpression Bach::CompiledExpression::compile(const QJsonArray &expression)
+{
+    CompiledExpression out;
+    if (!expression.isEmpty()) {
+        out.m_root = std::make_shared<const Node>(compileNode(expression));
+        out.m_usesViewportZoom = nodeUsesViewportZoom(*out.m_root);
+    }
+    return out;
+}
 
+/*!
+ * \brief Bach::CompiledExpression::evaluate
+ * Evaluates the expression for a feature.
+ *
+ * \param feature The feature on which expression operation will be performed (if aplicable)
+ * \param mapZoomLevel The zoom level that will be used to resolve expressions that require a zoom parameter.
+ * \param vpZoomLevel The viewport zoom level.
+ *
+ * \return a QVariant containing the result of the evaluation, or an invalid QVariant if the expression was invalid.
+ *
+ * \threadsafe
+ */
+QVariant Bach::CompiledExpression::evaluate(
+    const AbstractLayerFeature *feature,
+    int mapZoomLevel,
+    float vpZoomLevel) const
+{
+    if (m_root == nullptr)
+        return {};
+    return evaluateNode(*m_root, feature, mapZoomLevel, vpZoomLevel);
+}
@@ -11,6 +11,9 @@
 #include <QString>
 #include <QVariant>
 
+// STL header files
+#include <memory>
+
 // Other header files.
 #include "VectorTiles.h"
 
@@ -35,4 +38,47 @@ public:
     static QVariant resolveExpression(const QJsonArray& expression, const AbstractLayerFeature* feature, int mapZoomLevel, float vpZoomeLevel);
 };
 
+namespace Bach {
+    /*!
+     * \brief The CompiledExpression class
+     * A style expression that has been parsed ahead of time into a tree of typed nodes.
+     *
+     * Operator keywords, property keys and constant operands are extracted once when compiling,
+     * so evaluating the expression for a feature does not touch the original QJsonArray.
+     * For well-formed expressions, the result of evaluate() is the same as passing
+     * the original expression to Evaluator::resolveExpression.
+     *
+     * The compiled form is immutable and cheap to copy.
+     */
+    class CompiledExpression
+    {
+    public:
+        CompiledExpression() = default;
+
+        static CompiledExpression compile(const QJsonArray &expression);
+
+        /*!
+         * \brief isEmpty
+         * \return true if this was default constructed or compiled from an empty expression.
+         */
+        bool isEmpty() const { return m_root == nullptr; }
+
+        QVariant evaluate(const AbstractLayerFeature *feature, int mapZoomLevel, float vpZoomLevel) const;
+
+        /*!
+         * \brief usesViewportZoom
+         * \return true if the result may depend on the viewport zoom level, and not only
+         * on the feature and the map zoom level. Results of expressions that return false
+         * can be cached per map zoom level.
+         */
+        bool usesViewportZoom() const { return m_usesViewportZoom; }
+
+        struct Node;
+
+    private:
+        std::shared_ptr<const Node> m_root;
+        bool m_usesViewportZoom = false;
+    };
+}
+
 #endif // EVALUATOR_H
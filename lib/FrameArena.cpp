@@ -0,0 +1,87 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// STL header files
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+// Other header files
+#include "FrameArena.h"
+
+using Bach::FrameArena;
+
+/*!
+ * \brief FrameArena::FrameArena
+ * \param firstBlockSize The size of the first block, in bytes. No memory is allocated
+ * until the first call to allocate.
+ */
+FrameArena::FrameArena(size_t firstBlockSize) : m_nextBlockSize{ std::max<size_t>(firstBlockSize, 64) } {}
+
+/*!
+ * \internal
+ * \brief FrameArena::addBlock
+ * Starts a new block that can hold at least minSize bytes. Every block is twice as large as the last.
+ */
+void FrameArena::addBlock(size_t minSize)
+{
+    const size_t size = std::max(m_nextBlockSize, minSize);
+    m_blocks.push_back({ std::make_unique<std::byte[]>(size), size });
+    m_offset = 0;
+    m_nextBlockSize = size * 2;
+    m_blockAllocations++;
+}
+
+/*!
+ * \brief FrameArena::allocate
+ * Hands out memory that stays valid until the next reset.
+ * \param alignment Must be a power of two.
+ */
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+    auto alignedOffset = [&]() -> std::optional<size_t> {
+        if (m_blocks.empty())
+            return std::nullopt;
+        const Block &block = m_blocks.back();
+        const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+        const std::uintptr_t aligned = (base + m_offset + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+        const size_t offset = aligned - base;
+        if (offset > block.size || block.size - offset < size)
+            return std::nullopt;
+        return offset;
+    };
+
+    std::optional<size_t> offset = alignedOffset();
+    if (!offset.has_value()) {
+        addBlock(size + alignment);
+        offset = alignedOffset();
+    }
+    m_offset = *offset + size;
+    m_bytesUsed += size;
+    return m_blocks.back().data.get() + *offset;
+}
+
+/*!
+ * \brief FrameArena::reset
+ * Frees everything handed out so far.
+ * Keeps a single block, large enough for everything that was handed out since the last reset.
+ */
+void FrameArena::reset()
+{
+    if (m_blocks.size() > 1) {
+        const size_t frameSize = capacity();
+        m_blocks.clear();
+        m_nextBlockSize = frameSize;
+        addBlock(frameSize);
+    }
+    m_offset = 0;
+    m_bytesUsed = 0;
+}
+
+size_t FrameArena::capacity() const
+{
+    size_t out = 0;
+    for (const Block &block : m_blocks)
+        out += block.size;
+    return out;
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_FRAMEARENA_H
+#define BACH_FRAMEARENA_H
+
+// STL header files
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace Bach {
+    /*!
+     * \brief The FrameArena class hands out memory that is only needed until the end of a frame.
+     *
+     * Allocations are carved out of the current block by bumping an offset, and are never
+     * freed one by one. reset() frees everything at once. If a frame needed more than one
+     * block, reset() replaces them with a single block large enough for the whole frame,
+     * so that the frames after it don't allocate at all.
+     *
+     * Not thread-safe, every thread needs its own arena.
+     */
+    class FrameArena {
+    public:
+        /*!
+         * \brief defaultBlockSize is the size of the first block, in bytes.
+         */
+        static constexpr size_t defaultBlockSize = 16 * 1024;
+
+        explicit FrameArena(size_t firstBlockSize = defaultBlockSize);
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        void* allocate(size_t size, size_t alignment);
+        void reset();
+
+        // Amount of bytes handed out since the last reset.
+        size_t bytesUsed() const { return m_bytesUsed; }
+        // Amount of bytes in the blocks the arena holds on to.
+        size_t capacity() const;
+        // Amount of blocks that were allocated since the arena was created.
+        int blockAllocations() const { return m_blockAllocations; }
+
+    private:
+        struct Block {
+            std::unique_ptr<std::byte[]> data;
+            size_t size = 0;
+        };
+        void addBlock(size_t minSize);
+
+        std::vector<Block> m_blocks;
+        // Offset of the free memory in the last block.
+        size_t m_offset = 0;
+        size_t m_bytesUsed = 0;
+        size_t m_nextBlockSize = defaultBlockSize;
+        int m_blockAllocations = 0;
+    };
+
+    /*!
+     * \brief The FrameArenaAllocator class lets standard containers allocate from a FrameArena.
+     *
+     * Deallocating is a no-op, the memory is freed by FrameArena::reset. Containers using it
+     * must not outlive the frame. Without an arena, it allocates from the heap like std::allocator.
+     */
+    template<class T>
+    class FrameArenaAllocator {
+    public:
+        using value_type = T;
+
+        FrameArenaAllocator(FrameArena *arena = nullptr) noexcept : m_arena{ arena } {}
+        template<class U>
+        FrameArenaAllocator(const FrameArenaAllocator<U> &other) noexcept : m_arena{ other.arena() } {}
+
+        T* allocate(size_t count)
+        {
+            if (m_arena == nullptr)
+                return static_cast<T*>(::operator new(count * sizeof(T)));
+            return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+        }
+        void deallocate(T *ptr, size_t) noexcept
+        {
+            if (m_arena == nullptr)
+                ::operator delete(ptr);
+        }
+
+        FrameArena* arena() const noexcept { return m_arena; }
+
+        template<class U>
+        bool operator==(const FrameArenaAllocator<U> &other) const noexcept { return m_arena == other.arena(); }
+        template<class U>
+        bool operator!=(const FrameArenaAllocator<U> &other) const noexcept { return m_arena != other.arena(); }
+
+    private:
+        FrameArena *m_arena = nullptr;
+    };
+}
+
+#endif // BACH_FRAMEARENA_H
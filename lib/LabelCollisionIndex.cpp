@@ -0,0 +1,150 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// STL header files
+#include <cmath>
+
+// Other header files
+#include "LabelCollisionIndex.h"
+
+using Bach::LabelCollisionIndex;
+
+/*!
+ * \internal
+ * \brief cellKey packs the two cell coordinates into a single hash key.
+ */
+static quint64 cellKey(int cellX, int cellY)
+{
+    return (quint64(quint32(cellX)) << 32) | quint64(quint32(cellY));
+}
+
+/*!
+ * \internal
+ * \brief cellIndex returns the index of the cell containing the pixel coordinate.
+ * Rounds towards negative infinity so that negative coordinates get their own cells.
+ */
+static int cellIndex(int coordinate, int cellSize)
+{
+    return (int)std::floor((double)coordinate / cellSize);
+}
+
+/*!
+ * \brief LabelCollisionIndex::LabelCollisionIndex
+ * \param cellSize The width and height of a grid cell in pixels. Must be positive.
+ */
+LabelCollisionIndex::LabelCollisionIndex(int cellSize) : m_cellSize{ qMax(cellSize, 1) } {}
+
+/*!
+ * \internal
+ * \brief LabelCollisionIndex::forEachCell
+ * Calls fn with the key of every cell that the box touches.
+ */
+template<class Fn>
+void LabelCollisionIndex::forEachCell(const QRect &box, Fn &&fn) const
+{
+    const int firstX = cellIndex(box.left(), m_cellSize);
+    const int lastX = cellIndex(box.right(), m_cellSize);
+    const int firstY = cellIndex(box.top(), m_cellSize);
+    const int lastY = cellIndex(box.bottom(), m_cellSize);
+    for (int cellY = firstY; cellY <= lastY; cellY++) {
+        for (int cellX = firstX; cellX <= lastX; cellX++)
+            fn(cellKey(cellX, cellY));
+    }
+}
+
+/*!
+ * \brief LabelCollisionIndex::overlaps
+ * Checks if the box intersects any of the boxes in the index.
+ * Uses the same rules as QRect::intersects, so empty boxes never overlap.
+ */
+bool LabelCollisionIndex::overlaps(const QRect &box) const
+{
+    if (box.isEmpty())
+        return false;
+
+    bool found = false;
+    forEachCell(box, [&](quint64 key) {
+        if (found)
+            return;
+        auto cellIt = m_cells.constFind(key);
+        if (cellIt == m_cells.constEnd())
+            return;
+        for (int boxIndex : *cellIt) {
+            if (m_boxes[boxIndex].intersects(box)) {
+                found = true;
+                return;
+            }
+        }
+    });
+    return found;
+}
+
+/*!
+ * \brief LabelCollisionIndex::overlapsAny
+ * Checks if any of the boxes of a label intersects the boxes in the index.
+ */
+bool LabelCollisionIndex::overlapsAny(const QVector<QRect> &boxes) const
+{
+    for (const QRect &box : boxes) {
+        if (overlaps(box))
+            return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief LabelCollisionIndex::insert
+ * Adds a box to the index. Empty boxes are kept in boxes() but never collide.
+ */
+void LabelCollisionIndex::insert(const QRect &box)
+{
+    const int boxIndex = m_boxes.size();
+    m_boxes.append(box);
+    if (box.isEmpty())
+        return;
+
+    forEachCell(box, [&](quint64 key) {
+        m_cells[key].append(boxIndex);
+    });
+}
+
+/*!
+ * \brief LabelCollisionIndex::insert
+ * Adds all the boxes of a label to the index.
+ */
+void LabelCollisionIndex::insert(const QVector<QRect> &boxes)
+{
+    for (const QRect &box : boxes)
+        insert(box);
+}
+
+/*!
+ * \brief LabelCollisionIndex::clear
+ * Removes every box from the index.
+ */
+void LabelCollisionIndex::clear()
+{
+    m_boxes.clear();
+    m_cells.clear();
+}
+
+/*!
+ * \brief LabelCollisionIndex::reset
+ * Removes every box from the index, like clear, but keeps the memory of the
+ * box list and the grid cells so that the next frame can fill them without allocating.
+ *
+ * Cells that stayed empty during the last frame are only dropped once they outnumber
+ * the used ones, so that panning around does not grow the grid without bounds.
+ */
+void LabelCollisionIndex::reset()
+{
+    m_boxes.clear();
+    qsizetype usedCells = 0;
+    for (QVector<int> &cell : m_cells) {
+        if (!cell.isEmpty())
+            usedCells++;
+        cell.clear();
+    }
+    if (m_cells.size() > usedCells * 2 + 64)
+        m_cells.clear();
+}
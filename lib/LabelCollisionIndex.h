@@ -0,0 +1,55 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_LABELCOLLISIONINDEX_H
+#define BACH_LABELCOLLISIONINDEX_H
+
+// Qt header files
+#include <QHash>
+#include <QRect>
+#include <QVector>
+
+namespace Bach {
+    /*!
+     * \brief The LabelCollisionIndex class
+     * stores the bounding boxes of the labels placed in the viewport, and answers
+     * whether a new box would collide with any of them.
+     *
+     * The boxes are bucketed into a uniform grid of square cells, so a query only
+     * has to test the boxes that share a cell with it, instead of every label on screen.
+     *
+     * A label may consist of several boxes, for example one per glyph of curved text.
+     * Coordinates are viewport pixels and may be negative.
+     */
+    class LabelCollisionIndex {
+    public:
+        /*!
+         * \brief defaultCellSize is the width and height of a grid cell in pixels.
+         * It is in the order of a typical label, so most labels touch one to four cells.
+         */
+        static constexpr int defaultCellSize = 64;
+
+        explicit LabelCollisionIndex(int cellSize = defaultCellSize);
+
+        bool overlaps(const QRect &box) const;
+        bool overlapsAny(const QVector<QRect> &boxes) const;
+        void insert(const QRect &box);
+        void insert(const QVector<QRect> &boxes);
+        void clear();
+        void reset();
+
+        // All the boxes inserted so far, in insertion order.
+        const QVector<QRect>& boxes() const { return m_boxes; }
+
+    private:
+        template<class Fn>
+        void forEachCell(const QRect &box, Fn &&fn) const;
+
+        int m_cellSize = defaultCellSize;
+        QVector<QRect> m_boxes;
+        // Maps a cell to the indices into m_boxes of the boxes that touch it.
+        QHash<quint64, QVector<int>> m_cells;
+    };
+}
+
+#endif // BACH_LABELCOLLISIONINDEX_H
@@ -6,6 +6,10 @@
 #include <QRegularExpression>
 #include <QtMath>
 
+// STL header files
+#include <algorithm>
+#include <atomic>
+
 // Other header files.
 #include "LayerStyle.h"
 
@@ -54,6 +58,30 @@ QColor Bach::getColorFromString(QString colorString)
     }
 }
 
+/*!
+ * \brief AbstractLayerStyle::newUniqueId
+ * \return a new id that has not been returned before.
+ *
+ * \threadsafe
+ */
+quint64 AbstractLayerStyle::newUniqueId()
+{
+    static std::atomic<quint64> nextId = 1;
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief StyleSheet::newUniqueId
+ * \return a new id that has not been returned before.
+ *
+ * \threadsafe
+ */
+quint64 StyleSheet::newUniqueId()
+{
+    static std::atomic<quint64> nextId = 1;
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
 /*!
  * \brief AbstractLayerStyle::fromJson parses different layer style types.
  *
@@ -100,8 +128,10 @@ std::unique_ptr<AbstractLayerStyle> AbstractLayerStyle::fromJson(const QJsonObje
      else
         newLayer->m_visibility = QString("none");
 
-    if(json.contains("filter"))
+    if(json.contains("filter")) {
         newLayer->m_filter = json.value("filter").toArray();
+        newLayer->m_compiledFilter = Bach::CompiledExpression::compile(newLayer->m_filter);
+    }
 
     return returnLayerPtr;
 }
@@ -167,3 +197,63 @@ std::optional<StyleSheet> StyleSheet::fromJsonFile(const QString& path)
 
     return fromJsonBytes(file.readAll());
 }
+
+/*!
+ * \brief StyleSheet::sourceLayersShownFrom
+ * Finds the tile layers the style sheet draws anything from.
+ *
+ * \param minMapZoom The lowest map zoom level to consider. Layer styles
+ * that are only shown below it are left out.
+ *
+ * \return The names of the source layers of every visible layer style
+ * shown at minMapZoom or any higher zoom level.
+ */
+std::set<QString> StyleSheet::sourceLayersShownFrom(int minMapZoom) const
+{
+    std::set<QString> out;
+    for (const std::unique_ptr<AbstractLayerStyle> &layerStyle : m_layerStyles) {
+        if (layerStyle->m_visibility != "visible" || layerStyle->m_maxZoom <= minMapZoom)
+            continue;
+        if (!layerStyle->m_sourceLayer.isEmpty())
+            out.insert(layerStyle->m_sourceLayer);
+    }
+    return out;
+}
+
+/*!
+ * \brief StyleSheet::sourceLayerStages
+ * Groups the tile layers the style sheet draws anything from by how early they are drawn.
+ *
+ * The first stage holds the layers of the background and fill styles drawn before any line,
+ * such as water and landcover. The second holds the layers first drawn by the line styles,
+ * and the fill styles that come after them, such as roads and buildings. The last holds
+ * the layers only drawn by symbol styles, such as labels and icons. Each layer is part of
+ * the stage of the first style that draws it. Stages without any layers are left out.
+ *
+ * \param minMapZoom The lowest map zoom level to consider, see sourceLayersShownFrom.
+ * \return The stages, the first drawn first.
+ */
+std::vector<std::set<QString>> StyleSheet::sourceLayerStages(int minMapZoom) const
+{
+    std::vector<std::set<QString>> out;
+    std::set<QString> seenLayers;
+    int stage = 0;
+    for (const std::unique_ptr<AbstractLayerStyle> &layerStyle : m_layerStyles) {
+        const AbstractLayerStyle::LayerType type = layerStyle->type();
+        if (type == AbstractLayerStyle::LayerType::line)
+            stage = qMax(stage, 1);
+        else if (type == AbstractLayerStyle::LayerType::symbol)
+            stage = 2;
+
+        if (layerStyle->m_visibility != "visible" || layerStyle->m_maxZoom <= minMapZoom)
+            continue;
+        if (layerStyle->m_sourceLayer.isEmpty() || !seenLayers.insert(layerStyle->m_sourceLayer).second)
+            continue;
+        out.resize(qMax((int)out.size(), stage + 1));
+        out[stage].insert(layerStyle->m_sourceLayer);
+    }
+    out.erase(
+        std::remove_if(out.begin(), out.end(), [](const std::set<QString> &layers) { return layers.empty(); }),
+        out.end());
+    return out;
+}
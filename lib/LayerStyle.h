@@ -6,6 +6,7 @@
 
 // Qt header files.
 #include <QColor>
+#include <QDataStream>
 #include <QFont>
 #include <QImage>
 #include <QJsonArray>
@@ -14,14 +15,61 @@
 #include <QPen>
 #include <QString>
 #include <QtTypes>
+#include <array>
 #include <vector>
 #include <optional>
+#include <set>
+
+// Other header files.
+#include "Evaluator.h"
 
 /*
  *  All the layers styles follow the maptiler layer style specification :
  *  https://docs.maptiler.com/gl-style-specification/layers/
  */
 
+namespace Bach {
+/*!
+ * \brief The PerZoomStyleValues class
+ * Stores the value of a style property that only depends on the zoom level,
+ * evaluated once for every zoom level from 0 to 24.
+ *
+ * This lets the layer style getters return zoom-only properties with a single array read,
+ * instead of unpacking the stops from a QVariant every time.
+ */
+class PerZoomStyleValues
+{
+public:
+    static constexpr int zoomLevelCount = 25;
+
+    /*!
+     * \brief fromFunction
+     * \param valueAtZoom a function that returns the value of the property at a given zoom level.
+     * \return the values returned by valueAtZoom for every zoom level.
+     */
+    template<class Fn>
+    static PerZoomStyleValues fromFunction(Fn &&valueAtZoom)
+    {
+        PerZoomStyleValues out;
+        for (int zoomLevel = 0; zoomLevel < zoomLevelCount; zoomLevel++)
+            out.m_values[zoomLevel] = valueAtZoom(zoomLevel);
+        out.m_isSet = true;
+        return out;
+    }
+
+    bool contains(int zoomLevel) const
+    {
+        return m_isSet && zoomLevel >= 0 && zoomLevel < zoomLevelCount;
+    }
+
+    const QVariant& at(int zoomLevel) const { return m_values[zoomLevel]; }
+
+private:
+    std::array<QVariant, zoomLevelCount> m_values;
+    bool m_isSet = false;
+};
+}
+
 /*!
  * \brief The AbstractLayerStyle class
  * Abstract parent class for all specific layerstyle types.
@@ -40,6 +88,8 @@ public:
     };
 
     static std::unique_ptr<AbstractLayerStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<AbstractLayerStyle> fromBinary(QDataStream &in);
+    void writeBinary(QDataStream &out) const;
     virtual LayerType type() const = 0;
     QString m_id;
     QString m_sourceLayer;
@@ -48,6 +98,19 @@ public:
     int m_maxZoom = 24;
     QString m_visibility;
     QJsonArray m_filter;
+    // The compiled form of m_filter. Set together with m_filter when parsing the style sheet.
+    Bach::CompiledExpression m_compiledFilter;
+
+    // Unique for every layer style that is created. Used as a cache key when rendering.
+    quint64 uniqueId() const { return m_uniqueId; }
+
+protected:
+    // Writes the properties specific to the layer type, see writeBinary.
+    virtual void writeBinaryProperties(QDataStream &) const {}
+
+private:
+    static quint64 newUniqueId();
+    quint64 m_uniqueId = newUniqueId();
 };
 
 class BackgroundStyle : public AbstractLayerStyle
@@ -55,9 +118,15 @@ class BackgroundStyle : public AbstractLayerStyle
 private:
     QVariant m_backgroundColor;
     QVariant m_backgroundOpacity;
+    Bach::PerZoomStyleValues m_backgroundColorPerZoom;
+    Bach::PerZoomStyleValues m_backgroundOpacityPerZoom;
+
+    void bakePerZoomValues();
+    void writeBinaryProperties(QDataStream &out) const override;
 
 public:
     static std::unique_ptr<BackgroundStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<BackgroundStyle> fromBinary(QDataStream &in);
 
     LayerType type() const override
     {
@@ -74,9 +143,17 @@ private:
     QVariant m_fillColor;
     QVariant m_fillOpacity;
     QVariant m_fillOutlineColor;
+    Bach::CompiledExpression m_fillColorExpression;
+    Bach::CompiledExpression m_fillOpacityExpression;
+    Bach::PerZoomStyleValues m_fillColorPerZoom;
+    Bach::PerZoomStyleValues m_fillOpacityPerZoom;
+
+    void bakePerZoomValues();
+    void writeBinaryProperties(QDataStream &out) const override;
 
 public:
     static std::unique_ptr<FillLayerStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<FillLayerStyle> fromBinary(QDataStream &in);
 
     LayerType type() const override
     {
@@ -87,6 +164,10 @@ public:
     QVariant getFillOpacityAtZoom(int zoomLevel) const;
     QVariant getFillOutLineColorAtZoom(int zoomLevel) const;
 
+    // The compiled expressions, used when the property is an expression.
+    const Bach::CompiledExpression& getFillColorExpression() const { return m_fillColorExpression; }
+    const Bach::CompiledExpression& getFillOpacityExpression() const { return m_fillOpacityExpression; }
+
     bool m_antialias;
 };
 
@@ -98,9 +179,19 @@ private:
     QVariant m_lineColor;
     QVariant m_lineOpacity;
     QVariant m_lineWidth;
+    Bach::CompiledExpression m_lineColorExpression;
+    Bach::CompiledExpression m_lineOpacityExpression;
+    Bach::CompiledExpression m_lineWidthExpression;
+    Bach::PerZoomStyleValues m_lineColorPerZoom;
+    Bach::PerZoomStyleValues m_lineOpacityPerZoom;
+    Bach::PerZoomStyleValues m_lineWidthPerZoom;
+
+    void bakePerZoomValues();
+    void writeBinaryProperties(QDataStream &out) const override;
 
 public:
     static std::unique_ptr<LineLayerStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<LineLayerStyle> fromBinary(QDataStream &in);
 
     LayerType type() const override {
         return AbstractLayerStyle::LayerType::line;
@@ -110,6 +201,11 @@ public:
     QVariant getLineOpacityAtZoom(int zoomLevel) const;
     QVariant getLineWidthAtZoom(int zoomLevel) const;
 
+    // The compiled expressions, used when the property is an expression.
+    const Bach::CompiledExpression& getLineColorExpression() const { return m_lineColorExpression; }
+    const Bach::CompiledExpression& getLineOpacityExpression() const { return m_lineOpacityExpression; }
+    const Bach::CompiledExpression& getLineWidthExpression() const { return m_lineWidthExpression; }
+
     Qt::PenJoinStyle getJoinStyle() const;
     Qt::PenCapStyle getCapStyle() const;
 
@@ -125,9 +221,24 @@ private:
     QVariant m_symbolSpacing;
     QVariant m_textLetterSpacing;
     QVariant m_textMaxAngle;
+    Bach::CompiledExpression m_textSizeExpression;
+    Bach::CompiledExpression m_textColorExpression;
+    Bach::CompiledExpression m_textOpacityExpression;
+    Bach::CompiledExpression m_textLetterSpacingExpression;
+    Bach::CompiledExpression m_textMaxAngleExpression;
+    Bach::PerZoomStyleValues m_textSizePerZoom;
+    Bach::PerZoomStyleValues m_textColorPerZoom;
+    Bach::PerZoomStyleValues m_textOpacityPerZoom;
+    Bach::PerZoomStyleValues m_symbolSpacingPerZoom;
+    Bach::PerZoomStyleValues m_textLetterSpacingPerZoom;
+    Bach::PerZoomStyleValues m_textMaxAnglePerZoom;
+
+    void bakePerZoomValues();
+    void writeBinaryProperties(QDataStream &out) const override;
 
 public:
     static std::unique_ptr<SymbolLayerStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<SymbolLayerStyle> fromBinary(QDataStream &in);
 
     LayerType type() const override {
         return AbstractLayerStyle::LayerType::symbol;
@@ -140,7 +251,17 @@ public:
     QVariant getTextMaxAngleAtZoom(int zoomLevel) const;
     QVariant getTextLetterSpacingAtZoom(int zoomLevel) const;
 
+    // The compiled expressions, used when the property is an expression.
+    const Bach::CompiledExpression& getTextSizeExpression() const { return m_textSizeExpression; }
+    const Bach::CompiledExpression& getTextColorExpression() const { return m_textColorExpression; }
+    const Bach::CompiledExpression& getTextOpacityExpression() const { return m_textOpacityExpression; }
+    const Bach::CompiledExpression& getTextMaxAngleExpression() const { return m_textMaxAngleExpression; }
+    const Bach::CompiledExpression& getTextLetterSpacingExpression() const { return m_textLetterSpacingExpression; }
+
     QVariant m_textField;
+    // The compiled form of m_textField, if it is an expression.
+    // Set together with m_textField when parsing the style sheet.
+    Bach::CompiledExpression m_compiledTextField;
     QStringList m_textFont;
     QVariant m_textMaxWidth = 10;
     QVariant m_textHaloWidth;
@@ -151,6 +272,7 @@ class NotImplementedStyle : public AbstractLayerStyle
 {
 public:
     static std::unique_ptr<NotImplementedStyle> fromJson(const QJsonObject &json);
+    static std::unique_ptr<NotImplementedStyle> fromBinary(QDataStream &in);
     AbstractLayerStyle::LayerType type() const override
     {
         return LayerType::notImplemented;
@@ -174,14 +296,33 @@ public:
     static std::optional<StyleSheet> fromJsonBytes(const QByteArray& input);
     static std::optional<StyleSheet> fromJsonFile(const QString& path);
 
+    // Bump whenever the layout written by toBinary changes, so that old files are rebuilt.
+    static constexpr quint32 binaryFormatVersion = 1;
+    static QByteArray hashJsonBytes(const QByteArray &jsonBytes);
+    QByteArray toBinary(const QByteArray &sourceHash) const;
+    static std::optional<StyleSheet> fromBinary(const QByteArray &input, const QByteArray &expectedSourceHash);
+    static std::optional<StyleSheet> fromBinaryFile(const QString &path, const QByteArray &expectedSourceHash);
+    static std::optional<StyleSheet> fromJsonBytesCached(const QByteArray &jsonBytes, const QString &binaryCachePath);
+
+    std::set<QString> sourceLayersShownFrom(int minMapZoom) const;
+    std::vector<std::set<QString>> sourceLayerStages(int minMapZoom) const;
+
+    // Unique for every style sheet that is created, unlike its address which may be reused.
+    // Used as a cache key when rendering.
+    quint64 uniqueId() const { return m_uniqueId; }
+
     QString m_id;
     int m_version;
     QString m_name;
     std::vector<std::unique_ptr<AbstractLayerStyle>> m_layerStyles;
+
+private:
+    static quint64 newUniqueId();
+    quint64 m_uniqueId = newUniqueId();
 };
 
 template <class T>
-inline T getStopOutput(QList<QPair<int, T>> list, int currentZoom)
+inline T getStopOutput(const QList<QPair<int, T>> &list, int currentZoom)
 {
     if (currentZoom <= list.begin()->first) {
         return list.begin()->second;
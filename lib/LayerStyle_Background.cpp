@@ -99,8 +99,25 @@ std::unique_ptr<BackgroundStyle> BackgroundStyle::fromJson(const QJsonObject &js
             returnLayer->m_backgroundOpacity.setValue(backgroundOpacity.toDouble());
         }
     }
+    returnLayer->bakePerZoomValues();
     return returnLayerPtr;
 }
+
+/*!
+ * \brief BackgroundStyle::bakePerZoomValues stores the zoom-only properties
+ * of this layer at every zoom level.
+ *
+ * Properties that are expressions depend on the feature, and are left out.
+ * Must be called after all the properties have been parsed.
+ */
+void BackgroundStyle::bakePerZoomValues()
+{
+    if (m_backgroundColor.typeId() != QMetaType::Type::QJsonArray)
+        m_backgroundColorPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getColorAtZoom(zoomLevel); });
+    if (m_backgroundOpacity.typeId() != QMetaType::Type::QJsonArray)
+        m_backgroundOpacityPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getOpacityAtZoom(zoomLevel); });
+}
+
 /*!
  * \brief BackgroundStyle::getColorAtZoom returns the color for
  * a given zoom level.
@@ -113,6 +130,8 @@ std::unique_ptr<BackgroundStyle> BackgroundStyle::fromJson(const QJsonObject &js
  */
 QVariant BackgroundStyle::getColorAtZoom(int zoomLevel) const
 {
+    if (m_backgroundColorPerZoom.contains(zoomLevel))
+        return m_backgroundColorPerZoom.at(zoomLevel);
     if (m_backgroundColor.isNull()) {
         // The default color in case no color is provided by the style sheet.
         return QColor(Qt::GlobalColor::black);
@@ -139,6 +158,8 @@ QVariant BackgroundStyle::getColorAtZoom(int zoomLevel) const
  */
 QVariant BackgroundStyle::getOpacityAtZoom(int zoomLevel) const
 {
+    if (m_backgroundOpacityPerZoom.contains(zoomLevel))
+        return m_backgroundOpacityPerZoom.at(zoomLevel);
     if (m_backgroundOpacity.isNull()) {
         // The default opacity in case no opacity is provided by the style sheet.
         return QVariant(1);
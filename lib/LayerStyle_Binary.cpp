@@ -0,0 +1,536 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Qt header files.
+#include <QCborValue>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+// Other header files.
+#include "LayerStyle.h"
+
+/*
+ * The binary style sheet is a QDataStream holding the parsed properties of every layer style.
+ * Colors are stored as QColor and stops as lists of pairs, so loading it skips the JSON parser
+ * and getColorFromString. Expressions are stored as CBOR and compiled again when loaded.
+ *
+ * Layout:
+ *      quint32 magic, quint32 binaryFormatVersion, QByteArray hash of the source JSON,
+ *      the style sheet fields, quint32 layer count, then every layer style.
+ */
+
+// Identifies a binary style sheet file, reads "BSTY".
+static constexpr quint32 binaryStyleSheetMagic = 0x42535459;
+
+// Fixed so that a file stays readable when the application is built against a newer Qt.
+static constexpr QDataStream::Version binaryStyleSheetStreamVersion = QDataStream::Qt_6_0;
+
+/*!
+ * \internal
+ * \brief The StyleValueType enum tags the type of a property stored by writeStyleValue.
+ */
+enum class StyleValueType : quint8 {
+    Null,
+    Bool,
+    Int,
+    Float,
+    Double,
+    String,
+    Color,
+    Expression,
+    ColorStops,
+    FloatStops,
+    IntStops,
+};
+
+static void writeJsonArray(QDataStream &out, const QJsonArray &array)
+{
+    out << QCborValue::fromJsonValue(array).toCbor();
+}
+
+static QJsonArray readJsonArray(QDataStream &in)
+{
+    QByteArray cbor;
+    in >> cbor;
+    return QCborValue::fromCbor(cbor).toJsonValue().toArray();
+}
+
+/*!
+ * \internal
+ * \brief writeStyleValue writes a property of a layer style, keeping its exact type.
+ *
+ * The layer style getters tell the kinds of properties apart by their type,
+ * so a layer must get back every property with the type it was parsed into.
+ * Sets the stream status to WriteFailed for types the format doesn't know.
+ */
+static void writeStyleValue(QDataStream &out, const QVariant &value)
+{
+    if (!value.isValid()) {
+        out << (quint8)StyleValueType::Null;
+        return;
+    }
+    switch (value.typeId()) {
+    case QMetaType::Type::Bool:
+        out << (quint8)StyleValueType::Bool << value.toBool();
+        return;
+    case QMetaType::Type::Int:
+        out << (quint8)StyleValueType::Int << (qint32)value.toInt();
+        return;
+    case QMetaType::Type::Float:
+        out << (quint8)StyleValueType::Float << value.toFloat();
+        return;
+    case QMetaType::Type::Double:
+        out << (quint8)StyleValueType::Double << value.toDouble();
+        return;
+    case QMetaType::Type::QString:
+        out << (quint8)StyleValueType::String << value.toString();
+        return;
+    case QMetaType::Type::QColor:
+        out << (quint8)StyleValueType::Color << value.value<QColor>();
+        return;
+    case QMetaType::Type::QJsonArray:
+        out << (quint8)StyleValueType::Expression;
+        writeJsonArray(out, value.toJsonArray());
+        return;
+    default:
+        break;
+    }
+
+    const QMetaType metaType = value.metaType();
+    if (metaType == QMetaType::fromType<QList<QPair<int, QColor>>>()) {
+        out << (quint8)StyleValueType::ColorStops << value.value<QList<QPair<int, QColor>>>();
+    } else if (metaType == QMetaType::fromType<QList<QPair<int, float>>>()) {
+        out << (quint8)StyleValueType::FloatStops << value.value<QList<QPair<int, float>>>();
+    } else if (metaType == QMetaType::fromType<QList<QPair<int, int>>>()) {
+        out << (quint8)StyleValueType::IntStops << value.value<QList<QPair<int, int>>>();
+    } else {
+        qWarning() << "StyleSheet: Unable to store a layer style property of type" << metaType.name();
+        out.setStatus(QDataStream::WriteFailed);
+    }
+}
+
+/*!
+ * \internal
+ * \brief readStyleValue reads a property written by writeStyleValue.
+ */
+static QVariant readStyleValue(QDataStream &in)
+{
+    quint8 type = 0;
+    in >> type;
+    QVariant out;
+    switch ((StyleValueType)type) {
+    case StyleValueType::Null:
+        break;
+    case StyleValueType::Bool: {
+        bool value = false;
+        in >> value;
+        out.setValue(value);
+        break;
+    }
+    case StyleValueType::Int: {
+        qint32 value = 0;
+        in >> value;
+        out.setValue((int)value);
+        break;
+    }
+    case StyleValueType::Float: {
+        float value = 0;
+        in >> value;
+        out.setValue(value);
+        break;
+    }
+    case StyleValueType::Double: {
+        double value = 0;
+        in >> value;
+        out.setValue(value);
+        break;
+    }
+    case StyleValueType::String: {
+        QString value;
+        in >> value;
+        out.setValue(value);
+        break;
+    }
+    case StyleValueType::Color: {
+        QColor value;
+        in >> value;
+        out.setValue(value);
+        break;
+    }
+    case StyleValueType::Expression:
+        out.setValue(readJsonArray(in));
+        break;
+    case StyleValueType::ColorStops: {
+        QList<QPair<int, QColor>> stops;
+        in >> stops;
+        out.setValue(stops);
+        break;
+    }
+    case StyleValueType::FloatStops: {
+        QList<QPair<int, float>> stops;
+        in >> stops;
+        out.setValue(stops);
+        break;
+    }
+    case StyleValueType::IntStops: {
+        QList<QPair<int, int>> stops;
+        in >> stops;
+        out.setValue(stops);
+        break;
+    }
+    default:
+        in.setStatus(QDataStream::ReadCorruptData);
+        break;
+    }
+    return out;
+}
+
+/*!
+ * \internal
+ * \brief compileIfExpression
+ * \return The compiled expression if the property is an expression, or an empty one otherwise.
+ */
+static Bach::CompiledExpression compileIfExpression(const QVariant &value)
+{
+    if (value.typeId() != QMetaType::Type::QJsonArray)
+        return {};
+    return Bach::CompiledExpression::compile(value.toJsonArray());
+}
+
+/*!
+ * \brief AbstractLayerStyle::writeBinary writes the layer style
+ * in the binary style sheet format, see StyleSheet::toBinary.
+ *
+ * \param out is the stream to write to. Its status is set to
+ * WriteFailed if a property could not be stored.
+ */
+void AbstractLayerStyle::writeBinary(QDataStream &out) const
+{
+    out << (quint8)type();
+    out << m_id << m_source << m_sourceLayer;
+    out << (qint32)m_minZoom << (qint32)m_maxZoom;
+    out << m_visibility;
+    writeJsonArray(out, m_filter);
+    writeBinaryProperties(out);
+}
+
+/*!
+ * \brief AbstractLayerStyle::fromBinary reads a layer style written by writeBinary.
+ *
+ * \param in is the stream to read from.
+ * \return The layer style, or nullptr if the data is corrupt.
+ */
+std::unique_ptr<AbstractLayerStyle> AbstractLayerStyle::fromBinary(QDataStream &in)
+{
+    quint8 layerType = 0;
+    QString id;
+    QString source;
+    QString sourceLayer;
+    qint32 minZoom = 0;
+    qint32 maxZoom = 0;
+    QString visibility;
+    in >> layerType >> id >> source >> sourceLayer >> minZoom >> maxZoom >> visibility;
+    QJsonArray filter = readJsonArray(in);
+
+    std::unique_ptr<AbstractLayerStyle> returnLayerPtr;
+    switch ((LayerType)layerType) {
+    case LayerType::background:
+        returnLayerPtr = BackgroundStyle::fromBinary(in);
+        break;
+    case LayerType::fill:
+        returnLayerPtr = FillLayerStyle::fromBinary(in);
+        break;
+    case LayerType::line:
+        returnLayerPtr = LineLayerStyle::fromBinary(in);
+        break;
+    case LayerType::symbol:
+        returnLayerPtr = SymbolLayerStyle::fromBinary(in);
+        break;
+    case LayerType::notImplemented:
+        returnLayerPtr = NotImplementedStyle::fromBinary(in);
+        break;
+    default:
+        return nullptr;
+    }
+    if (in.status() != QDataStream::Ok)
+        return nullptr;
+
+    AbstractLayerStyle *newLayer = returnLayerPtr.get();
+    newLayer->m_id = id;
+    newLayer->m_source = source;
+    newLayer->m_sourceLayer = sourceLayer;
+    newLayer->m_minZoom = minZoom;
+    newLayer->m_maxZoom = maxZoom;
+    newLayer->m_visibility = visibility;
+    newLayer->m_filter = filter;
+    if (!filter.isEmpty())
+        newLayer->m_compiledFilter = Bach::CompiledExpression::compile(filter);
+    return returnLayerPtr;
+}
+
+void BackgroundStyle::writeBinaryProperties(QDataStream &out) const
+{
+    writeStyleValue(out, m_backgroundColor);
+    writeStyleValue(out, m_backgroundOpacity);
+}
+
+/*!
+ * \brief BackgroundStyle::fromBinary reads the properties written by writeBinaryProperties.
+ */
+std::unique_ptr<BackgroundStyle> BackgroundStyle::fromBinary(QDataStream &in)
+{
+    std::unique_ptr<BackgroundStyle> returnLayerPtr = std::make_unique<BackgroundStyle>();
+    BackgroundStyle* returnLayer = returnLayerPtr.get();
+    returnLayer->m_backgroundColor = readStyleValue(in);
+    returnLayer->m_backgroundOpacity = readStyleValue(in);
+    returnLayer->bakePerZoomValues();
+    return returnLayerPtr;
+}
+
+void FillLayerStyle::writeBinaryProperties(QDataStream &out) const
+{
+    out << m_antialias;
+    writeStyleValue(out, m_fillColor);
+    writeStyleValue(out, m_fillOpacity);
+    writeStyleValue(out, m_fillOutlineColor);
+}
+
+/*!
+ * \brief FillLayerStyle::fromBinary reads the properties written by writeBinaryProperties.
+ *
+ * Like fromJson, the outline color is not compiled when it is an expression.
+ */
+std::unique_ptr<FillLayerStyle> FillLayerStyle::fromBinary(QDataStream &in)
+{
+    std::unique_ptr<FillLayerStyle> returnLayerPtr = std::make_unique<FillLayerStyle>();
+    FillLayerStyle* returnLayer = returnLayerPtr.get();
+    in >> returnLayer->m_antialias;
+    returnLayer->m_fillColor = readStyleValue(in);
+    returnLayer->m_fillOpacity = readStyleValue(in);
+    returnLayer->m_fillOutlineColor = readStyleValue(in);
+    returnLayer->m_fillColorExpression = compileIfExpression(returnLayer->m_fillColor);
+    returnLayer->m_fillOpacityExpression = compileIfExpression(returnLayer->m_fillOpacity);
+    returnLayer->bakePerZoomValues();
+    return returnLayerPtr;
+}
+
+void LineLayerStyle::writeBinaryProperties(QDataStream &out) const
+{
+    out << m_lineCap << m_lineJoin << m_lineDashArray;
+    writeStyleValue(out, m_lineColor);
+    writeStyleValue(out, m_lineOpacity);
+    writeStyleValue(out, m_lineWidth);
+}
+
+/*!
+ * \brief LineLayerStyle::fromBinary reads the properties written by writeBinaryProperties.
+ */
+std::unique_ptr<LineLayerStyle> LineLayerStyle::fromBinary(QDataStream &in)
+{
+    std::unique_ptr<LineLayerStyle> returnLayerPtr = std::make_unique<LineLayerStyle>();
+    LineLayerStyle* returnLayer = returnLayerPtr.get();
+    in >> returnLayer->m_lineCap >> returnLayer->m_lineJoin >> returnLayer->m_lineDashArray;
+    returnLayer->m_lineColor = readStyleValue(in);
+    returnLayer->m_lineOpacity = readStyleValue(in);
+    returnLayer->m_lineWidth = readStyleValue(in);
+    returnLayer->m_lineColorExpression = compileIfExpression(returnLayer->m_lineColor);
+    returnLayer->m_lineOpacityExpression = compileIfExpression(returnLayer->m_lineOpacity);
+    returnLayer->m_lineWidthExpression = compileIfExpression(returnLayer->m_lineWidth);
+    returnLayer->bakePerZoomValues();
+    return returnLayerPtr;
+}
+
+void SymbolLayerStyle::writeBinaryProperties(QDataStream &out) const
+{
+    writeStyleValue(out, m_textSize);
+    writeStyleValue(out, m_textColor);
+    writeStyleValue(out, m_textOpacity);
+    writeStyleValue(out, m_symbolSpacing);
+    writeStyleValue(out, m_textLetterSpacing);
+    writeStyleValue(out, m_textMaxAngle);
+    writeStyleValue(out, m_textField);
+    out << m_textFont;
+    writeStyleValue(out, m_textMaxWidth);
+    writeStyleValue(out, m_textHaloWidth);
+    writeStyleValue(out, m_textHaloColor);
+}
+
+/*!
+ * \brief SymbolLayerStyle::fromBinary reads the properties written by writeBinaryProperties.
+ *
+ * Like fromJson, the symbol spacing is not compiled when it is an expression.
+ */
+std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromBinary(QDataStream &in)
+{
+    std::unique_ptr<SymbolLayerStyle> returnLayerPtr = std::make_unique<SymbolLayerStyle>();
+    SymbolLayerStyle* returnLayer = returnLayerPtr.get();
+    returnLayer->m_textSize = readStyleValue(in);
+    returnLayer->m_textColor = readStyleValue(in);
+    returnLayer->m_textOpacity = readStyleValue(in);
+    returnLayer->m_symbolSpacing = readStyleValue(in);
+    returnLayer->m_textLetterSpacing = readStyleValue(in);
+    returnLayer->m_textMaxAngle = readStyleValue(in);
+    returnLayer->m_textField = readStyleValue(in);
+    in >> returnLayer->m_textFont;
+    returnLayer->m_textMaxWidth = readStyleValue(in);
+    returnLayer->m_textHaloWidth = readStyleValue(in);
+    returnLayer->m_textHaloColor = readStyleValue(in);
+
+    returnLayer->m_textSizeExpression = compileIfExpression(returnLayer->m_textSize);
+    returnLayer->m_textColorExpression = compileIfExpression(returnLayer->m_textColor);
+    returnLayer->m_textOpacityExpression = compileIfExpression(returnLayer->m_textOpacity);
+    returnLayer->m_textLetterSpacingExpression = compileIfExpression(returnLayer->m_textLetterSpacing);
+    returnLayer->m_textMaxAngleExpression = compileIfExpression(returnLayer->m_textMaxAngle);
+    returnLayer->m_compiledTextField = compileIfExpression(returnLayer->m_textField);
+    returnLayer->bakePerZoomValues();
+    return returnLayerPtr;
+}
+
+/*!
+ * \brief NotImplementedStyle::fromBinary returns the NotImplementedStyle layer style.
+ * It has no properties of its own.
+ */
+std::unique_ptr<NotImplementedStyle> NotImplementedStyle::fromBinary(QDataStream &)
+{
+    return std::make_unique<NotImplementedStyle>();
+}
+
+/*!
+ * \brief StyleSheet::hashJsonBytes
+ * \return The hash of a style sheet JSON file, used to tell if a binary
+ * style sheet was made from it.
+ */
+QByteArray StyleSheet::hashJsonBytes(const QByteArray &jsonBytes)
+{
+    return QCryptographicHash::hash(jsonBytes, QCryptographicHash::Sha256);
+}
+
+/*!
+ * \brief StyleSheet::toBinary stores the parsed style sheet in a versioned binary format
+ * that loads faster than the JSON it was parsed from.
+ *
+ * \param sourceHash is the hash of the JSON the style sheet was parsed from, see hashJsonBytes.
+ * \return The binary style sheet, or an empty QByteArray if a property could not be stored.
+ */
+QByteArray StyleSheet::toBinary(const QByteArray &sourceHash) const
+{
+    QByteArray out;
+    QDataStream stream { &out, QIODevice::WriteOnly };
+    stream.setVersion(binaryStyleSheetStreamVersion);
+
+    stream << binaryStyleSheetMagic << binaryFormatVersion << sourceHash;
+    stream << m_id << (qint32)m_version << m_name;
+    stream << (quint32)m_layerStyles.size();
+    for (const std::unique_ptr<AbstractLayerStyle> &layerStyle : m_layerStyles)
+        layerStyle->writeBinary(stream);
+
+    if (stream.status() != QDataStream::Ok)
+        return {};
+    return out;
+}
+
+/*!
+ * \brief StyleSheet::fromBinary loads a style sheet stored by toBinary.
+ *
+ * \param input is the binary style sheet.
+ * \param expectedSourceHash is the hash of the current JSON style sheet.
+ * \return The style sheet, or std::nullopt if the data is of another format version,
+ * was made from another JSON file, or is corrupt.
+ */
+std::optional<StyleSheet> StyleSheet::fromBinary(const QByteArray &input, const QByteArray &expectedSourceHash)
+{
+    QDataStream stream { input };
+    stream.setVersion(binaryStyleSheetStreamVersion);
+
+    quint32 magic = 0;
+    quint32 formatVersion = 0;
+    QByteArray sourceHash;
+    stream >> magic >> formatVersion;
+    if (stream.status() != QDataStream::Ok || magic != binaryStyleSheetMagic || formatVersion != binaryFormatVersion)
+        return std::nullopt;
+    stream >> sourceHash;
+    if (sourceHash != expectedSourceHash)
+        return std::nullopt;
+
+    StyleSheet out;
+    qint32 version = 0;
+    quint32 layerCount = 0;
+    stream >> out.m_id >> version >> out.m_name >> layerCount;
+    out.m_version = version;
+    if (stream.status() != QDataStream::Ok)
+        return std::nullopt;
+
+    out.m_layerStyles.reserve(qMin<quint32>(layerCount, 4096));
+    for (quint32 i = 0; i < layerCount; i++) {
+        std::unique_ptr<AbstractLayerStyle> layerStyle = AbstractLayerStyle::fromBinary(stream);
+        if (layerStyle == nullptr) {
+            qWarning() << "StyleSheet: The binary style sheet is corrupt.";
+            return std::nullopt;
+        }
+        out.m_layerStyles.push_back(std::move(layerStyle));
+    }
+    return out;
+}
+
+/*!
+ * \brief StyleSheet::fromBinaryFile loads a binary style sheet file, see fromBinary.
+ *
+ * The file is memory-mapped while it is read, falling back to reading it
+ * into memory if it can't be mapped.
+ */
+std::optional<StyleSheet> StyleSheet::fromBinaryFile(const QString &path, const QByteArray &expectedSourceHash)
+{
+    QFile file { path };
+    if (!file.open(QFile::ReadOnly))
+        return std::nullopt;
+
+    uchar *mapped = file.map(0, file.size());
+    if (mapped == nullptr)
+        return fromBinary(file.readAll(), expectedSourceHash);
+
+    std::optional<StyleSheet> out;
+    {
+        // Everything is copied out of the mapping while reading, so it can be unmapped right after.
+        const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), file.size());
+        out = fromBinary(bytes, expectedSourceHash);
+    }
+    file.unmap(mapped);
+    return out;
+}
+
+/*!
+ * \brief StyleSheet::fromJsonBytesCached
+ * Parses a JSON style sheet, using a binary style sheet made from
+ * the same JSON on an earlier run instead if there is one.
+ *
+ * If the binary style sheet is missing or outdated, the JSON is parsed
+ * and the binary style sheet is written again for the next run.
+ *
+ * \param jsonBytes The JSON style sheet.
+ * \param binaryCachePath Where the binary style sheet is kept.
+ * \return The parsed stylesheet or std::nullopt.
+ */
+std::optional<StyleSheet> StyleSheet::fromJsonBytesCached(const QByteArray &jsonBytes, const QString &binaryCachePath)
+{
+    const QByteArray sourceHash = hashJsonBytes(jsonBytes);
+    std::optional<StyleSheet> cached = fromBinaryFile(binaryCachePath, sourceHash);
+    if (cached.has_value())
+        return cached;
+
+    std::optional<StyleSheet> parsed = fromJsonBytes(jsonBytes);
+    if (!parsed.has_value())
+        return std::nullopt;
+
+    const QByteArray binary = parsed->toBinary(sourceHash);
+    if (!binary.isEmpty()) {
+        // Written through a temporary file, so a crash never leaves a half-written cache behind.
+        QDir().mkpath(QFileInfo(binaryCachePath).absolutePath());
+        QSaveFile file { binaryCachePath };
+        if (!file.open(QFile::WriteOnly) || file.write(binary) != binary.size() || !file.commit())
+            qWarning() << "StyleSheet: Unable to write the binary style sheet to" << binaryCachePath;
+    }
+    return parsed;
+}
@@ -49,6 +49,7 @@ std::unique_ptr<FillLayerStyle> FillLayerStyle::fromJson(const QJsonObject &json
         } else if (fillColor.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_fillColor.setValue(fillColor.toArray());
+            returnLayer->m_fillColorExpression = Bach::CompiledExpression::compile(fillColor.toArray());
         } else {
             // Case where the property is a color value.
             returnLayer->m_fillColor.setValue(Bach::getColorFromString(fillColor.toString()));
@@ -72,6 +73,7 @@ std::unique_ptr<FillLayerStyle> FillLayerStyle::fromJson(const QJsonObject &json
         } else if (fillOpacity.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_fillOpacity.setValue(fillOpacity.toArray());
+            returnLayer->m_fillOpacityExpression = Bach::CompiledExpression::compile(fillOpacity.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_fillOpacity.setValue(fillOpacity.toDouble());
@@ -101,9 +103,25 @@ std::unique_ptr<FillLayerStyle> FillLayerStyle::fromJson(const QJsonObject &json
         }
     }
 
+    returnLayer->bakePerZoomValues();
     return returnLayerPtr;
 }
 
+/*!
+ * \brief FillLayerStyle::bakePerZoomValues stores the zoom-only properties
+ * of this layer at every zoom level.
+ *
+ * Properties that are expressions depend on the feature, and are left out.
+ * Must be called after all the properties have been parsed.
+ */
+void FillLayerStyle::bakePerZoomValues()
+{
+    if (m_fillColor.typeId() != QMetaType::Type::QJsonArray)
+        m_fillColorPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getFillColorAtZoom(zoomLevel); });
+    if (m_fillOpacity.typeId() != QMetaType::Type::QJsonArray)
+        m_fillOpacityPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getFillOpacityAtZoom(zoomLevel); });
+}
+
 
 /*!
  * \brief FillLayerStyle::getFillColorAtZoom returns the color for a given zoom.
@@ -116,6 +134,8 @@ std::unique_ptr<FillLayerStyle> FillLayerStyle::fromJson(const QJsonObject &json
  */
 QVariant FillLayerStyle::getFillColorAtZoom(int zoomLevel) const
 {
+    if (m_fillColorPerZoom.contains(zoomLevel))
+        return m_fillColorPerZoom.at(zoomLevel);
     if (m_fillColor.isNull()) {
         // The default color in case no color is provided by the style sheet.
         return QColor(Qt::GlobalColor::black);
@@ -138,6 +158,8 @@ QVariant FillLayerStyle::getFillColorAtZoom(int zoomLevel) const
  */
 QVariant FillLayerStyle::getFillOpacityAtZoom(int zoomLevel) const
 {
+    if (m_fillOpacityPerZoom.contains(zoomLevel))
+        return m_fillOpacityPerZoom.at(zoomLevel);
     if (m_fillOpacity.isNull()) {
         // The default opacity in case no opacity is provided by the style sheet.
         return QVariant(1);
@@ -52,6 +52,7 @@ std::unique_ptr<LineLayerStyle> LineLayerStyle::fromJson(const QJsonObject &json
         } else if (lineColor.isArray()) {
             //Case where the property is an expression.
             returnLayer->m_lineColor.setValue(lineColor.toArray());
+            returnLayer->m_lineColorExpression = Bach::CompiledExpression::compile(lineColor.toArray());
         } else {
             //Case where the property is a color value.
             returnLayer->m_lineColor.setValue(Bach::getColorFromString(lineColor.toString()));
@@ -76,6 +77,7 @@ std::unique_ptr<LineLayerStyle> LineLayerStyle::fromJson(const QJsonObject &json
         }else if (lineOpacity.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_lineOpacity.setValue(lineOpacity.toArray());
+            returnLayer->m_lineOpacityExpression = Bach::CompiledExpression::compile(lineOpacity.toArray());
         } else { //Case where the property is a numeric value.
             returnLayer->m_lineOpacity.setValue(lineOpacity.toDouble());
         }
@@ -99,14 +101,34 @@ std::unique_ptr<LineLayerStyle> LineLayerStyle::fromJson(const QJsonObject &json
         } else if (lineWidth.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_lineWidth.setValue(lineWidth.toArray());
+            returnLayer->m_lineWidthExpression = Bach::CompiledExpression::compile(lineWidth.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_lineWidth.setValue(lineWidth.toInt());
         }
     }
 
+    returnLayer->bakePerZoomValues();
     return returnLayerPtr;
 }
+
+/*!
+ * \brief LineLayerStyle::bakePerZoomValues stores the zoom-only properties
+ * of this layer at every zoom level.
+ *
+ * Properties that are expressions depend on the feature, and are left out.
+ * Must be called after all the properties have been parsed.
+ */
+void LineLayerStyle::bakePerZoomValues()
+{
+    if (m_lineColor.typeId() != QMetaType::Type::QJsonArray)
+        m_lineColorPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getLineColorAtZoom(zoomLevel); });
+    if (m_lineOpacity.typeId() != QMetaType::Type::QJsonArray)
+        m_lineOpacityPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getLineOpacityAtZoom(zoomLevel); });
+    if (m_lineWidth.typeId() != QMetaType::Type::QJsonArray)
+        m_lineWidthPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getLineWidthAtZoom(zoomLevel); });
+}
+
 /*!
  * \brief LineLayerStyle::getLineColorAtZoom returns the color for a given zoom.
  *
@@ -118,6 +140,8 @@ std::unique_ptr<LineLayerStyle> LineLayerStyle::fromJson(const QJsonObject &json
  */
 QVariant LineLayerStyle::getLineColorAtZoom(int zoomLevel) const
 {
+    if (m_lineColorPerZoom.contains(zoomLevel))
+        return m_lineColorPerZoom.at(zoomLevel);
     if (m_lineColor.isNull()) {
         // The default color in case no color is provided by the style sheet.
         return QVariant(QColor(Qt::GlobalColor::black));
@@ -144,6 +168,8 @@ QVariant LineLayerStyle::getLineColorAtZoom(int zoomLevel) const
  */
 QVariant LineLayerStyle::getLineOpacityAtZoom(int zoomLevel) const
 {
+    if (m_lineOpacityPerZoom.contains(zoomLevel))
+        return m_lineOpacityPerZoom.at(zoomLevel);
     if (m_lineOpacity.isNull()) {
         // The default opacity in case no opacity is provided by the style sheet.
         return QVariant(1);
@@ -169,6 +195,8 @@ QVariant LineLayerStyle::getLineOpacityAtZoom(int zoomLevel) const
  */
 QVariant LineLayerStyle::getLineWidthAtZoom(int zoomLevel) const
 {
+    if (m_lineWidthPerZoom.contains(zoomLevel))
+        return m_lineWidthPerZoom.at(zoomLevel);
     if (m_lineWidth.isNull()) {
         // The default width in case no width is provided by the style sheet.
         return QVariant(1);
@@ -41,6 +41,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         } else if (textSize.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_textSize.setValue(textSize.toArray());
+            returnLayer->m_textSizeExpression = Bach::CompiledExpression::compile(textSize.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_textSize.setValue(textSize.toInt());
@@ -62,6 +63,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         } else if (textSize.isArray()){
             // Case where the property is an expression.
             returnLayer->m_textMaxAngle.setValue(textSize.toArray());
+            returnLayer->m_textMaxAngleExpression = Bach::CompiledExpression::compile(textSize.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_textMaxAngle.setValue(textSize.toInt());
@@ -105,6 +107,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         } else if (textSize.isArray()){
             // Case where the property is an expression.
             returnLayer->m_textLetterSpacing.setValue(textSize.toArray());
+            returnLayer->m_textLetterSpacingExpression = Bach::CompiledExpression::compile(textSize.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_textLetterSpacing.setValue(textSize.toDouble());
@@ -123,6 +126,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         if (layout.value("text-field").isArray()) {
             // Case where the property is an expression.
             returnLayer->m_textField = QVariant(layout.value("text-field").toArray());
+            returnLayer->m_compiledTextField = Bach::CompiledExpression::compile(layout.value("text-field").toArray());
         } else {
             // Case where the property is a string value.
             returnLayer->m_textField = QVariant(layout.value("text-field").toString());
@@ -154,6 +158,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         }else if (textColor.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_textColor.setValue(textColor.toArray());
+            returnLayer->m_textColorExpression = Bach::CompiledExpression::compile(textColor.toArray());
         } else {
             // Case where the property is a color value.
             returnLayer->m_textColor.setValue(Bach::getColorFromString(textColor.toString()));
@@ -178,6 +183,7 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         } else if (textOpacity.isArray()) {
             // Case where the property is an expression.
             returnLayer->m_textOpacity.setValue(textOpacity.toArray());
+            returnLayer->m_textOpacityExpression = Bach::CompiledExpression::compile(textOpacity.toArray());
         } else {
             // Case where the property is a numeric value.
             returnLayer->m_textOpacity.setValue(textOpacity.toDouble());
@@ -197,9 +203,33 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
         returnLayer->m_textHaloWidth = 0;
     }
 
+    returnLayer->bakePerZoomValues();
     return returnLayerPtr;
 }
 
+/*!
+ * \brief SymbolLayerStyle::bakePerZoomValues stores the zoom-only properties
+ * of this layer at every zoom level.
+ *
+ * Properties that are expressions depend on the feature, and are left out.
+ * Must be called after all the properties have been parsed.
+ */
+void SymbolLayerStyle::bakePerZoomValues()
+{
+    if (m_textSize.typeId() != QMetaType::Type::QJsonArray)
+        m_textSizePerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getTextSizeAtZoom(zoomLevel); });
+    if (m_textSize.typeId() != QMetaType::Type::QJsonArray)
+        m_symbolSpacingPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getSymbolSpacingAtZoom(zoomLevel); });
+    if (m_textMaxAngle.typeId() != QMetaType::Type::QJsonArray)
+        m_textMaxAnglePerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getTextMaxAngleAtZoom(zoomLevel); });
+    if (m_textLetterSpacing.typeId() != QMetaType::Type::QJsonArray)
+        m_textLetterSpacingPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getTextLetterSpacingAtZoom(zoomLevel); });
+    if (m_textColor.typeId() != QMetaType::Type::QJsonArray)
+        m_textColorPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getTextColorAtZoom(zoomLevel); });
+    if (m_textOpacity.typeId() != QMetaType::Type::QJsonArray)
+        m_textOpacityPerZoom = Bach::PerZoomStyleValues::fromFunction([this](int zoomLevel) { return getTextOpacityAtZoom(zoomLevel); });
+}
+
 /*!
  * \brief SymbolLayerStyle::getTextSizeAtZoom returns the text size for a given zoom.
  *
@@ -211,6 +241,8 @@ std::unique_ptr<SymbolLayerStyle> SymbolLayerStyle::fromJson(const QJsonObject &
  */
 QVariant SymbolLayerStyle::getTextSizeAtZoom(int zoomLevel) const
 {
+    if (m_textSizePerZoom.contains(zoomLevel))
+        return m_textSizePerZoom.at(zoomLevel);
     if (m_textSize.isNull()) {
         // The default size in case no size is provided by the style sheet.
         return QVariant(16);
@@ -236,6 +268,8 @@ QVariant SymbolLayerStyle::getTextSizeAtZoom(int zoomLevel) const
  */
 QVariant SymbolLayerStyle::getSymbolSpacingAtZoom(int zoomLevel) const
 {
+    if (m_symbolSpacingPerZoom.contains(zoomLevel))
+        return m_symbolSpacingPerZoom.at(zoomLevel);
     if (m_textSize.isNull()){
         // The default size in case no size is provided by the style sheet.
         return QVariant(250);
@@ -262,6 +296,8 @@ QVariant SymbolLayerStyle::getSymbolSpacingAtZoom(int zoomLevel) const
  */
 QVariant SymbolLayerStyle::getTextMaxAngleAtZoom(int zoomLevel) const
 {
+    if (m_textMaxAnglePerZoom.contains(zoomLevel))
+        return m_textMaxAnglePerZoom.at(zoomLevel);
     if (m_textMaxAngle.isNull()){
         // The default size in case no size is provided by the style sheet.
         return QVariant(45);
@@ -288,6 +324,8 @@ QVariant SymbolLayerStyle::getTextMaxAngleAtZoom(int zoomLevel) const
  */
 QVariant SymbolLayerStyle::getTextLetterSpacingAtZoom(int zoomLevel) const
 {
+    if (m_textLetterSpacingPerZoom.contains(zoomLevel))
+        return m_textLetterSpacingPerZoom.at(zoomLevel);
     if (m_textLetterSpacing.isNull()){
         // The default size in case no size is provided by the style sheet.
         return QVariant(0);
@@ -310,6 +348,8 @@ QVariant SymbolLayerStyle::getTextLetterSpacingAtZoom(int zoomLevel) const
  */
 QVariant SymbolLayerStyle::getTextColorAtZoom(int zoomLevel) const
 {
+    if (m_textColorPerZoom.contains(zoomLevel))
+        return m_textColorPerZoom.at(zoomLevel);
     if(m_textColor.isNull()) {
         // The default color in case no color is provided by the style sheet.
         return QVariant(QColor(Qt::GlobalColor::black));
@@ -336,6 +376,8 @@ QVariant SymbolLayerStyle::getTextColorAtZoom(int zoomLevel) const
  */
 QVariant SymbolLayerStyle::getTextOpacityAtZoom(int zoomLevel) const
 {
+    if (m_textOpacityPerZoom.contains(zoomLevel))
+        return m_textOpacityPerZoom.at(zoomLevel);
     if (m_textOpacity.isNull()) {
         // The default color in case no color is provided by the style sheet.
         return QVariant(1);
@@ -2,13 +2,19 @@
 // SPDX-License-Identifier: MIT
 
 // STL header files
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtMath>
 #include <QTextLayout>
 #include <QTextCharFormat>
 
 // Other header files
 #include "Evaluator.h"
 #include "Rendering.h"
+#include "Tracing.h"
 
 /*!
  * \internal
@@ -20,8 +26,38 @@ struct TileScreenPlacement {
     double pixelPosX;
     double pixelPosY;
     double pixelWidth;
+    // Tiles above the zoom levels of the tile source are drawn from a part of their ancestor.
+    // How many times larger the ancestor is than the tile, and the offset of the tile
+    // within the ancestor, in units of the tile width.
+    int sourceScale = 1;
+    QPoint sourceOffset;
 };
 
+// The visible tiles of a frame along with their placement, see calcVisibleTilePlacements.
+using TilePlacementList = std::vector<
+    std::pair<TileCoord, TileScreenPlacement>,
+    Bach::FrameArenaAllocator<std::pair<TileCoord, TileScreenPlacement>>>;
+
+/*!
+ * \internal
+ * \brief placeOnAncestor
+ * Sets up a placement to draw the part of an ancestor tile that covers the given tile.
+ */
+static TileScreenPlacement placeOnAncestor(
+    TileScreenPlacement tilePlacement,
+    TileCoord tileCoord,
+    TileCoord ancestor)
+{
+    const int levelsUp = tileCoord.zoom - ancestor.zoom;
+    if (levelsUp <= 0)
+        return tilePlacement;
+    tilePlacement.sourceScale = 1 << levelsUp;
+    tilePlacement.sourceOffset = {
+        tileCoord.x - (ancestor.x << levelsUp),
+        tileCoord.y - (ancestor.y << levelsUp) };
+    return tilePlacement;
+}
+
 /*!
  * \internal
  *
@@ -217,6 +253,10 @@ static bool includeFeature(
 {
     if (layerStyle.m_filter.isEmpty())
         return true;
+    // Use the compiled filter if the style sheet was parsed,
+    // and fall back to resolving the filter directly otherwise.
+    if (!layerStyle.m_compiledFilter.isEmpty())
+        return layerStyle.m_compiledFilter.evaluate(&feature, mapZoom, vpZoom).toBool();
     return Evaluator::resolveExpression(
         layerStyle.m_filter,
         &feature,
@@ -224,6 +264,82 @@ static bool includeFeature(
         vpZoom).toBool();
 }
 
+/*!
+ * \brief getIncludedFeatures finds the features of the layer that pass the layer style's filter.
+ *
+ * Filters that only depend on the feature and the map zoom level are cached in the layer,
+ * so they are only evaluated the first time a layer is rendered with a given style and map zoom level.
+ *
+ * \param layerStyle The layer style whose filter should be applied.
+ * \param layer The layer whose features should be filtered.
+ * \param mapZoom is the map zoom level.
+ * \param vpZoom is the viewport zoom level.
+ * \return The sorted list of indices into the layer's features that pass the filter.
+ */
+static std::shared_ptr<const TileLayerFilterCache::FeatureIndices> getIncludedFeatures(
+    const AbstractLayerStyle &layerStyle,
+    const TileLayer &layer,
+    int mapZoom,
+    double vpZoom)
+{
+    BACH_TRACE_SCOPE("getIncludedFeatures");
+    // Filters that are not compiled might use anything, so they can't be cached.
+    const bool cacheable =
+        !layerStyle.m_compiledFilter.isEmpty() &&
+        !layerStyle.m_compiledFilter.usesViewportZoom();
+
+    TileLayerFilterCache &cache = layer.filterCache();
+    if (cacheable) {
+        auto cached = cache.find(layerStyle.uniqueId(), mapZoom);
+        if (cached != nullptr)
+            return cached;
+    }
+
+    auto indices = std::make_shared<TileLayerFilterCache::FeatureIndices>();
+    for (int i = 0; i < (int)layer.m_features.size(); i++) {
+        if (includeFeature(layerStyle, *layer.m_features[i], mapZoom, vpZoom))
+            indices->push_back(i);
+    }
+
+    if (cacheable)
+        cache.insert(layerStyle.uniqueId(), mapZoom, indices);
+    return indices;
+}
+
+/*!
+ * \internal
+ * \brief calcVisibleTileRect
+ * Finds the part of a tile that ends up on the painter's device.
+ * \param transform maps the tile geometry to the painter's coordinates.
+ * \return The visible part, in the units of the tile geometry.
+ */
+static QRectF calcVisibleTileRect(const QPainter &painter, const QTransform &transform)
+{
+    // The device size is in device pixels, which is at least its logical size.
+    // This can only make the rectangle larger than it has to be.
+    const QPaintDevice &device = *painter.device();
+    QRectF visibleRect = painter.worldTransform().inverted().mapRect(QRectF(0, 0, device.width(), device.height()));
+    if (painter.hasClipping())
+        visibleRect = visibleRect.intersected(painter.clipBoundingRect());
+    return transform.inverted().mapRect(visibleRect);
+}
+
+/*!
+ * \internal
+ * \brief isFeatureInRect
+ * Checks the bounding box of a feature against a rectangle, in the units of the tile geometry.
+ * \param margin How far outside its bounding box the feature is drawn, such as half the width of a line.
+ * \return Returns false only if the feature is known to be entirely outside the rectangle.
+ */
+static bool isFeatureInRect(const std::optional<QRect> &bounds, const QRectF &rect, double margin)
+{
+    if (!bounds.has_value())
+        return true;
+    if (bounds->isEmpty())
+        return false;
+    return QRectF(*bounds).adjusted(-margin, -margin, margin, margin).intersects(rect);
+}
+
 /*!
  * \brief paintVectorLayer_Fill
  * Call the polygon rendering function on all the layer's features that pass the layerStyle filter
@@ -236,6 +352,17 @@ static bool includeFeature(
  * \param mapZoom The map zoom level being rendered.
  * \param vpZoom The zoom level of the viewport.
  * \param geometryTransform the transform to be used to map the features into the correct position.
+ * \param tilePixelSize The size of the tile on screen in device pixels,
+ * used to pick the simplified geometry of the layer if it has any.
+ * \param visibleTileRect The part of the tile that is visible, see calcVisibleTileRect.
+ * Features outside of it are skipped before they are styled.
+ * \param minFeaturePixelSize Features smaller than this on screen, in both directions,
+ * are skipped as well. See PaintVectorTileSettings::minFeaturePixelSize.
+ *
+ * The painter state is set up once for the layer, and the brush is only changed
+ * when the resolved colour differs from that of the feature before. Features are still
+ * drawn one by one and in order, the translucent and antialiased edges of touching
+ * polygons would blend differently if their paths were merged.
  */
 static void paintVectorLayer_Fill(
     QPainter &painter,
@@ -243,23 +370,49 @@ static void paintVectorLayer_Fill(
     const TileLayer& layer,
     double vpZoom,
     int mapZoom,
-    QTransform geometryTransform)
+    QTransform geometryTransform,
+    double tilePixelSize,
+    const QRectF &visibleTileRect,
+    double minFeaturePixelSize)
 {
-    // Iterate over all the features, and filter out anything that is not fill.
-    for (const std::unique_ptr<AbstractLayerFeature> &abstractFeature : layer.m_features) {
+    // The same painter state as paintSingleTileFeature_Polygon sets up for every feature.
+    painter.save();
+    painter.setRenderHints(QPainter::Antialiasing, layerStyle.m_antialias);
+    painter.setPen(Qt::NoPen);
+    QTransform transform = geometryTransform;
+    transform.scale(1 / 4096.0, 1 / 4096.0);
+    std::optional<QColor> currentColor;
+
+    // Antialiasing can touch the pixel next to the edge of a polygon.
+    const double pixelsPerTileUnit = transform.m11();
+    const double cullMargin = 1 / pixelsPerTileUnit;
+    const double minFeatureSize = minFeaturePixelSize / pixelsPerTileUnit;
+
+    // Iterate over all the features that pass the filter, and filter out anything that is not fill.
+    auto includedFeatures = getIncludedFeatures(layerStyle, layer, mapZoom, vpZoom);
+    for (int featureIndex : *includedFeatures) {
+        const AbstractLayerFeature *abstractFeature = layer.m_features[featureIndex].get();
         if (abstractFeature->type() != AbstractLayerFeature::featureType::polygon)
             continue;
 
-        const auto &feature = *static_cast<const PolygonFeature*>(abstractFeature.get());
+        const auto &feature = *static_cast<const PolygonFeature*>(abstractFeature);
 
-        if (!includeFeature(layerStyle, feature, mapZoom, vpZoom))
+        const std::optional<QRect> bounds = layer.featureBoundingRect(feature.geometryIndex());
+        if (!isFeatureInRect(bounds, visibleTileRect, cullMargin))
+            continue;
+        if (bounds.has_value() && bounds->width() < minFeatureSize && bounds->height() < minFeatureSize)
             continue;
 
         // Render the feature in question.
-        painter.save();
-        Bach::paintSingleTileFeature_Polygon({&painter, &layerStyle, &feature, mapZoom, vpZoom, geometryTransform});
-        painter.restore();
+        const QColor color = Bach::getFillColor(layerStyle, feature, mapZoom, vpZoom);
+        if (color != currentColor) {
+            painter.setBrush(color);
+            currentColor = color;
+        }
+        const QPainterPath *simplifiedPath = layer.simplifiedPath(feature.geometryIndex(), tilePixelSize);
+        painter.drawPath(transform.map(simplifiedPath != nullptr ? *simplifiedPath : feature.polygon()));
     }
+    painter.restore();
 }
 
 /*!
@@ -274,6 +427,16 @@ static void paintVectorLayer_Fill(
  * \param mapZoom The map zoom level being rendered.
  * \param vpZoom The zoom level of the viewport.
  * \param geometryTransform the transform to be used to map the features into the correct position.
+ * \param tilePixelSize The size of the tile on screen in device pixels,
+ * used to pick the simplified geometry of the layer if it has any.
+ * \param visibleTileRect The part of the tile that is visible, see calcVisibleTileRect.
+ * Lines outside of it are skipped, taking their width into account.
+ *
+ * Consecutive features that resolve to the same pen and opacity are drawn as one batch,
+ * with the painter state set once per batch. Opaque solid lines are merged into a single
+ * path and drawn with one call, which results in the same pixels since the lines
+ * are not antialiased. Translucent and dashed lines are still drawn one by one,
+ * since overlaps would blend differently and dashes would continue across features.
  */
 static void paintVectorLayer_Line(
     QPainter &painter,
@@ -281,30 +444,196 @@ static void paintVectorLayer_Line(
     const TileLayer& layer,
     double vpZoom,
     int mapZoom,
-    QTransform geometryTransform)
+    QTransform geometryTransform,
+    double tilePixelSize,
+    const QRectF &visibleTileRect)
 {
-    // Iterate over all the features, and filter out anything that is not line.
-    for (const std::unique_ptr<AbstractLayerFeature> &abstractFeature : layer.m_features) {
+    // The same painter state as paintSingleTileFeature_Line sets up for every feature.
+    painter.save();
+    painter.setBrush(Qt::NoBrush);
+    painter.setRenderHints(QPainter::Antialiasing, false);
+    const QPen basePen = painter.pen();
+    QTransform transform = geometryTransform;
+    transform.scale(1 / 4096.0, 1 / 4096.0);
+    const double pixelsPerTileUnit = transform.m11();
+
+    std::optional<QPen> currentPen;
+    float currentOpacity = 1;
+    bool mergeLines = false;
+    QPainterPath mergedPath;
+    auto flushMergedPath = [&]() {
+        if (!mergedPath.isEmpty())
+            painter.drawPath(mergedPath);
+        mergedPath = {};
+    };
+
+    // Iterate over all the features that pass the filter, and filter out anything that is not line.
+    auto includedFeatures = getIncludedFeatures(layerStyle, layer, mapZoom, vpZoom);
+    for (int featureIndex : *includedFeatures) {
+        const AbstractLayerFeature *abstractFeature = layer.m_features[featureIndex].get();
         if (abstractFeature->type() != AbstractLayerFeature::featureType::line)
             continue;
-        const auto &feature = *static_cast<const LineFeature*>(abstractFeature.get());
+        const auto &feature = *static_cast<const LineFeature*>(abstractFeature);
 
-        // Tests whether the feature should be rendered at all based on possible expression.
-        if (!includeFeature(layerStyle, feature, mapZoom, vpZoom))
+        // Start a new batch whenever the resolved style changes.
+        const QPen pen = Bach::getLinePen(layerStyle, feature, mapZoom, vpZoom, basePen);
+        const float opacity = Bach::getLineOpacity(layerStyle, feature, mapZoom, vpZoom);
+
+        // Miter joins reach out to the miter limit times half the width, square caps less than that.
+        // The extra pixel covers rounding, and cosmetic pens with a width of zero.
+        const double lineReach = pen.widthF() / 2 * qMax(pen.miterLimit(), M_SQRT2) + 1;
+        const std::optional<QRect> bounds = layer.featureBoundingRect(feature.geometryIndex());
+        if (!isFeatureInRect(bounds, visibleTileRect, lineReach / pixelsPerTileUnit))
             continue;
 
+        if (!currentPen.has_value() || pen != *currentPen || opacity != currentOpacity) {
+            flushMergedPath();
+            painter.setPen(pen);
+            painter.setOpacity(opacity);
+            currentPen = pen;
+            currentOpacity = opacity;
+            mergeLines = opacity >= 1 && pen.color().alpha() == 255 && pen.style() == Qt::SolidLine;
+        }
+
         // Render the feature in question.
-        painter.save();
-        Bach::paintSingleTileFeature_Line({&painter, &layerStyle, &feature, mapZoom, vpZoom, geometryTransform});
-        painter.restore();
+        const QPainterPath *simplifiedPath = layer.simplifiedPath(feature.geometryIndex(), tilePixelSize);
+        const QPainterPath path = transform.map(simplifiedPath != nullptr ? *simplifiedPath : feature.line());
+        if (mergeLines)
+            mergedPath.addPath(path);
+        else
+            painter.drawPath(path);
+    }
+    flushMergedPath();
+    painter.restore();
+}
+
+/*!
+ * \internal
+ * \brief canPrepareLabels
+ * Checks whether the labels of a symbol layer style only depend on the features
+ * and the map zoom level, so that they can be prepared once and kept in the layer's label cache.
+ */
+static bool canPrepareLabels(const SymbolLayerStyle &layerStyle)
+{
+    // Filters that are not compiled might use anything.
+    const bool filterCacheable =
+        layerStyle.m_filter.isEmpty() ||
+        (!layerStyle.m_compiledFilter.isEmpty() && !layerStyle.m_compiledFilter.usesViewportZoom());
+    return filterCacheable && !Bach::labelsUseViewportZoom(layerStyle);
+}
+
+/*!
+ * \internal
+ * \brief buildLabelCandidates
+ * Prepares the labels of every feature of the layer that has any text.
+ * The filter is only applied to the point features, and these are ordered by their "rank" property.
+ * \param forcedFont If set, the font to use for point labels instead of the one suggested by the stylesheet.
+ */
+static std::shared_ptr<const Bach::TileLabelCandidates> buildLabelCandidates(
+    const SymbolLayerStyle &layerStyle,
+    const TileLayer &layer,
+    int mapZoom,
+    double vpZoom,
+    const QFont *forcedFont)
+{
+    BACH_TRACE_SCOPE("buildLabelCandidates");
+    auto out = std::make_shared<Bach::TileLabelCandidates>();
+    out->outlineSize = layerStyle.m_textHaloWidth.toInt();
+    out->outlineColor = layerStyle.m_textHaloColor.value<QColor>();
+
+    //Used to order text rendering operation based on "rank" property.
+    std::vector<std::pair<int, Bach::TileLabelCandidates::PointLabel>> rankedLabels;
+    auto includedFeatures = getIncludedFeatures(layerStyle, layer, mapZoom, vpZoom);
+    auto nextIncludedFeature = includedFeatures->begin();
+    // Iterate over all the features, and filter out anything that is not point.
+    for (int featureIndex = 0; featureIndex < (int)layer.m_features.size(); featureIndex++) {
+        const std::unique_ptr<AbstractLayerFeature> &abstractFeature = layer.m_features[featureIndex];
+        // Advance to the first included feature that is not before this one.
+        while (nextIncludedFeature != includedFeatures->end() && *nextIncludedFeature < featureIndex)
+            nextIncludedFeature++;
+        const bool included = nextIncludedFeature != includedFeatures->end() && *nextIncludedFeature == featureIndex;
+
+        if (abstractFeature->type() == AbstractLayerFeature::featureType::line){
+            const LineFeature &feature = *static_cast<const LineFeature*>(abstractFeature.get());
+            auto label = Bach::prepareLabel_Point_Curved(layerStyle, feature, mapZoom, vpZoom);
+            if (!label.has_value())
+                continue;
+            label->featureIndex = featureIndex;
+            out->curvedLabels.push_back(std::move(*label));
+        } else if (abstractFeature->type() == AbstractLayerFeature::featureType::point){
+            //For normal text (continents /countries / cities / places / ...)
+            const PointFeature &feature = *static_cast<const PointFeature*>(abstractFeature.get());
+            // Tests whether the feature should be rendered at all based on possible expression.
+            if (!included)
+                continue;
+            auto label = Bach::prepareLabel_Point(layerStyle, feature, mapZoom, vpZoom, forcedFont);
+            if (!label.has_value())
+                continue;
+
+            //Add the label along with its "rank" (if present, defaults to 100).
+            const QVariant *rank = feature.findProperty("rank");
+            rankedLabels.push_back({ rank != nullptr ? rank->toInt() : 100, std::move(*label) });
+        }
+    }
+
+    //Sort the labels in increasing order based on the label's "rank"
+    std::stable_sort(rankedLabels.begin(), rankedLabels.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+    out->pointLabels.reserve(rankedLabels.size());
+    for (auto &[rank, label] : rankedLabels)
+        out->pointLabels.push_back(std::move(label));
+    return out;
+}
+
+/*!
+ * \brief Bach::prepareTileLabels
+ * Prepares the label candidates of every symbol layer style shown at the map zoom level,
+ * and stores them in the label caches of the tile's layers, see TileLabelCandidates.
+ *
+ * Meant to be run on a worker thread right after the tile is parsed, so that painting
+ * the tile only has to place the labels. Styles whose labels read the viewport zoom level
+ * are skipped, they are still prepared while painting.
+ *
+ * \threadsafe
+ */
+void Bach::prepareTileLabels(const VectorTile &tileData, const StyleSheet &styleSheet, int mapZoom)
+{
+    BACH_TRACE_SCOPE("prepareTileLabels");
+    for (const std::unique_ptr<AbstractLayerStyle> &abstractLayerStylePtr : styleSheet.m_layerStyles) {
+        const AbstractLayerStyle *abstractLayerStyle = abstractLayerStylePtr.get();
+        if (abstractLayerStyle->type() != AbstractLayerStyle::LayerType::symbol)
+            continue;
+        if (!isLayerShown(*abstractLayerStyle, mapZoom))
+            continue;
+        const auto &layerStyle = *static_cast<const SymbolLayerStyle*>(abstractLayerStyle);
+        if (!canPrepareLabels(layerStyle))
+            continue;
+
+        auto layerIt = tileData.m_layers.find(layerStyle.m_sourceLayer);
+        if (layerIt == tileData.m_layers.end())
+            continue;
+        const TileLayer &layer = *layerIt->second;
+
+        TileLayerLabelCache &cache = layer.labelCache();
+        if (cache.find(layerStyle.uniqueId(), mapZoom) != nullptr)
+            continue;
+        // The labels don't read the viewport zoom level, so any value will do.
+        cache.insert(
+            layerStyle.uniqueId(),
+            mapZoom,
+            buildLabelCandidates(layerStyle, layer, mapZoom, mapZoom, nullptr));
     }
 }
 
 /*!
  * \brief processVectorLayer_Point
- * Call the text processing function on all the layer's features that pass the layerStyle filter.
- * For normal text, the processing function is called after that the features have been ordered according to the rank property.
+ * Places the labels of the layer's features that pass the layerStyle filter.
+ * For normal text, the labels are placed in the order of their rank property.
  * This will update the vpTextList list with the text that passes the global collision filtering.
+ *
+ * The labels are taken from the layer's label cache if they were prepared before,
+ * see Bach::prepareTileLabels, so that only the placement is left to do here.
  * \param painter
  * The painter object to paint into.
  * It assumes the painter object has had its origin moved to the tiles origin, and is unscaled.
@@ -312,11 +641,13 @@ static void paintVectorLayer_Line(
  * \param layer the TileLayer containing the features to be rendered.
  * \param mapZoom The map zoom level being rendered.
  * \param vpZoom The zoom level of the viewport.
+ * \param sourceScale How many times larger the drawn tile-data is than the tile, see TileScreenPlacement.
+ * \param sourceOffset The offset of the tile within the drawn tile-data, see TileScreenPlacement.
  * \param geometryTransform the transform to be used to map the features into the correct position.
  * \param forceNoChangeFontType If set to true, the text font
  * rendered will be the one currently set by the QPainter object.
  * If set to false, it will try to use the font suggested by the stylesheet.
- * \param labelRects The list containing the bounding rectangles for all the text features that  have
+ * \param labelCollisions The index containing the bounding rectangles for all the text features that  have
  * been processed. This bounding rects have view port coordinates rather than tile coordinates, which means
  * that the collision detection will check for all the text in the map widget and not only the text in the current tile.
  * \param vpTextList a list of structs that contain all the texts that passed the collision filtering along with all the
@@ -333,59 +664,60 @@ static void processVectorLayer_Point(
     int tileWidthPixels,
     int tileOriginX,
     int tileOriginY,
+    int sourceScale,
+    QPoint sourceOffset,
     QTransform geometryTransform,
     bool forceNoChangeFontType,
-    QVector<QRect> &labelRects,
+    Bach::LabelCollisionIndex &labelCollisions,
     QVector<Bach::vpGlobalText> &vpTextList,
     QVector<Bach::vpGlobalCurvedText> &vpCurvedTextList)
 {
-    QVector<QPair<int, PointFeature>> labels; //Used to order text rendering operation based on "rank" property.
-    // Iterate over all the features, and filter out anything that is not point.
-    for (const std::unique_ptr<AbstractLayerFeature> &abstractFeature : layer.m_features) {
-        if (abstractFeature->type() == AbstractLayerFeature::featureType::line){
-            const LineFeature &feature = *static_cast<const LineFeature*>(abstractFeature.get());
-            //Bach::paintSingleTileFeature_Point_Curved({&painter, &layerStyle, &feature, mapZoom, vpZoom, geometryTransform});
-            Bach::processSingleTileFeature_Point_Curved(
-                {&painter, &layerStyle, &feature, mapZoom, vpZoom, geometryTransform},
-                tileWidthPixels,
-                tileOriginX,
-                tileOriginY,
-                labelRects,
-                vpCurvedTextList);
-        } else if (abstractFeature->type() == AbstractLayerFeature::featureType::point){
-            //For normal text (continents /countries / cities / places / ...)
-            const PointFeature &feature = *static_cast<const PointFeature*>(abstractFeature.get());
-            // Tests whether the feature should be rendered at all based on possible expression.
-            if (!includeFeature(layerStyle, feature, mapZoom, vpZoom))
-                continue;
-
-            //Add the feature along with its "rank" (if present, defaults to 100) to the labels map.
-            if (feature.featureMetaData.contains("rank"))
-                labels.append(QPair<int, PointFeature>(feature.featureMetaData["rank"].toInt(), feature));
-            else
-                labels.append(QPair<int, PointFeature>(100, feature));
-        }
+    // The painter's font is not part of the cache key, so labels using it are never cached.
+    const bool cacheable = !forceNoChangeFontType && canPrepareLabels(layerStyle);
+    TileLayerLabelCache &cache = layer.labelCache();
+    std::shared_ptr<const Bach::TileLabelCandidates> labels;
+    if (cacheable)
+        labels = cache.find(layerStyle.uniqueId(), mapZoom);
+    if (labels == nullptr) {
+        const QFont painterFont = painter.font();
+        labels = buildLabelCandidates(
+            layerStyle,
+            layer,
+            mapZoom,
+            vpZoom,
+            forceNoChangeFontType ? &painterFont : nullptr);
+        if (cacheable)
+            cache.insert(layerStyle.uniqueId(), mapZoom, labels);
     }
 
-    //Sort the labels map in increasing order based on the laber's "rank"
-    std::stable_sort(labels.begin(), labels.end(), [](const QPair<int, PointFeature>& a, const QPair<int, PointFeature>& b) {
-        return a.first < b.first;
-    });
+    for (const Bach::TileLabelCandidates::CurvedLabel &label : labels->curvedLabels) {
+        const auto &feature = *static_cast<const LineFeature*>(layer.m_features[label.featureIndex].get());
+        Bach::placeLabel_Point_Curved(
+            label,
+            feature,
+            labels->outlineSize,
+            labels->outlineColor,
+            geometryTransform,
+            tileOriginX,
+            tileOriginY,
+            labelCollisions,
+            vpCurvedTextList);
+    }
 
-    //Loop over the ordered label map and add the text that passes the collision filter to the vpTextList list.
-    for (const auto &pair : labels){
-        painter.save();
-        Bach::processSingleTileFeature_Point(
-            {&painter, &layerStyle, &pair.second, mapZoom, vpZoom, geometryTransform},
+    //Loop over the ordered labels and add the text that passes the collision filter to the vpTextList list.
+    for (const Bach::TileLabelCandidates::PointLabel &label : labels->pointLabels) {
+        Bach::placeLabel_Point(
+            label,
+            labels->outlineSize,
+            labels->outlineColor,
+            sourceScale,
+            sourceOffset,
             tileWidthPixels,
             tileOriginX,
             tileOriginY,
-            forceNoChangeFontType,
-            labelRects,
+            labelCollisions,
             vpTextList);
-        painter.restore();
     }
-    labels.clear();
 }
 
 /*!
@@ -400,6 +732,7 @@ static void paintText(
     QVector<Bach::vpGlobalText> &vpTextList,
     Bach::PaintVectorTileSettings params)
 {
+    BACH_TRACE_SCOPE("paintText");
 
     QPen pen;
     QTextCharFormat charFormat;
@@ -421,20 +754,25 @@ static void paintText(
             //Set the pen to be used for text outline
             pen.setWidth(globalText.outlineSize);
             pen.setColor(globalText.outlineColor);
-            //Set the text layout parameters
-            textLayout.setText(text);
-            textLayout.setFont(globalText.font);
             //Set the formatRange parameters
             charFormat.setTextOutline(pen);
             formatRange.format = charFormat;
             formatRange.length = text.length();
             formatRange.start = 0;
             painter.setPen(globalText.textColor);
+            //Corrected text position
+            QPointF textPosition(globalText.position.at(i).x(), globalText.position.at(i).y() - fmetrics.height()/2);
+            //Reuse the cached layout of the text if there is one.
+            if (globalText.shape != nullptr && i < (int)globalText.shape->lineLayouts.size()) {
+                globalText.shape->lineLayouts[i]->draw(&painter, textPosition, {formatRange}, QRect(0, 0, 0, 0));
+                continue;
+            }
+            //Set the text layout parameters
+            textLayout.setText(text);
+            textLayout.setFont(globalText.font);
             textLayout.beginLayout();
             textLayout.createLine();
             textLayout.endLayout();
-            //Corrected text position
-            QPointF textPosition(globalText.position.at(i).x(), globalText.position.at(i).y() - fmetrics.height()/2);
             textLayout.draw(&painter, textPosition, {formatRange},QRect(0, 0, 0, 0));
 
         }
@@ -454,6 +792,7 @@ static void paintText_Curved(
     QPainter &painter,
     QVector<Bach::vpGlobalCurvedText> &vpCurvedTextList)
 {
+    BACH_TRACE_SCOPE("paintText_Curved");
 
     QPen pen;
     QTextCharFormat charFormat;
@@ -484,14 +823,23 @@ static void paintText_Curved(
                 painter.setPen(globalText.textColor);
                 painter.translate(text.position);
                 painter.rotate(text.angle);
+                //Get the corrected text position
+                QPoint offsetTextPos(0, -fmetrics.height());
+                //Reuse the cached layout of the character if there is one.
+                if (globalText.shape != nullptr &&
+                    text.textIndex >= 0 &&
+                    text.textIndex < (int)globalText.shape->characterLayouts.size())
+                {
+                    globalText.shape->characterLayouts[text.textIndex]->draw(&painter, offsetTextPos, {formatRange}, QRect(0, 0, 0, 0));
+                    painter.restore();
+                    continue;
+                }
                 //Set the text layout parameters
                 textLayout.setText(text.character);
                 textLayout.setFont(globalText.font);
                 textLayout.beginLayout();
                 textLayout.createLine();
                 textLayout.endLayout();
-                //Get the corrected text position
-                QPoint offsetTextPos(0, -fmetrics.height());
                 textLayout.draw(&painter, offsetTextPos, {formatRange},QRect(0, 0, 0, 0));
                 textLayout.clearLayout();
                 painter.restore();
@@ -525,7 +873,7 @@ static void paintText_Curved(
  * \param tileOriginX the x component of the tile's origin (used for text collistion detection)
  * \param tileOriginY the y component of the tile's origin (used for text collistion detection)
  * \param settings
- * \param labelRects the list containing all the bounding rectangle for previously processed text feratures (used for text collistion detection)
+ * \param labelCollisions the index containing all the bounding rectangle for previously processed text feratures (used for text collistion detection)
  * \param vpTextList the list containing all the text elements for all the tiles currently visible on the view port
  */
 static void paintVectorTile(
@@ -536,14 +884,27 @@ static void paintVectorTile(
     const StyleSheet &styleSheet,
     TileScreenPlacement tileScreenPlacement,
     const Bach::PaintVectorTileSettings &settings,
-    QVector<QRect> &labelRects,
+    Bach::LabelCollisionIndex &labelCollisions,
     QVector<Bach::vpGlobalText> &vpTextList,
     QVector<Bach::vpGlobalCurvedText> &vpCurvedTextList)
 {
+    // A tile drawn from its ancestor shows the part of the ancestor that covers it.
+    // The painter is clipped to the tile, which cuts away the rest of the ancestor.
+    const double sourcePixelWidth = tileScreenPlacement.pixelWidth * tileScreenPlacement.sourceScale;
     QTransform geometryTransform;
+    geometryTransform.translate(
+        -tileScreenPlacement.sourceOffset.x() * tileScreenPlacement.pixelWidth,
+        -tileScreenPlacement.sourceOffset.y() * tileScreenPlacement.pixelWidth);
     geometryTransform.scale(
-        tileScreenPlacement.pixelWidth,
-        tileScreenPlacement.pixelWidth);
+        sourcePixelWidth,
+        sourcePixelWidth);
+    // Simplified geometry is picked by the size the tile ends up at on the device.
+    const double tileDevicePixelSize = sourcePixelWidth * painter.device()->devicePixelRatioF();
+
+    // Features outside of the part of the tile that is drawn are skipped.
+    QTransform tileUnitTransform = geometryTransform;
+    tileUnitTransform.scale(1 / 4096.0, 1 / 4096.0);
+    const QRectF visibleTileRect = calcVisibleTileRect(painter, tileUnitTransform);
 
     // We start by iterating over each layer style, it determines the order
     // at which we draw the elements of the map.
@@ -564,27 +925,35 @@ static void paintVectorTile(
         if (abstractLayerStyle->type() == AbstractLayerStyle::LayerType::fill) {
             if (!settings.drawFill)
                 continue;
+            BACH_TRACE_SCOPE("paintVectorTile::fill");
             paintVectorLayer_Fill(
                 painter,
                 *static_cast<const FillLayerStyle*>(abstractLayerStyle),
                 layer,
                 vpZoom,
                 mapZoom,
-                geometryTransform);
+                geometryTransform,
+                tileDevicePixelSize,
+                visibleTileRect,
+                settings.minFeaturePixelSize);
 
         } else if (abstractLayerStyle->type() == AbstractLayerStyle::LayerType::line) {
             if (!settings.drawLines)
                 continue;
+            BACH_TRACE_SCOPE("paintVectorTile::line");
             paintVectorLayer_Line(
                 painter,
                 *static_cast<const LineLayerStyle*>(abstractLayerStyle),
                 layer,
                 vpZoom,
                 mapZoom,
-                geometryTransform);
+                geometryTransform,
+                tileDevicePixelSize,
+                visibleTileRect);
         } else if(abstractLayerStyle->type() == AbstractLayerStyle::LayerType::symbol){
             if (!settings.drawText)
                 continue;
+            BACH_TRACE_SCOPE("paintVectorTile::symbol");
             processVectorLayer_Point(
                 painter,
                 *static_cast<const SymbolLayerStyle*>(abstractLayerStyle),
@@ -594,15 +963,548 @@ static void paintVectorTile(
                 tileScreenPlacement.pixelWidth,
                 tileScreenPlacement.pixelPosX,
                 tileScreenPlacement.pixelPosY,
+                tileScreenPlacement.sourceScale,
+                tileScreenPlacement.sourceOffset,
                 geometryTransform,
                 settings.forceNoChangeFontType,
-                labelRects,
+                labelCollisions,
                 vpTextList,
                 vpCurvedTextList);
         }
     }
 }
 
+/*!
+ * \internal
+ * \brief fillAndLineStylesUseViewportZoom
+ * Checks whether any fill or line layer style reads the viewport zoom level.
+ *
+ * The output of such layers changes while zooming within a single map zoom level,
+ * so their tiles can not be reused from the TileBitmapCache.
+ */
+static bool fillAndLineStylesUseViewportZoom(const StyleSheet &styleSheet)
+{
+    for (const std::unique_ptr<AbstractLayerStyle> &abstractLayerStylePtr : styleSheet.m_layerStyles) {
+        const AbstractLayerStyle *abstractLayerStyle = abstractLayerStylePtr.get();
+        if (abstractLayerStyle->type() == AbstractLayerStyle::LayerType::fill) {
+            const auto &layerStyle = *static_cast<const FillLayerStyle*>(abstractLayerStyle);
+            if (layerStyle.m_compiledFilter.usesViewportZoom() ||
+                layerStyle.getFillColorExpression().usesViewportZoom() ||
+                layerStyle.getFillOpacityExpression().usesViewportZoom())
+                return true;
+        } else if (abstractLayerStyle->type() == AbstractLayerStyle::LayerType::line) {
+            const auto &layerStyle = *static_cast<const LineLayerStyle*>(abstractLayerStyle);
+            if (layerStyle.m_compiledFilter.usesViewportZoom() ||
+                layerStyle.getLineColorExpression().usesViewportZoom() ||
+                layerStyle.getLineOpacityExpression().usesViewportZoom() ||
+                layerStyle.getLineWidthExpression().usesViewportZoom())
+                return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \internal
+ * \brief rasterizeVectorTile
+ * Paints the fill and line layers of a single tile into a transparent image.
+ *
+ * \param tileData The vector-data for this tile.
+ * \param mapZoom The map zoom level being rendered.
+ * \param vpZoom The zoom level of the viewport.
+ * \param styleSheet
+ * \param pixelSize The width and height of the image in device independent pixels.
+ * \param devicePixelRatio The device pixel ratio of the image.
+ * \param renderHints The render hints to paint the image with.
+ * \param settings Text rendering is ignored, everything else is applied.
+ * \param sourcePlacement Only the part of the tile-data to draw is used, see TileScreenPlacement.
+ * \return The rasterized tile.
+ */
+static QImage rasterizeVectorTile(
+    const VectorTile &tileData,
+    int mapZoom,
+    double vpZoom,
+    const StyleSheet &styleSheet,
+    int pixelSize,
+    qreal devicePixelRatio,
+    QPainter::RenderHints renderHints,
+    const Bach::PaintVectorTileSettings &settings,
+    const TileScreenPlacement &sourcePlacement)
+{
+    QImage image(QSize(pixelSize, pixelSize) * devicePixelRatio, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(devicePixelRatio);
+    image.fill(Qt::transparent);
+
+    QPainter tilePainter(&image);
+    tilePainter.setRenderHints(renderHints);
+    tilePainter.setClipRect(QRect{ 0, 0, pixelSize, pixelSize });
+
+    // Text is placed globally across tiles, so it can never be part of the image.
+    Bach::PaintVectorTileSettings rasterSettings = settings;
+    rasterSettings.drawText = false;
+
+    TileScreenPlacement tilePlacement;
+    tilePlacement.pixelPosX = 0;
+    tilePlacement.pixelPosY = 0;
+    tilePlacement.pixelWidth = pixelSize;
+    tilePlacement.sourceScale = sourcePlacement.sourceScale;
+    tilePlacement.sourceOffset = sourcePlacement.sourceOffset;
+
+    Bach::LabelCollisionIndex unusedLabelCollisions;
+    QVector<Bach::vpGlobalText> unusedTextList;
+    QVector<Bach::vpGlobalCurvedText> unusedCurvedTextList;
+    paintVectorTile(
+        tileData,
+        tilePainter,
+        mapZoom,
+        vpZoom,
+        styleSheet,
+        tilePlacement,
+        rasterSettings,
+        unusedLabelCollisions,
+        unusedTextList,
+        unusedCurvedTextList);
+    return image;
+}
+
+/*!
+ * \internal
+ * \brief calcVisibleTilePlacements
+ * Calculates the set of visible tiles and where each of them is placed on-screen.
+ *
+ * \param vpWidth The width of the viewport in pixels.
+ * \param vpHeight The height of the viewport in pixels.
+ * \param vpX center-coordinate X of the viewport in world-normalized coordinates.
+ * \param vpY center-coordinate Y of the viewport in world-normalized coordinates.
+ * \param vpZoom Zoom level of the viewport.
+ * \param mapZoom Zoom level of the map.
+ * \param overzoomMap If set, the tiles in it are placed to draw the part of
+ * their ancestor that covers them, see RequestTilesResult::overzoomMap().
+ * \param frameScratch If set, the list is taken from its arena and only lives until the next frame.
+ * \return The visible tiles, along with their placement.
+ */
+static TilePlacementList calcVisibleTilePlacements(
+    int vpWidth,
+    int vpHeight,
+    double vpX,
+    double vpY,
+    double vpZoom,
+    int mapZoom,
+    const QMap<TileCoord, TileCoord> *overzoomMap = nullptr,
+    Bach::RenderFrameScratch *frameScratch = nullptr)
+{
+    TilePosCalculator tilePosCalc = TilePosCalculator::create(
+        vpWidth,
+        vpHeight,
+        vpX,
+        vpY,
+        vpZoom,
+        mapZoom);
+
+    // Aspect ratio of the viewport.
+    double vpAspect = (double)vpWidth / (double)vpHeight;
+    // Calculate the set of visible tiles that fit in the viewport.
+    QVector<TileCoord> localVisibleTiles;
+    QVector<TileCoord> &visibleTiles = frameScratch != nullptr ? frameScratch->visibleTiles : localVisibleTiles;
+    Bach::calcVisibleTiles(
+        vpX,
+        vpY,
+        vpAspect,
+        vpZoom,
+        mapZoom,
+        visibleTiles);
+
+    TilePlacementList out { TilePlacementList::allocator_type{
+        frameScratch != nullptr ? &frameScratch->arena : nullptr } };
+    out.reserve(visibleTiles.size());
+    for (TileCoord tileCoord : visibleTiles) {
+        TileScreenPlacement tilePlacement = tilePosCalc.calcTileSizeData(tileCoord);
+        if (overzoomMap != nullptr) {
+            auto ancestorIt = overzoomMap->find(tileCoord);
+            if (ancestorIt != overzoomMap->end())
+                tilePlacement = placeOnAncestor(tilePlacement, tileCoord, *ancestorIt);
+        }
+        out.push_back({ tileCoord, tilePlacement });
+    }
+    return out;
+}
+
+/*!
+ * \internal
+ * \brief tileScreenRect
+ * \return The smallest rect of whole pixels that covers the tile on screen.
+ */
+static QRect tileScreenRect(const TileScreenPlacement &tilePlacement)
+{
+    return QRectF{
+        tilePlacement.pixelPosX,
+        tilePlacement.pixelPosY,
+        tilePlacement.pixelWidth,
+        tilePlacement.pixelWidth }.toAlignedRect();
+}
+
+/*!
+ * \internal
+ * \brief isTileInPaintRegion
+ * \param paintRegion The region being painted, or null if the whole viewport is painted.
+ * \return Returns true if any part of the tile lies within the region.
+ */
+static bool isTileInPaintRegion(const TileScreenPlacement &tilePlacement, const QRegion *paintRegion)
+{
+    return paintRegion == nullptr || paintRegion->intersects(tileScreenRect(tilePlacement));
+}
+
+/*!
+ * \brief Bach::calcTileScreenRects
+ * Calculates where each visible tile ends up on screen.
+ *
+ * Useful for repainting only the part of the viewport covered by a tile,
+ * for example when its tile-data has just been loaded.
+ *
+ * \param vpWidth The width of the viewport in pixels.
+ * \param vpHeight The height of the viewport in pixels.
+ * \param vpX center-coordinate X of the viewport in world-normalized coordinates.
+ * \param vpY center-coordinate Y of the viewport in world-normalized coordinates.
+ * \param vpZoom Zoom level of the viewport.
+ * \param mapZoom Zoom level of the map.
+ * \return The smallest rect of whole pixels that covers each visible tile.
+ */
+QMap<TileCoord, QRect> Bach::calcTileScreenRects(
+    int vpWidth,
+    int vpHeight,
+    double vpX,
+    double vpY,
+    double vpZoom,
+    int mapZoom)
+{
+    QMap<TileCoord, QRect> out;
+    const auto tilePlacements = calcVisibleTilePlacements(
+        vpWidth,
+        vpHeight,
+        vpX,
+        vpY,
+        vpZoom,
+        mapZoom);
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements)
+        out.insert(tileCoord, tileScreenRect(tilePlacement));
+    return out;
+}
+
+/*!
+ * \internal
+ * \brief renderThreadPool
+ * The pool that tiles are rasterized on when
+ * PaintVectorTileSettings::rasterizeTilesInParallel is set.
+ *
+ * It is kept apart from the TileLoader's pool so that rasterizing a frame
+ * never has to wait behind network and parsing jobs.
+ */
+static QThreadPool& renderThreadPool()
+{
+    static QThreadPool pool;
+    return pool;
+}
+
+/*!
+ * \internal
+ * \brief rasterizeVisibleTiles
+ * Rasterizes the fill and line layers of every visible tile that has tile-data.
+ *
+ * Tiles found in the TileBitmapCache are reused, the rest are rasterized
+ * and inserted into the cache. If PaintVectorTileSettings::rasterizeTilesInParallel
+ * is set, the tiles are rasterized on the render thread pool and this function
+ * waits for all of them to finish.
+ *
+ * \param painter The painter the images will later be drawn into.
+ * Used for the viewport size, device pixel ratio and render hints.
+ * \param tileBitmapCache The cache to reuse images from. May be null.
+ * \param paintRegion If set, tiles outside this region are not rasterized.
+ * \param overzoomMap If set, the tiles in it are drawn from the part of their ancestor that covers them.
+ * \return The rasterized image of each visible tile.
+ */
+static QMap<TileCoord, QImage> rasterizeVisibleTiles(
+    const QPainter &painter,
+    double vpX,
+    double vpY,
+    double vpZoom,
+    int mapZoom,
+    const QMap<TileCoord, const VectorTile*> &tileContainer,
+    const StyleSheet &styleSheet,
+    const Bach::PaintVectorTileSettings &settings,
+    Bach::TileBitmapCache *tileBitmapCache,
+    const QRegion *paintRegion,
+    const QMap<TileCoord, TileCoord> *overzoomMap)
+{
+    struct RasterJob {
+        Bach::TileBitmapCache::Key key;
+        const VectorTile *tileData = nullptr;
+        TileScreenPlacement placement;
+        QImage image;
+    };
+
+    qreal devicePixelRatio = painter.device()->devicePixelRatioF();
+    const QPainter::RenderHints renderHints = painter.renderHints();
+    const int vpWidth = painter.window().width();
+    const int vpHeight = painter.window().height();
+
+    // Zoom previews are rasterized at the viewport zoom where the tiles have their
+    // nominal size, so every frame of a zoom gesture reuses the same images.
+    double rasterVpZoom = vpZoom;
+    if (settings.zoomPreviewResolution.has_value()) {
+        rasterVpZoom = Bach::calcViewportZoomForMapZoom(vpWidth, vpHeight, mapZoom);
+        devicePixelRatio *= std::clamp(*settings.zoomPreviewResolution, 0.1, 1.0);
+    }
+
+    QMap<TileCoord, QImage> out;
+    std::vector<RasterJob> jobs;
+    const auto tilePlacements = calcVisibleTilePlacements(
+        vpWidth,
+        vpHeight,
+        vpX,
+        vpY,
+        vpZoom,
+        mapZoom,
+        overzoomMap);
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements) {
+        auto tileIt = tileContainer.find(tileCoord);
+        if (tileIt == tileContainer.end() || !isTileInPaintRegion(tilePlacement, paintRegion))
+            continue;
+
+        RasterJob job;
+        job.key.coord = tileCoord;
+        if (settings.zoomPreviewResolution.has_value()) {
+            job.key.pixelSize = Bach::defaultDesiredTileSizePixels;
+            job.key.vpZoom = rasterVpZoom;
+        } else {
+            job.key.pixelSize = qCeil(tilePlacement.pixelWidth);
+        }
+        job.key.devicePixelRatio = devicePixelRatio;
+        job.key.drawFill = settings.drawFill;
+        job.key.drawLines = settings.drawLines;
+        job.key.styleSheetId = styleSheet.uniqueId();
+        job.tileData = *tileIt;
+        job.key.tileDataId = job.tileData->uniqueId();
+        job.placement = tilePlacement;
+
+        // A partially parsed tile is replaced by the complete tile under the same key.
+        if (tileBitmapCache != nullptr && !job.tileData->m_partial) {
+            if (std::optional<QImage> image = tileBitmapCache->find(job.key)) {
+                out.insert(tileCoord, *image);
+                continue;
+            }
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    auto runJob = [&](RasterJob &job) {
+        job.image = rasterizeVectorTile(
+            *job.tileData,
+            mapZoom,
+            rasterVpZoom,
+            styleSheet,
+            job.key.pixelSize,
+            job.key.devicePixelRatio,
+            renderHints,
+            settings,
+            job.placement);
+    };
+
+    if (settings.rasterizeTilesInParallel && jobs.size() > 1) {
+        QSemaphore finishedJobs;
+        for (RasterJob &job : jobs) {
+            renderThreadPool().start([&]() {
+                runJob(job);
+                finishedJobs.release();
+            });
+        }
+        finishedJobs.acquire((int)jobs.size());
+    } else {
+        for (RasterJob &job : jobs)
+            runJob(job);
+    }
+
+    for (RasterJob &job : jobs) {
+        if (tileBitmapCache != nullptr && !job.tileData->m_partial)
+            tileBitmapCache->insert(job.key, job.image);
+        out.insert(job.key.coord, std::move(job.image));
+    }
+    return out;
+}
+
+/*!
+ * \internal
+ * \brief updateLabelPlacement
+ * Places the labels of the visible tiles, reusing the labels kept in the LabelPlacementState.
+ *
+ * Tiles that are still visible keep their labels as they are, unless their tile-data was replaced.
+ * Tiles that have become visible place their labels around the kept ones, and tiles that are no
+ * longer visible are dropped.
+ * If the map zoom, tile size, style sheet or font settings changed, every tile is placed again.
+ *
+ * With a paint region, only the tiles inside it place new labels. The rest keep what they had
+ * and place theirs once they are painted. Whatever ends up outdated outside the region is added
+ * to LabelPlacementState::pendingRepaint.
+ *
+ * \param painter The painter that the text will be painted into.
+ * \param settings Only the text related settings are used.
+ * \param state The labels placed during previous frames. Updated to hold this frame's labels.
+ * \param paintRegion The region being painted, or null if the whole viewport is painted.
+ * \param vpTextList Filled with the texts of every visible tile.
+ * \param vpCurvedTextList Filled with the curved texts of every visible tile.
+ * \param overzoomMap If set, the tiles in it place the labels of the part of their ancestor that covers them.
+ * \param frameScratch Provides the temporary buffers of the frame.
+ */
+static void updateLabelPlacement(
+    QPainter &painter,
+    double vpX,
+    double vpY,
+    double vpZoom,
+    int mapZoom,
+    const QMap<TileCoord, const VectorTile*> &tileContainer,
+    const StyleSheet &styleSheet,
+    const Bach::PaintVectorTileSettings &settings,
+    Bach::LabelPlacementState &state,
+    const QRegion *paintRegion,
+    QVector<Bach::vpGlobalText> &vpTextList,
+    QVector<Bach::vpGlobalCurvedText> &vpCurvedTextList,
+    const QMap<TileCoord, TileCoord> *overzoomMap,
+    Bach::RenderFrameScratch &frameScratch)
+{
+    BACH_TRACE_SCOPE("updateLabelPlacement");
+    const auto tilePlacements = calcVisibleTilePlacements(
+        painter.window().width(),
+        painter.window().height(),
+        vpX,
+        vpY,
+        vpZoom,
+        mapZoom,
+        overzoomMap,
+        &frameScratch);
+    if (tilePlacements.empty())
+        return;
+
+    // Anything but a pan invalidates every placed label.
+    const double tilePixelWidth = tilePlacements.front().second.pixelWidth;
+    if (state.mapZoom != mapZoom ||
+        state.tilePixelWidth != tilePixelWidth ||
+        state.styleSheetId != styleSheet.uniqueId() ||
+        state.forceNoChangeFontType != settings.forceNoChangeFontType)
+    {
+        // The labels still on screen outside the region are all outdated now.
+        if (paintRegion != nullptr && !state.tiles.empty())
+            state.pendingRepaint += QRegion{ painter.window() } - *paintRegion;
+        state.tiles.clear();
+        state.mapZoom = mapZoom;
+        state.tilePixelWidth = tilePixelWidth;
+        state.styleSheetId = styleSheet.uniqueId();
+        state.forceNoChangeFontType = settings.forceNoChangeFontType;
+    }
+
+    auto tileOrigin = [](const TileScreenPlacement &tilePlacement) {
+        return QPoint{ (int)tilePlacement.pixelPosX, (int)tilePlacement.pixelPosY };
+    };
+
+    // Drop the tiles that scrolled out, or whose tile-data is no longer available.
+    // The labels of partially parsed tiles are placed again every frame, until the complete tile arrives,
+    // and so are the labels of a tile whose tile-data was replaced since they were placed.
+    using VisibleTileMap = std::map<
+        TileCoord,
+        TileScreenPlacement,
+        std::less<TileCoord>,
+        Bach::FrameArenaAllocator<std::pair<const TileCoord, TileScreenPlacement>>>;
+    VisibleTileMap visibleTiles { VisibleTileMap::allocator_type{ &frameScratch.arena } };
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements) {
+        if (tileContainer.contains(tileCoord))
+            visibleTiles.insert({ tileCoord, tilePlacement });
+    }
+    for (auto it = state.tiles.begin(); it != state.tiles.end();) {
+        auto visibleIt = visibleTiles.find(it->first);
+        if (visibleIt == visibleTiles.end()) {
+            it = state.tiles.erase(it);
+            continue;
+        }
+        const VectorTile &tileData = **tileContainer.find(it->first);
+        const bool tileDataReplaced = it->second.tileDataId != tileData.uniqueId();
+        if (it->second.fromPartialTile || tileDataReplaced) {
+            // The old labels of a replaced tile that reach past the paint region are outdated there too.
+            if (paintRegion != nullptr && tileDataReplaced && !it->second.fromPartialTile) {
+                const QPoint origin = tileOrigin(visibleIt->second);
+                for (const QRect &box : it->second.collisionBoxes)
+                    state.pendingRepaint += QRegion{ box.translated(origin) } - *paintRegion;
+            }
+            it = state.tiles.erase(it);
+            continue;
+        }
+        it++;
+    }
+
+    // The kept labels are the obstacles for the labels of the new tiles.
+    Bach::LabelCollisionIndex &labelCollisions = frameScratch.labelCollisions;
+    labelCollisions.reset();
+    for (const auto &[tileCoord, tileLabels] : state.tiles) {
+        const QPoint origin = tileOrigin(visibleTiles.at(tileCoord));
+        for (const QRect &box : tileLabels.collisionBoxes)
+            labelCollisions.insert(box.translated(origin));
+    }
+
+    Bach::PaintVectorTileSettings textSettings = settings;
+    textSettings.drawFill = false;
+    textSettings.drawLines = false;
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements) {
+        if (visibleTiles.find(tileCoord) == visibleTiles.end() || state.tiles.count(tileCoord) != 0)
+            continue;
+        if (!isTileInPaintRegion(tilePlacement, paintRegion))
+            continue;
+
+        const QPoint origin = tileOrigin(tilePlacement);
+        const int boxesBefore = labelCollisions.boxes().size();
+        const VectorTile &tileData = **tileContainer.find(tileCoord);
+        Bach::LabelPlacementState::TileLabels tileLabels;
+        tileLabels.fromPartialTile = tileData.m_partial;
+        tileLabels.tileDataId = tileData.uniqueId();
+
+        painter.save();
+        painter.translate(tilePlacement.pixelPosX, tilePlacement.pixelPosY);
+        paintVectorTile(
+            tileData,
+            painter,
+            mapZoom,
+            vpZoom,
+            styleSheet,
+            tilePlacement,
+            textSettings,
+            labelCollisions,
+            tileLabels.texts,
+            tileLabels.curvedTexts);
+        painter.restore();
+
+        for (int i = boxesBefore; i < labelCollisions.boxes().size(); i++) {
+            const QRect &box = labelCollisions.boxes()[i];
+            tileLabels.collisionBoxes.append(box.translated(-origin));
+            if (paintRegion != nullptr && !paintRegion->contains(box))
+                state.pendingRepaint += QRegion{ box } - *paintRegion;
+        }
+        state.tiles.insert({ tileCoord, std::move(tileLabels) });
+    }
+
+    // Hand out the labels of every visible tile, moved to where the tile is this frame.
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements) {
+        auto labelsIt = state.tiles.find(tileCoord);
+        if (labelsIt == state.tiles.end())
+            continue;
+
+        const QPoint origin = tileOrigin(tilePlacement);
+        for (Bach::vpGlobalText text : labelsIt->second.texts) {
+            text.tileOrigin = origin;
+            vpTextList.append(std::move(text));
+        }
+        for (Bach::vpGlobalCurvedText text : labelsIt->second.curvedTexts) {
+            text.tileOrigin = origin;
+            vpCurvedTextList.append(std::move(text));
+        }
+    }
+}
+
 /*!
  * \brief drawBackgroundColor
  * Draws the background color of the stylesheet to the Painter object.
@@ -647,6 +1549,75 @@ static void drawBackgroundColor(
     }
 }
 
+/*!
+ * \internal
+ * \brief paintFallbackTiles
+ * Paints loaded tiles of other zoom levels in place of a tile that has no tile-data yet.
+ *
+ * The closest available ancestor is scaled up to cover the tile, and any available
+ * children one zoom level down are drawn on top of it, each in its own quarter.
+ * The painter is expected to be translated and clipped to the missing tile.
+ *
+ * \param hasTileFn Tells whether tile-data is available for a tile.
+ * \param paintTileFn Paints a single tile at the origin of the painter, with the given placement.
+ */
+template<class HasTileFn, class PaintTileFn>
+static void paintFallbackTiles(
+    QPainter &painter,
+    TileCoord tileCoord,
+    TileScreenPlacement tilePlacement,
+    const HasTileFn &hasTileFn,
+    const PaintTileFn &paintTileFn)
+{
+    std::array<TileCoord, 4> children;
+    int childCount = 0;
+    for (int i = 0; i < 4; i++) {
+        const TileCoord child { tileCoord.zoom + 1, tileCoord.x * 2 + i % 2, tileCoord.y * 2 + i / 2 };
+        if (hasTileFn(child))
+            children[childCount++] = child;
+    }
+
+    // There is no need for an ancestor if the children cover the whole tile.
+    if (childCount < 4) {
+        for (int levelsUp = 1; levelsUp <= tileCoord.zoom; levelsUp++) {
+            const TileCoord ancestor { tileCoord.zoom - levelsUp, tileCoord.x >> levelsUp, tileCoord.y >> levelsUp };
+            if (!hasTileFn(ancestor))
+                continue;
+
+            // Move the ancestor so that the part covering our tile lands on our tile.
+            const int scale = 1 << levelsUp;
+            TileScreenPlacement ancestorPlacement = tilePlacement;
+            ancestorPlacement.pixelWidth = tilePlacement.pixelWidth * scale;
+            ancestorPlacement.sourceScale = 1;
+            ancestorPlacement.sourceOffset = {};
+            painter.save();
+            painter.translate(
+                -(tileCoord.x - ancestor.x * scale) * tilePlacement.pixelWidth,
+                -(tileCoord.y - ancestor.y * scale) * tilePlacement.pixelWidth);
+            paintTileFn(ancestor, ancestorPlacement);
+            painter.restore();
+            break;
+        }
+    }
+
+    for (int i = 0; i < childCount; i++) {
+        const TileCoord child = children[i];
+        TileScreenPlacement childPlacement = tilePlacement;
+        childPlacement.pixelWidth = tilePlacement.pixelWidth / 2;
+        childPlacement.sourceScale = 1;
+        childPlacement.sourceOffset = {};
+        painter.save();
+        painter.translate(
+            (child.x % 2) * childPlacement.pixelWidth,
+            (child.y % 2) * childPlacement.pixelWidth);
+        painter.setClipRect(
+            QRectF{ 0, 0, childPlacement.pixelWidth, childPlacement.pixelWidth },
+            Qt::IntersectClip);
+        paintTileFn(child, childPlacement);
+        painter.restore();
+    }
+}
+
 /*!
  * \internal
  * \brief A helper class for painting vector-tiles and raster-tiles while reusing code.
@@ -660,47 +1631,56 @@ static void drawBackgroundColor(
  * \param vpY center-coordinate Y of the viewport in world-normalized coordinates.
  * \param vpZoom Zoom level of the viewport.
  * \param mapZoom Zoom level of the map.
- * \param paintSingleTileFn The function to call to draw a single tile.
+ * \param hasTileFn Tells whether tile-data is available for a tile.
+ * \param paintSingleTileFn The function to call to draw a single visible tile.
+ * \param paintFallbackTileFn The function to call to draw a tile of another zoom level,
+ * in place of a visible tile that has no tile-data.
+ * \param paintRegion If set, only this region is painted, and tiles outside it are skipped.
+ * \param overzoomMap If set, the tiles in it are placed to draw the part of their ancestor that covers them.
+ * \param frameScratch If set, provides the temporary buffers of the frame.
  */
+template<class HasTileFn, class PaintSingleTileFn, class PaintFallbackTileFn>
 static void paintTilesGeneric(
     QPainter &painter,
     double vpX,
     double vpY,
     double vpZoom,
     int mapZoom,
-    const std::function<void(TileCoord, TileScreenPlacement)> &paintSingleTileFn,
+    const HasTileFn &hasTileFn,
+    const PaintSingleTileFn &paintSingleTileFn,
+    const PaintFallbackTileFn &paintFallbackTileFn,
     const StyleSheet &styleSheet,
-    bool drawDebug)
+    bool drawDebug,
+    const QRegion *paintRegion,
+    const QMap<TileCoord, TileCoord> *overzoomMap = nullptr,
+    Bach::RenderFrameScratch *frameScratch = nullptr)
 {
-    // Start by drawing the background color on the entire canvas.
+    // Start by drawing the background color on the entire canvas,
+    // or just the part of it that is being painted.
+    painter.save();
+    if (paintRegion != nullptr)
+        painter.setClipRegion(*paintRegion, Qt::IntersectClip);
     drawBackgroundColor(painter, styleSheet, mapZoom);
+    painter.restore();
 
     // Gather viewport width and height, in pixels.
     int vpWidth = painter.window().width();
     int vpHeight = painter.window().height();
 
-    TilePosCalculator tilePosCalc = TilePosCalculator::create(
+    // Iterate over all possible tiles that can possibly fit in this viewport.
+    const auto tilePlacements = calcVisibleTilePlacements(
         vpWidth,
         vpHeight,
         vpX,
         vpY,
         vpZoom,
-        mapZoom);
-
-    // Aspect ratio of the viewport.
-    double vpAspect = (double)vpWidth / (double)vpHeight;
-    // Calculate the set of visible tiles that fit in the viewport.
-    QVector<TileCoord> visibleTiles = Bach::calcVisibleTiles(
-        vpX,
-        vpY,
-        vpAspect,
-        vpZoom,
-        mapZoom);
-
-    // Iterate over all possible tiles that can possibly fit in this viewport.
-
-    for (TileCoord tileCoord : visibleTiles) {
-        TileScreenPlacement tilePlacement = tilePosCalc.calcTileSizeData(tileCoord);
+        mapZoom,
+        overzoomMap,
+        frameScratch);
+    for (const auto &[tileCoord, tilePlacement] : tilePlacements) {
+        // Tiles outside the paint region would be clipped away entirely.
+        if (!isTileInPaintRegion(tilePlacement, paintRegion))
+            continue;
 
         painter.save();
 
@@ -717,8 +1697,11 @@ static void paintTilesGeneric(
             tilePlacement.pixelWidth,
             tilePlacement.pixelWidth });
 
-        // Draw the single tile.
-        paintSingleTileFn(tileCoord, tilePlacement);
+        // Draw the single tile, or whatever we have of it while it is loading.
+        if (hasTileFn(tileCoord))
+            paintSingleTileFn(tileCoord, tilePlacement);
+        else
+            paintFallbackTiles(painter, tileCoord, tilePlacement, hasTileFn, paintFallbackTileFn);
 
         // Paint debug lines around the tile.
         if (drawDebug) {
@@ -743,8 +1726,35 @@ static void paintTilesGeneric(
  * \param viewportZoomLevel
  * \param mapZoomLevel
  * \param tileContainer contains all the tile-data available at this point in time.
+ * A visible tile without tile-data is drawn from the closest ancestor and the children
+ * found in this container, such as those of RequestTilesResult::fallbackVectorMap().
  * \param styleSheet contains layer styling data.
  * \param drawDebug determines if debug lines should be drawn or not.
+ * \param tileBitmapCache If set, the fill and line layers of each tile are rasterized
+ * into this cache and reused on later calls, for example while panning.
+ * Text is still placed and painted on top every call.
+ *
+ * If PaintVectorTileSettings::rasterizeTilesInParallel is set, the fill and line layers
+ * of the visible tiles are rasterized on worker threads before being composited here.
+ * The text placement pass always runs on the calling thread.
+ *
+ * If PaintVectorTileSettings::zoomPreviewResolution is set, the fill and line layers
+ * are rasterized once per map zoom level and scaled to the viewport zoom. Pass a
+ * tileBitmapCache along with it, or the images are rasterized again every call.
+ *
+ * \param labelPlacement If set, labels placed during previous calls are kept in place
+ * while only panning, and only tiles that scroll in place new labels.
+ * \param paintRegion If set, only the tiles that intersect this region are painted,
+ * such as the QPaintEvent::region() of a partial repaint. Without a labelPlacement
+ * every tile still takes part in placing the labels.
+ * \param overzoomMap If set, the tiles in it are above the zoom levels of the tile source.
+ * They are drawn from the part of their ancestor that covers them, including labels,
+ * see RequestTilesResult::overzoomMap(). The ancestor has to be in the tileContainer.
+ * \param frameScratch If set, the temporary buffers of the call are kept in it, so that
+ * the next call reuses their memory instead of allocating them again. Keep one per viewport.
+ * \param rasterPlaceholders If set, the visible tiles without tile-data, or with tile-data
+ * that is still being parsed, are drawn from the raster image of the tile found in it,
+ * such as those of RequestTilesResult::rasterImageMap(). See VectorTile::m_partial.
  */
 void Bach::paintVectorTiles(
     QPainter &painter,
@@ -755,18 +1765,147 @@ void Bach::paintVectorTiles(
     const QMap<TileCoord, const VectorTile*> &tileContainer,
     const StyleSheet &styleSheet,
     const PaintVectorTileSettings &settings,
-    bool drawDebug)
+    bool drawDebug,
+    TileBitmapCache *tileBitmapCache,
+    LabelPlacementState *labelPlacement,
+    const QRegion *paintRegion,
+    const QMap<TileCoord, TileCoord> *overzoomMap,
+    RenderFrameScratch *frameScratch,
+    const QMap<TileCoord, const QImage*> *rasterPlaceholders)
 {
-    QVector<QRect> labelRects;
-    QVector<Bach::vpGlobalText> vpTextList;
-    QVector<Bach::vpGlobalCurvedText> vpCurvedTextList;
+    BACH_TRACE_SCOPE("paintVectorTiles");
+    std::optional<RenderFrameScratch> localScratch;
+    if (frameScratch == nullptr)
+        frameScratch = &localScratch.emplace();
+    frameScratch->beginFrame();
+
+    // Overzoomed tiles are handled like any other tile, with the tile-data of their ancestor.
+    QMap<TileCoord, const VectorTile*> adjustedTileContainer;
+    bool useAdjustedTileContainer = false;
+    if (overzoomMap != nullptr && !overzoomMap->isEmpty()) {
+        adjustedTileContainer = tileContainer;
+        useAdjustedTileContainer = true;
+        for (auto it = overzoomMap->cbegin(); it != overzoomMap->cend(); it++) {
+            auto ancestorIt = tileContainer.find(it.value());
+            if (ancestorIt != tileContainer.end())
+                adjustedTileContainer.insert(it.key(), *ancestorIt);
+        }
+    }
+
+    // Tiles drawn from their raster image take no part in any of the vector passes.
+    QMap<TileCoord, const QImage*> placeholderImages;
+    if (rasterPlaceholders != nullptr) {
+        const QMap<TileCoord, const VectorTile*> &vectorTiles =
+            useAdjustedTileContainer ? adjustedTileContainer : tileContainer;
+        for (auto it = rasterPlaceholders->cbegin(); it != rasterPlaceholders->cend(); it++) {
+            auto tileIt = vectorTiles.find(it.key());
+            if (tileIt == vectorTiles.end() || (*tileIt)->m_partial)
+                placeholderImages.insert(it.key(), it.value());
+        }
+    }
+    if (!placeholderImages.isEmpty()) {
+        if (!useAdjustedTileContainer)
+            adjustedTileContainer = tileContainer;
+        useAdjustedTileContainer = true;
+        for (auto it = placeholderImages.cbegin(); it != placeholderImages.cend(); it++)
+            adjustedTileContainer.remove(it.key());
+    }
+    const QMap<TileCoord, const VectorTile*> &tiles =
+        useAdjustedTileContainer ? adjustedTileContainer : tileContainer;
+
+    // Returns true if the tile was drawn from its raster image.
+    auto paintPlaceholderFn = [&](TileCoord tileCoord, const TileScreenPlacement &tilePlacement) {
+        auto imageIt = placeholderImages.find(tileCoord);
+        if (imageIt == placeholderImages.end())
+            return false;
+        QRectF target {
+            0,
+            0,
+            tilePlacement.pixelWidth,
+            tilePlacement.pixelWidth, };
+        painter.drawImage(target, **imageIt);
+        return true;
+    };
+
+    // Without a persistent label placement, the labels of every visible tile
+    // are placed during the tile pass, so no tile can be skipped.
+    const QRegion *tileRegion = labelPlacement != nullptr || !settings.drawText ? paintRegion : nullptr;
+
+    Bach::LabelCollisionIndex &labelCollisions = frameScratch->labelCollisions;
+    QVector<Bach::vpGlobalText> &vpTextList = frameScratch->texts;
+    QVector<Bach::vpGlobalCurvedText> &vpCurvedTextList = frameScratch->curvedTexts;
+
+    // Fill and line layers can be rasterized into one image per tile ahead of time,
+    // either to reuse them through the bitmap cache or to paint them on worker threads.
+    // Zoom previews are always drawn from images, even when the styles depend on
+    // the viewport zoom, since they are meant to be approximate.
+    const bool zoomPreview = settings.zoomPreviewResolution.has_value();
+    const bool useTileImages =
+        (tileBitmapCache != nullptr || settings.rasterizeTilesInParallel || zoomPreview) &&
+        (settings.drawFill || settings.drawLines) &&
+        (zoomPreview || !fillAndLineStylesUseViewportZoom(styleSheet));
+    QMap<TileCoord, QImage> tileImages;
+    if (useTileImages) {
+        tileImages = rasterizeVisibleTiles(
+            painter,
+            vpX,
+            vpY,
+            viewportZoom,
+            mapZoom,
+            tiles,
+            styleSheet,
+            settings,
+            tileBitmapCache,
+            tileRegion,
+            overzoomMap);
+    }
+
+    // With a persistent label placement, the text is placed after all the tiles are painted.
+    PaintVectorTileSettings tileSettings = settings;
+    if (labelPlacement != nullptr)
+        tileSettings.drawText = false;
+
     auto paintSingleTileFn = [&](TileCoord tileCoord, TileScreenPlacement tilePlacement) {
+        if (paintPlaceholderFn(tileCoord, tilePlacement))
+            return;
+
         // See if the tile being rendered has any tile-data associated with it.
-        auto tileIt = tileContainer.find(tileCoord);
-        if (tileIt == tileContainer.end())
+        auto tileIt = tiles.find(tileCoord);
+        if (tileIt == tiles.end())
             return;
 
         const VectorTile &tileData = **tileIt;
+        if (useTileImages) {
+            auto imageIt = tileImages.find(tileCoord);
+            if (imageIt != tileImages.end()) {
+                QRectF target {
+                    0,
+                    0,
+                    tilePlacement.pixelWidth,
+                    tilePlacement.pixelWidth, };
+                painter.drawImage(target, *imageIt);
+            }
+            if (!tileSettings.drawText)
+                return;
+
+            // The text still has to go through the global collision filtering.
+            PaintVectorTileSettings textSettings = tileSettings;
+            textSettings.drawFill = false;
+            textSettings.drawLines = false;
+            paintVectorTile(
+                tileData,
+                painter,
+                mapZoom,
+                viewportZoom,
+                styleSheet,
+                tilePlacement,
+                textSettings,
+                labelCollisions,
+                vpTextList,
+                vpCurvedTextList);
+            return;
+        }
+
         paintVectorTile(
             tileData,
             painter,
@@ -774,21 +1913,71 @@ void Bach::paintVectorTiles(
             viewportZoom,
             styleSheet,
             tilePlacement,
-            settings,
-            labelRects,
+            tileSettings,
+            labelCollisions,
             vpTextList,
             vpCurvedTextList);
     };
 
+    auto hasTileFn = [&](TileCoord tileCoord) {
+        return tiles.contains(tileCoord) || placeholderImages.contains(tileCoord);
+    };
+
+    // Tiles of other zoom levels only stand in for the fill and lines,
+    // their labels would be of the wrong size and density.
+    auto paintFallbackTileFn = [&](TileCoord tileCoord, TileScreenPlacement tilePlacement) {
+        if (paintPlaceholderFn(tileCoord, tilePlacement))
+            return;
+        PaintVectorTileSettings fallbackSettings = settings;
+        fallbackSettings.drawText = false;
+        Bach::LabelCollisionIndex unusedCollisions;
+        QVector<Bach::vpGlobalText> unusedTexts;
+        QVector<Bach::vpGlobalCurvedText> unusedCurvedTexts;
+        paintVectorTile(
+            **tiles.find(tileCoord),
+            painter,
+            mapZoom,
+            viewportZoom,
+            styleSheet,
+            tilePlacement,
+            fallbackSettings,
+            unusedCollisions,
+            unusedTexts,
+            unusedCurvedTexts);
+    };
+
     paintTilesGeneric(
         painter,
         vpX,
         vpY,
         viewportZoom,
         mapZoom,
+        hasTileFn,
         paintSingleTileFn,
+        paintFallbackTileFn,
         styleSheet,
-        drawDebug);
+        drawDebug,
+        tileRegion,
+        overzoomMap,
+        frameScratch);
+
+    if (labelPlacement != nullptr && settings.drawText) {
+        updateLabelPlacement(
+            painter,
+            vpX,
+            vpY,
+            viewportZoom,
+            mapZoom,
+            tiles,
+            styleSheet,
+            settings,
+            *labelPlacement,
+            paintRegion,
+            vpTextList,
+            vpCurvedTextList,
+            overzoomMap,
+            *frameScratch);
+    }
 
     //After rendering all the other layers , we render all the text that should be currently visible on the viewport.
     paintText(painter, vpTextList, settings);
@@ -798,6 +1987,10 @@ void Bach::paintVectorTiles(
 /*!
  *  \brief paintRasterTiles
  *  Paints all tiles into a painter object, using raster-graphics.
+ *
+ *  If paintRegion is set, only the tiles that intersect it are painted.
+ *  If mipLevels is set, tiles drawn smaller than their image are drawn
+ *  from the smallest downscaled copy that is still at least as large.
  */
 void Bach::paintRasterTiles(
     QPainter &painter,
@@ -807,21 +2000,32 @@ void Bach::paintRasterTiles(
     int mapZoomLevel,
     const QMap<TileCoord, const QImage*> &tileContainer,
     const StyleSheet &styleSheet,
-    bool drawDebug)
+    bool drawDebug,
+    const QRegion *paintRegion,
+    const QMap<TileCoord, const QList<QImage>*> *mipLevels)
 {
-    auto paintSingleTileFn = [&](TileCoord tileCoord, TileScreenPlacement tilePlacement) {
-        // See if the tile being rendered has any tile-data associated with it.
-        auto tileIt = tileContainer.find(tileCoord);
-        if (tileIt == tileContainer.end())
-            return;
+    auto hasTileFn = [&](TileCoord tileCoord) { return tileContainer.contains(tileCoord); };
 
-        const QImage &tileData = **tileIt;
+    const qreal devicePixelRatio = painter.device()->devicePixelRatioF();
+    auto paintSingleTileFn = [&](TileCoord tileCoord, TileScreenPlacement tilePlacement) {
+        const QImage *tileData = *tileContainer.find(tileCoord);
+        if (mipLevels != nullptr) {
+            auto levelsIt = mipLevels->find(tileCoord);
+            if (levelsIt != mipLevels->end()) {
+                const double targetDevicePixels = tilePlacement.pixelWidth * devicePixelRatio;
+                for (const QImage &level : **levelsIt) {
+                    if (level.width() < targetDevicePixels)
+                        break;
+                    tileData = &level;
+                }
+            }
+        }
         QRectF target {
             0,
             0,
             tilePlacement.pixelWidth,
             tilePlacement.pixelWidth, };
-        painter.drawImage(target, tileData);
+        painter.drawImage(target, *tileData);
     };
 
     paintTilesGeneric(
@@ -830,7 +2034,10 @@ void Bach::paintRasterTiles(
         vpY,
         viewportZoomLevel,
         mapZoomLevel,
+        hasTileFn,
+        paintSingleTileFn,
         paintSingleTileFn,
         styleSheet,
-        drawDebug);
+        drawDebug,
+        paintRegion);
 }
@@ -5,12 +5,26 @@
 #define RENDERING_HPP
 
 // Qt header files
+#include <QImage>
+#include <QList>
 #include <QMap>
 #include <QPainter>
 #include <QPair>
+#include <QRect>
+#include <QRegion>
+
+// STL header files
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
 
 // Other header files
+#include "FrameArena.h"
+#include "LabelCollisionIndex.h"
 #include "LayerStyle.h"
+#include "TextShapeCache.h"
+#include "TileBitmapCache.h"
 #include "TileCoord.h"
 #include "VectorTiles.h"
 
@@ -42,6 +56,8 @@ namespace Bach {
         int mapZoom{};
         double vpZoom{};
         QTransform transformIn;
+        // Simplified geometry to draw instead of the feature's own, if any.
+        const QPainterPath *path = nullptr;
     };
 
     /*!
@@ -58,6 +74,8 @@ namespace Bach {
         int mapZoom{};
         double vpZoom{};
         QTransform transformIn;
+        // Simplified geometry to draw instead of the feature's own, if any.
+        const QPainterPath *path = nullptr;
     };
 
     /*!
@@ -74,6 +92,10 @@ namespace Bach {
         int mapZoom{};
         double vpZoom{};
         QTransform transformIn;
+        // For a tile drawn from a part of its ancestor, how many times larger the
+        // ancestor is, and the offset of the tile within it in units of the tile size.
+        int sourceScale = 1;
+        QPoint sourceOffset;
     };
 
     /*!
@@ -90,6 +112,8 @@ namespace Bach {
         int mapZoom{};
         double vpZoom{};
         QTransform transformIn;
+        // Simplified geometry to draw instead of the feature's own, if any.
+        const QPainterPath *path = nullptr;
     };
 
     /*!
@@ -109,6 +133,8 @@ namespace Bach {
         int outlineSize;
         QColor outlineColor;
         QRect boundingRect;
+        // The cached shape of the text, holding one layout for every string in text.
+        std::shared_ptr<const TextShapeCache::ShapedLabel> shape;
     };
 
 
@@ -123,6 +149,8 @@ namespace Bach {
         QChar character;
         QPointF position;
         qreal angle;
+        // Index of the character within the text, used to look up its cached layout.
+        int textIndex = -1;
     };
 
     /*!
@@ -140,6 +168,145 @@ namespace Bach {
         QPoint tileOrigin;
         QColor outlineColor;
         int outlineSize;
+        // The cached shape of the text, holding one layout for every character.
+        std::shared_ptr<const TextShapeCache::ShapedCurvedText> shape;
+    };
+
+    /*!
+     * \brief The TileLabelCandidates struct holds the labels a symbol layer style
+     * gives a single tile layer, before they are placed on screen.
+     *
+     * Resolving the text and style of every label and shaping it only depends on the
+     * features and the map zoom level, so it is done once per tile, ideally on the
+     * worker threads of the TileLoader, see prepareTileLabels. Only the collision
+     * checks and drawing are left for every frame. The candidates are stored in
+     * TileLayer::labelCache.
+     *
+     * The candidates only hold measurements, never QTextLayouts, so that they can be
+     * prepared on one thread and painted on another. The layouts of the labels that
+     * are placed are taken from the TextShapeCache of the painting thread.
+     */
+    struct TileLabelCandidates {
+        /*!
+         * \brief The PointLabel struct is the label of a single point feature.
+         */
+        struct PointLabel {
+            // The anchor of the label, in the units of the tile geometry.
+            QPoint anchor;
+            QString text;
+            int maxWidthEms = 0;
+            // The lines and their outlines, without layouts, see TextShapeCache::measureLabel.
+            std::shared_ptr<const TextShapeCache::ShapedLabel> shape;
+            QFont font;
+            QColor textColor;
+        };
+
+        /*!
+         * \brief The CurvedLabel struct is the label of a single line feature,
+         * drawn along the line.
+         */
+        struct CurvedLabel {
+            // The index of the line feature within the layer.
+            int featureIndex = -1;
+            QString text;
+            // The advances of the characters, without layouts, see TextShapeCache::measureCurvedText.
+            std::shared_ptr<const TextShapeCache::ShapedCurvedText> shape;
+            QFont font;
+            QColor textColor;
+            float opacity = 1;
+            float letterSpacing = 0;
+            int maxAngle = 0;
+        };
+
+        int outlineSize = 0;
+        QColor outlineColor;
+        // In the order they are placed, by increasing "rank".
+        std::vector<PointLabel> pointLabels;
+        // In the order of the features of the layer.
+        std::vector<CurvedLabel> curvedLabels;
+    };
+
+    /*!
+     * \brief The LabelPlacementState struct
+     * keeps the labels placed by paintVectorTiles from one frame to the next.
+     *
+     * While only panning, the labels of tiles that stay visible keep their slot,
+     * tiles that scroll in only have to place their own labels around them, and
+     * tiles that scroll out drop theirs. Any change to the map zoom, the on-screen
+     * tile size or the style sheet runs the full placement pass again.
+     *
+     * The members are only for internal use by paintVectorTiles.
+     */
+    struct LabelPlacementState {
+        /*!
+         * \brief The TileLabels struct holds the labels placed for a single tile.
+         * All coordinates are relative to the tile's origin.
+         */
+        struct TileLabels {
+            QVector<vpGlobalText> texts;
+            QVector<vpGlobalCurvedText> curvedTexts;
+            QVector<QRect> collisionBoxes;
+            // Set when the labels were placed for a tile that was still being parsed.
+            bool fromPartialTile = false;
+            // The tile-data the labels were placed for, see VectorTile::uniqueId.
+            // Labels of a tile that was loaded again are placed again.
+            quint64 tileDataId = 0;
+        };
+
+        int mapZoom = -1;
+        double tilePixelWidth = 0;
+        // See StyleSheet::uniqueId.
+        quint64 styleSheetId = 0;
+        bool forceNoChangeFontType = false;
+        std::map<TileCoord, TileLabels> tiles;
+
+        /*!
+         * \brief pendingRepaint is the area outside the paint region of the latest frame
+         * that now shows outdated labels, such as labels that were placed for a tile inside
+         * the region but reach past it. The caller should repaint it and clear it.
+         */
+        QRegion pendingRepaint;
+
+        /*!
+         * \brief clear forces the next frame to run the full placement pass.
+         */
+        void clear()
+        {
+            tiles.clear();
+            mapZoom = -1;
+        }
+    };
+
+    /*!
+     * \brief The RenderFrameScratch struct
+     * holds the temporary buffers of paintVectorTiles, so that they can be kept from one frame to the next.
+     *
+     * Every frame empties the buffers but keeps their memory, so once the map has been painted
+     * a few times, a frame of the same size no longer allocates for them. Short-lived lists built
+     * while painting, such as the placement of every visible tile, are taken from the arena.
+     *
+     * Can only be used by a single paintVectorTiles call at a time.
+     * The members are only for internal use by paintVectorTiles.
+     */
+    struct RenderFrameScratch {
+        FrameArena arena;
+        QVector<TileCoord> visibleTiles;
+        QVector<vpGlobalText> texts;
+        QVector<vpGlobalCurvedText> curvedTexts;
+        LabelCollisionIndex labelCollisions;
+
+        /*!
+         * \brief beginFrame empties every buffer, keeping the memory for the new frame.
+         * Anything that was taken from the arena during the previous frame is freed.
+         */
+        void beginFrame()
+        {
+            arena.reset();
+            visibleTiles.clear();
+            texts.clear();
+            curvedTexts.clear();
+            labelCollisions.reset();
+        }
     };
 
     /*!
@@ -157,30 +324,69 @@ namespace Bach {
     MapCoordinate calcViewportSizeNorm(double viewportZoom, double viewportAspect);
     double normalizeValueToZeroOneRange(double value, double min, double max);
 
+    QColor getFillColor(
+        const FillLayerStyle &layerStyle,
+        const AbstractLayerFeature &feature,
+        int mapZoom,
+        double vpZoom);
     void paintSingleTileFeature_Polygon(PaintingDetailsPolygon details);
 
+    float getLineOpacity(
+        const LineLayerStyle &layerStyle,
+        const LineFeature &feature,
+        int mapZoom,
+        double vpZoom);
+    QPen getLinePen(
+        const LineLayerStyle &layerStyle,
+        const LineFeature &feature,
+        int mapZoom,
+        double vpZoom,
+        QPen basePen);
     void paintSingleTileFeature_Line(PaintingDetailsLine details);
 
 
-    void processSingleTileFeature_Point(
-        PaintingDetailsPoint details,
-        const int tileSize,
-        const int tileOriginX,
-        const int tileOriginY,
-        const bool forceNoChangeFontType,
-        QVector<QRect> &rects,
-        QVector<vpGlobalText> &vpTextList);
-
     void paintSingleTileFeature_Point_Curved(PaintingDetailsPointCurved details);
 
-    void processSingleTileFeature_Point_Curved(
-        PaintingDetailsPointCurved details,
-        const int tileSize,
+    std::optional<TileLabelCandidates::PointLabel> prepareLabel_Point(
+        const SymbolLayerStyle &layerStyle,
+        const PointFeature &feature,
+        int mapZoom,
+        double vpZoom,
+        const QFont *forcedFont = nullptr);
+
+    std::optional<TileLabelCandidates::CurvedLabel> prepareLabel_Point_Curved(
+        const SymbolLayerStyle &layerStyle,
+        const LineFeature &feature,
+        int mapZoom,
+        double vpZoom);
+
+    void placeLabel_Point(
+        const TileLabelCandidates::PointLabel &label,
+        int outlineSize,
+        const QColor &outlineColor,
+        int sourceScale,
+        QPoint sourceOffset,
+        int tileSize,
+        int tileOriginX,
+        int tileOriginY,
+        LabelCollisionIndex &labelCollisions,
+        QVector<vpGlobalText> &vpTextList);
+
+    void placeLabel_Point_Curved(
+        const TileLabelCandidates::CurvedLabel &label,
+        const LineFeature &feature,
+        int outlineSize,
+        const QColor &outlineColor,
+        const QTransform &geometryTransform,
         int tileOriginX,
         int tileOriginY,
-        QVector<QRect> &rects,
+        LabelCollisionIndex &labelCollisions,
         QVector<vpGlobalCurvedText> &vpCurvedTextList);
 
+    bool labelsUseViewportZoom(const SymbolLayerStyle &layerStyle);
+
+    void prepareTileLabels(const VectorTile &tileData, const StyleSheet &styleSheet, int mapZoom);
+
 
     int calcMapZoomLevelForTileSizePixels(
         int vpWidth,
@@ -188,6 +394,12 @@ namespace Bach {
         double vpZoom,
         int desiredTileSize = defaultDesiredTileSizePixels);
 
+    double calcViewportZoomForMapZoom(
+        int vpWidth,
+        int vpHeight,
+        int mapZoom,
+        int desiredTileSize = defaultDesiredTileSizePixels);
+
     QVector<TileCoord> calcVisibleTiles(
         double vpX,
         double vpY,
@@ -195,6 +407,22 @@ namespace Bach {
         double vpZoomLevel,
         int mapZoomLevel);
 
+    void calcVisibleTiles(
+        double vpX,
+        double vpY,
+        double vpAspect,
+        double vpZoomLevel,
+        int mapZoomLevel,
+        QVector<TileCoord> &out);
+
+    QMap<TileCoord, QRect> calcTileScreenRects(
+        int vpWidth,
+        int vpHeight,
+        double vpX,
+        double vpY,
+        double vpZoom,
+        int mapZoom);
+
 
     /*!
      * \class Collection of settings that modify how vector tiles are rendered.
@@ -232,6 +460,35 @@ namespace Bach {
          */
         bool useQTextLayout = {};
 
+        /*!
+         * \brief
+         * Paints the fill and line layers of each visible tile into its own image
+         * on worker threads, then composites the images on the calling thread.
+         * Text placement is not affected and always runs on the calling thread.
+         */
+        bool rasterizeTilesInParallel = {};
+
+        /*!
+         * \brief
+         * If set, the fill and line layers of each tile are rasterized only once per
+         * map zoom level, as if the viewport was at calcViewportZoomForMapZoom, and the
+         * image is scaled to wherever the viewport zoom places the tile.
+         * Meant to be set while a zoom gesture is in progress, so that the tiles
+         * don't have to be rasterized again every frame.
+         *
+         * The value is the resolution of the images, as a fraction of the
+         * resolution of the display. Lower values are faster but blurrier.
+         */
+        std::optional<double> zoomPreviewResolution;
+
+        /*!
+         * \brief
+         * Fill features whose bounding box is smaller than this many pixels on screen,
+         * both horizontally and vertically, are not drawn. Zero draws every feature.
+         * Features outside the visible part of a tile are always skipped.
+         */
+        double minFeaturePixelSize = {};
+
         static PaintVectorTileSettings getDefault();
     };
 
@@ -244,7 +501,13 @@ namespace Bach {
         const QMap<TileCoord, const VectorTile*> &tileContainer,
         const StyleSheet &styleSheet,
         const PaintVectorTileSettings &settings,
-        bool drawDebug);
+        bool drawDebug,
+        TileBitmapCache *tileBitmapCache = nullptr,
+        LabelPlacementState *labelPlacement = nullptr,
+        const QRegion *paintRegion = nullptr,
+        const QMap<TileCoord, TileCoord> *overzoomMap = nullptr,
+        RenderFrameScratch *frameScratch = nullptr,
+        const QMap<TileCoord, const QImage*> *rasterPlaceholders = nullptr);
 
     void paintRasterTiles(
         QPainter &painter,
@@ -254,7 +517,9 @@ namespace Bach {
         int mapZoomLevel,
         const QMap<TileCoord, const QImage*> &tileContainer,
         const StyleSheet &styleSheet,
-        bool drawDebug);
+        bool drawDebug,
+        const QRegion *paintRegion = nullptr,
+        const QMap<TileCoord, const QList<QImage>*> *mipLevels = nullptr);
 }
 
 #endif // RENDERING_HPP
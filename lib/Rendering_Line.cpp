@@ -24,8 +24,7 @@ static QColor getLineColor(
     QVariant color = layerStyle.getLineColorAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(color.typeId() == QMetaType::Type::QJsonArray){
-        color = Evaluator::resolveExpression(
-            color.toJsonArray(),
+        color = layerStyle.getLineColorExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -34,7 +33,7 @@ static QColor getLineColor(
 }
 
 /*!
- * \brief getLineOpacity
+ * \brief Bach::getLineOpacity
  * Get the QVariant of the opcity from the layerStyle and resolve and return it if its an expression,
  * or return it as a float otherwise
  * \param layerStyle the layerStyle containing the opacity variable
@@ -43,7 +42,7 @@ static QColor getLineColor(
  * \param vpZoom the viewport zoom level to be used in case the QVariant is an expression
  * \return a float for the opacity to be used to render the line
  */
-static float getLineOpacity(
+float Bach::getLineOpacity(
     const LineLayerStyle &layerStyle,
     const LineFeature &feature,
     int mapZoom,
@@ -52,8 +51,7 @@ static float getLineOpacity(
     QVariant lineOpacity = layerStyle.getLineOpacityAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(lineOpacity.typeId() == QMetaType::Type::QJsonArray){
-        lineOpacity = Evaluator::resolveExpression(
-            lineOpacity.toJsonArray(),
+        lineOpacity = layerStyle.getLineOpacityExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -80,8 +78,7 @@ static int getLineWidth(
     QVariant lineWidth = layerStyle.getLineWidthAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(lineWidth.typeId() == QMetaType::Type::QJsonArray){
-        lineWidth = Evaluator::resolveExpression(
-            lineWidth.toJsonArray(),
+        lineWidth = layerStyle.getLineWidthExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -89,6 +86,30 @@ static int getLineWidth(
     return lineWidth.value<int>();
 }
 
+/*!
+ * \brief Bach::getLinePen
+ * Resolves the pen a line feature is drawn with.
+ * \param basePen the pen to start out from, the properties the layer style doesn't set are kept.
+ * \return the pen with the color, width, cap, join and dashes of the line.
+ */
+QPen Bach::getLinePen(
+    const LineLayerStyle &layerStyle,
+    const LineFeature &feature,
+    int mapZoom,
+    double vpZoom,
+    QPen basePen)
+{
+    QPen pen = basePen;
+    pen.setColor(getLineColor(layerStyle, feature, mapZoom, vpZoom));
+    pen.setWidth(getLineWidth(layerStyle, feature, mapZoom, vpZoom));
+    pen.setCapStyle(layerStyle.getCapStyle());
+    pen.setJoinStyle(layerStyle.getJoinStyle());
+    if(!layerStyle.m_lineDashArray.isEmpty()){
+        pen.setDashPattern(layerStyle.m_lineDashArray);
+    }
+    return pen;
+}
+
 /* Paints a single Line feature within a tile.
  *
  * Assumes the painters origin has moved to the tiles origin.
@@ -103,24 +124,15 @@ void Bach::paintSingleTileFeature_Line(Bach::PaintingDetailsLine details)
     QPainter &painter = *details.painter;
     const LineFeature &feature = *details.feature;
     const LineLayerStyle &layerStyle = *details.layerStyle;
-    QPen pen = painter.pen();
 
-    pen.setColor(getLineColor(layerStyle, feature, details.mapZoom, details.vpZoom));
     painter.setOpacity(getLineOpacity(layerStyle, feature,  details.mapZoom,  details.vpZoom));
-    pen.setWidth(getLineWidth(layerStyle, feature, details.mapZoom, details.vpZoom));
-    pen.setCapStyle(layerStyle.getCapStyle());
-    pen.setJoinStyle(layerStyle.getJoinStyle());
-    if(!layerStyle.m_lineDashArray.isEmpty()){
-        pen.setDashPattern(layerStyle.m_lineDashArray);
-    }
-
-    painter.setPen(pen);
+    painter.setPen(getLinePen(layerStyle, feature, details.mapZoom, details.vpZoom, painter.pen()));
     painter.setBrush(Qt::NoBrush);
 
     // Not sure yet how to determine AA for lines.
     painter.setRenderHints(QPainter::Antialiasing, false);
 
-    const QPainterPath &path = feature.line();
+    const QPainterPath &path = details.path != nullptr ? *details.path : feature.line();
     QTransform transform = details.transformIn;
     transform.scale(1 / 4096.0, 1 / 4096.0);
     const QPainterPath newPath = transform.map(path);
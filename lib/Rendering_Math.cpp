@@ -88,6 +88,29 @@ int Bach::calcMapZoomLevelForTileSizePixels(
     return std::clamp((int)round(newMapZoomLevel), 0, maxZoomLevel);
 }
 
+/*!
+ * \brief Bach::calcViewportZoomForMapZoom calculates the viewport zoom level at which
+ * the tiles of a map zoom level are displayed at exactly desiredTileWidth pixels.
+ *
+ * This is the counterpart of calcMapZoomLevelForTileSizePixels, and lies in the middle
+ * of the range of viewport zoom levels that map to this map zoom level.
+ *
+ * \param vpWidth is the width of the viewport in pixels.
+ * \param vpHeight is the height of the viewport in pixels.
+ * \param mapZoom is the zoom level of the map.
+ * \param desiredTileWidth is the desired size of tiles in pixels.
+ * \return the zoom level of the viewport.
+ */
+double Bach::calcViewportZoomForMapZoom(
+    int vpWidth,
+    int vpHeight,
+    int mapZoom,
+    int desiredTileWidth)
+{
+    double desiredScale = (double)desiredTileWidth / qMax(vpWidth, vpHeight);
+    return mapZoom + log2(desiredScale);
+}
+
 /* Calculates the width and height of the viewport in world-normalized coordinates.
      * This means the size expressed as a fraction of the world map. For example,
      * a viewportZoom set to 0 will return size as 1, while a zoom level of
@@ -147,6 +170,25 @@ QVector<TileCoord> Bach::calcVisibleTiles(
     double vpZoomLevel,
     int mapZoomLevel)
 {
+    QVector<TileCoord> visibleTiles;
+    calcVisibleTiles(vpX, vpY, vpAspect, vpZoomLevel, mapZoomLevel, visibleTiles);
+    return visibleTiles;
+}
+
+/*!
+ * \brief Bach::calcVisibleTiles
+ * Same as the overload returning a list, but writes the tile-coordinates into out,
+ * replacing its contents. Reusing the same list every frame avoids allocating it again.
+ */
+void Bach::calcVisibleTiles(
+    double vpX,
+    double vpY,
+    double vpAspect,
+    double vpZoomLevel,
+    int mapZoomLevel,
+    QVector<TileCoord> &out)
+{
+    out.clear();
     mapZoomLevel = qMax(0, mapZoomLevel);
 
     // We need to calculate the width and height of the viewport in terms of
@@ -179,15 +221,14 @@ QVector<TileCoord> Bach::calcVisibleTiles(
         rightTileX - leftTileX == 0 &&
         botTileY - topTileY == 0)
     {
-        return { { 0, 0, 0 } };
+        out += { 0, 0, 0 };
     } else {
-        QVector<TileCoord> visibleTiles;
+        out.reserve((botTileY - topTileY + 1) * (rightTileX - leftTileX + 1));
         for (int y = topTileY; y <= botTileY; y++) {
             for (int x = leftTileX; x <= rightTileX; x++) {
-                visibleTiles += { mapZoomLevel, x, y };
+                out += { mapZoomLevel, x, y };
             }
         }
-        return visibleTiles;
     }
 }
 
@@ -5,7 +5,7 @@
 #include "Rendering.h"
 
 /*!
- * \brief getFillColor
+ * \brief Bach::getFillColor
  * Get the QVariant of the color from the layerStyle and resolve and return it if its an expression,
  * or return it as a QColor otherwise. This function also gets the opacity of the polygon.
  * \param layerStyle the layerStyle containing the color variable.
@@ -14,7 +14,7 @@
  * \param vpZoom The viewport zoom level to be used in case the QVariant is an expression.
  * \return The QColor to be used to render the polygon.
  */
-static QColor getFillColor(
+QColor Bach::getFillColor(
     const FillLayerStyle &layerStyle,
     const AbstractLayerFeature &feature,
     int mapZoom,
@@ -24,8 +24,7 @@ static QColor getFillColor(
     QColor color;
     // The layer style might return an expression, that must be resolved.
     if (colorVariant.typeId() == QMetaType::Type::QJsonArray){
-        color = Evaluator::resolveExpression(
-                    colorVariant.toJsonArray(),
+        color = layerStyle.getFillColorExpression().evaluate(
                     &feature,
                     mapZoom,
                     vpZoom).value<QColor>();
@@ -37,8 +36,7 @@ static QColor getFillColor(
     float fillOpacity;
     // The layer style might return an expression, that must be resolved.
     if (fillOpacityVariant.typeId() == QMetaType::Type::QJsonArray){
-        fillOpacity = Evaluator::resolveExpression(
-                          fillOpacityVariant.toJsonArray(),
+        fillOpacity = layerStyle.getFillOpacityExpression().evaluate(
                           &feature,
                           mapZoom,
                           vpZoom).value<float>();
@@ -68,7 +66,7 @@ void Bach::paintSingleTileFeature_Polygon(Bach::PaintingDetailsPolygon details)
     painter.setRenderHints(QPainter::Antialiasing, layerStyle.m_antialias);
     painter.setPen(Qt::NoPen);
 
-    const QPainterPath &path = feature.polygon();
+    const QPainterPath &path = details.path != nullptr ? *details.path : feature.polygon();
 
     QTransform transform = details.transformIn;
     transform.scale(1 / 4096.0, 1 / 4096.0);
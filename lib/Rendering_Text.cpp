@@ -25,8 +25,7 @@ static QColor getTextColor(
     QVariant color = layerStyle.getTextColorAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(color.typeId() == QMetaType::Type::QJsonArray){
-        color = Evaluator::resolveExpression(
-            color.toJsonArray(),
+        color = layerStyle.getTextColorExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -54,8 +53,7 @@ static int getTextSize(
     QVariant size = layerStyle.getTextSizeAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(size.typeId() == QMetaType::Type::QJsonArray){
-        size = Evaluator::resolveExpression(
-            size.toJsonArray(),
+        size = layerStyle.getTextSizeExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -83,8 +81,7 @@ static float getTextOpacity(
     QVariant opacity = layerStyle.getTextOpacityAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(opacity.typeId() == QMetaType::Type::QJsonArray){
-        opacity = Evaluator::resolveExpression(
-            opacity.toJsonArray(),
+        opacity = layerStyle.getTextOpacityExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -115,20 +112,27 @@ static QString getTextContent(
 
     // The layer style might return an expression, we need to resolve it.
     if(textVariant.typeId() == QMetaType::Type::QJsonArray){
-        textVariant = Evaluator::resolveExpression(
-            textVariant.toJsonArray(),
-            &feature,
-            mapZoom,
-            vpZoom);
+        // Use the compiled form if the style sheet was parsed,
+        // and fall back to resolving the expression directly otherwise.
+        if (!layerStyle.m_compiledTextField.isEmpty()) {
+            textVariant = layerStyle.m_compiledTextField.evaluate(&feature, mapZoom, vpZoom);
+        } else {
+            textVariant = Evaluator::resolveExpression(
+                textVariant.toJsonArray(),
+                &feature,
+                mapZoom,
+                vpZoom);
+        }
         return textVariant.toString();
     }else{ //In case the text field is just a string of the key for the metadata map.
         QString textFieldKey = textVariant.toString();
         textFieldKey.remove("{");
         textFieldKey.remove("}");
-        if(!feature.featureMetaData.contains(textFieldKey)){
+        const QVariant *textValue = feature.findProperty(textFieldKey);
+        if(textValue == nullptr){
             return "";
         }
-        return feature.featureMetaData[textFieldKey].toString();
+        return textValue->toString();
     }
 }
 
@@ -151,8 +155,7 @@ static int getTextMaxAngle(
     QVariant angle = layerStyle.getTextMaxAngleAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(angle.typeId() == QMetaType::Type::QJsonArray){
-        angle = Evaluator::resolveExpression(
-            angle.toJsonArray(),
+        angle = layerStyle.getTextMaxAngleExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -181,8 +184,7 @@ static float getTextLetterSpacing(
     QVariant spacing = layerStyle.getTextLetterSpacingAtZoom(mapZoom);
     // The layer style might return an expression, we need to resolve it.
     if(spacing.typeId() == QMetaType::Type::QJsonArray){
-        spacing = Evaluator::resolveExpression(
-            spacing.toJsonArray(),
+        spacing = layerStyle.getTextLetterSpacingExpression().evaluate(
             &feature,
             mapZoom,
             vpZoom);
@@ -193,99 +195,32 @@ static float getTextLetterSpacing(
 
 
 
-/*!
- * \brief isOverlapping
- * Checks if the passed QRect intersects any QRects in the passed list. This is used to eliminate text
- * overlap in the map.
- * \param textRect the bounding rect of the current text.
- * \param rectList A vector containing all the bounding rects of all the texts previously rendered.
- * \return True if the text overlaps, or false otherwise.
- */
-static bool isOverlapping(const QRect &textRect, const QVector<QRect> &rectList){
-    for(const auto& rect : rectList){
-        if(rect.intersects(textRect)) return true;
-    }
-    return false;
-}
-
-
-/* Splits text to multiple strings depending on the text length and the maximum allowed rect width
- */
-/*!
- * \brief getCorrectedText
- * This functions will split the text into a list of string depending on if the text fits into the
- * passed rectangle width or not. The number of strings that the text is diveded to is dependent on
- * how much space the text will take with the provided font conpared to the allowed width of the rectangle.
- * \param text The text to be checked and split.
- * \param font the font to be used in the calculation.
- * \param rectWidth the maximum width allowed for the text rectangle.
- * \return a QList containing 1 QString if the text fits in the rectable of n > 1 QStrings if it does not.
- */
-static QList<QString> getCorrectedText(
-    const QString &text,
-    const QFont &font,
-    int rectWidth)
-{
-    QFontMetrics fontMetrics(font);
-    int rectWidthInPix = font.pixelSize() * rectWidth;
-    if(fontMetrics.horizontalAdvance(text) <= rectWidthInPix)
-        return { text };
-
-    QList<QString> words = text.split(" ");
-    QList<QString> wordClusters;
-    QString currentCluster = words.at(0);
-    for(const auto &word : words.sliced(1)){
-        if(fontMetrics.horizontalAdvance(currentCluster + " " + word) > rectWidthInPix){
-            wordClusters.append(currentCluster);
-            currentCluster = word;
-            continue;
-        }
-        currentCluster += " " + word;
-    }
-    wordClusters.append(currentCluster);
-    return wordClusters;
-}
-
-
-
 /*!
  * \brief processSimpleText
  * This function renders text that fits in one line and does not require wrapping.
- * \param text the text to be rendered
+ * \param label the label to be rendered, see Bach::prepareLabel_Point.
  * \param coordinate the coordinates where the text should be rendered. The text is rendered so that the point is right in the middle of the bounding rect of the text.
  * \param outlineSize the width of the text outline.
  * \param outlineColor the color of the text outline
- * \param textFont the text font
- * \param rects the QList of previously rendered texts to be used to check for overlapping.
- * \param painter The painter object to paint into.
- * \param feature the text feature
- * \param layerStyle the layerStyle to style the text
- * \param mapZoom
- * \param vpZoom
+ * \param labelCollisions the index of previously rendered texts to be used to check for overlapping.
  * \param tileOriginX the x component of this feature's parent tile's origin (used for text collistion detection)
  * \param tileOriginY the y component of this feature's parent tile's origin (used for text collistion detection)
  * \param vpTextList the list of text features that this text will be added to
  */
 static void processSimpleText(
-    const QString &text,
+    const Bach::TileLabelCandidates::PointLabel &label,
     const QPoint &coordinate,
     int outlineSize,
     const QColor &outlineColor,
-    const QFont &textFont,
-    QVector<QRect> &rects,
-    const PointFeature &feature,
-    const SymbolLayerStyle &layerStyle,
-    int mapZoom,
-    double vpZoom,
+    Bach::LabelCollisionIndex &labelCollisions,
     int tileOriginX,
     int tileOriginY,
     QVector<Bach::vpGlobalText> &vpTextList)
 {
-
-    //Create a QPainterPath for the text.
-    QPainterPath textPath;
-    //Create the path with no offset first.
-    textPath.addText({}, textFont, text);
+    const Bach::TextShapeCache::ShapedLabel &shapedLabel = *label.shape;
+    const QString &text = shapedLabel.lines.at(0);
+    //Copy the cached QPainterPath of the text, which has no offset yet.
+    QPainterPath textPath = shapedLabel.linePaths.at(0);
 
     QRectF boundingRect = textPath.boundingRect().toRect();
     //We account for the text outline when calculating the bounding rect size.
@@ -310,9 +245,9 @@ static void processSimpleText(
         QSize {
             (int)boundingRect.width(),
             (int)boundingRect.height() } };
-    if(isOverlapping(globalRect, rects)) return;
-    //Add the total bouding rect to the list of the text rects to check for overlap for upcoming text.
-    rects.append(globalRect);
+    if(labelCollisions.overlaps(globalRect)) return;
+    //Add the total bouding rect to the collision index to check for overlap for upcoming text.
+    labelCollisions.insert(globalRect);
     //add the feature's details to the vpTextList
     vpTextList.append({ QPoint(tileOriginX, tileOriginY),
         { textPath },
@@ -320,11 +255,13 @@ static void processSimpleText(
         { QPoint{
             (int)(coordinate.x() + textCenteringOffsetX),
             (int)(coordinate.y() + textCenteringOffsetY) } },
-        textFont,
-        getTextColor(layerStyle, feature, mapZoom, vpZoom),
+        label.font,
+        label.textColor,
         outlineSize,
         outlineColor,
-        boundingRect.toRect()});
+        boundingRect.toRect(),
+        // The layouts are built on the painting thread, since that is where they are drawn.
+        Bach::TextShapeCache::global().shapeLabel(label.font, label.text, label.maxWidthEms) });
 }
 
 
@@ -333,38 +270,29 @@ static void processSimpleText(
 /*!
  * \brief processCompositeText
  * This function renders text that requires myltiple lines
- * \param texts the List containing the strings of text to be rendered, each on a separate line.
+ * \param label the label to be rendered, containing each of the lines. See Bach::prepareLabel_Point.
  * \param coordinates the coordinates where the text should be rendered. The text is rendered so that the point is right in the middle of the union of all the bounding rects of the text strings.
  * \param outlineSize the width of the text outline.
  * \param outlineColor the color of the text outline
- * \param textFont the text font
- * \param rects the QList of previously rendered texts to be used to check for overlapping.
- * \param painter The painter object to paint into.
- * \param feature the text feature
- * \param layerStyle the layerStyle to style the text
- * \param mapZoom
- * \param vpZoom
+ * \param labelCollisions the index of previously rendered texts to be used to check for overlapping.
  * \param tileOriginX the x component of this feature's parent tile's origin (used for text collistion detection)
  * \param tileOriginY the y component of this feature's parent tile's origin (used for text collistion detection)
  * \param vpTextList the list of text features that this text will be added to
  */
 static void processCompositeText(
-    const QList<QString> &texts,
+    const Bach::TileLabelCandidates::PointLabel &label,
     const QPoint &coordinates,
     int outlineSize,
-    QColor &outlineColor,
-    const QFont &textFont,
-    QVector<QRect> &rects,
-    const PointFeature &feature,
-    const SymbolLayerStyle &layerStyle,
-    int mapZoom,
-    double vpZoom,
+    const QColor &outlineColor,
+    Bach::LabelCollisionIndex &labelCollisions,
     int tileOriginX,
     int tileOriginY,
     QVector<Bach::vpGlobalText> &vpTextList)
 {
+    const Bach::TextShapeCache::ShapedLabel &shapedLabel = *label.shape;
+    const QList<QString> &texts = shapedLabel.lines;
     //The font metrics var is used to calculate how much space does each word consume.
-    QFontMetricsF fmetrics(textFont);
+    QFontMetricsF fmetrics(label.font);
     //This is the hight of text character, this is used to calculate the combined hight of all the substrings' bounding rects.
     qreal height = fmetrics.height();
     //This will hold the paths for all the substrings of the text.
@@ -374,7 +302,7 @@ static void processCompositeText(
     QPainterPath temp;
     //Loop over each substring and calculate its correct position.
     for(int i = 0; i < texts.size(); i++){
-        temp.addText({}, textFont, texts.at(i));
+        temp = shapedLabel.linePaths.at(i);
         QRectF boundingRect = temp.boundingRect().toRect();
         //We account for the text outline when calculating the bounding rect size.
         boundingRect.setWidth(boundingRect.width() + 2 * outlineSize);
@@ -416,9 +344,9 @@ static void processCompositeText(
         QSize {
             boundingRect.width(),
             boundingRect.height() } };
-    if(isOverlapping(globalRect, rects)) return;
-    //Add the total bouding rect to the list of the text rects to check for overlap for upcoming text.
-    rects.append(globalRect);
+    if(labelCollisions.overlaps(globalRect)) return;
+    //Add the total bouding rect to the collision index to check for overlap for upcoming text.
+    labelCollisions.insert(globalRect);
     //add the feature's details to the vpTextList
     QList<QPainterPath> pathsList;
     for(const QPainterPath &path : paths){
@@ -429,73 +357,40 @@ static void processCompositeText(
         pathsList,
         texts,
         points,
-        textFont,
-        getTextColor(layerStyle, feature, mapZoom, vpZoom),
+        label.font,
+        label.textColor,
         outlineSize,
         outlineColor,
-        boundingRect});
+        boundingRect,
+        // The layouts are built on the painting thread, since that is where they are drawn.
+        Bach::TextShapeCache::global().shapeLabel(label.font, label.text, label.maxWidthEms) });
 }
 
 /*!
- * \brief Bach::processSingleTileFeature_Point
- * This function is called in the tile rendering loop. It is responsible for processing the feature and layerstyle, and passing the text to be rendered
- * along with the styling information to one of the two rendering functions above depending if the text is a one liner or if it requires multiple lines.
- * \param details the struct containig all the elemets needed to paint the feature includeing the layerStyle and the feature itself.
- * \param tileSize the size of the current tile in pixels, used to scale the the transform.
- * \param forceNoChangeFontType If set to true, the text font
- * rendered will be the one currently set by the QPainter object.
- * If set to false, it will try to use the font suggested by the stylesheet.
- * \param tileOriginX the x component of this feature's parent tile's origin (used for text collistion detection)
- * \param tileOriginY the y component of this feature's parent tile's origin (used for text collistion detection)
- * \param rects the list of rects that the current feature's rect will be checked against for collision
- * \param vpTextList the list of text features that this text will be added to if it passses all the filters.
+ * \brief Bach::prepareLabel_Point
+ * Resolves the text and styling of the label of a point feature, and shapes it.
+ * This only depends on the feature and the zoom levels, not on where the tile is drawn,
+ * so the result can be prepared ahead of time and placed in every frame, see TileLabelCandidates.
+ * \param layerStyle the layerStyle to style the text.
+ * \param feature the text feature.
+ * \param forcedFont If set, the font to use instead of the one suggested by the stylesheet.
+ * \return The label, or nothing if the feature has no text to draw.
  */
-void Bach::processSingleTileFeature_Point(
-    PaintingDetailsPoint details,
-    int tileSize,
-    int tileOriginX,
-    int tileOriginY,
-    bool forceNoChangeFontType,
-    QVector<QRect> &rects,
-    QVector<vpGlobalText> &vpTextList)
+std::optional<Bach::TileLabelCandidates::PointLabel> Bach::prepareLabel_Point(
+    const SymbolLayerStyle &layerStyle,
+    const PointFeature &feature,
+    int mapZoom,
+    double vpZoom,
+    const QFont *forcedFont)
 {
-    QPainter &painter = *details.painter;
-    const SymbolLayerStyle &layerStyle = *details.layerStyle;
-    const PointFeature &feature = *details.feature;
     //Get the text to be rendered.
-    QString textToDraw = getTextContent(layerStyle, feature, details.mapZoom, details.vpZoom);
+    QString textToDraw = getTextContent(layerStyle, feature, mapZoom, vpZoom);
     //If there is no text then there is nothing to render, we return
-    if(textToDraw == "")
-        return;
-
-    //Get the rendering parameters from the layerstyle and set the relevant painter field.
-
-    // If the flag 'forceNoChangeFontType' it means we should use the
-    // font object already set by the painter.
-    // So we count on the font already set by the painter object.
-    QFont textFont;
-    if (forceNoChangeFontType) {
-        textFont = painter.font();
-    } else {
-        textFont = QFont(layerStyle.m_textFont);
-    }
-
-    int textSize = getTextSize(layerStyle, feature, details.mapZoom, details.vpZoom);
-    textFont.setPixelSize(textSize);
-
-    painter.setBrush(Qt::NoBrush);
-
-    painter.setOpacity(getTextOpacity(layerStyle, feature, details.mapZoom, details.vpZoom));
-
-    const int outlineSize = layerStyle.m_textHaloWidth.toInt();
-    QColor outlineColor = layerStyle.m_textHaloColor.value<QColor>();
+    if(textToDraw == "" || feature.points().isEmpty())
+        return std::nullopt;
 
-    //Text is always antialised (otherwise it does not look good)
-    painter.setRenderHints(QPainter::Antialiasing, true);
-
-    //Get the corrected version of the text.
-    //This means that text is split up for text wrapping depending on if it exceeds the maximum allowed width.
-    QList<QString> correctedText = getCorrectedText(textToDraw, textFont, layerStyle.m_textMaxWidth.toInt());
+    QFont textFont = forcedFont != nullptr ? *forcedFont : QFont(layerStyle.m_textFont);
+    textFont.setPixelSize(getTextSize(layerStyle, feature, mapZoom, vpZoom));
 
     // Get the coordinates for the text rendering
     // We don't actually know why
@@ -508,44 +403,79 @@ void Bach::processSingleTileFeature_Point(
     } else {
         coordinates = feature.points().at(0);
     }
+
+    //Get the measured version of the text.
+    //This means that text is split up for text wrapping depending on if it exceeds the maximum allowed width.
+    //It holds no layouts, so this can run on any thread.
+    const int maxWidthEms = layerStyle.m_textMaxWidth.toInt();
+    auto shapedLabel = std::make_shared<const TextShapeCache::ShapedLabel>(
+        TextShapeCache::measureLabel(textFont, textToDraw, maxWidthEms));
+
+    return TileLabelCandidates::PointLabel {
+        coordinates,
+        textToDraw,
+        maxWidthEms,
+        std::move(shapedLabel),
+        textFont,
+        getTextColor(layerStyle, feature, mapZoom, vpZoom) };
+}
+
+/*!
+ * \brief Bach::placeLabel_Point
+ * Positions a prepared point label within its tile, and adds it to the text list
+ * if it doesn't overlap any text placed before it.
+ * \param label the label, see prepareLabel_Point.
+ * \param outlineSize the width of the text outline.
+ * \param outlineColor the color of the text outline.
+ * \param sourceScale How many times larger the drawn tile-data is than the tile, see TileScreenPlacement.
+ * \param sourceOffset The offset of the tile within the drawn tile-data, see TileScreenPlacement.
+ * \param tileSize the size of the current tile in pixels, used to scale the the transform.
+ * \param tileOriginX the x component of this feature's parent tile's origin (used for text collistion detection)
+ * \param tileOriginY the y component of this feature's parent tile's origin (used for text collistion detection)
+ * \param labelCollisions the index of rects that the current feature's rect will be checked against for collision
+ * \param vpTextList the list of text features that this text will be added to if it passses all the filters.
+ */
+void Bach::placeLabel_Point(
+    const TileLabelCandidates::PointLabel &label,
+    int outlineSize,
+    const QColor &outlineColor,
+    int sourceScale,
+    QPoint sourceOffset,
+    int tileSize,
+    int tileOriginX,
+    int tileOriginY,
+    Bach::LabelCollisionIndex &labelCollisions,
+    QVector<vpGlobalText> &vpTextList)
+{
     QTransform transform = {};
+    transform.translate(-sourceOffset.x() * tileSize, -sourceOffset.y() * tileSize);
     transform.scale(1 / 4096.0, 1 / 4096.0);
-    transform.scale(tileSize, tileSize);
+    transform.scale(tileSize * sourceScale, tileSize * sourceScale);
     //Remap the original coordinates so that they are positioned correctly.
-    const QPoint newCoordinates = transform.map(coordinates);
+    const QPoint newCoordinates = transform.map(label.anchor);
     //exclude any text that is outside of the tile extent
     if (newCoordinates.x() < 0 || newCoordinates.x() > tileSize || newCoordinates.y() < 0 || newCoordinates.y() > tileSize){
         return;
     }
 
     //The text is processed differently depending on it it wraps or not.
-    if (correctedText.size() == 1) //In case there is only one string to be processed (no wrapping)
+    if (label.shape->lines.size() == 1) //In case there is only one string to be processed (no wrapping)
         processSimpleText(
-            correctedText.at(0),
+            label,
             newCoordinates,
             outlineSize,
             outlineColor,
-            textFont,
-            rects,
-            feature,
-            layerStyle,
-            details.mapZoom,
-            details.vpZoom,
+            labelCollisions,
             tileOriginX,
             tileOriginY,
             vpTextList);
     else { //In case there are multiple strings to be processed (text wrapping)
         processCompositeText(
-            correctedText,
+            label,
             newCoordinates,
             outlineSize,
             outlineColor,
-            textFont,
-            rects,
-            feature,
-            layerStyle,
-            details.mapZoom,
-            details.vpZoom,
+            labelCollisions,
             tileOriginX,
             tileOriginY,
             vpTextList);
@@ -567,93 +497,106 @@ static bool isTextFlipped(double angle){
 }
 
 /*!
- * \brief calctotalTextHorizontalAdvance
- * Calculate the total horizontal advance fo the text. The value includes the space between
- * letters and white spaces as well.
- * \param fMetrics the QFontMetrics object used to calculate the distance
- * \param text the text for wich the distance is calculated
- * \param letterSpacing the distance between individual letters
- * \return the total horizontal distance of the text
+ * \brief Bach::prepareLabel_Point_Curved
+ * Resolves the text and styling of the label of a line feature, and measures its characters.
+ * Like prepareLabel_Point, this does not depend on where the tile is drawn.
+ * \param layerStyle the layerStyle to style the text.
+ * \param feature the line feature the text is drawn along.
+ * \return The label, or nothing if the feature has no text to draw.
+ * The index of the feature is left for the caller to set.
  */
-static int calctotalTextHorizontalAdvance(QFontMetrics fMetrics, QString text, int letterSpacing){
-    int totalHorizontalAdvance = 0;
-    QVector<QString> splitText = text.split(" ");
-    for(const auto& text : splitText){
-        totalHorizontalAdvance += fMetrics.horizontalAdvance(text) + letterSpacing*text.size();
-    }
-    return totalHorizontalAdvance + ((splitText.size()-1) * fMetrics.horizontalAdvance(" "));
+std::optional<Bach::TileLabelCandidates::CurvedLabel> Bach::prepareLabel_Point_Curved(
+    const SymbolLayerStyle &layerStyle,
+    const LineFeature &feature,
+    int mapZoom,
+    double vpZoom)
+{
+    //Get the text to be rendered.
+    QString textToDraw = getTextContent(layerStyle, feature, mapZoom, vpZoom).toUpper();
+    //If there is no text then there is nothing to render, we return
+    if(textToDraw == "")
+        return std::nullopt;
+    //Get the styling parameters
+    int textSize = getTextSize(layerStyle, feature, mapZoom, vpZoom);
+    QFont textFont = QFont(layerStyle.m_textFont);
+    float spacing = getTextLetterSpacing(layerStyle, feature, mapZoom, vpZoom, textSize);
+    textFont.setPixelSize(textSize);
+
+    //The advances of the characters, without layouts, so this can run on any thread.
+    auto shapedText = std::make_shared<const TextShapeCache::ShapedCurvedText>(
+        TextShapeCache::measureCurvedText(textFont, textToDraw, spacing));
+
+    return TileLabelCandidates::CurvedLabel {
+        -1,
+        textToDraw,
+        std::move(shapedText),
+        textFont,
+        getTextColor(layerStyle, feature, mapZoom, vpZoom),
+        getTextOpacity(layerStyle, feature, mapZoom, vpZoom),
+        spacing,
+        getTextMaxAngle(layerStyle, feature, mapZoom, vpZoom) };
 }
 
 /*!
- * \brief Bach::processSingleTileFeature_Point_Curved
- * This function is called in the tile rendering loop.
- * It is responsible for processing curved text. The function filters out texts
- * based on multiple parameters and then adds the text to be rendered to the text list.
+ * \brief Bach::placeLabel_Point_Curved
+ * Lays out the characters of a prepared curved label along its line. The text is
+ * dropped if the line is too short or bends too sharply, or if any of the characters
+ * overlap text placed before it. Otherwise it is added to the text list.
+ *
  * Curved text is represented as a list of structs each containing a
  * charater with its position and rotation.
  *
- * \param details the struct containig all the elemets needed to
- * paint the feature including the layerStyle and the feature itself.
- *
- * \param tileSize the size of the current tile in pixels,
- * used to scale the the transform.
- *
+ * \param label the label, see prepareLabel_Point_Curved.
+ * \param feature the line feature the text is drawn along.
+ * \param outlineSize the width of the text outline.
+ * \param outlineColor the color of the text outline.
+ * \param geometryTransform maps the tile geometry to the painter's coordinates.
  * \param tileOriginX the x component of this feature's parent
  * tile's origin (used for text collistion detection)
- *
  * \param tileOriginY the y component of this feature's parent
  * tile's origin (used for text collistion detection)
- *
- * \param rects the list of rects that the current feature's
- * rect will be checked against for collision
- *
+ * \param labelCollisions the index of rects that the current feature's
+ * glyph rects will be checked against for collision
  * \param vpCurvedTextList the list of curved text features
  * that this text will be added to if it passses all the filters.
  */
-void Bach::processSingleTileFeature_Point_Curved(
-    PaintingDetailsPointCurved details,
-    const int tileSize,
+void Bach::placeLabel_Point_Curved(
+    const TileLabelCandidates::CurvedLabel &label,
+    const LineFeature &feature,
+    int outlineSize,
+    const QColor &outlineColor,
+    const QTransform &geometryTransform,
     int tileOriginX,
     int tileOriginY,
-    QVector<QRect> &rects,
+    Bach::LabelCollisionIndex &labelCollisions,
     QVector<vpGlobalCurvedText> &vpCurvedTextList)
 {
-    QPainter &painter = *details.painter;
-    const SymbolLayerStyle &layerStyle = *details.layerStyle;
-    const LineFeature &feature = *details.feature;
-    //Get the text to be rendered.
-    QString textToDraw = getTextContent(layerStyle, feature, details.mapZoom, details.vpZoom).toUpper();
-    //If there is no text then there is nothing to render, we return
-    if(textToDraw == "") return;
-    //Get the styling parameters
-    int textSize = getTextSize(layerStyle, feature, details.mapZoom, details.vpZoom);
-    QFont textFont = QFont(layerStyle.m_textFont);
-    float spacing = getTextLetterSpacing(layerStyle, feature, details.mapZoom, details.vpZoom, textSize);
-    textFont.setPixelSize(textSize);
-    const int outlineSize = layerStyle.m_textHaloWidth.toInt();
-    QColor outlineColor = layerStyle.m_textHaloColor.value<QColor>();
+    const QString &textToDraw = label.text;
+    const float spacing = label.letterSpacing;
 
     //Get the coordinates for the text rendering
-    QTransform transform = details.transformIn;
+    QTransform transform = geometryTransform;
     transform.scale(1 / 4096.0, 1 / 4096.0);
     QPainterPath path = transform.map(feature.line());
-    QFontMetrics fMetrics(textFont);
+    const QVector<int> &advances = label.shape->characterAdvances;
+    const int textHeight = label.shape->height;
 
     // Check if the path is long enough to render the text at least once
-    if(calctotalTextHorizontalAdvance(fMetrics, textToDraw, spacing) > path.length())
+    if(label.shape->totalAdvance > path.length())
         return;
 
     //Check if the text should be rotated 180 degrees or not
     bool flipText = isTextFlipped(path.angleAtPercent(0));
-    int maxAngle = getTextMaxAngle(layerStyle, feature, details.mapZoom, details.vpZoom);
+    const int maxAngle = label.maxAngle;
     qreal length = 0;
     qreal percentage = path.percentAtLength(length);
     qreal angle;
     QPointF charPosition;
     qreal preAngle = path.angleAtPercent(0);
     QVector<Bach::singleCurvedTextCharacter> charsVector;
-    //This is the bounding rect for the text. It is used to check for text collision
-    QRect textRect(path.pointAtPercent(0).x(), path.pointAtPercent(0).y() - fMetrics.height()/2, fMetrics.horizontalAdvance(textToDraw.at(0)), fMetrics.height());
+    //These are the bounding rects of the individual characters. They are used to check for text collision
+    QVector<QRect> glyphRects;
+    glyphRects.reserve(textToDraw.size());
     if (flipText) { //In case the text is to be flipped, it must be rendered starting from the last character
         for (int i = textToDraw.size() - 1; i >= 0; i--) {
             charPosition = path.pointAtPercent(percentage);
@@ -662,11 +605,11 @@ void Bach::processSingleTileFeature_Point_Curved(
             //adjacent characters, we cancel the text processing
             if(std::abs(angle - preAngle) > maxAngle)
                 return;
-            charsVector.append({textToDraw.at(i), charPosition, -(angle + 180)});
-            QRect charRect(charPosition.x(), charPosition.y() - fMetrics.height()/2, fMetrics.horizontalAdvance(textToDraw.at(i)), fMetrics.height());
-            textRect = textRect.united(charRect);
+            charsVector.append({textToDraw.at(i), charPosition, -(angle + 180), i});
+            QRect charRect(charPosition.x(), charPosition.y() - textHeight/2, advances.at(i), textHeight);
+            glyphRects.append(charRect);
             float letterSpacing = (textToDraw.at(i) == ' ') ? 0 : spacing;
-            length = length + fMetrics.horizontalAdvance(textToDraw.at(i)) + letterSpacing;
+            length = length + advances.at(i) + letterSpacing;
             percentage = path.percentAtLength(length);
             preAngle = angle;
         }
@@ -678,33 +621,55 @@ void Bach::processSingleTileFeature_Point_Curved(
             //adjacent characters, we cancel the text processing
             if(std::abs(angle - preAngle) > maxAngle)
                 return;
-            charsVector.append({textToDraw.at(i), charPosition, -angle});
-            QRect charRect(charPosition.x(), charPosition.y() - fMetrics.height()/2, fMetrics.horizontalAdvance(textToDraw.at(i)), fMetrics.height());
-            textRect = textRect.united(charRect);
+            charsVector.append({textToDraw.at(i), charPosition, -angle, i});
+            QRect charRect(charPosition.x(), charPosition.y() - textHeight/2, advances.at(i), textHeight);
+            glyphRects.append(charRect);
             float letterSpacing = (textToDraw.at(i) == ' ') ? 0 : spacing;
-            length = length + fMetrics.horizontalAdvance(textToDraw.at(i)) + letterSpacing;
+            length = length + advances.at(i) + letterSpacing;
             percentage = path.percentAtLength(length);
             preAngle = angle;
         }
     }
     //Chan ge the rects coordinates so that it is relative to the view port rather than the tile origin
-    textRect.translate(tileOriginX, tileOriginY);
-    //Check for overlap with other text and cancel processing if this text overllaps with another
-    if(isOverlapping(textRect, rects)){
+    for (QRect &glyphRect : glyphRects)
+        glyphRect.translate(tileOriginX, tileOriginY);
+    //Check for overlap with other text and cancel processing if any character overllaps with another text
+    if(labelCollisions.overlapsAny(glyphRects)){
         return;
     }else{
-        //Add this text's total bouding rect to the list of the text rects to check for overlap for upcoming text.
-        rects.append(textRect);
+        //Add this text's character rects to the collision index to check for overlap for upcoming text.
+        labelCollisions.insert(glyphRects);
         //Queue this text for rendering by adding it to the texts list.
         vpCurvedTextList.append({
             charsVector,
-            textFont,
-            getTextColor(layerStyle, feature, details.mapZoom, details.vpZoom),
-            getTextOpacity(layerStyle, feature, details.mapZoom, details.vpZoom),
+            label.font,
+            label.textColor,
+            label.opacity,
             QPoint{ tileOriginX, tileOriginY },
             outlineColor,
-            outlineSize });
+            outlineSize,
+            // The layouts are built on the painting thread, since that is where they are drawn.
+            Bach::TextShapeCache::global().shapeCurvedText(label.font, label.text, label.letterSpacing) });
     }
 }
 
-
+/*!
+ * \brief Bach::labelsUseViewportZoom
+ * Checks whether the text or styling of the labels of a symbol layer style
+ * read the viewport zoom level. The labels of such styles change while zooming
+ * within a single map zoom level, so they can't be prepared ahead of time.
+ *
+ * Text fields that are expressions but were not compiled might use anything,
+ * so they count as reading the viewport zoom level.
+ */
+bool Bach::labelsUseViewportZoom(const SymbolLayerStyle &layerStyle)
+{
+    if (layerStyle.m_textField.typeId() == QMetaType::Type::QJsonArray &&
+        (layerStyle.m_compiledTextField.isEmpty() || layerStyle.m_compiledTextField.usesViewportZoom()))
+        return true;
+    return layerStyle.getTextSizeExpression().usesViewportZoom() ||
+        layerStyle.getTextColorExpression().usesViewportZoom() ||
+        layerStyle.getTextOpacityExpression().usesViewportZoom() ||
+        layerStyle.getTextLetterSpacingExpression().usesViewportZoom() ||
+        layerStyle.getTextMaxAngleExpression().usesViewportZoom();
+}
@@ -27,7 +27,23 @@ namespace Bach {
         virtual ~RequestTilesResult() {}
         // Returns the map of returned tiles.
         virtual const QMap<TileCoord, const VectorTile*> &vectorMap() const = 0;
+        // Returns the returned vector tiles that are still being parsed, which only
+        // hold the layers decoded so far. They are also part of vectorMap(),
+        // and are replaced by the complete tile once it's loaded.
+        // See TileLoader::setStreamVectorTileLayers.
+        virtual const QMap<TileCoord, const VectorTile*> &partialVectorMap() const = 0;
         virtual const QMap<TileCoord, const QImage*> &rasterImageMap() const = 0;
+        // Returns loaded tiles that were not requested, but that can be drawn
+        // in place of the requested tiles that are not loaded yet.
+        // These are ancestors and, if enabled, descendants of the missing tiles.
+        virtual const QMap<TileCoord, const VectorTile*> &fallbackVectorMap() const = 0;
+        virtual const QMap<TileCoord, const QImage*> &fallbackRasterImageMap() const = 0;
+        // Returns the downscaled copies of the returned raster tiles, for the tiles that have them.
+        // Each level is half the size of the one before it, starting at half the size of the tile.
+        virtual const QMap<TileCoord, const QList<QImage>*> &rasterMipLevelMap() const = 0;
+        // Returns the requested tiles that are above the zoom levels of the tile source,
+        // along with the ancestor that is returned in their place and covers them.
+        virtual const QMap<TileCoord, TileCoord> &overzoomMap() const = 0;
         virtual const StyleSheet &styleSheet() const = 0;
     };
 }
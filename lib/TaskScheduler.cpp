@@ -0,0 +1,318 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Other header files
+#include "TaskScheduler.h"
+
+using Bach::TaskScheduler;
+
+// The scheduler handed out by TaskScheduler::shared, while anyone holds on to it.
+// IMPORTANT! Only use when 'sharedSchedulerLock' is locked!
+static std::weak_ptr<TaskScheduler> sharedScheduler;
+static QMutex sharedSchedulerLock;
+
+namespace {
+    // Identifies the worker running on the current thread, if any.
+    struct CurrentWorker {
+        const TaskScheduler *scheduler = nullptr;
+        const void *poolState = nullptr;
+        int index = -1;
+    };
+}
+static thread_local CurrentWorker currentWorker;
+
+/*!
+ * \brief TaskScheduler::TaskScheduler
+ * Starts the workers of both pools. The CPU pool gets one worker per core.
+ * \param name Prefix of the names of the worker threads.
+ */
+TaskScheduler::TaskScheduler(const QString &name) : name{ name }
+{
+    ioPool.pool = Pool::Io;
+    cpuPool.pool = Pool::Cpu;
+    setThreadCount(Pool::Io, defaultIoThreadCount);
+    setThreadCount(Pool::Cpu, QThread::idealThreadCount());
+}
+
+/*!
+ * \brief TaskScheduler::~TaskScheduler
+ * Waits for every submitted task to finish, then stops the workers.
+ */
+TaskScheduler::~TaskScheduler()
+{
+    waitForDone();
+    for (PoolState *state : { &ioPool, &cpuPool }) {
+        QMutexLocker resizeLock { &state->resizeLock };
+        stopWorkers(*state);
+    }
+}
+
+/*!
+ * \brief TaskScheduler::shared
+ * \return The scheduler shared by everyone who asks for it, so that several users,
+ * such as the TileLoader of every tile source, don't each start their own threads.
+ * It is created on first use, and destroyed once nobody holds on to it.
+ *
+ * \threadsafe
+ */
+std::shared_ptr<TaskScheduler> TaskScheduler::shared()
+{
+    QMutexLocker lock { &sharedSchedulerLock };
+    std::shared_ptr<TaskScheduler> out = sharedScheduler.lock();
+    if (out == nullptr) {
+        out = std::make_shared<TaskScheduler>("Shared");
+        sharedScheduler = out;
+    }
+    return out;
+}
+
+/*!
+ * \brief TaskScheduler::submit
+ * Queues a task on one of the pools.
+ *
+ * \param fn The work of the task. It is released right after it has run.
+ * \param priority Tasks with a higher priority are started first,
+ * among the tasks submitted from outside the pool.
+ * \param dependencies The task is started once all of these have finished.
+ * Null handles and tasks that have already finished are ignored.
+ * \return A handle to the task, which can be a dependency of later tasks.
+ *
+ * \threadsafe
+ */
+TaskScheduler::TaskHandle TaskScheduler::submit(
+    Pool pool,
+    std::function<void()> fn,
+    qint64 priority,
+    const std::vector<TaskHandle> &dependencies)
+{
+    auto task = std::make_shared<Task>();
+    task->fn = std::move(fn);
+    task->pool = pool;
+    task->priority = priority;
+    // Holds the task back until all of its dependencies are registered.
+    task->blockerCount = 1;
+    unfinishedTaskCount++;
+
+    for (const TaskHandle &dependency : dependencies) {
+        if (dependency == nullptr)
+            continue;
+        QMutexLocker lock { &dependency->lock };
+        if (dependency->finished)
+            continue;
+        dependency->dependents.push_back(task);
+        task->blockerCount++;
+    }
+
+    if (--task->blockerCount == 0)
+        schedule(task);
+    return task;
+}
+
+/*!
+ * \brief TaskScheduler::waitForDone
+ * Blocks until every submitted task has finished, including the tasks they submit.
+ * Must not be called from a task.
+ *
+ * \threadsafe
+ */
+void TaskScheduler::waitForDone()
+{
+    QMutexLocker lock { &doneLock };
+    while (unfinishedTaskCount > 0)
+        doneCondition.wait(&doneLock);
+}
+
+/*!
+ * \brief TaskScheduler::setThreadCount
+ * Sets the amount of workers of a pool. The running tasks of the pool are finished first,
+ * the tasks still queued are kept for the new workers. Must not be called from a task.
+ *
+ * \threadsafe
+ */
+void TaskScheduler::setThreadCount(Pool pool, int count)
+{
+    count = qMax(count, 1);
+    PoolState &state = poolState(pool);
+    QMutexLocker resizeLock { &state.resizeLock };
+    if (count == (int)state.workers.size())
+        return;
+    stopWorkers(state);
+    startWorkers(state, count);
+}
+
+int TaskScheduler::threadCount(Pool pool) const
+{
+    return poolState(pool).workerCount;
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::schedule
+ * Hands a task whose dependencies have all finished to its pool.
+ *
+ * \threadsafe
+ */
+void TaskScheduler::schedule(const TaskHandle &task)
+{
+    PoolState &state = poolState(task->pool);
+    const bool onOwnPool = currentWorker.scheduler == this && currentWorker.poolState == &state;
+    if (onOwnPool) {
+        // The calling worker takes this task as soon as its current one returns,
+        // so there is no one to wake up. Workers that are awake may still steal it.
+        Worker &worker = *state.workers[currentWorker.index];
+        QMutexLocker lock { &worker.lock };
+        worker.tasks.push_back(task);
+        state.workerTaskCount++;
+        return;
+    }
+
+    QMutexLocker lock { &state.lock };
+    state.queuedTasks.insert({ task->priority, task });
+    state.wakeCondition.wakeOne();
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::takeTask
+ * Finds the next task for a worker. First from its own queue, then from the tasks
+ * submitted to the pool, and last by stealing from the other workers.
+ * \return The task, or nullptr if the pool has nothing to do.
+ */
+TaskScheduler::TaskHandle TaskScheduler::takeTask(PoolState &state, int workerIndex)
+{
+    Worker &ownWorker = *state.workers[workerIndex];
+    {
+        QMutexLocker lock { &ownWorker.lock };
+        if (!ownWorker.tasks.empty()) {
+            TaskHandle task = std::move(ownWorker.tasks.back());
+            ownWorker.tasks.pop_back();
+            state.workerTaskCount--;
+            return task;
+        }
+    }
+
+    {
+        QMutexLocker lock { &state.lock };
+        if (!state.queuedTasks.empty()) {
+            TaskHandle task = std::move(state.queuedTasks.begin()->second);
+            state.queuedTasks.erase(state.queuedTasks.begin());
+            return task;
+        }
+    }
+
+    if (state.workerTaskCount == 0)
+        return nullptr;
+    const int workerCount = (int)state.workers.size();
+    for (int i = 1; i < workerCount; i++) {
+        Worker &victim = *state.workers[(workerIndex + i) % workerCount];
+        QMutexLocker lock { &victim.lock };
+        if (!victim.tasks.empty()) {
+            TaskHandle task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            state.workerTaskCount--;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::runTask
+ * Runs a task, then schedules the dependents that no longer wait on anything.
+ */
+void TaskScheduler::runTask(const TaskHandle &task)
+{
+    task->fn();
+    task->fn = nullptr;
+
+    std::vector<TaskHandle> dependents;
+    {
+        QMutexLocker lock { &task->lock };
+        task->finished.store(true, std::memory_order_release);
+        std::swap(dependents, task->dependents);
+    }
+    for (const TaskHandle &dependent : dependents) {
+        if (--dependent->blockerCount == 0)
+            schedule(dependent);
+    }
+
+    // The dependents were counted when they were submitted, so this only
+    // reaches zero once there is nothing left to run.
+    if (--unfinishedTaskCount == 0) {
+        QMutexLocker lock { &doneLock };
+        doneCondition.wakeAll();
+    }
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::runWorker
+ * The loop of a worker thread. Sleeps while the pool has nothing to do.
+ */
+void TaskScheduler::runWorker(PoolState &state, int workerIndex)
+{
+    currentWorker = { this, &state, workerIndex };
+    while (!state.stopping) {
+        if (TaskHandle task = takeTask(state, workerIndex)) {
+            runTask(task);
+            continue;
+        }
+
+        // Tasks are queued before the pool lock is taken to wake us,
+        // so checking again under the lock can't miss any of them.
+        QMutexLocker lock { &state.lock };
+        if (!state.stopping && state.queuedTasks.empty() && state.workerTaskCount == 0)
+            state.wakeCondition.wait(&state.lock);
+    }
+    currentWorker = {};
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::startWorkers
+ * IMPORTANT! Only use when 'resizeLock' of the pool is locked, and the pool has no workers!
+ */
+void TaskScheduler::startWorkers(PoolState &state, int count)
+{
+    const QString poolName = state.pool == Pool::Io ? "I/O" : "CPU";
+    for (int i = 0; i < count; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->thread.reset(QThread::create([this, &state, i]() { runWorker(state, i); }));
+        worker->thread->setObjectName(QString("%1 %2 #%3").arg(name, poolName).arg(i));
+        state.workers.push_back(std::move(worker));
+    }
+    state.workerCount = count;
+    // Only start once every worker exists, since they steal from each other.
+    for (const auto &worker : state.workers)
+        worker->thread->start();
+}
+
+/*!
+ * \internal
+ * \brief TaskScheduler::stopWorkers
+ * Lets the workers of a pool finish their current task and stops them.
+ * The tasks in their queues are moved to the queue of the pool.
+ *
+ * IMPORTANT! Only use when 'resizeLock' of the pool is locked!
+ */
+void TaskScheduler::stopWorkers(PoolState &state)
+{
+    {
+        QMutexLocker lock { &state.lock };
+        state.stopping = true;
+        state.wakeCondition.wakeAll();
+    }
+    for (const auto &worker : state.workers)
+        worker->thread->wait();
+
+    QMutexLocker lock { &state.lock };
+    for (const auto &worker : state.workers) {
+        for (TaskHandle &task : worker->tasks)
+            state.queuedTasks.insert({ task->priority, std::move(task) });
+    }
+    state.workerTaskCount = 0;
+    state.workers.clear();
+    state.workerCount = 0;
+    state.stopping = false;
+}
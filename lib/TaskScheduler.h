@@ -0,0 +1,138 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TASKSCHEDULER_H
+#define BACH_TASKSCHEDULER_H
+
+// Qt header files
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+// STL header files
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace Bach {
+    /*!
+     * \brief The TaskScheduler class runs small tasks on two pools of worker threads,
+     * one for tasks that mostly wait on I/O and one for tasks that keep the CPU busy.
+     *
+     * A task can depend on other tasks, and is only started once all of them have finished.
+     * This lets a job be split into stages, such as reading a file on the I/O pool and
+     * parsing it on the CPU pool, without either pool waiting for the other.
+     *
+     * Tasks submitted from outside a pool are started in order of priority, the highest first.
+     * Only a task whose last dependency finished on a worker of the task's own pool skips
+     * that order. It is put on that worker's own queue and runs next, without waking any
+     * other worker, and workers that are awake steal the oldest of these tasks from each other.
+     * The stages of the TileLoader alternate between the I/O and the CPU pool, so their
+     * tasks rarely end up on these queues and mostly go through the priority order.
+     *
+     * \threadsafe
+     */
+    class TaskScheduler {
+    public:
+        enum class Pool {
+            Io,
+            Cpu,
+        };
+
+        /*!
+         * \brief The Task class is a single task of the scheduler, see TaskScheduler::submit.
+         */
+        class Task {
+        public:
+            bool isFinished() const { return finished.load(std::memory_order_acquire); }
+
+        private:
+            friend class TaskScheduler;
+            std::function<void()> fn;
+            Pool pool = Pool::Cpu;
+            qint64 priority = 0;
+            // Amount of dependencies that have not finished yet.
+            std::atomic<int> blockerCount = 0;
+            std::atomic<bool> finished = false;
+            QMutex lock;
+            // The tasks waiting for this one to finish.
+            // IMPORTANT! Only use when 'lock' is locked!
+            std::vector<std::shared_ptr<Task>> dependents;
+        };
+        using TaskHandle = std::shared_ptr<Task>;
+
+        /*!
+         * \brief defaultIoThreadCount is the amount of I/O workers unless set otherwise.
+         * These threads mostly wait, so there can be more of them than there are cores.
+         */
+        static constexpr int defaultIoThreadCount = 4;
+
+        explicit TaskScheduler(const QString &name = "TaskScheduler");
+        ~TaskScheduler();
+        TaskScheduler(const TaskScheduler&) = delete;
+        TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+        static std::shared_ptr<TaskScheduler> shared();
+
+        TaskHandle submit(
+            Pool pool,
+            std::function<void()> fn,
+            qint64 priority = 0,
+            const std::vector<TaskHandle> &dependencies = {});
+        void waitForDone();
+
+        void setThreadCount(Pool pool, int count);
+        int threadCount(Pool pool) const;
+
+    private:
+        struct Worker {
+            QMutex lock;
+            // The tasks that became ready on this worker. The worker takes from the back,
+            // other workers steal from the front.
+            // IMPORTANT! Only use when 'lock' is locked!
+            std::deque<TaskHandle> tasks;
+            std::unique_ptr<QThread> thread;
+        };
+        struct PoolState {
+            Pool pool = Pool::Cpu;
+            // Locked while starting and stopping the workers, see setThreadCount.
+            QMutex resizeLock;
+            QMutex lock;
+            QWaitCondition wakeCondition;
+            // The tasks submitted from outside the pool, the highest priority first.
+            // Tasks of equal priority keep their submission order.
+            // IMPORTANT! Only use when 'lock' is locked!
+            std::multimap<qint64, TaskHandle, std::greater<qint64>> queuedTasks;
+            // Amount of tasks in the queues of the workers.
+            std::atomic<qint64> workerTaskCount = 0;
+            std::atomic<bool> stopping = false;
+            // Only changed while 'resizeLock' is locked and none of the workers are running.
+            std::vector<std::unique_ptr<Worker>> workers;
+            std::atomic<int> workerCount = 0;
+        };
+
+        PoolState& poolState(Pool pool) { return pool == Pool::Io ? ioPool : cpuPool; }
+        const PoolState& poolState(Pool pool) const { return pool == Pool::Io ? ioPool : cpuPool; }
+        void schedule(const TaskHandle &task);
+        TaskHandle takeTask(PoolState &state, int workerIndex);
+        void runTask(const TaskHandle &task);
+        void runWorker(PoolState &state, int workerIndex);
+        void startWorkers(PoolState &state, int count);
+        void stopWorkers(PoolState &state);
+
+        QString name;
+        PoolState ioPool;
+        PoolState cpuPool;
+
+        // Amount of tasks submitted that have not finished yet, including those waiting on dependencies.
+        std::atomic<qint64> unfinishedTaskCount = 0;
+        QMutex doneLock;
+        QWaitCondition doneCondition;
+    };
+}
+
+#endif // BACH_TASKSCHEDULER_H
@@ -0,0 +1,234 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Qt header files
+#include <QFontMetrics>
+#include <QHashFunctions>
+
+// Other header files
+#include "TextShapeCache.h"
+
+using Bach::TextShapeCache;
+
+bool TextShapeCache::Key::operator==(const Key &other) const
+{
+    return curved == other.curved &&
+        layoutParameter == other.layoutParameter &&
+        fontKey == other.fontKey &&
+        text == other.text;
+}
+
+size_t Bach::qHash(const TextShapeCache::Key &key, size_t seed)
+{
+    return qHashMulti(seed, int(key.curved), key.layoutParameter, key.fontKey, key.text);
+}
+
+/*!
+ * \brief TextShapeCache::TextShapeCache
+ * \param maxEntries The maximum amount of point labels, and separately of curved texts, to keep.
+ */
+TextShapeCache::TextShapeCache(int maxEntries)
+{
+    m_labels.setMaxCost(maxEntries);
+    m_curvedTexts.setMaxCost(maxEntries);
+}
+
+/*!
+ * \brief TextShapeCache::global
+ * \return The cache of the calling thread, shared by all the text rendering functions on it.
+ * Every thread has its own, since the layouts it holds can only be drawn on the thread that built them.
+ */
+TextShapeCache& TextShapeCache::global()
+{
+    static thread_local TextShapeCache cache;
+    return cache;
+}
+
+/*!
+ * \internal
+ * \brief breakIntoLines
+ * This functions will split the text into a list of string depending on if the text fits into the
+ * passed rectangle width or not. The number of strings that the text is diveded to is dependent on
+ * how much space the text will take with the provided font conpared to the allowed width of the rectangle.
+ * \param text The text to be checked and split.
+ * \param fontMetrics the metrics of the font to be used in the calculation.
+ * \param rectWidthInPix the maximum width allowed for the text rectangle, in pixels.
+ * \return a QList containing 1 QString if the text fits in the rectable of n > 1 QStrings if it does not.
+ */
+static QList<QString> breakIntoLines(
+    const QString &text,
+    const QFontMetrics &fontMetrics,
+    int rectWidthInPix)
+{
+    if(fontMetrics.horizontalAdvance(text) <= rectWidthInPix)
+        return { text };
+
+    QList<QString> words = text.split(" ");
+    QList<QString> wordClusters;
+    QString currentCluster = words.at(0);
+    for(const auto &word : words.sliced(1)){
+        if(fontMetrics.horizontalAdvance(currentCluster + " " + word) > rectWidthInPix){
+            wordClusters.append(currentCluster);
+            currentCluster = word;
+            continue;
+        }
+        currentCluster += " " + word;
+    }
+    wordClusters.append(currentCluster);
+    return wordClusters;
+}
+
+/*!
+ * \internal
+ * \brief createTextLayout lays out the text on a single line.
+ */
+static std::shared_ptr<QTextLayout> createTextLayout(const QString &text, const QFont &font)
+{
+    auto textLayout = std::make_shared<QTextLayout>(text, font);
+    textLayout->beginLayout();
+    textLayout->createLine();
+    textLayout->endLayout();
+    return textLayout;
+}
+
+/*!
+ * \brief TextShapeCache::shapeLabel
+ * Splits a point label into lines and builds the outline and layout of every line.
+ *
+ * \param font The font of the label, including its pixel size.
+ * \param text The text of the label.
+ * \param maxWidthEms The maximum width of a line, as a multiple of the font's pixel size.
+ * \return The shaped label, shared with every other caller that asks for the same label.
+ */
+std::shared_ptr<const TextShapeCache::ShapedLabel> TextShapeCache::shapeLabel(
+    const QFont &font,
+    const QString &text,
+    int maxWidthEms)
+{
+    const Key key { false, font.key(), text, (float)maxWidthEms };
+    {
+        QMutexLocker lock { &m_lock };
+        if (const auto *cached = m_labels.object(key))
+            return *cached;
+    }
+
+    // Shape the label without holding the lock, so other threads can keep reading.
+    auto shapedLabel = std::make_shared<ShapedLabel>(measureLabel(font, text, maxWidthEms));
+    for (const QString &line : shapedLabel->lines)
+        shapedLabel->lineLayouts.push_back(createTextLayout(line, font));
+
+    QMutexLocker lock { &m_lock };
+    m_labels.insert(key, new std::shared_ptr<const ShapedLabel>(shapedLabel));
+    return shapedLabel;
+}
+
+/*!
+ * \brief TextShapeCache::shapeCurvedText
+ * Measures every character of a curved label and builds the layout of each of them.
+ *
+ * \param font The font of the label, including its pixel size.
+ * \param text The text of the label.
+ * \param letterSpacing The space added after every letter, in pixels.
+ * Only the integer part is used for the total advance.
+ * \return The shaped text, shared with every other caller that asks for the same text.
+ */
+std::shared_ptr<const TextShapeCache::ShapedCurvedText> TextShapeCache::shapeCurvedText(
+    const QFont &font,
+    const QString &text,
+    float letterSpacing)
+{
+    const Key key { true, font.key(), text, letterSpacing };
+    {
+        QMutexLocker lock { &m_lock };
+        if (const auto *cached = m_curvedTexts.object(key))
+            return *cached;
+    }
+
+    // Shape the text without holding the lock, so other threads can keep reading.
+    auto shapedText = std::make_shared<ShapedCurvedText>(measureCurvedText(font, text, letterSpacing));
+    shapedText->characterLayouts.reserve(text.size());
+    for (QChar character : text)
+        shapedText->characterLayouts.push_back(createTextLayout(character, font));
+
+    QMutexLocker lock { &m_lock };
+    m_curvedTexts.insert(key, new std::shared_ptr<const ShapedCurvedText>(shapedText));
+    return shapedText;
+}
+
+/*!
+ * \brief TextShapeCache::measureLabel
+ * Splits a point label into lines and builds the outline of every line, like shapeLabel,
+ * but without laying out the lines or caching the result.
+ *
+ * The result holds no layouts, so it can be built on one thread and used on another.
+ *
+ * \threadsafe
+ */
+TextShapeCache::ShapedLabel TextShapeCache::measureLabel(
+    const QFont &font,
+    const QString &text,
+    int maxWidthEms)
+{
+    ShapedLabel out;
+    out.lines = breakIntoLines(text, QFontMetrics(font), font.pixelSize() * maxWidthEms);
+    for (const QString &line : out.lines) {
+        QPainterPath linePath;
+        linePath.addText({}, font, line);
+        out.linePaths.append(linePath);
+    }
+    return out;
+}
+
+/*!
+ * \brief TextShapeCache::measureCurvedText
+ * Measures every character of a curved label, like shapeCurvedText,
+ * but without laying out the characters or caching the result.
+ *
+ * The result holds no layouts, so it can be built on one thread and used on another.
+ *
+ * \threadsafe
+ */
+TextShapeCache::ShapedCurvedText TextShapeCache::measureCurvedText(
+    const QFont &font,
+    const QString &text,
+    float letterSpacing)
+{
+    QFontMetrics fontMetrics(font);
+    ShapedCurvedText out;
+    out.height = fontMetrics.height();
+    out.characterAdvances.reserve(text.size());
+    for (QChar character : text)
+        out.characterAdvances.append(fontMetrics.horizontalAdvance(character));
+
+    // The total advance includes the white spaces, and the letter spacing after every letter of each word.
+    const int spacing = (int)letterSpacing;
+    const QList<QString> words = text.split(" ");
+    for (const QString &word : words)
+        out.totalAdvance += fontMetrics.horizontalAdvance(word) + spacing * word.size();
+    out.totalAdvance += (words.size() - 1) * fontMetrics.horizontalAdvance(" ");
+    return out;
+}
+
+/*!
+ * \brief TextShapeCache::clear
+ * Removes every shaped text from the cache. Texts still in use stay valid.
+ */
+void TextShapeCache::clear()
+{
+    QMutexLocker lock { &m_lock };
+    m_labels.clear();
+    m_curvedTexts.clear();
+}
+
+int TextShapeCache::maxEntries() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_labels.maxCost();
+}
+
+void TextShapeCache::setMaxEntries(int maxEntries)
+{
+    QMutexLocker lock { &m_lock };
+    m_labels.setMaxCost(maxEntries);
+    m_curvedTexts.setMaxCost(maxEntries);
+}
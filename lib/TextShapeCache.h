@@ -0,0 +1,121 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TEXTSHAPECACHE_H
+#define BACH_TEXTSHAPECACHE_H
+
+// Qt header files
+#include <QCache>
+#include <QFont>
+#include <QList>
+#include <QMutex>
+#include <QPainterPath>
+#include <QString>
+#include <QTextLayout>
+#include <QVector>
+
+// STL header files
+#include <memory>
+#include <vector>
+
+namespace Bach {
+    /*!
+     * \brief The TextShapeCache class
+     * stores the result of measuring and laying out label strings, so that
+     * a label is shaped once and reused across frames and across neighbouring tiles.
+     *
+     * Entries are keyed on the font (including its pixel size), the string and
+     * the parameter that affects the layout, and the least recently used entries are
+     * dropped once the cache holds more than maxEntries() of them.
+     *
+     * The QTextLayouts of a shaped text use the font engines of the thread that built them,
+     * so they must only be drawn on that thread, see global(). measureLabel and measureCurvedText
+     * give the same measurements without any layouts, which can be handed to any thread.
+     *
+     * \threadsafe
+     */
+    class TextShapeCache {
+    public:
+        /*!
+         * \brief The ShapedLabel struct holds a label placed on a single point.
+         */
+        struct ShapedLabel {
+            // The text split into lines that fit within the maximum label width.
+            QList<QString> lines;
+            // The outline of every line, with the start of its baseline at the origin.
+            QList<QPainterPath> linePaths;
+            // Every line laid out by QTextLayout, ready to be drawn.
+            // Empty for labels returned by measureLabel.
+            std::vector<std::shared_ptr<QTextLayout>> lineLayouts;
+        };
+
+        /*!
+         * \brief The ShapedCurvedText struct holds a label that follows a line.
+         * Curved text is drawn one character at a time.
+         */
+        struct ShapedCurvedText {
+            // The horizontal advance of every character of the text.
+            QVector<int> characterAdvances;
+            // The horizontal advance of the whole text, including the letter spacing.
+            int totalAdvance = 0;
+            // The height of the font.
+            int height = 0;
+            // Every character laid out on its own by QTextLayout, ready to be drawn.
+            // Empty for texts returned by measureCurvedText.
+            std::vector<std::shared_ptr<QTextLayout>> characterLayouts;
+        };
+
+        static constexpr int defaultMaxEntries = 4096;
+
+        explicit TextShapeCache(int maxEntries = defaultMaxEntries);
+        TextShapeCache(const TextShapeCache&) = delete;
+        TextShapeCache& operator=(const TextShapeCache&) = delete;
+
+        static TextShapeCache& global();
+
+        std::shared_ptr<const ShapedLabel> shapeLabel(
+            const QFont &font,
+            const QString &text,
+            int maxWidthEms);
+        std::shared_ptr<const ShapedCurvedText> shapeCurvedText(
+            const QFont &font,
+            const QString &text,
+            float letterSpacing);
+
+        static ShapedLabel measureLabel(
+            const QFont &font,
+            const QString &text,
+            int maxWidthEms);
+        static ShapedCurvedText measureCurvedText(
+            const QFont &font,
+            const QString &text,
+            float letterSpacing);
+
+        void clear();
+        int maxEntries() const;
+        void setMaxEntries(int maxEntries);
+
+        /*!
+         * \brief The Key struct identifies one shaped string.
+         * The layout parameter is the maximum width for point labels,
+         * and the letter spacing for curved text.
+         */
+        struct Key {
+            bool curved = false;
+            QString fontKey;
+            QString text;
+            float layoutParameter = 0;
+
+            bool operator==(const Key &other) const;
+        };
+
+    private:
+        mutable QMutex m_lock;
+        QCache<Key, std::shared_ptr<const ShapedLabel>> m_labels;
+        QCache<Key, std::shared_ptr<const ShapedCurvedText>> m_curvedTexts;
+    };
+
+    size_t qHash(const TextShapeCache::Key &key, size_t seed = 0);
+}
+
+#endif // BACH_TEXTSHAPECACHE_H
@@ -0,0 +1,132 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// STL header files
+#include <tuple>
+
+// Other header files
+#include "TileBitmapCache.h"
+
+using Bach::TileBitmapCache;
+
+bool TileBitmapCache::Key::operator<(const Key &other) const
+{
+    return std::tie(coord, pixelSize, devicePixelRatio, vpZoom, drawFill, drawLines, styleSheetId, tileDataId) <
+        std::tie(other.coord, other.pixelSize, other.devicePixelRatio, other.vpZoom, other.drawFill, other.drawLines, other.styleSheetId, other.tileDataId);
+}
+
+/*!
+ * \brief TileBitmapCache::TileBitmapCache
+ * \param maxBytes The maximum amount of image memory to keep, in bytes.
+ */
+TileBitmapCache::TileBitmapCache(qsizetype maxBytes) : m_maxBytes{ maxBytes } {}
+
+/*!
+ * \brief TileBitmapCache::find
+ * Looks up a rasterized tile and marks it as the most recently used.
+ *
+ * \return The image if it is in the cache, std::nullopt otherwise.
+ */
+std::optional<QImage> TileBitmapCache::find(const Key &key)
+{
+    QMutexLocker lock { &m_lock };
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        m_misses++;
+        return std::nullopt;
+    }
+
+    m_hits++;
+    m_lru.splice(m_lru.end(), m_lru, it->second.lruIt);
+    return it->second.image;
+}
+
+/*!
+ * \brief TileBitmapCache::insert
+ * Stores a rasterized tile, replacing any previous image for the same key.
+ * Evicts the least recently used images if the budget is exceeded.
+ */
+void TileBitmapCache::insert(const Key &key, const QImage &image)
+{
+    QMutexLocker lock { &m_lock };
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        m_sizeInBytes -= it->second.image.sizeInBytes();
+        it->second.image = image;
+        m_lru.splice(m_lru.end(), m_lru, it->second.lruIt);
+    } else {
+        Entry entry;
+        entry.image = image;
+        entry.lruIt = m_lru.insert(m_lru.end(), key);
+        m_entries.emplace(key, std::move(entry));
+    }
+    m_sizeInBytes += image.sizeInBytes();
+    evictOverBudget();
+}
+
+/*!
+ * \brief TileBitmapCache::clear
+ * Drops every image. Should be called when the tile data or the style sheet changes.
+ */
+void TileBitmapCache::clear()
+{
+    QMutexLocker lock { &m_lock };
+    m_entries.clear();
+    m_lru.clear();
+    m_sizeInBytes = 0;
+}
+
+/*!
+ * \brief TileBitmapCache::hitCount
+ * \return The amount of calls to find() that returned an image.
+ */
+qint64 TileBitmapCache::hitCount() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_hits;
+}
+
+/*!
+ * \brief TileBitmapCache::missCount
+ * \return The amount of calls to find() that returned nothing.
+ */
+qint64 TileBitmapCache::missCount() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_misses;
+}
+
+qsizetype TileBitmapCache::sizeInBytes() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_sizeInBytes;
+}
+
+qsizetype TileBitmapCache::maxBytes() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_maxBytes;
+}
+
+void TileBitmapCache::setMaxBytes(qsizetype maxBytes)
+{
+    QMutexLocker lock { &m_lock };
+    m_maxBytes = maxBytes;
+    evictOverBudget();
+}
+
+/*!
+ * \internal
+ * \brief TileBitmapCache::evictOverBudget
+ * Drops the least recently used images until the cache fits in its budget.
+ * Assumes the lock is held.
+ */
+void TileBitmapCache::evictOverBudget()
+{
+    while (m_sizeInBytes > m_maxBytes && !m_lru.empty()) {
+        auto it = m_entries.find(m_lru.front());
+        m_sizeInBytes -= it->second.image.sizeInBytes();
+        m_entries.erase(it);
+        m_lru.pop_front();
+    }
+}
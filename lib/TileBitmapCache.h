@@ -0,0 +1,94 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TILEBITMAPCACHE_H
+#define BACH_TILEBITMAPCACHE_H
+
+// Qt header files
+#include <QImage>
+#include <QMutex>
+
+// STL header files
+#include <list>
+#include <map>
+#include <optional>
+
+// Other header files
+#include "TileCoord.h"
+
+namespace Bach {
+    /*!
+     * \brief The TileBitmapCache class
+     * stores the fill and line layers of vector tiles rasterized into images,
+     * so that they can be composited again without re-running the style loop.
+     *
+     * The cache is bounded by the total amount of image memory it holds.
+     * When that is exceeded, the least recently used images are dropped.
+     *
+     * \threadsafe
+     */
+    class TileBitmapCache {
+    public:
+        /*!
+         * \brief The Key struct
+         * identifies one rasterized tile. Two tiles rendered with the same key
+         * produce the same image.
+         */
+        struct Key {
+            TileCoord coord;
+            // Width and height of the image, in device independent pixels.
+            int pixelSize = 0;
+            qreal devicePixelRatio = 1.0;
+            // The viewport zoom the styles were evaluated at.
+            // Only set for zoom previews, which are rasterized at a fixed zoom per map zoom level.
+            double vpZoom = 0;
+            bool drawFill = false;
+            bool drawLines = false;
+            // See StyleSheet::uniqueId.
+            quint64 styleSheetId = 0;
+            // See VectorTile::uniqueId. Tiles that are loaded again get a new image.
+            quint64 tileDataId = 0;
+
+            bool operator<(const Key &other) const;
+        };
+
+        /*!
+         * \brief defaultMaxBytes is the default memory budget, 64 MiB.
+         * This is enough for roughly 64 tiles of 512x512 pixels.
+         */
+        static constexpr qsizetype defaultMaxBytes = 64 * 1024 * 1024;
+
+        explicit TileBitmapCache(qsizetype maxBytes = defaultMaxBytes);
+        TileBitmapCache(const TileBitmapCache&) = delete;
+        TileBitmapCache& operator=(const TileBitmapCache&) = delete;
+
+        std::optional<QImage> find(const Key &key);
+        void insert(const Key &key, const QImage &image);
+        void clear();
+
+        qint64 hitCount() const;
+        qint64 missCount() const;
+        qsizetype sizeInBytes() const;
+        qsizetype maxBytes() const;
+        void setMaxBytes(qsizetype maxBytes);
+
+    private:
+        void evictOverBudget();
+
+        struct Entry {
+            QImage image;
+            std::list<Key>::iterator lruIt;
+        };
+
+        mutable QMutex m_lock;
+        qsizetype m_maxBytes = 0;
+        qsizetype m_sizeInBytes = 0;
+        qint64 m_hits = 0;
+        qint64 m_misses = 0;
+        std::map<Key, Entry> m_entries;
+        // Least recently used key first.
+        std::list<Key> m_lru;
+    };
+}
+
+#endif // BACH_TILEBITMAPCACHE_H
@@ -73,3 +73,44 @@ bool TileCoord::operator!=(const TileCoord& other) const
 {
     return !(*this == other);
 }
+
+/*!
+ * \brief TileCoord::packed packs the coordinate into a single 64-bit key.
+ *
+ * The zoom level takes the top 8 bits, followed by 28 bits of x and 28 bits of y.
+ * Coordinates outside of that range are cut off to fit.
+ *
+ * \return the key of this TileCoord.
+ */
+quint64 TileCoord::packed() const
+{
+    constexpr quint64 mask28 = (1ull << 28) - 1;
+    return
+        ((quint64)(quint8)zoom << 56) |
+        (((quint64)x & mask28) << 28) |
+        ((quint64)y & mask28);
+}
+
+/*!
+ * \brief TileCoord::fromPacked unpacks a key made by TileCoord::packed.
+ */
+TileCoord TileCoord::fromPacked(quint64 key)
+{
+    constexpr quint64 mask28 = (1ull << 28) - 1;
+    return { (int)(key >> 56), (int)((key >> 28) & mask28), (int)(key & mask28) };
+}
+
+/*!
+ * \brief qHash hashes a TileCoord for QHash, QSet and std::unordered_map.
+ *
+ * Neighbouring tiles have keys that only differ in their lowest bits,
+ * so the key is mixed with the finalizer of SplitMix64 to spread them out.
+ */
+size_t qHash(const TileCoord &coord, size_t seed) noexcept
+{
+    quint64 hash = coord.packed() ^ (quint64)seed;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    hash ^= hash >> 31;
+    return (size_t)hash;
+}
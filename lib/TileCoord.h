@@ -6,6 +6,11 @@
 
 // Qt header files
 #include <QString>
+#include <QtGlobal>
+
+// STL header files
+#include <cstddef>
+#include <functional>
 
 // Represents the position of a tile within the maps grid at a given zoom level.
 //
@@ -35,6 +40,25 @@ struct TileCoord {
     bool operator<(const TileCoord &other) const;
     bool operator==(const TileCoord &other) const;
     bool operator!=(const TileCoord &other) const;
+
+    /* Packs the zoom level into the top 8 bits of a 64-bit key, and
+     * x and y into 28 bits each. Two tiles have the same key if, and only if,
+     * they are the same tile, as long as the zoom level is at most 28.
+     * Keys sort in the same order as operator<.
+     */
+    quint64 packed() const;
+    static TileCoord fromPacked(quint64 key);
 };
 
+// Lets TileCoord be used as a key in QHash and QSet.
+size_t qHash(const TileCoord &coord, size_t seed = 0) noexcept;
+
+// Lets TileCoord be used as a key in std::unordered_map and std::unordered_set.
+namespace std {
+    template<>
+    struct hash<TileCoord> {
+        size_t operator()(const TileCoord &coord) const noexcept { return qHash(coord); }
+    };
+}
+
 #endif // TILECOORD_HPP
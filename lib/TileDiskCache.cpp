@@ -0,0 +1,507 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Qt header files
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QTimeZone>
+
+// STL header files
+#include <algorithm>
+#include <vector>
+
+// Other header files
+#include "TileDiskCache.h"
+#include "TileLoader.h"
+
+using Bach::TileDiskCache;
+
+// The index is saved in the background after this many changes.
+static constexpr int changesPerIndexSave = 64;
+
+static QString tileTypeToString(TileType type)
+{
+    return type == TileType::Vector ? "mvt" : "png";
+}
+
+static std::optional<TileType> tileTypeFromString(const QString &string)
+{
+    if (string == "mvt")
+        return TileType::Vector;
+    if (string == "png")
+        return TileType::Raster;
+    return std::nullopt;
+}
+
+/*!
+ * \internal
+ * \brief parseHttpDate parses a date in the format used by HTTP headers,
+ * for example "Wed, 21 Oct 2015 07:28:00 GMT".
+ * \return The date in milliseconds since epoch, or nullopt if it could not be parsed.
+ */
+static std::optional<qint64> parseHttpDate(const QByteArray &value)
+{
+    const QDateTime parsed = QLocale::c().toDateTime(
+        QString::fromLatin1(value).trimmed(),
+        "ddd, dd MMM yyyy HH:mm:ss 'GMT'");
+    if (!parsed.isValid())
+        return std::nullopt;
+    return QDateTime(parsed.date(), parsed.time(), QTimeZone::utc()).toMSecsSinceEpoch();
+}
+
+/*!
+ * \brief TileDiskCache::expiryFromHeaders finds out when a tile expires,
+ * based on the headers of the reply it came with.
+ *
+ * 'Cache-Control' takes precedence over 'Expires'. Tiles that must always be
+ * revalidated expire right away, and tiles without either header expire
+ * after 'defaultMaxAgeSecs'.
+ *
+ * \param nowMs The time the reply was received, in milliseconds since epoch.
+ * \return The time the tile expires, in milliseconds since epoch.
+ */
+qint64 TileDiskCache::expiryFromHeaders(const HttpCacheHeaders &headers, qint64 nowMs)
+{
+    if (!headers.cacheControl.isEmpty()) {
+        std::optional<qint64> maxAgeSecs;
+        for (QByteArray directive : headers.cacheControl.split(',')) {
+            directive = directive.trimmed().toLower();
+            if (directive == "no-cache" || directive == "no-store")
+                return nowMs;
+            if (directive.startsWith("max-age=")) {
+                bool ok = false;
+                const qint64 value = directive.mid(8).toLongLong(&ok);
+                if (ok)
+                    maxAgeSecs = value;
+            }
+        }
+        if (maxAgeSecs.has_value())
+            return nowMs + qMax(maxAgeSecs.value(), 0ll) * 1000;
+    }
+
+    if (!headers.expires.isEmpty()) {
+        // Invalid dates, like "0", mean the tile has already expired.
+        return parseHttpDate(headers.expires).value_or(nowMs);
+    }
+
+    return nowMs + defaultMaxAgeSecs * 1000;
+}
+
+/*!
+ * \brief TileDiskCache::open opens the book-keeping of a tile cache folder.
+ *
+ * The index is read right away, and the folder is scanned
+ * for tiles missing from the index in the background.
+ *
+ * \param basePath The tile cache folder. It does not need to exist yet.
+ */
+std::unique_ptr<TileDiskCache> TileDiskCache::open(const QString &basePath)
+{
+    auto out = std::unique_ptr<TileDiskCache>(new TileDiskCache());
+    TileDiskCache &cache = *out;
+    cache.m_basePath = basePath;
+    cache.m_maintenancePool.setMaxThreadCount(1);
+
+    QMutexLocker lock { &cache.m_lock };
+    cache.loadIndex_Locked();
+    cache.scheduleMaintenance_Locked();
+    return out;
+}
+
+TileDiskCache::~TileDiskCache()
+{
+    m_maintenancePool.waitForDone();
+    saveIndex();
+}
+
+/*!
+ * \brief TileDiskCache::setLimits sets the quota of the cache folder.
+ * If the folder is over the new quota, it is pruned in the background.
+ */
+void TileDiskCache::setLimits(const TileDiskCacheLimits &limits)
+{
+    QMutexLocker lock { &m_lock };
+    m_limits = limits;
+    if (isOverQuota_Locked())
+        scheduleMaintenance_Locked();
+}
+
+Bach::TileDiskCacheLimits TileDiskCache::limits() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_limits;
+}
+
+Bach::TileDiskCacheStats TileDiskCache::stats() const
+{
+    QMutexLocker lock { &m_lock };
+    TileDiskCacheStats out;
+    out.tileCount = (int)m_entries.size();
+    out.byteSize = m_byteSize;
+    out.prunedTiles = m_prunedTiles;
+    out.notModifiedReplies = m_notModifiedReplies;
+    return out;
+}
+
+/*!
+ * \brief TileDiskCache::validators
+ * \return The validators to send when revalidating the tile, or nullopt
+ * if the tile is not cached or the server didn't send any.
+ */
+std::optional<TileDiskCache::Validators> TileDiskCache::validators(TileCoord coord, TileType type) const
+{
+    QMutexLocker lock { &m_lock };
+    auto entryIt = m_entries.find({ coord, type });
+    if (entryIt == m_entries.end())
+        return std::nullopt;
+    const Entry &entry = entryIt->second;
+    if (entry.etag.isEmpty() && entry.lastModified.isEmpty())
+        return std::nullopt;
+    return Validators { entry.etag, entry.lastModified };
+}
+
+/*!
+ * \brief TileDiskCache::needsRevalidation
+ * \return Returns true if the tile is cached, but has expired.
+ */
+bool TileDiskCache::needsRevalidation(TileCoord coord, TileType type) const
+{
+    const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker lock { &m_lock };
+    auto entryIt = m_entries.find({ coord, type });
+    return entryIt != m_entries.end() && entryIt->second.expiresMs <= nowMs;
+}
+
+/*!
+ * \brief TileDiskCache::recordWrite registers a tile that was just written to the cache folder.
+ * \param headers The headers of the reply the tile came with.
+ */
+void TileDiskCache::recordWrite(
+    TileCoord coord,
+    TileType type,
+    qint64 byteSize,
+    const HttpCacheHeaders &headers)
+{
+    const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker lock { &m_lock };
+    Entry &entry = m_entries[{ coord, type }];
+    m_byteSize += byteSize - entry.byteSize;
+    entry.byteSize = byteSize;
+    entry.lastAccessMs = nextAccessTime_Locked();
+    entry.expiresMs = expiryFromHeaders(headers, nowMs);
+    entry.etag = headers.etag;
+    entry.lastModified = headers.lastModified;
+    markChanged_Locked();
+    if (isOverQuota_Locked())
+        scheduleMaintenance_Locked();
+}
+
+/*!
+ * \brief TileDiskCache::recordAccess marks a cached tile as used,
+ * so that it is pruned after the tiles that were not.
+ */
+void TileDiskCache::recordAccess(TileCoord coord, TileType type)
+{
+    QMutexLocker lock { &m_lock };
+    auto entryIt = m_entries.find({ coord, type });
+    if (entryIt == m_entries.end())
+        return;
+    entryIt->second.lastAccessMs = nextAccessTime_Locked();
+    markChanged_Locked();
+}
+
+/*!
+ * \brief TileDiskCache::recordNotModified registers that the server
+ * confirmed an expired tile to be unchanged.
+ * \param headers The headers of the '304 Not Modified' reply.
+ * They may update the validators the tile was stored with.
+ */
+void TileDiskCache::recordNotModified(TileCoord coord, TileType type, const HttpCacheHeaders &headers)
+{
+    const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
+    QMutexLocker lock { &m_lock };
+    m_notModifiedReplies++;
+    auto entryIt = m_entries.find({ coord, type });
+    if (entryIt == m_entries.end())
+        return;
+    Entry &entry = entryIt->second;
+    entry.lastAccessMs = nextAccessTime_Locked();
+    entry.expiresMs = expiryFromHeaders(headers, nowMs);
+    if (!headers.etag.isEmpty())
+        entry.etag = headers.etag;
+    if (!headers.lastModified.isEmpty())
+        entry.lastModified = headers.lastModified;
+    markChanged_Locked();
+}
+
+/*!
+ * \brief TileDiskCache::remove forgets a tile whose file is no longer in the cache folder.
+ */
+void TileDiskCache::remove(TileCoord coord, TileType type)
+{
+    QMutexLocker lock { &m_lock };
+    auto entryIt = m_entries.find({ coord, type });
+    if (entryIt == m_entries.end())
+        return;
+    m_byteSize -= entryIt->second.byteSize;
+    m_entries.erase(entryIt);
+    markChanged_Locked();
+}
+
+/*!
+ * \brief TileDiskCache::waitForMaintenance blocks until the background
+ * scanning, pruning and saving of the index is done.
+ */
+void TileDiskCache::waitForMaintenance()
+{
+    m_maintenancePool.waitForDone();
+}
+
+QString TileDiskCache::tilePath(const Key &key) const
+{
+    return QDir::cleanPath(
+        m_basePath +
+        QDir::separator() +
+        Bach::tileDiskCacheSubPath(key.first, key.second));
+}
+
+// Access times are kept unique, so that tiles used within
+// the same millisecond are still pruned in the order they were used.
+qint64 TileDiskCache::nextAccessTime_Locked()
+{
+    m_lastAccessMs = qMax(QDateTime::currentMSecsSinceEpoch(), m_lastAccessMs + 1);
+    return m_lastAccessMs;
+}
+
+void TileDiskCache::markChanged_Locked()
+{
+    m_unsavedChanges++;
+    if (m_unsavedChanges >= changesPerIndexSave)
+        scheduleMaintenance_Locked();
+}
+
+void TileDiskCache::scheduleMaintenance_Locked()
+{
+    if (m_maintenanceQueued)
+        return;
+    m_maintenanceQueued = true;
+    m_maintenancePool.start([this]() { runMaintenance(); });
+}
+
+bool TileDiskCache::isOverQuota_Locked() const
+{
+    return m_limits.maxBytes.has_value() && m_byteSize > m_limits.maxBytes.value();
+}
+
+void TileDiskCache::loadIndex_Locked()
+{
+    QFile file { QDir::cleanPath(m_basePath + QDir::separator() + indexFileName) };
+    if (!file.exists())
+        return;
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "TileDiskCache: Unable to open" << file.fileName() << ":" << file.errorString();
+        return;
+    }
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    if (!document.isObject()) {
+        qWarning() << "TileDiskCache:" << file.fileName() << "is not a valid index, rebuilding it.";
+        return;
+    }
+
+    const QJsonArray tiles = document.object().value("tiles").toArray();
+    for (const QJsonValue &tileValue : tiles) {
+        const QJsonObject tile = tileValue.toObject();
+        std::optional<TileType> type = tileTypeFromString(tile.value("type").toString());
+        if (!type.has_value())
+            continue;
+        const TileCoord coord {
+            tile.value("z").toInt(),
+            tile.value("x").toInt(),
+            tile.value("y").toInt() };
+
+        Entry entry;
+        entry.byteSize = tile.value("size").toInteger();
+        entry.lastAccessMs = tile.value("access").toInteger();
+        entry.expiresMs = tile.value("expires").toInteger();
+        entry.etag = tile.value("etag").toString().toLatin1();
+        entry.lastModified = tile.value("lastModified").toString().toLatin1();
+        m_byteSize += entry.byteSize;
+        m_lastAccessMs = qMax(m_lastAccessMs, entry.lastAccessMs);
+        m_entries[{ coord, type.value() }] = entry;
+    }
+}
+
+void TileDiskCache::runMaintenance()
+{
+    {
+        // Changes made from here on queue another run.
+        QMutexLocker lock { &m_lock };
+        m_maintenanceQueued = false;
+    }
+    if (!m_folderScanned) {
+        scanFolder();
+        m_folderScanned = true;
+    }
+    pruneToQuota();
+    saveIndex();
+}
+
+/*!
+ * \internal
+ * \brief TileDiskCache::scanFolder brings the index in line with the tile files in the cache folder.
+ *
+ * Files missing from the index are added with their modification time as the
+ * time they were last used, and entries whose file is gone are dropped.
+ */
+void TileDiskCache::scanFolder()
+{
+    const qint64 scanStartMs = QDateTime::currentMSecsSinceEpoch();
+    static const QRegularExpression fileNamePattern { "^z(\\d+)x(\\d+)y(\\d+)\\.(mvt|png)$" };
+
+    struct ScannedFile {
+        Key key;
+        qint64 byteSize;
+        qint64 modifiedMs;
+    };
+    std::vector<ScannedFile> scannedFiles;
+    const QFileInfoList fileInfos = QDir{ m_basePath }.entryInfoList({ "*.mvt", "*.png" }, QDir::Files);
+    for (const QFileInfo &fileInfo : fileInfos) {
+        const QRegularExpressionMatch match = fileNamePattern.match(fileInfo.fileName());
+        if (!match.hasMatch())
+            continue;
+        const TileCoord coord { match.captured(1).toInt(), match.captured(2).toInt(), match.captured(3).toInt() };
+        const TileType type = tileTypeFromString(match.captured(4)).value();
+        scannedFiles.push_back({ { coord, type }, fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch() });
+    }
+
+    QMutexLocker lock { &m_lock };
+    std::map<Key, Entry> foundEntries;
+    for (const ScannedFile &scanned : scannedFiles) {
+        auto entryIt = m_entries.find(scanned.key);
+        if (entryIt != m_entries.end()) {
+            // Trust the file over the index about the size.
+            m_byteSize += scanned.byteSize - entryIt->second.byteSize;
+            entryIt->second.byteSize = scanned.byteSize;
+            foundEntries.insert(m_entries.extract(entryIt));
+            continue;
+        }
+        Entry entry;
+        entry.byteSize = scanned.byteSize;
+        entry.lastAccessMs = scanned.modifiedMs;
+        entry.expiresMs = scanned.modifiedMs + defaultMaxAgeSecs * 1000;
+        m_byteSize += entry.byteSize;
+        foundEntries[scanned.key] = entry;
+        m_unsavedChanges++;
+    }
+    // What is left was not found on disk. Tiles written since the scan started are kept.
+    for (auto &[key, entry] : m_entries) {
+        if (entry.lastAccessMs >= scanStartMs) {
+            foundEntries[key] = entry;
+        } else {
+            m_byteSize -= entry.byteSize;
+            m_unsavedChanges++;
+        }
+    }
+    m_entries = std::move(foundEntries);
+}
+
+/*!
+ * \internal
+ * \brief TileDiskCache::pruneToQuota removes the least recently used tiles
+ * from disk until the cache folder is back under its quota.
+ */
+void TileDiskCache::pruneToQuota()
+{
+    std::vector<Key> victims;
+    {
+        QMutexLocker lock { &m_lock };
+        if (!isOverQuota_Locked())
+            return;
+        const qint64 targetBytes = (qint64)(m_limits.maxBytes.value() * pruneTargetRatio);
+
+        std::vector<std::pair<qint64, Key>> byAccess;
+        byAccess.reserve(m_entries.size());
+        for (const auto &[key, entry] : m_entries)
+            byAccess.push_back({ entry.lastAccessMs, key });
+        std::sort(byAccess.begin(), byAccess.end(), [](const auto &a, const auto &b) {
+            return a.first < b.first;
+        });
+
+        for (const auto &[lastAccessMs, key] : byAccess) {
+            if (m_byteSize <= targetBytes)
+                break;
+            auto entryIt = m_entries.find(key);
+            m_byteSize -= entryIt->second.byteSize;
+            m_entries.erase(entryIt);
+            victims.push_back(key);
+        }
+        m_prunedTiles += (qint64)victims.size();
+        m_unsavedChanges += (int)victims.size();
+    }
+
+    // The files are removed without holding the lock, so loading tiles isn't held up.
+    for (const Key &key : victims) {
+        {
+            // Keep the tile if it was written again since it was picked.
+            QMutexLocker lock { &m_lock };
+            if (m_entries.find(key) != m_entries.end())
+                continue;
+        }
+        QFile::remove(tilePath(key));
+    }
+}
+
+/*!
+ * \internal
+ * \brief TileDiskCache::saveIndex writes the index to the cache folder, if it changed.
+ */
+void TileDiskCache::saveIndex()
+{
+    QJsonArray tiles;
+    {
+        QMutexLocker lock { &m_lock };
+        if (m_unsavedChanges == 0)
+            return;
+        m_unsavedChanges = 0;
+        for (const auto &[key, entry] : m_entries) {
+            QJsonObject tile;
+            tile["z"] = key.first.zoom;
+            tile["x"] = key.first.x;
+            tile["y"] = key.first.y;
+            tile["type"] = tileTypeToString(key.second);
+            tile["size"] = entry.byteSize;
+            tile["access"] = entry.lastAccessMs;
+            tile["expires"] = entry.expiresMs;
+            if (!entry.etag.isEmpty())
+                tile["etag"] = QString::fromLatin1(entry.etag);
+            if (!entry.lastModified.isEmpty())
+                tile["lastModified"] = QString::fromLatin1(entry.lastModified);
+            tiles.append(tile);
+        }
+    }
+
+    // Nothing has been cached yet.
+    if (!QDir{ m_basePath }.exists())
+        return;
+
+    QJsonObject root;
+    root["tiles"] = tiles;
+    QSaveFile file { QDir::cleanPath(m_basePath + QDir::separator() + indexFileName) };
+    if (!file.open(QFile::WriteOnly) ||
+        file.write(QJsonDocument{ root }.toJson(QJsonDocument::Compact)) < 0 ||
+        !file.commit())
+    {
+        qWarning() << "TileDiskCache: Unable to save" << file.fileName() << ":" << file.errorString();
+        QMutexLocker lock { &m_lock };
+        m_unsavedChanges++;
+    }
+}
@@ -0,0 +1,176 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TILEDISKCACHE_H
+#define BACH_TILEDISKCACHE_H
+
+// Qt header files
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+
+// STL header files
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Other header files
+#include "TileCoord.h"
+#include "Utilities.h"
+
+namespace Bach {
+    /*!
+     * \brief The TileDiskCacheLimits struct describes how much
+     * the tile cache folder is allowed to hold.
+     */
+    struct TileDiskCacheLimits {
+        /*!
+         * \brief Maximum amount of bytes used by cached tile files.
+         * Set to nullopt for an unbounded cache.
+         */
+        std::optional<qint64> maxBytes;
+    };
+
+    /*!
+     * \brief The TileDiskCacheStats struct contains counters describing
+     * how the tile cache folder has been used.
+     */
+    struct TileDiskCacheStats {
+        // Amount of tiles currently stored in the cache folder.
+        int tileCount = 0;
+        // Amount of bytes used by the cached tile files.
+        qint64 byteSize = 0;
+        // Amount of tiles that have been removed from disk to stay within the quota.
+        qint64 prunedTiles = 0;
+        // Amount of expired tiles the server confirmed to be unchanged,
+        // instead of sending them again.
+        qint64 notModifiedReplies = 0;
+    };
+
+    /*!
+     * \brief The HttpCacheHeaders struct holds the headers of a tile reply
+     * that tell us how long the tile can be used before it has to be revalidated.
+     * Headers missing from the reply are left empty.
+     */
+    struct HttpCacheHeaders {
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray cacheControl;
+        QByteArray expires;
+    };
+
+    /*!
+     * \brief The TileDiskCache class keeps the book-keeping of the tile cache folder.
+     *
+     * For every cached tile file it tracks the size, when the tile was last used,
+     * when it expires and the validators the server sent along with it. Expired tiles
+     * are revalidated with a conditional request, so that a tile that didn't change
+     * only costs a '304 Not Modified' reply.
+     *
+     * Once the folder is over its quota, the least recently used tiles are removed
+     * from disk on a background thread.
+     *
+     * The book-keeping is stored in 'indexFileName' inside the cache folder.
+     * Tile files that are not in the index, like the ones written by older versions,
+     * are picked up when the folder is scanned in the background after opening.
+     *
+     * \threadsafe
+     */
+    class TileDiskCache {
+    public:
+        // File name of the index inside the tile cache folder.
+        static constexpr const char* indexFileName = "tile_cache_index.json";
+        // How long a tile is used before it is revalidated,
+        // when the server didn't tell us.
+        static constexpr qint64 defaultMaxAgeSecs = 7 * 24 * 60 * 60;
+        // Pruning stops once the cache is down to this fraction of the quota,
+        // so that we don't prune again on the very next write.
+        static constexpr double pruneTargetRatio = 0.9;
+
+        static std::unique_ptr<TileDiskCache> open(const QString &basePath);
+
+        TileDiskCache(const TileDiskCache&) = delete;
+        TileDiskCache& operator=(const TileDiskCache&) = delete;
+        ~TileDiskCache();
+
+        void setLimits(const TileDiskCacheLimits &limits);
+        TileDiskCacheLimits limits() const;
+        TileDiskCacheStats stats() const;
+
+        /*!
+         * \brief The Validators struct holds the values to send
+         * with a conditional request for a cached tile.
+         */
+        struct Validators {
+            QByteArray etag;
+            QByteArray lastModified;
+        };
+        std::optional<Validators> validators(TileCoord coord, TileType type) const;
+        bool needsRevalidation(TileCoord coord, TileType type) const;
+
+        void recordWrite(TileCoord coord, TileType type, qint64 byteSize, const HttpCacheHeaders &headers);
+        void recordAccess(TileCoord coord, TileType type);
+        void recordNotModified(TileCoord coord, TileType type, const HttpCacheHeaders &headers);
+        void remove(TileCoord coord, TileType type);
+
+        void waitForMaintenance();
+
+        static qint64 expiryFromHeaders(const HttpCacheHeaders &headers, qint64 nowMs);
+
+    private:
+        TileDiskCache() = default;
+
+        using Key = std::pair<TileCoord, TileType>;
+
+        struct Entry {
+            qint64 byteSize = 0;
+            // Milliseconds since epoch.
+            qint64 lastAccessMs = 0;
+            // Milliseconds since epoch. The tile is revalidated once this has passed.
+            qint64 expiresMs = 0;
+            QByteArray etag;
+            QByteArray lastModified;
+        };
+
+        QString tilePath(const Key &key) const;
+
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        qint64 nextAccessTime_Locked();
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        void markChanged_Locked();
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        void scheduleMaintenance_Locked();
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        bool isOverQuota_Locked() const;
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        void loadIndex_Locked();
+
+        // These run on the maintenance thread, or once it is done.
+        void runMaintenance();
+        void scanFolder();
+        void pruneToQuota();
+        void saveIndex();
+
+        mutable QMutex m_lock;
+        QString m_basePath;
+        std::map<Key, Entry> m_entries;
+        qint64 m_byteSize = 0;
+        TileDiskCacheLimits m_limits;
+        qint64 m_prunedTiles = 0;
+        qint64 m_notModifiedReplies = 0;
+        // The latest access time handed out.
+        qint64 m_lastAccessMs = 0;
+        // Amount of changes since the index was last saved.
+        int m_unsavedChanges = 0;
+        bool m_maintenanceQueued = false;
+        // Only used from the maintenance thread.
+        bool m_folderScanned = false;
+
+        // Runs the maintenance jobs one at a time.
+        QThreadPool m_maintenancePool;
+    };
+}
+
+#endif // BACH_TILEDISKCACHE_H
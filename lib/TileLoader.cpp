@@ -2,9 +2,11 @@
 // SPDX-License-Identifier: MIT
 
 // Qt header files
-#include <QBuffer>
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
 #include <QFile>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -12,10 +14,18 @@
 #include <QNetworkReply>
 #include <QScopeGuard>
 #include <QStandardPaths>
+#include <QTimer>
+
+// STL header files
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 // Other header files
+#include "Rendering.h"
 #include "TileCoord.h"
 #include "TileLoader.h"
+#include "TileTessellation.h"
 #include "Utilities.h"
 
 using Bach::TileLoader;
@@ -23,12 +33,17 @@ using Bach::TileLoader;
 // This might not be ideal place to define this struct.
 struct TileResultType : public Bach::RequestTilesResult {
     virtual ~TileResultType() {
-        // TODO:
-        // This should eventually notify the TileLoader
-        // that our tiles are no longer being read.
-        // Only really necessary when we have an eviction policy in place.
+        // Notify the TileLoader that our tiles are no longer being read,
+        // so that they can be evicted again.
+        if (_tileLoader != nullptr && !_pinnedTiles.isEmpty())
+            _tileLoader->unpinTiles(_pinnedTiles);
     }
 
+    // The TileLoader that pinned the tiles of this result.
+    TileLoader* _tileLoader = nullptr;
+    // The tile-memory entries this result is currently keeping alive.
+    QVector<TileLoader::TileMemoryKey> _pinnedTiles;
+
     // Generate the map holding tile coordinates and a vector tile.
     QMap<TileCoord, const VectorTile*> _vectorMap;
     const QMap<TileCoord, const VectorTile*> &vectorMap() const override
@@ -36,6 +51,15 @@ struct TileResultType : public Bach::RequestTilesResult {
         return _vectorMap;
     }
 
+    // The partially parsed tiles of '_vectorMap'.
+    QMap<TileCoord, const VectorTile*> _partialVectorMap;
+    const QMap<TileCoord, const VectorTile*> &partialVectorMap() const override
+    {
+        return _partialVectorMap;
+    }
+    // Keeps the partially parsed tiles alive, they are not pinned like loaded tiles.
+    std::vector<std::shared_ptr<const VectorTile>> _partialTiles;
+
     // Generate the map holding tile coordinates and a raster tile.
     QMap<TileCoord, const QImage*> _rasterMap;
     const QMap<TileCoord, const QImage*> &rasterImageMap() const override
@@ -43,6 +67,32 @@ struct TileResultType : public Bach::RequestTilesResult {
         return _rasterMap;
     }
 
+    // Loaded tiles that can stand in for the requested tiles that are missing.
+    QMap<TileCoord, const VectorTile*> _fallbackVectorMap;
+    const QMap<TileCoord, const VectorTile*> &fallbackVectorMap() const override
+    {
+        return _fallbackVectorMap;
+    }
+
+    QMap<TileCoord, const QImage*> _fallbackRasterMap;
+    const QMap<TileCoord, const QImage*> &fallbackRasterImageMap() const override
+    {
+        return _fallbackRasterMap;
+    }
+
+    QMap<TileCoord, const QList<QImage>*> _rasterMipLevelMap;
+    const QMap<TileCoord, const QList<QImage>*> &rasterMipLevelMap() const override
+    {
+        return _rasterMipLevelMap;
+    }
+
+    // Requested tiles above the source max zoom, and the tile they are drawn from.
+    QMap<TileCoord, TileCoord> _overzoomMap;
+    const QMap<TileCoord, TileCoord> &overzoomMap() const override
+    {
+        return _overzoomMap;
+    }
+
     const StyleSheet* _styleSheet = nullptr;
     const StyleSheet &styleSheet() const override
     {
@@ -57,7 +107,32 @@ struct TileResultType : public Bach::RequestTilesResult {
 TileLoader::TileLoader() :
     tileCacheDiskPath { getTileCacheFolder() }
 {
+    // Downloads and their replies are handled on a thread of their own,
+    // so bursts of downloads don't hold up the GUI thread.
+    networkManager = new QNetworkAccessManager;
+    networkManager->moveToThread(&networkThread);
+    networkThread.setObjectName("TileLoader network");
+    networkThread.start();
+}
+
+TileLoader::~TileLoader()
+{
+    // Stop replies from queueing more work, and let the workers finish.
+    shuttingDown = true;
+    waitForTasks();
 
+    // The network manager has to be deleted on its own thread,
+    // which also deletes the replies still in flight.
+    QNetworkAccessManager *manager = networkManager;
+    QMetaObject::invokeMethod(
+        manager,
+        [manager]() { delete manager; },
+        Qt::BlockingQueuedConnection);
+    networkThread.quit();
+    networkThread.wait();
+
+    // A reply handled right before we deleted the network manager may have started a job.
+    waitForTasks();
 }
 
 /*!
@@ -92,6 +167,7 @@ std::unique_ptr<TileLoader> TileLoader::fromTileUrlTemplate(
     else
         tileLoader.useWeb = true;
 
+    tileLoader.diskCache = TileDiskCache::open(tileLoader.tileCacheDiskPath);
     return out;
 }
 
@@ -99,14 +175,26 @@ std::unique_ptr<TileLoader> TileLoader::fromTileUrlTemplate(
  * \brief
  * Local-only alternative to 'fromPbfLink' function.
  * Creates a TileLoader that can not access the web and will
- * only try to load from cache.
+ * only try to load from cache, until setTileUrlTemplates is called.
+ *
+ * \param diskCachePath The tile cache folder to load from.
+ * Defaults to the folder of getTileCacheFolder().
+ *
+ * \param loadRaster Whether raster tiles should be loaded along with the vector tiles.
  */
-std::unique_ptr<TileLoader> TileLoader::newLocalOnly(StyleSheet&& styleSheet)
+std::unique_ptr<TileLoader> TileLoader::newLocalOnly(
+    StyleSheet&& styleSheet,
+    const QString &diskCachePath,
+    bool loadRaster)
 {
     auto out = std::unique_ptr<TileLoader>(new TileLoader());
     TileLoader &tileLoader = *out;
     tileLoader.styleSheet = std::move(styleSheet);
     tileLoader.useWeb = false;
+    tileLoader.loadRaster = loadRaster;
+    if (!diskCachePath.isEmpty())
+        tileLoader.tileCacheDiskPath = diskCachePath;
+    tileLoader.diskCache = TileDiskCache::open(tileLoader.tileCacheDiskPath);
     return out;
 }
 
@@ -118,25 +206,35 @@ std::unique_ptr<TileLoader> TileLoader::newLocalOnly(StyleSheet&& styleSheet)
  *
  * \param Takes the directory path to read/write cache into.
  *
- * \param The amount of worker threads, if not set to nullopt. Defaults
- * to nullopt.
+ * \param The amount of worker threads of both the I/O and the CPU pool,
+ * if not set to nullopt. Defaults to nullopt.
+ *
+ * \param The stylesheet that decides which layers are decoded, and in which stages,
+ * see setDecodeStyledLayersOnly and setStreamVectorTileLayers. Empty by default.
  */
 std::unique_ptr<TileLoader> TileLoader::newDummy(
     const QString &diskCachePath,
     std::function<LoadTileOverrideFnT> loadTileOverride,
     bool loadRaster,
-    std::optional<int> workerThreadCount)
+    std::optional<int> workerThreadCount,
+    StyleSheet&& styleSheet)
 {    
     auto out = std::unique_ptr<TileLoader>(new TileLoader());
     TileLoader &tileLoader = *out;
+    tileLoader.styleSheet = std::move(styleSheet);
     if (workerThreadCount.has_value()) {
-        tileLoader.getThreadPool().setMaxThreadCount(workerThreadCount.value());
+        // A scheduler of our own, so that we don't change the threads of the shared one.
+        tileLoader.taskScheduler = std::make_shared<TaskScheduler>("TileLoader");
+        tileLoader.taskScheduler->setThreadCount(TaskScheduler::Pool::Io, workerThreadCount.value());
+        tileLoader.taskScheduler->setThreadCount(TaskScheduler::Pool::Cpu, workerThreadCount.value());
     }
 
     tileLoader.tileCacheDiskPath = diskCachePath;
     tileLoader.useWeb = false;
     tileLoader.loadRaster = loadRaster;
     tileLoader.loadTileOverride = loadTileOverride;
+    if (!diskCachePath.isEmpty())
+        tileLoader.diskCache = TileDiskCache::open(diskCachePath);
     return out;
 }
 
@@ -163,9 +261,10 @@ QString TileLoader::getTileCacheFolder()
  */
 std::optional<Bach::LoadedTileState> TileLoader::getTileState_Vector(TileCoord coord) const
 {
-    auto tileLock = createTileMemoryLocker();
-    auto itemIt = vectorTileMemory.find(coord);
-    if (itemIt == vectorTileMemory.end())
+    const TileMemoryShard &shard = getTileMemoryShard(coord);
+    auto tileLock = shard.createLocker();
+    auto itemIt = shard.vectorTileMemory.find(coord);
+    if (itemIt == shard.vectorTileMemory.end())
         return std::nullopt;
     else {
         const StoredVectorTile &item = itemIt->second;
@@ -174,262 +273,1754 @@ std::optional<Bach::LoadedTileState> TileLoader::getTileState_Vector(TileCoord c
 }
 
 /*!
- * \brief Bach::setPbfLink exchanges x, y, z coordinates in a Protobuf link.
- *
- * The function searches for {x}, {y}, and {z} in the link and replaces them
- * with their corresponding coordinate values from the TileCoord struct:
- * - x: x-coordinate
- * - y: y-coordinate
- * - z: zoomlevel
+ * \brief Controls whether 'requestTiles' also returns the loaded children
+ * of requested tiles that are missing, for example after zooming out.
+ * The closest loaded ancestor is always returned. Disabled by default.
  *
- * \param tileCoord is a struct containing x and y coordinates, z (zoom) information.
- * \param pbfLinkTemplate is the templated URL/link.
- * \return The generated link.
+ * \threadsafe
  */
-QString Bach::setPbfLink(TileCoord tileCoord, const QString &pbfLinkTemplate)
+void TileLoader::setUseDescendantFallbacks(bool enabled)
 {
-    // Exchange the {x, y z} in link
-    auto copy = pbfLinkTemplate;
-    copy.replace("{z}", QString::number(tileCoord.zoom));
-    copy.replace("{x}", QString::number(tileCoord.x));
-    copy.replace("{y}", QString::number(tileCoord.y));
-    return copy;
+    useDescendantFallbacks = enabled;
+}
+
+bool TileLoader::usesDescendantFallbacks() const
+{
+    return useDescendantFallbacks;
 }
 
 /*!
- * \brief Gets the full file-path of a given tile, whether it exists or not.
+ * \brief Sets the highest zoom level the tile source has tiles for.
+ *
+ * Requested tiles above it are never loaded. 'requestTiles' returns their ancestor
+ * at this zoom level in their place, and lists the pair in RequestTilesResult::overzoomMap(),
+ * so the renderer can draw the part of the ancestor that covers the requested tile.
+ * Set to std::nullopt to load every requested tile as-is, which is the default.
+ *
+ * \threadsafe
  */
-QString TileLoader::getTileDiskPath(TileCoord coord, TileType tileType)
+void TileLoader::setSourceMaxZoom(std::optional<int> maxZoom)
 {
-    return tileCacheDiskPath + QDir::separator() + Bach::tileDiskCacheSubPath(coord, tileType);
+    sourceMaxZoom = maxZoom.has_value() ? qMax(*maxZoom, 0) : -1;
+}
+
+std::optional<int> TileLoader::getSourceMaxZoom() const
+{
+    const int maxZoom = sourceMaxZoom;
+    if (maxZoom < 0)
+        return std::nullopt;
+    return maxZoom;
 }
 
 /*!
- * \brief Grabs loaded tiles, and enqueues loading tiles that are missing
- * onto bakground thread(s).
+ * \brief Controls whether vector tiles are tessellated on the worker threads
+ * right after they are parsed. Disabled by default.
  *
- * This function does not block and is not re-entrant as
- * this may get called from a QWidget paint event.
+ * The polygons of every tile are triangulated and its lines extruded, and the meshes
+ * are stored on the layers of the tile, see TileLayer::meshes. Tiles already in memory
+ * are not affected.
  *
- * Returns the set of tiles that are already in memory at the
- * time of the request. To grab new tiles as they are loaded,
- * use the tileLoadedSignalFn parameter and call this function again.
- * Alternatively connect to the tileFinished-signal.
+ * None of the renderers in this library draw the meshes yet, they still fill and stroke
+ * the QPainterPaths of the tiles. Only enable this for a renderer that draws triangles.
+ * Tessellating also decodes the geometry of every layer right away, so it undoes
+ * TileParseOptions::deferGeometry, and the meshes count towards the memory limits.
  *
- * \param requestInput is a set of TileCoords that is requested.
+ * \threadsafe
+ */
+void TileLoader::setTessellateVectorTiles(bool enabled)
+{
+    tessellateVectorTiles = enabled;
+}
+
+bool TileLoader::tessellatesVectorTiles() const
+{
+    return tessellateVectorTiles;
+}
+
+/*!
+ * \brief Controls whether the labels of vector tiles are prepared on the worker threads
+ * right after they are parsed. Disabled by default.
  *
- * \param tileLoadedSignalFn is a function that will get called whenever
- * a vectorTile is loaded, will be called later in time,
- * can be called from another thread. This function
- * will be called once for each vectorTile that was loaded successfully.
+ * The text and styling of every label the style sheet draws at the zoom level of the tile
+ * are resolved and shaped, see Bach::prepareTileLabels, so that painting the tile only
+ * has to place them. Tiles already in memory are not affected.
  *
- * This function is only called if a vectorTile is successfully loaded.
+ * \threadsafe
+ */
+void TileLoader::setPrepareTileLabels(bool enabled)
+{
+    prepareTileLabels = enabled;
+}
+
+bool TileLoader::preparesTileLabels() const
+{
+    return prepareTileLabels;
+}
+
+/*!
+ * \brief Sets the pixel format raster tiles are converted to on the worker threads.
+ * Defaults to QImage::Format_ARGB32_Premultiplied, which QPainter draws the fastest.
  *
- * If this argument is set to null, the missing tiles will not be loaded.
+ * Format_RGB16 halves the memory of every tile, and is faster to draw onto
+ * 16-bit displays. Tiles already in memory are not affected.
  *
- * \param loadMissingTiles can be set to 'false' to force the
- * TileLoader to NOT load tiles that are requested but not loaded.
- * This means missing tiles will NOT be loaded in the future.
+ * \threadsafe
+ */
+void TileLoader::setRasterTileFormat(QImage::Format format)
+{
+    rasterTileFormat = format;
+}
+
+QImage::Format TileLoader::getRasterTileFormat() const
+{
+    return rasterTileFormat;
+}
+
+/*!
+ * \brief Sets how many downscaled copies are kept of every raster tile. Defaults to 0.
  *
- * \return Returns a RequestTilesResult object containing
- * the resulting map of tiles. The returned set of
- * data will always be a subset of requested tiles and all currently loaded tiles.
+ * Each level is half the size of the one before it. When a tile is drawn smaller
+ * than its full size, the smallest level that is still large enough is drawn
+ * instead, see RequestTilesResult::rasterMipLevelMap. Tiles already in memory are not affected.
+ *
+ * \threadsafe
  */
-QScopedPointer<Bach::RequestTilesResult> TileLoader::requestTiles(
-    const std::set<TileCoord> &input,
-    const TileLoadedCallbackFn &signalFn,
-    bool loadMissingTiles)
+void TileLoader::setRasterTileMipLevels(int levels)
 {
-    TileResultType* out = new TileResultType;
-    // Temporary: We just need some way to handle when the user makes
-    // a dummy TileLoader with no stylesheet, but tries to request one anyways.
-    if (!styleSheet.m_layerStyles.empty())
-        out->_styleSheet = &styleSheet;
+    rasterTileMipLevels = qMax(levels, 0);
+}
 
-    // Contains the list of tiles we want to load deferredly.
-    QVector<LoadJob> loadJobs;
+int TileLoader::getRasterTileMipLevels() const
+{
+    return rasterTileMipLevels;
+}
 
-    // Create scope for the mutex-locker
-    {
-        QMutexLocker lock = createTileMemoryLocker();
-        for (TileCoord requestedCoord : input) {
-
-            // First run our code on vector-tiles.
-            {
-                // Load iterator to our tile memory.
-                auto tileIt = vectorTileMemory.find(requestedCoord);
-                // If found, return it immediately.
-                // (Maybe mark it as recently used for cache purposes???)
-                if (tileIt != vectorTileMemory.end()) {
-                    // Key found, check if it can be returned immediately.
-                    const StoredVectorTile &memoryItem = tileIt->second;
-                    // If the item is marked as nullptr,
-                    // it means it is pending and should not be immediately returned.
-                    if (memoryItem.isReadyToRender()) {
-                        out->_vectorMap.insert(requestedCoord, memoryItem.tileData.get());
-                    }
-                } else if (loadMissingTiles) {
-                    // Tile not found, queue it for loading.
-                    // Insert it with the pending status.
-                    vectorTileMemory.insert({
-                        requestedCoord,
-                        StoredVectorTile::newPending() });
-                    loadJobs.push_back({ requestedCoord, TileType::Vector });
-                }
-            }
+/*!
+ * \brief Sets how the geometry of vector tiles is decoded.
+ * By default every vertex of a tile is kept.
+ *
+ * Clipping and simplification make tiles smaller in memory and faster to draw,
+ * see TileParseOptions::forTilePixelSize. Tiles already in memory are not affected.
+ *
+ * \threadsafe
+ */
+void TileLoader::setTileParseOptions(const TileParseOptions &options)
+{
+    QMutexLocker lock { _parseOptionsLock.get() };
+    parseOptions = options;
+}
 
-            {
-                // Load iterator to our tile memory.
-                auto tileIt = rasterTileMemory.find(requestedCoord);
-                // If found, return it immediately.
-                if (tileIt != rasterTileMemory.end()) {
-                    // Key found, check if it can be returned immediately.
-                    const StoredRasterTile &memoryItem = tileIt->second;
-                    // If the item is marked as nullptr,
-                    // it means it is pending and should not be immediately returned.
-                    if (memoryItem.isReadyToRender()) {
-                        out->_rasterMap.insert(requestedCoord, &memoryItem.image);
-                    }
-                } else if (loadMissingTiles && loadRaster) {
-                    // Tile not found, queue it for loading.
-                    // Insert it with the pending status.
-                    rasterTileMemory.insert({
-                        requestedCoord,
-                        StoredRasterTile::newPending() });
-                    loadJobs.push_back({ requestedCoord, TileType::Raster });
-                }
-            }
-        }
-    }
-    if (loadMissingTiles)
-        queueTileLoadingJobs(loadJobs, signalFn);
+Bach::TileParseOptions TileLoader::getTileParseOptions() const
+{
+    QMutexLocker lock { _parseOptionsLock.get() };
+    return parseOptions;
+}
 
-    return QScopedPointer<Bach::RequestTilesResult>{ out };
+/*!
+ * \brief Controls whether vector tiles are parsed with only the layers
+ * the style sheet draws at the zoom levels the tile can be shown at. Disabled by default.
+ *
+ * The other layers are skipped without being decoded, which saves both
+ * parse time and memory. This replaces the 'layerNames' of the parse options.
+ * Tiles already in memory are not affected.
+ *
+ * \threadsafe
+ */
+void TileLoader::setDecodeStyledLayersOnly(bool enabled)
+{
+    decodeStyledLayersOnly = enabled;
+}
+
+bool TileLoader::decodesStyledLayersOnly() const
+{
+    return decodeStyledLayersOnly;
 }
 
 /*!
- * \brief Loads the given tile from disk and inserts it
- * into memory. This is a blocking call.
+ * \brief Controls whether vector tiles are handed out while they are being parsed.
+ * Disabled by default.
+ *
+ * The layers of a tile are then decoded in the stages of StyleSheet::sourceLayerStages,
+ * and after each stage but the last, 'requestTiles' returns the tile with the layers
+ * decoded so far, see RequestTilesResult::partialVectorMap. The base map, such as water
+ * and landcover, then shows up before the rest of a large tile is parsed. The callback
+ * passed to 'requestTiles' is run after each stage, while 'tileFinished' is only
+ * emitted for the complete tile.
  *
- * \return Returns true if it was unable to load from disk
+ * \threadsafe
  */
-bool TileLoader::loadFromDisk_Vector(TileCoord coord, TileLoadedCallbackFn signalFn)
+void TileLoader::setStreamVectorTileLayers(bool enabled)
 {
-    // Check if the tile in disk.
-    QString vectorDiskPath = getTileDiskPath(coord, TileType::Vector);
-    QFile vectorFile { vectorDiskPath };
-    if (!vectorFile.exists()) {
-        // This is NOT an error. This just means our cache files didn't exist and we should return false
-        return false;
-    }
+    streamVectorTileLayers = enabled;
+}
 
-    // TODO: Check that the file isn't currently being written into
-    // by another thread by checking for associated .lock file.
-    if (!vectorFile.open(QFile::ReadOnly)) {
-        // TODO: This should return the error instead of printing.
-        qDebug() << "Tried reading tile from file, but encountered unexpected error when opening file.\n";
-        // Error, file exists but didn't open.
-        return false;
-    }
+bool TileLoader::streamsVectorTileLayers() const
+{
+    return streamVectorTileLayers;
+}
 
-    // Successfully opened file, read contents.
-    QByteArray vectorBytes = vectorFile.readAll();
+/*!
+ * \internal
+ * \brief Picks the shard a given tile coordinate belongs to.
+ */
+static int tileMemoryShardIndex(TileCoord coord, int shardCount)
+{
+    // Neighbouring tiles are requested together, and the hash spreads them across shards.
+    // The hash maps of every shard pick buckets from the bottom bits, so we skip those.
+    const size_t hash = qHash(coord);
+    return (int)((hash >> 16) % (size_t)shardCount);
+}
 
-    // Now we need to insert the tile into the tile-memory
-    // and NOT insert it into disk cache.
-    insertIntoTileMemory_Vector(coord, vectorBytes, signalFn);
+TileLoader::TileMemoryShard& TileLoader::getTileMemoryShard(TileCoord coord)
+{
+    return tileMemoryShards[tileMemoryShardIndex(coord, tileMemoryShardCount)];
+}
 
-    // Return success if we found the file.
-    return true;
+const TileLoader::TileMemoryShard& TileLoader::getTileMemoryShard(TileCoord coord) const
+{
+    return tileMemoryShards[tileMemoryShardIndex(coord, tileMemoryShardCount)];
+}
+
+TileLoader::StoredTileBase* TileLoader::TileMemoryShard::find(const TileMemoryKey &key)
+{
+    if (key.type == TileType::Vector) {
+        auto tileIt = vectorTileMemory.find(key.coord);
+        return tileIt == vectorTileMemory.end() ? nullptr : &tileIt->second;
+    } else {
+        auto tileIt = rasterTileMemory.find(key.coord);
+        return tileIt == rasterTileMemory.end() ? nullptr : &tileIt->second;
+    }
 }
 
 /*!
- * \brief Loads the given tile from disk and inserts it
- * into memory. This is a blocking call.
+ * \brief Sets the URL templates to download tiles from, after the TileLoader was created.
  *
- * \return Returns true if it was unable to load from disk
+ * Lets the application start drawing cached tiles before the templates are known.
+ * Vector tiles are downloaded once the vector template is set, raster tiles once
+ * both are. Tiles that failed to load while the web was unavailable are loaded
+ * again the next time they are requested.
+ *
+ * \param pbfUrlTemplate The URL template of the vector tiles. Empty to not use the web.
+ * \param pngUrlTemplate The URL template of the raster tiles, may be empty.
+ *
+ * \threadsafe
  */
-bool TileLoader::loadFromDisk_Raster(TileCoord coord, TileLoadedCallbackFn signalFn)
+void TileLoader::setTileUrlTemplates(const QString &pbfUrlTemplate, const QString &pngUrlTemplate)
 {
-    // Check if the tile in disk.
-    QString diskPath = getTileDiskPath(coord, TileType::Raster);
-    QFile file { diskPath };
-    if (!file.exists()) {
-        // This is NOT an error. This just means our cache files didn't exist and we should return false
-        return false;
+    {
+        QMutexLocker lock { urlTemplateLock.get() };
+        pbfLinkTemplate = pbfUrlTemplate;
+        this->pngUrlTemplate = pngUrlTemplate;
     }
+    useWeb = !pbfUrlTemplate.isEmpty();
+    if (!useWeb)
+        return;
 
-    // TODO: Check that the file isn't currently being written into
-    // by another thread by checking for associated .lock file.
-    if (!file.open(QFile::ReadOnly)) {
-        // TODO: This should return the error instead of printing.
-        qDebug() << "Tried reading tile from file, but encountered unexpected error when opening file.\n";
-        // Error, file exists but didn't open.
-        return false;
+    // Failed tiles are never queued again by requestTiles, but cancelled ones are.
+    for (TileMemoryShard &shard : tileMemoryShards) {
+        QMutexLocker lock = shard.createLocker();
+        for (auto &[coord, item] : shard.vectorTileMemory) {
+            if (item.state == Bach::LoadedTileState::UnknownError)
+                item.state = Bach::LoadedTileState::Cancelled;
+        }
+        for (auto &[coord, item] : shard.rasterTileMemory) {
+            if (item.state == Bach::LoadedTileState::UnknownError)
+                item.state = Bach::LoadedTileState::Cancelled;
+        }
     }
+}
 
-    // Successfully opened file, read contents.
-    QByteArray bytes = file.readAll();
+/*!
+ * \brief Sets the budget for the in-memory tile cache.
+ *
+ * Loaded tiles are evicted in least-recently-requested order until the
+ * budget is satisfied. With TileMemoryLimits::maxParsedVectorTiles set,
+ * the least recently requested vector tiles are first demoted to their
+ * encoded bytes instead.
+ *
+ * Tiles held by a live RequestTilesResult are never evicted, so the
+ * budget may be temporarily exceeded while they are being read.
+ *
+ * \threadsafe
+ */
+void TileLoader::setTileMemoryLimits(const TileMemoryLimits &limits)
+{
+    {
+        QMutexLocker evictionLock { _evictionLock.get() };
+        tileMemoryLimits = limits;
+        keepEncodedVectorTiles = limits.maxParsedVectorTiles.has_value();
+    }
+    evictTilesOverBudget();
+}
 
-    // Now we need to insert the tile into the tile-memory
-    // and NOT insert it into disk cache.
-    insertIntoTileMemory_Raster(coord, bytes, signalFn);
+/*!
+ * \brief Returns the current budget of the in-memory tile cache.
+ *
+ * \threadsafe
+ */
+Bach::TileMemoryLimits TileLoader::getTileMemoryLimits() const
+{
+    QMutexLocker evictionLock { _evictionLock.get() };
+    return tileMemoryLimits;
+}
 
-    // Return success if we found the file.
-    return true;
+/*!
+ * \brief Returns the hit, miss and eviction counters of the in-memory
+ * tile cache, along with its current size.
+ *
+ * Counting the pending tiles locks every shard in turn, so this is meant
+ * to be called about once per frame, not once per tile.
+ *
+ * \threadsafe
+ */
+Bach::TileMemoryStats TileLoader::getTileMemoryStats() const
+{
+    TileMemoryStats out;
+    out.hits = tileMemoryHits;
+    out.misses = tileMemoryMisses;
+    out.evictions = tileMemoryEvictions;
+    out.demotions = tileMemoryDemotions;
+    out.promotions = tileMemoryPromotions;
+    out.tileCount = (int)tileMemoryTileCount;
+    out.byteSize = tileMemoryByteSize;
+    out.demotedTileCount = (int)tileMemoryDemotedCount;
+    out.prefetchLoads = prefetchLoads;
+    out.prefetchHits = prefetchHits;
+    out.activeDownloads = activeDownloadCount;
+    for (const TileMemoryShard &shard : tileMemoryShards) {
+        auto shardLock = shard.createLocker();
+        for (const auto &[coord, item] : shard.vectorTileMemory) {
+            if (item.state == Bach::LoadedTileState::Pending)
+                out.pendingTileCount++;
+        }
+        for (const auto &[coord, item] : shard.rasterTileMemory) {
+            if (item.state == Bach::LoadedTileState::Pending)
+                out.pendingTileCount++;
+        }
+    }
+    return out;
 }
 
+/*!
+ * \internal
+ * \brief Moves a pending tile into its new state, and releases
+ * its share of the prefetch budget if it was prefetched.
+ *
+ * IMPORTANT! Only use when the shard's lock is held!
+ */
+void TileLoader::finishPendingTile_Locked(StoredTileBase &item, Bach::LoadedTileState newState)
+{
+    if (item.prefetched && item.state == Bach::LoadedTileState::Pending)
+        pendingPrefetchLoads--;
+    item.state = newState;
+}
 
 /*!
- * \brief TileLoader::writeTileToDisk writes a tile to disk cache.
- * \param coord is the ZXY coordinate of the tile to write to disk.
- * \param bytes is vector tile information stored as a QByteArray.
+ * \internal
+ * \brief Registers a tile that just finished loading with the memory budget.
+ * The tile is inserted as the most recently used entry of its shard.
+ *
+ * IMPORTANT! Only use when the shard's lock is held!
  */
-void TileLoader::writeTileToDisk_Raster(
-    TileCoord coord,
-    const QByteArray &rasterBytes)
+void TileLoader::trackLoadedTile_Locked(
+    TileMemoryShard &shard,
+    const TileMemoryKey &key,
+    StoredTileBase &item)
 {
-    // TODO unused return value of this function.
-    Bach::writeTileToDiskCache_Raster(
-        tileCacheDiskPath,
-        coord,
-        rasterBytes);
+    item.lastUsedTick = ++tileMemoryAccessTick;
+    item.lruIt = shard.lru.insert(shard.lru.end(), key);
+    tileMemoryNewestInsertTick = item.lastUsedTick;
+    tileMemoryTileCount++;
+    tileMemoryByteSize += item.byteSize;
 }
 
 /*!
- * \brief TileLoader::writeTileToDisk writes a tile to disk cache.
- * \param coord is the ZXY coordinate of the tile to write to disk.
- * \param bytes is vector tile information stored as a QByteArray.
+ * \internal
+ * \brief Marks a loaded tile as the most recently used.
+ *
+ * IMPORTANT! Only use when the shard's lock is held!
  */
-void TileLoader::writeTileToDisk_Vector(
-    TileCoord coord,
-    const QByteArray &vectorBytes)
+void TileLoader::markRecentlyUsed_Locked(TileMemoryShard &shard, StoredTileBase &item)
+{
+    item.lastUsedTick = ++tileMemoryAccessTick;
+    shard.lru.splice(shard.lru.end(), shard.lru, item.lruIt);
+}
+
+/*!
+ * \internal
+ * \brief Drops the parsed tile-data of a vector tile, and keeps only its encoded bytes.
+ * The tile is parsed again from memory the next time it is requested.
+ *
+ * \return true if the encoded bytes should be compressed, see compressDemotedTile_Vector.
+ * Compressing is slow, so it is left for the caller to do once the locks are released.
+ *
+ * IMPORTANT! Only use when both the shard's lock and '_evictionLock' are held!
+ */
+bool TileLoader::demoteVectorTile_Locked(StoredVectorTile &item)
 {
-    // TODO unused return value of this function.
-    Bach::writeTileToDiskCache_Vector(
+    BACH_TRACE_SCOPE("TileLoader::demoteVectorTile");
+    item.tileData = nullptr;
+    item.demoted = true;
+
+    tileMemoryByteSize -= item.byteSize;
+    item.byteSize = item.encodedBytes.size();
+    tileMemoryByteSize += item.byteSize;
+    tileMemoryParsedVectorCount--;
+    tileMemoryDemotedCount++;
+    tileMemoryDemotions++;
+    return tileMemoryLimits.compressDemotedVectorTiles && !item.encodedBytesCompressed;
+}
+
+/*!
+ * \internal
+ * \brief Compresses the encoded bytes of a demoted vector tile,
+ * see TileMemoryLimits::compressDemotedVectorTiles.
+ *
+ * The bytes are compressed without holding any lock, and only swapped in
+ * if the tile is still demoted with the same bytes by then.
+ *
+ * Must be called without holding any shard lock or '_evictionLock'.
+ *
+ * \threadsafe
+ */
+void TileLoader::compressDemotedTile_Vector(TileCoord coord)
+{
+    BACH_TRACE_SCOPE("TileLoader::compressDemotedTile_Vector");
+    TileMemoryShard &shard = getTileMemoryShard(coord);
+
+    QByteArray encodedBytes;
+    {
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.vectorTileMemory.find(coord);
+        if (tileIt == shard.vectorTileMemory.end() ||
+            !tileIt->second.demoted ||
+            tileIt->second.encodedBytesCompressed)
+        {
+            return;
+        }
+        // The bytes are shared, so this doesn't copy them.
+        encodedBytes = tileIt->second.encodedBytes;
+    }
+
+    QByteArray compressedBytes = qCompress(encodedBytes);
+
+    QMutexLocker lock = shard.createLocker();
+    auto tileIt = shard.vectorTileMemory.find(coord);
+    // The tile may have been promoted, evicted or loaded again while we compressed it.
+    if (tileIt == shard.vectorTileMemory.end())
+        return;
+    StoredVectorTile &memoryItem = tileIt->second;
+    if (!memoryItem.demoted ||
+        memoryItem.encodedBytesCompressed ||
+        !memoryItem.encodedBytes.isSharedWith(encodedBytes))
+    {
+        return;
+    }
+    memoryItem.encodedBytes = std::move(compressedBytes);
+    memoryItem.encodedBytesCompressed = true;
+    tileMemoryByteSize -= memoryItem.byteSize;
+    memoryItem.byteSize = memoryItem.encodedBytes.size();
+    tileMemoryByteSize += memoryItem.byteSize;
+}
+
+/*!
+ * \internal
+ * \brief Demotes and evicts the least recently used tiles until the memory budget is satisfied.
+ *
+ * Vector tiles over TileMemoryLimits::maxParsedVectorTiles are demoted first, and then
+ * whole tiles are evicted until the rest of the limits are met. Demoted tiles keep
+ * their place in the LRU order, so they are the first to be evicted.
+ *
+ * Every shard keeps its own LRU list, so the oldest evictable entry overall is
+ * found by comparing the oldest evictable entry of each shard. We only ever hold
+ * one shard lock at a time, which means workers and the paint thread can keep
+ * using the other shards while we evict.
+ *
+ * Pinned tiles are skipped. The most recently inserted tile is never evicted,
+ * this way a tile that just finished loading will always make it to the
+ * next render even when the budget is too small.
+ *
+ * Must be called without holding any shard lock.
+ *
+ * \threadsafe
+ */
+void TileLoader::evictTilesOverBudget()
+{
+    QMutexLocker evictionLock { _evictionLock.get() };
+
+    auto isOverBudget = [&]() {
+        const TileMemoryLimits &limits = tileMemoryLimits;
+        if (limits.maxTileCount.has_value() && tileMemoryTileCount > limits.maxTileCount.value())
+            return true;
+        if (limits.maxBytes.has_value() && tileMemoryByteSize > limits.maxBytes.value())
+            return true;
+        return false;
+    };
+
+    auto isOverParsedBudget = [&]() {
+        const TileMemoryLimits &limits = tileMemoryLimits;
+        return limits.maxParsedVectorTiles.has_value() &&
+            tileMemoryParsedVectorCount > limits.maxParsedVectorTiles.value();
+    };
+
+    auto isEvictable = [](const TileMemoryKey &, const StoredTileBase &) { return true; };
+    auto isDemotable = [](const TileMemoryKey &key, const StoredTileBase &item) {
+        if (key.type != TileType::Vector || !item.isReadyToRender())
+            return false;
+        const auto &vectorItem = static_cast<const StoredVectorTile&>(item);
+        return vectorItem.tileData != nullptr && !vectorItem.encodedBytes.isEmpty();
+    };
+
+    // Finds the oldest entry of a shard that we are allowed to touch, and that passes the filter.
+    auto findOldest_Locked = [&](TileMemoryShard &shard, const auto &filterFn) -> std::optional<TileMemoryKey> {
+        quint64 newestInsertTick = tileMemoryNewestInsertTick;
+        for (const TileMemoryKey &key : shard.lru) {
+            StoredTileBase* item = shard.find(key);
+            Q_ASSERT(item != nullptr);
+            if (item->pinCount > 0 || item->lastUsedTick == newestInsertTick)
+                continue;
+            if (!filterFn(key, *item))
+                continue;
+            return key;
+        }
+        return std::nullopt;
+    };
+
+    // Finds the shard holding the oldest entry across all shards that passes the filter.
+    // Returns -1 if there is none.
+    auto findOldestShard = [&](const auto &filterFn) {
+        int victimShardIndex = -1;
+        quint64 victimTick = 0;
+        for (int i = 0; i < tileMemoryShardCount; i++) {
+            TileMemoryShard &shard = tileMemoryShards[i];
+            auto shardLock = shard.createLocker();
+            std::optional<TileMemoryKey> candidate = findOldest_Locked(shard, filterFn);
+            if (!candidate.has_value())
+                continue;
+            quint64 candidateTick = shard.find(candidate.value())->lastUsedTick;
+            if (victimShardIndex == -1 || candidateTick < victimTick) {
+                victimShardIndex = i;
+                victimTick = candidateTick;
+            }
+        }
+        return victimShardIndex;
+    };
+
+    // The demoted tiles whose bytes still have to be compressed.
+    std::vector<TileCoord> compressibleTiles;
+    while (isOverParsedBudget()) {
+        const int victimShardIndex = findOldestShard(isDemotable);
+        // Everything left is pinned or can't be demoted.
+        if (victimShardIndex == -1)
+            break;
+
+        // The shard may have changed since we released its lock,
+        // so we pick the oldest demotable entry again.
+        TileMemoryShard &shard = tileMemoryShards[victimShardIndex];
+        auto shardLock = shard.createLocker();
+        std::optional<TileMemoryKey> victim = findOldest_Locked(shard, isDemotable);
+        if (!victim.has_value())
+            continue;
+        if (demoteVectorTile_Locked(shard.vectorTileMemory.at(victim->coord)))
+            compressibleTiles.push_back(victim->coord);
+    }
+
+    // Compressing is slow, so every other user of the tile memory may go on meanwhile.
+    if (!compressibleTiles.empty()) {
+        evictionLock.unlock();
+        for (TileCoord coord : compressibleTiles)
+            compressDemotedTile_Vector(coord);
+        evictionLock.relock();
+    }
+
+    while (isOverBudget()) {
+        // Look for our victim.
+        const int victimShardIndex = findOldestShard(isEvictable);
+        // Everything left is pinned.
+        if (victimShardIndex == -1)
+            return;
+
+        // The shard may have changed since we released its lock,
+        // so we pick the oldest evictable entry again.
+        TileMemoryShard &shard = tileMemoryShards[victimShardIndex];
+        auto shardLock = shard.createLocker();
+        std::optional<TileMemoryKey> victim = findOldest_Locked(shard, isEvictable);
+        if (!victim.has_value())
+            continue;
+
+        StoredTileBase* item = shard.find(victim.value());
+        tileMemoryByteSize -= item->byteSize;
+        tileMemoryTileCount--;
+        shard.lru.erase(item->lruIt);
+        if (victim->type == TileType::Vector) {
+            const StoredVectorTile &vectorItem = shard.vectorTileMemory.at(victim->coord);
+            if (vectorItem.demoted)
+                tileMemoryDemotedCount--;
+            else if (vectorItem.tileData != nullptr)
+                tileMemoryParsedVectorCount--;
+            shard.vectorTileMemory.erase(victim->coord);
+        } else {
+            shard.rasterTileMemory.erase(victim->coord);
+        }
+        tileMemoryEvictions++;
+    }
+}
+
+/*!
+ * \internal
+ * \brief Releases the pins held by a RequestTilesResult,
+ * then evicts tiles that are no longer needed to stay within budget.
+ *
+ * \threadsafe
+ */
+void TileLoader::unpinTiles(const QVector<TileMemoryKey> &keys)
+{
+    for (const TileMemoryKey &key : keys) {
+        TileMemoryShard &shard = getTileMemoryShard(key.coord);
+        auto shardLock = shard.createLocker();
+        StoredTileBase* item = shard.find(key);
+        if (item != nullptr && item->pinCount > 0)
+            item->pinCount--;
+    }
+    evictTilesOverBudget();
+}
+
+/*!
+ * \brief Bach::setPbfLink exchanges x, y, z coordinates in a Protobuf link.
+ *
+ * The function searches for {x}, {y}, and {z} in the link and replaces them
+ * with their corresponding coordinate values from the TileCoord struct:
+ * - x: x-coordinate
+ * - y: y-coordinate
+ * - z: zoomlevel
+ *
+ * \param tileCoord is a struct containing x and y coordinates, z (zoom) information.
+ * \param pbfLinkTemplate is the templated URL/link.
+ * \return The generated link.
+ */
+QString Bach::setPbfLink(TileCoord tileCoord, const QString &pbfLinkTemplate)
+{
+    // Exchange the {x, y z} in link
+    auto copy = pbfLinkTemplate;
+    copy.replace("{z}", QString::number(tileCoord.zoom));
+    copy.replace("{x}", QString::number(tileCoord.x));
+    copy.replace("{y}", QString::number(tileCoord.y));
+    return copy;
+}
+
+/*!
+ * \brief Gets the full file-path of a given tile, whether it exists or not.
+ */
+QString TileLoader::getTileDiskPath(TileCoord coord, TileType tileType)
+{
+    return tileCacheDiskPath + QDir::separator() + Bach::tileDiskCacheSubPath(coord, tileType);
+}
+
+/*!
+ * \brief Switches the disk cache over to a single pack file,
+ * instead of one file per tile. See TilePackFile.
+ *
+ * Tiles already cached as separate files are not read from
+ * or moved into the pack. Must be called before any tiles are requested.
+ *
+ * \param packFilePath The pack file to use. Defaults to the
+ * 'packedDiskCacheFileName' in the tile cache folder.
+ *
+ * \return Returns true if the pack file could be opened.
+ * Otherwise the TileLoader keeps using separate files.
+ */
+bool TileLoader::enablePackedDiskCache(const QString &packFilePath)
+{
+    const QString path = packFilePath.isEmpty() ?
+        QDir::cleanPath(tileCacheDiskPath + QDir::separator() + packedDiskCacheFileName) :
+        packFilePath;
+    diskCachePack = TilePackFile::open(path);
+    return diskCachePack != nullptr;
+}
+
+bool TileLoader::isUsingPackedDiskCache() const
+{
+    return diskCachePack != nullptr;
+}
+
+/*!
+ * \brief Sets the quota of the tile cache folder. Once the folder is over it,
+ * the least recently used tiles are removed from disk in the background.
+ *
+ * Has no effect when the packed disk cache is used.
+ */
+void TileLoader::setDiskCacheLimits(const TileDiskCacheLimits &limits)
+{
+    if (diskCache != nullptr)
+        diskCache->setLimits(limits);
+}
+
+Bach::TileDiskCacheLimits TileLoader::getDiskCacheLimits() const
+{
+    return diskCache != nullptr ? diskCache->limits() : TileDiskCacheLimits{};
+}
+
+Bach::TileDiskCacheStats TileLoader::getDiskCacheStats() const
+{
+    TileDiskCache *cache = activeDiskCache();
+    return cache != nullptr ? cache->stats() : TileDiskCacheStats{};
+}
+
+/*!
+ * \internal
+ * \brief Returns the book-keeping of the tile cache folder,
+ * or nullptr if tiles are not cached as separate files.
+ */
+Bach::TileDiskCache* TileLoader::activeDiskCache() const
+{
+    if (diskCachePack != nullptr)
+        return nullptr;
+    return diskCache.get();
+}
+
+/*!
+ * \internal
+ * \brief Returns true if the tile is cached on disk, but has expired
+ * and should be revalidated with the server before it is used.
+ */
+bool TileLoader::needsRevalidation(TileCoord coord, TileType type) const
+{
+    TileDiskCache *cache = activeDiskCache();
+    return useWeb && cache != nullptr && cache->needsRevalidation(coord, type);
+}
+
+/*!
+ * \internal
+ * \brief Returns true if the tile is in the disk cache, without reading it.
+ */
+bool TileLoader::isTileOnDisk(TileCoord coord, TileType type) const
+{
+    if (diskCachePack != nullptr)
+        return diskCachePack->find(coord, type).has_value();
+    return QFile::exists(tileCacheDiskPath + QDir::separator() + Bach::tileDiskCacheSubPath(coord, type));
+}
+
+/*!
+ * \internal
+ * \brief Adds the validators of a cached tile to a request, so the
+ * server can reply with '304 Not Modified' if the tile didn't change.
+ */
+static void addConditionalHeaders(
+    QNetworkRequest &request,
+    const std::optional<Bach::TileDiskCache::Validators> &validators)
+{
+    if (!validators.has_value())
+        return;
+    if (!validators->etag.isEmpty())
+        request.setRawHeader("If-None-Match", validators->etag);
+    if (!validators->lastModified.isEmpty())
+        request.setRawHeader("If-Modified-Since", validators->lastModified);
+}
+
+static Bach::HttpCacheHeaders cacheHeadersFromReply(const QNetworkReply &reply)
+{
+    Bach::HttpCacheHeaders out;
+    out.etag = reply.rawHeader("ETag");
+    out.lastModified = reply.rawHeader("Last-Modified");
+    out.cacheControl = reply.rawHeader("Cache-Control");
+    out.expires = reply.rawHeader("Expires");
+    return out;
+}
+
+/*!
+ * \brief Grabs loaded tiles, and enqueues loading tiles that are missing
+ * onto bakground thread(s).
+ *
+ * This function does not block and is not re-entrant as
+ * this may get called from a QWidget paint event.
+ *
+ * Returns the set of tiles that are already in memory at the
+ * time of the request. To grab new tiles as they are loaded,
+ * use the tileLoadedSignalFn parameter and call this function again.
+ * Alternatively connect to the tileFinished-signal.
+ *
+ * \param requestInput is the list of TileCoords that is requested,
+ * such as the list from Bach::calcVisibleTiles. Tiles listed more than once are only
+ * handled once. Tiles that are equally urgent are loaded in the order they are listed.
+ *
+ * \param tileLoadedSignalFn is a function that will get called whenever
+ * a vectorTile is loaded, will be called later in time,
+ * can be called from another thread. This function
+ * will be called once for each vectorTile that was loaded successfully.
+ *
+ * This function is only called if a vectorTile is successfully loaded.
+ *
+ * If this argument is set to null, the missing tiles will not be loaded.
+ *
+ * \param loadMissingTiles can be set to 'false' to force the
+ * TileLoader to NOT load tiles that are requested but not loaded.
+ * This means missing tiles will NOT be loaded in the future.
+ *
+ * For every requested tile that is not ready, the result also holds the
+ * closest loaded ancestor, and the loaded children if descendant fallbacks
+ * are enabled. These are not loaded if missing.
+ *
+ * When set to 'true', the requested set replaces the set of tiles the
+ * client wants loaded. Queued jobs and network downloads of tiles
+ * no client wants are cancelled, and the missing tiles are loaded at
+ * the zoom level of the request first, closest to its centre first.
+ * If a prefetch policy is set, tiles around the request are queued
+ * after the requested tiles, see TilePrefetchPolicy.
+ *
+ * If a source max zoom is set, requested tiles above it are replaced by their
+ * ancestor at the source max zoom, see setSourceMaxZoom.
+ *
+ * \return Returns a RequestTilesResult object containing
+ * the resulting map of tiles. The returned set of
+ * data will always be a subset of requested tiles and all currently loaded tiles.
+ */
+QScopedPointer<Bach::RequestTilesResult> TileLoader::requestTiles(
+    const QVector<TileCoord> &requestedTiles,
+    const TileLoadedCallbackFn &signalFn,
+    bool loadMissingTiles,
+    ClientId client)
+{
+    BACH_TRACE_SCOPE("TileLoader::requestTiles");
+    TileResultType* out = new TileResultType;
+    out->_tileLoader = this;
+    // Temporary: We just need some way to handle when the user makes
+    // a dummy TileLoader with no stylesheet, but tries to request one anyways.
+    if (!styleSheet.m_layerStyles.empty())
+        out->_styleSheet = &styleSheet;
+
+    // Tiles above the source max zoom don't exist, so their ancestors are handled in their place.
+    // Siblings share the same ancestor, so the ancestor is only loaded and returned once.
+    QVector<TileCoord> input;
+    input.reserve(requestedTiles.size());
+    std::unordered_set<TileCoord> inputSet;
+    inputSet.reserve(requestedTiles.size());
+    const std::optional<int> maxZoom = getSourceMaxZoom();
+    for (TileCoord requestedCoord : requestedTiles) {
+        TileCoord inputCoord = requestedCoord;
+        if (maxZoom.has_value() && requestedCoord.zoom > *maxZoom) {
+            const int levelsUp = requestedCoord.zoom - *maxZoom;
+            inputCoord = { *maxZoom, requestedCoord.x >> levelsUp, requestedCoord.y >> levelsUp };
+            out->_overzoomMap.insert(requestedCoord, inputCoord);
+        }
+        if (inputSet.insert(inputCoord).second)
+            input.push_back(inputCoord);
+    }
+
+    // Contains the list of tiles we want to load deferredly.
+    QVector<LoadJob> loadJobs;
+
+    // Replace the wanted tiles before looking at the tile memory, so that a
+    // worker cancelling one of our tiles at the same time either sees it
+    // as wanted, or leaves it cancelled for us to queue again below.
+    quint64 generation = 0;
+    QVector<TileCoord> prefetchTiles;
+    if (loadMissingTiles) {
+        prefetchTiles = calcPrefetchTiles(client, input, inputSet);
+        generation = setWantedTiles(client, inputSet, prefetchTiles);
+    }
+
+    // The first request of a prefetched tile tells us whether the prefetch paid off.
+    auto claimPrefetchedTile = [&](StoredTileBase &item) {
+        if (!item.prefetched)
+            return;
+        item.prefetched = false;
+        if (item.isReadyToRender())
+            prefetchHits++;
+        else if (item.state == Bach::LoadedTileState::Pending)
+            pendingPrefetchLoads--;
+    };
+
+    for (TileCoord requestedCoord : input) {
+        // Only lock the shard this tile belongs to, so that workers
+        // publishing into other shards don't stall us.
+        TileMemoryShard &shard = getTileMemoryShard(requestedCoord);
+        QMutexLocker lock = shard.createLocker();
+
+        // First run our code on vector-tiles.
+        {
+            // Load iterator to our tile memory.
+            auto tileIt = shard.vectorTileMemory.find(requestedCoord);
+            // If found, return it immediately.
+            if (tileIt != shard.vectorTileMemory.end()) {
+                // Key found, check if it can be returned immediately.
+                StoredVectorTile &memoryItem = tileIt->second;
+                claimPrefetchedTile(memoryItem);
+                // If the item is marked as nullptr,
+                // it means it is pending and should not be immediately returned.
+                if (memoryItem.isReadyToRender()) {
+                    out->_vectorMap.insert(requestedCoord, memoryItem.tileData.get());
+                    // Pin the tile for as long as the result is alive,
+                    // and mark it as the most recently used.
+                    memoryItem.pinCount++;
+                    out->_pinnedTiles.push_back({ requestedCoord, TileType::Vector });
+                    markRecentlyUsed_Locked(shard, memoryItem);
+                    tileMemoryHits++;
+                } else if (loadMissingTiles && memoryItem.demoted) {
+                    tileMemoryMisses++;
+                    // The tile is kept as its encoded bytes, parse it again from memory.
+                    markRecentlyUsed_Locked(shard, memoryItem);
+                    if (!memoryItem.promoting) {
+                        memoryItem.promoting = true;
+                        LoadJob job { requestedCoord, TileType::Vector };
+                        job.promote = true;
+                        loadJobs.push_back(job);
+                    }
+                } else if (loadMissingTiles && memoryItem.state == Bach::LoadedTileState::Cancelled) {
+                    tileMemoryMisses++;
+                    // The tile was dropped by an earlier request, queue it again.
+                    memoryItem.state = Bach::LoadedTileState::Pending;
+                    loadJobs.push_back({ requestedCoord, TileType::Vector });
+                } else {
+                    tileMemoryMisses++;
+                    // Draw what has been parsed of the tile so far.
+                    if (memoryItem.state == Bach::LoadedTileState::Pending && memoryItem.partialTileData != nullptr) {
+                        out->_vectorMap.insert(requestedCoord, memoryItem.partialTileData.get());
+                        out->_partialVectorMap.insert(requestedCoord, memoryItem.partialTileData.get());
+                        out->_partialTiles.push_back(memoryItem.partialTileData);
+                    }
+                }
+            } else if (loadMissingTiles) {
+                tileMemoryMisses++;
+                // Tile not found, queue it for loading.
+                // Insert it with the pending status.
+                shard.vectorTileMemory.insert({
+                    requestedCoord,
+                    StoredVectorTile::newPending() });
+                loadJobs.push_back({ requestedCoord, TileType::Vector });
+            }
+        }
+
+        {
+            // Load iterator to our tile memory.
+            auto tileIt = shard.rasterTileMemory.find(requestedCoord);
+            // If found, return it immediately.
+            if (tileIt != shard.rasterTileMemory.end()) {
+                // Key found, check if it can be returned immediately.
+                StoredRasterTile &memoryItem = tileIt->second;
+                claimPrefetchedTile(memoryItem);
+                // If the item is marked as nullptr,
+                // it means it is pending and should not be immediately returned.
+                if (memoryItem.isReadyToRender()) {
+                    out->_rasterMap.insert(requestedCoord, &memoryItem.image);
+                    if (!memoryItem.mipLevels.isEmpty())
+                        out->_rasterMipLevelMap.insert(requestedCoord, &memoryItem.mipLevels);
+                    // Pin the tile for as long as the result is alive,
+                    // and mark it as the most recently used.
+                    memoryItem.pinCount++;
+                    out->_pinnedTiles.push_back({ requestedCoord, TileType::Raster });
+                    markRecentlyUsed_Locked(shard, memoryItem);
+                    tileMemoryHits++;
+                } else if (loadMissingTiles && memoryItem.state == Bach::LoadedTileState::Cancelled) {
+                    tileMemoryMisses++;
+                    // The tile was dropped by an earlier request, queue it again.
+                    memoryItem.state = Bach::LoadedTileState::Pending;
+                    loadJobs.push_back({ requestedCoord, TileType::Raster });
+                } else {
+                    tileMemoryMisses++;
+                }
+            } else if (loadMissingTiles && loadRaster) {
+                tileMemoryMisses++;
+                // Tile not found, queue it for loading.
+                // Insert it with the pending status.
+                shard.rasterTileMemory.insert({
+                    requestedCoord,
+                    StoredRasterTile::newPending() });
+                loadJobs.push_back({ requestedCoord, TileType::Raster });
+            }
+        }
+    }
+    addFallbackTiles(input, *out);
+
+    if (loadMissingTiles) {
+        queuePrefetchJobs(prefetchTiles, loadJobs);
+        prioritizeLoadJobs(loadJobs, input, generation);
+        queueTileLoadingJobs(loadJobs, signalFn);
+
+        // Any download of a tile we no longer want is wasted bandwidth.
+        if (useWeb) {
+            QMetaObject::invokeMethod(
+                networkManager,
+                [this]() { abortUnwantedReplies(); },
+                Qt::QueuedConnection);
+        }
+    }
+
+    return QScopedPointer<Bach::RequestTilesResult>{ out };
+}
+
+/*!
+ * \internal
+ * \brief Adds a single tile to the fallback tiles of a result, if it is ready to render.
+ *
+ * \return Returns true if the tile is available to the result.
+ */
+bool TileLoader::addFallbackTile(TileCoord coord, TileType type, ::TileResultType &out)
+{
+    if (type == TileType::Vector) {
+        if (out._vectorMap.contains(coord) || out._fallbackVectorMap.contains(coord))
+            return true;
+    } else {
+        if (out._rasterMap.contains(coord) || out._fallbackRasterMap.contains(coord))
+            return true;
+    }
+
+    TileMemoryShard &shard = getTileMemoryShard(coord);
+    QMutexLocker lock = shard.createLocker();
+    StoredTileBase *item = shard.find({ coord, type });
+    if (item == nullptr || !item->isReadyToRender())
+        return false;
+
+    if (type == TileType::Vector) {
+        auto &vectorItem = *static_cast<StoredVectorTile*>(item);
+        out._fallbackVectorMap.insert(coord, vectorItem.tileData.get());
+    } else {
+        auto &rasterItem = *static_cast<StoredRasterTile*>(item);
+        out._fallbackRasterMap.insert(coord, &rasterItem.image);
+    }
+    // Pin the tile like any requested tile, it is drawn while the result is alive.
+    item->pinCount++;
+    out._pinnedTiles.push_back({ coord, type });
+    markRecentlyUsed_Locked(shard, *item);
+    return true;
+}
+
+/*!
+ * \internal
+ * \brief Finds loaded tiles that can be drawn in place of the requested tiles that are missing.
+ *
+ * Descendants one zoom level down are looked up first, if enabled. If they
+ * don't cover the whole tile, the closest loaded ancestor is added as well.
+ */
+void TileLoader::addFallbackTiles(const QVector<TileCoord> &input, ::TileResultType &out)
+{
+    const bool useDescendants = useDescendantFallbacks.load();
+    for (TileCoord coord : input) {
+        for (TileType type : { TileType::Vector, TileType::Raster }) {
+            if (type == TileType::Raster && !loadRaster)
+                continue;
+            const bool isReady = type == TileType::Vector ?
+                out._vectorMap.contains(coord) :
+                out._rasterMap.contains(coord);
+            if (isReady)
+                continue;
+
+            int descendantsFound = 0;
+            if (useDescendants) {
+                for (int i = 0; i < 4; i++) {
+                    const TileCoord child { coord.zoom + 1, coord.x * 2 + i % 2, coord.y * 2 + i / 2 };
+                    if (addFallbackTile(child, type, out))
+                        descendantsFound++;
+                }
+            }
+            if (descendantsFound == 4)
+                continue;
+
+            for (int levelsUp = 1; levelsUp <= coord.zoom; levelsUp++) {
+                const TileCoord ancestor { coord.zoom - levelsUp, coord.x >> levelsUp, coord.y >> levelsUp };
+                if (addFallbackTile(ancestor, type, out))
+                    break;
+            }
+        }
+    }
+}
+
+/*!
+ * \brief Adds a client, which requests tiles independently of the other clients.
+ * See requestTiles.
+ *
+ * \threadsafe
+ */
+TileLoader::ClientId TileLoader::addClient()
+{
+    QMutexLocker lock { _wantedTilesLock.get() };
+    const ClientId client = nextClientId++;
+    clients.insert({ client, {} });
+    return client;
+}
+
+/*!
+ * \brief Removes a client, such as a view that is closed.
+ * Loads of tiles only the client wanted are cancelled.
+ *
+ * \threadsafe
+ */
+void TileLoader::removeClient(ClientId client)
+{
+    {
+        QMutexLocker lock { _wantedTilesLock.get() };
+        clients.erase(client);
+        // Jobs of the client's latest request must not skip the look-up.
+        requestGeneration++;
+    }
+    if (useWeb) {
+        QMetaObject::invokeMethod(
+            networkManager,
+            [this]() { abortUnwantedReplies(); },
+            Qt::QueuedConnection);
+    }
+}
+
+/*!
+ * \brief Replaces the set of tiles a client wants loaded,
+ * which are the requested tiles and the tiles to prefetch.
+ * Unknown clients are added, so that a request after removeClient still loads its tiles.
+ *
+ * \threadsafe
+ *
+ * \return The generation of the new set, to be stored in its load jobs.
+ */
+quint64 TileLoader::setWantedTiles(
+    ClientId client,
+    const std::unordered_set<TileCoord> &tiles,
+    const QVector<TileCoord> &prefetchTiles)
+{
+    QMutexLocker lock { _wantedTilesLock.get() };
+    std::unordered_set<TileCoord> &wantedTiles = clients[client].wantedTiles;
+    wantedTiles = tiles;
+    wantedTiles.insert(prefetchTiles.begin(), prefetchTiles.end());
+    return ++requestGeneration;
+}
+
+/*!
+ * \brief Checks if the given tile was asked for by the latest request of any client.
+ *
+ * \param generation is the generation of the request that queued the load,
+ * or 0 if not known.
+ *
+ * \threadsafe
+ */
+bool TileLoader::isTileLoadWanted(TileCoord coord, quint64 generation) const
+{
+    // Every tile of the latest request is wanted, no need to look it up.
+    if (generation != 0 && generation == requestGeneration.load())
+        return true;
+
+    QMutexLocker lock { _wantedTilesLock.get() };
+    for (const auto &[client, clientState] : clients) {
+        if (clientState.wantedTiles.find(coord) != clientState.wantedTiles.end())
+            return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief Marks a pending tile as cancelled if it is no longer wanted.
+ * Loading jobs call this before doing any work, and should stop if it returns true.
+ *
+ * \param generation is the generation of the request that queued the load,
+ * or 0 if not known.
+ *
+ * \threadsafe
+ *
+ * \return Returns true if the tile was cancelled.
+ */
+bool TileLoader::cancelTileLoadIfUnwanted(TileCoord coord, TileType type, quint64 generation)
+{
+    // Avoid locking the shard in the common case.
+    if (isTileLoadWanted(coord, generation))
+        return false;
+
+    TileMemoryShard &shard = getTileMemoryShard(coord);
+    QMutexLocker lock = shard.createLocker();
+    // Check again while holding the shard lock. 'requestTiles' replaces the
+    // wanted tiles before it locks the shard, so it either sees the tile
+    // as cancelled and queues it again, or we see it as wanted here.
+    if (isTileLoadWanted(coord, generation))
+        return false;
+
+    StoredTileBase *item = shard.find({ coord, type });
+    if (item == nullptr || item->state != Bach::LoadedTileState::Pending)
+        return false;
+    finishPendingTile_Locked(*item, Bach::LoadedTileState::Cancelled);
+    return true;
+}
+
+/*!
+ * \brief Marks a pending tile as failed, when none of our sources have it.
+ *
+ * \threadsafe
+ */
+void TileLoader::markTileLoadFailed(TileCoord coord, TileType type)
+{
+    {
+        TileMemoryShard &shard = getTileMemoryShard(coord);
+        QMutexLocker lock = shard.createLocker();
+        StoredTileBase *item = shard.find({ coord, type });
+        if (item == nullptr || item->state != Bach::LoadedTileState::Pending)
+            return;
+        finishPendingTile_Locked(*item, Bach::LoadedTileState::UnknownError);
+    }
+    emit tileFinished(coord);
+}
+
+/*!
+ * \internal
+ * \brief The RequestedArea struct describes the part of the map covered by a request,
+ * at the zoom level most of the requested tiles are at. This is taken as the viewport.
+ */
+struct RequestedArea {
+    int zoom = 0;
+    // Bounding box of the requested tiles at this zoom level, inclusive.
+    int minX = 0;
+    int minY = 0;
+    int maxX = 0;
+    int maxY = 0;
+    // Centre of the requested tiles at this zoom level, in tiles.
+    double centerX = 0;
+    double centerY = 0;
+
+    // Distance from the centre, scaled into this zoom level so tiles of all zoom levels compare.
+    double distanceFromCenter(TileCoord coord) const
+    {
+        const double scale = std::ldexp(1.0, zoom - coord.zoom);
+        const double dx = (coord.x + 0.5) * scale - centerX;
+        const double dy = (coord.y + 0.5) * scale - centerY;
+        return dx * dx + dy * dy;
+    }
+
+    // Tiles at the zoom level of the area come first, then the tiles closest to its centre.
+    bool isLoadedBefore(TileCoord a, TileCoord b) const
+    {
+        const int zoomDistanceA = std::abs(a.zoom - zoom);
+        const int zoomDistanceB = std::abs(b.zoom - zoom);
+        if (zoomDistanceA != zoomDistanceB)
+            return zoomDistanceA < zoomDistanceB;
+        return distanceFromCenter(a) < distanceFromCenter(b);
+    }
+};
+
+/*!
+ * \internal
+ * \brief Finds the area covered by a set of requested tiles.
+ *
+ * \return Returns nullopt if no tiles were requested.
+ */
+static std::optional<RequestedArea> calcRequestedArea(const QVector<TileCoord> &requestedTiles)
+{
+    if (requestedTiles.empty())
+        return std::nullopt;
+
+    std::map<int, int> tileCountPerZoom;
+    for (TileCoord coord : requestedTiles)
+        tileCountPerZoom[coord.zoom]++;
+
+    RequestedArea out;
+    out.zoom = std::max_element(
+        tileCountPerZoom.begin(),
+        tileCountPerZoom.end(),
+        [](const auto &a, const auto &b) { return a.second < b.second; })->first;
+    out.minX = std::numeric_limits<int>::max();
+    out.minY = std::numeric_limits<int>::max();
+    out.maxX = std::numeric_limits<int>::min();
+    out.maxY = std::numeric_limits<int>::min();
+    for (TileCoord coord : requestedTiles) {
+        if (coord.zoom != out.zoom)
+            continue;
+        out.minX = std::min(out.minX, coord.x);
+        out.minY = std::min(out.minY, coord.y);
+        out.maxX = std::max(out.maxX, coord.x);
+        out.maxY = std::max(out.maxY, coord.y);
+        out.centerX += coord.x + 0.5;
+        out.centerY += coord.y + 0.5;
+    }
+    out.centerX /= tileCountPerZoom[out.zoom];
+    out.centerY /= tileCountPerZoom[out.zoom];
+    return out;
+}
+
+/*!
+ * \brief Orders the load jobs of a request and assigns their task priority.
+ *
+ * Requested tiles come before prefetched tiles. Within each, tiles at the zoom level
+ * of the viewport come first, then the tiles closest to the centre of the request.
+ * Among tiles that are tied, such as the raster and vector tile of a coordinate, the raster
+ * tiles come first, since they are quick to decode and can be drawn in place of the vector tiles meanwhile.
+ *
+ * The generation of the request is the major part of the priority, so the
+ * jobs of the latest request start before any job still queued by an older one.
+ */
+void TileLoader::prioritizeLoadJobs(
+    QVector<LoadJob> &jobs,
+    const QVector<TileCoord> &requestedTiles,
+    quint64 generation)
+{
+    const std::optional<RequestedArea> area = calcRequestedArea(requestedTiles);
+    if (jobs.isEmpty() || !area.has_value())
+        return;
+
+    std::stable_sort(jobs.begin(), jobs.end(), [&](const LoadJob &a, const LoadJob &b) {
+        if (a.prefetch != b.prefetch)
+            return b.prefetch;
+        if (area->isLoadedBefore(a.tileCoord, b.tileCoord))
+            return true;
+        if (area->isLoadedBefore(b.tileCoord, a.tileCoord))
+            return false;
+        // Only break real ties by type, so that this stays a strict weak ordering.
+        return a.type == TileType::Raster && b.type == TileType::Vector;
+    });
+
+    // The task scheduler starts the jobs with the highest priority first.
+    const qint64 generationPriority = (qint64)generation << 32;
+    for (int i = 0; i < jobs.size(); i++) {
+        jobs[i].priority = generationPriority + (jobs.size() - i);
+        jobs[i].generation = generation;
+    }
+}
+
+/*!
+ * \brief Sets which tiles are loaded ahead of time when
+ * 'requestTiles' is asked to load missing tiles.
+ *
+ * \threadsafe
+ */
+void TileLoader::setPrefetchPolicy(const TilePrefetchPolicy &policy)
+{
+    QMutexLocker lock { _wantedTilesLock.get() };
+    prefetchPolicy = policy;
+}
+
+Bach::TilePrefetchPolicy TileLoader::getPrefetchPolicy() const
+{
+    QMutexLocker lock { _wantedTilesLock.get() };
+    return prefetchPolicy;
+}
+
+/*!
+ * \brief Sets how tiles are downloaded from the web.
+ * Downloads that are already in flight are not affected.
+ *
+ * \threadsafe
+ */
+void TileLoader::setNetworkPolicy(const TileNetworkPolicy &policy)
+{
+    {
+        QMutexLocker lock { _networkPolicyLock.get() };
+        networkPolicy = policy;
+    }
+    // A higher limit lets queued downloads start right away.
+    QMetaObject::invokeMethod(networkManager, [this]() {
+        for (const auto &[host, queue] : queuedDownloadsByHost)
+            startQueuedDownloads(host);
+    });
+}
+
+Bach::TileNetworkPolicy TileLoader::getNetworkPolicy() const
+{
+    QMutexLocker lock { _networkPolicyLock.get() };
+    return networkPolicy;
+}
+
+/*!
+ * \brief Finds the tiles to prefetch for a request, following the prefetch policy.
+ *
+ * Also records the pan direction of the request for the next call.
+ *
+ * \threadsafe
+ *
+ * \return The tiles to prefetch, in the order they should be loaded.
+ * None of them are part of the request.
+ */
+QVector<TileCoord> TileLoader::calcPrefetchTiles(
+    ClientId client,
+    const QVector<TileCoord> &requestedTiles,
+    const std::unordered_set<TileCoord> &requestedTileSet)
+{
+    const std::optional<RequestedArea> areaOpt = calcRequestedArea(requestedTiles);
+    if (!areaOpt.has_value())
+        return {};
+    const RequestedArea &area = areaOpt.value();
+
+    TilePrefetchPolicy policy;
+    QPoint panDirection;
+    {
+        QMutexLocker lock { _wantedTilesLock.get() };
+        policy = prefetchPolicy;
+        // Every client pans on its own.
+        PanTracking &panTracking = clients[client].panTracking;
+
+        // The requested area only moves when tiles scroll in or out,
+        // so we keep the last direction until it moves again.
+        const QPointF center { area.centerX, area.centerY };
+        if (panTracking.zoom != area.zoom) {
+            panTracking.direction = {};
+        } else if (center != panTracking.center) {
+            const QPointF delta = center - panTracking.center;
+            panTracking.direction = {
+                delta.x() > 0 ? 1 : (delta.x() < 0 ? -1 : 0),
+                delta.y() > 0 ? 1 : (delta.y() < 0 ? -1 : 0) };
+        }
+        panTracking.zoom = area.zoom;
+        panTracking.center = center;
+        panDirection = panTracking.direction;
+    }
+    if (!policy.enabled)
+        return {};
+
+    std::set<TileCoord> prefetchTiles;
+    auto addTileRange = [&](int zoom, int minX, int minY, int maxX, int maxY) {
+        const int tileCount = 1 << zoom;
+        minX = std::clamp(minX, 0, tileCount - 1);
+        minY = std::clamp(minY, 0, tileCount - 1);
+        maxX = std::clamp(maxX, 0, tileCount - 1);
+        maxY = std::clamp(maxY, 0, tileCount - 1);
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                const TileCoord coord { zoom, x, y };
+                if (requestedTileSet.find(coord) == requestedTileSet.end())
+                    prefetchTiles.insert(coord);
+            }
+        }
+    };
+
+    // The ring around the viewport.
+    const int ring = std::max(policy.ringWidth, 0);
+    addTileRange(area.zoom, area.minX - ring, area.minY - ring, area.maxX + ring, area.maxY + ring);
+
+    // The tiles ahead of the viewport, in the direction we are panning.
+    const int lookahead = ring + std::max(policy.panLookaheadTiles, 0);
+    addTileRange(
+        area.zoom,
+        panDirection.x() < 0 ? area.minX - lookahead : area.minX,
+        panDirection.y() < 0 ? area.minY - lookahead : area.minY,
+        panDirection.x() > 0 ? area.maxX + lookahead : area.maxX,
+        panDirection.y() > 0 ? area.maxY + lookahead : area.maxY);
+
+    // The zoom levels above and below the viewport.
+    if (policy.loadParentZoom && area.zoom > 0)
+        addTileRange(area.zoom - 1, area.minX / 2, area.minY / 2, area.maxX / 2, area.maxY / 2);
+    // The source has no tiles above its max zoom, see setSourceMaxZoom.
+    const std::optional<int> maxZoom = getSourceMaxZoom();
+    if (policy.loadChildZoom && (!maxZoom.has_value() || area.zoom < *maxZoom))
+        addTileRange(area.zoom + 1, area.minX * 2, area.minY * 2, area.maxX * 2 + 1, area.maxY * 2 + 1);
+
+    QVector<TileCoord> out { prefetchTiles.begin(), prefetchTiles.end() };
+    std::stable_sort(out.begin(), out.end(), [&](TileCoord a, TileCoord b) {
+        return area.isLoadedBefore(a, b);
+    });
+    return out;
+}
+
+/*!
+ * \brief Queues the prefetch tiles that are missing from memory,
+ * as long as they fit within the prefetch budget.
+ *
+ * \param prefetchTiles The tiles to prefetch, in the order they should be loaded.
+ * \param loadJobs The list of jobs to append the prefetch jobs to.
+ */
+void TileLoader::queuePrefetchJobs(const QVector<TileCoord> &prefetchTiles, QVector<LoadJob> &loadJobs)
+{
+    int budget = getPrefetchPolicy().maxPendingLoads - pendingPrefetchLoads;
+    for (TileCoord coord : prefetchTiles) {
+        for (TileType type : { TileType::Vector, TileType::Raster }) {
+            if (budget <= 0)
+                return;
+            if (type == TileType::Raster && !loadRaster)
+                continue;
+
+            TileMemoryShard &shard = getTileMemoryShard(coord);
+            QMutexLocker lock = shard.createLocker();
+            StoredTileBase *item = shard.find({ coord, type });
+            if (item == nullptr) {
+                if (type == TileType::Vector) {
+                    auto tileIt = shard.vectorTileMemory.insert({ coord, StoredVectorTile::newPending() }).first;
+                    item = &tileIt->second;
+                } else {
+                    auto tileIt = shard.rasterTileMemory.insert({ coord, StoredRasterTile::newPending() }).first;
+                    item = &tileIt->second;
+                }
+            } else if (item->state == Bach::LoadedTileState::Cancelled) {
+                item->state = Bach::LoadedTileState::Pending;
+            } else {
+                // Already loaded or on its way.
+                continue;
+            }
+
+            item->prefetched = true;
+            pendingPrefetchLoads++;
+            prefetchLoads++;
+            budget--;
+            LoadJob job { coord, type };
+            job.prefetch = true;
+            loadJobs.push_back(job);
+        }
+    }
+}
+
+/*!
+ * \brief Aborts the network replies of tiles that are no longer wanted.
+ * Must be called on the thread of the QNetworkAccessManager.
+ */
+void TileLoader::abortUnwantedReplies()
+{
+    // Aborting a reply emits 'finished' right away, which removes it
+    // from the in-flight replies. So we collect them first.
+    QVector<QNetworkReply*> unwantedReplies;
+    for (const auto &[reply, key] : inFlightReplies) {
+        if (!isTileLoadWanted(key.coord, 0))
+            unwantedReplies.push_back(reply);
+    }
+    for (QNetworkReply *reply : unwantedReplies)
+        reply->abort();
+}
+
+/*!
+ * \internal
+ * \brief Touches every page of a memory-mapped file once, so that the
+ * file is read from disk by the calling thread rather than by whoever parses it.
+ */
+static void prefaultMappedBytes(const uchar *mapped, qint64 size)
+{
+    constexpr qint64 pageSize = 4096;
+    volatile uchar sum = 0;
+    for (qint64 offset = 0; offset < size; offset += pageSize)
+        sum = sum + mapped[offset];
+}
+
+/*!
+ * \internal
+ * \brief Reads the encoded bytes of a tile from the disk cache.
+ * This is a blocking call, meant for the I/O pool.
+ *
+ * \return Returns false if the tile is not on disk, or could not be read.
+ */
+bool TileLoader::readTileFromDisk(TileCoord coord, TileType type, FetchedTileBytes &out)
+{
+    BACH_TRACE_SCOPE("TileLoader::readTileFromDisk");
+    if (diskCachePack != nullptr) {
+        std::optional<QByteArray> packedBytes = diskCachePack->find(coord, type);
+        if (!packedBytes.has_value())
+            return false;
+        out.found = true;
+        out.bytes = std::move(packedBytes.value());
+        return true;
+    }
+
+    // Check if the tile in disk.
+    auto file = std::make_unique<QFile>(getTileDiskPath(coord, type));
+    if (!file->exists()) {
+        // This is NOT an error. This just means our cache files didn't exist and we should return false
+        if (TileDiskCache *cache = activeDiskCache())
+            cache->remove(coord, type);
+        return false;
+    }
+
+    // TODO: Check that the file isn't currently being written into
+    // by another thread by checking for associated .lock file.
+    if (!file->open(QFile::ReadOnly)) {
+        // TODO: This should return the error instead of printing.
+        qDebug() << "Tried reading tile from file, but encountered unexpected error when opening file.\n";
+        // Error, file exists but didn't open.
+        return false;
+    }
+
+    // Successfully opened file, the contents are parsed straight out of the file.
+    // They are inserted into the tile-memory and NOT into the disk cache.
+    // The file is memory-mapped when possible, so that the contents don't have to be
+    // copied into memory. The mapping lives until 'out' is destroyed.
+    out.found = true;
+    const qint64 fileSize = file->size();
+    const uchar *mapped = fileSize > 0 ? file->map(0, fileSize) : nullptr;
+    if (mapped != nullptr) {
+        prefaultMappedBytes(mapped, fileSize);
+        out.mappedBytes = mapped;
+        out.mappedSize = fileSize;
+        out.mappedFile = std::move(file);
+    } else {
+        // Some files can't be mapped, like empty ones, so we fall back to reading them.
+        out.bytes = file->readAll();
+    }
+    if (TileDiskCache *cache = activeDiskCache())
+        cache->recordAccess(coord, type);
+
+    // Return success if we found the file.
+    return true;
+}
+
+/*!
+ * \internal
+ * \brief Submits a task to the task scheduler, and counts it
+ * until it finishes, see waitForTasks.
+ *
+ * \threadsafe
+ */
+Bach::TaskScheduler::TaskHandle TileLoader::submitTask(
+    TaskScheduler::Pool pool,
+    std::function<void()> fn,
+    qint64 priority,
+    const std::vector<TaskScheduler::TaskHandle> &dependencies)
+{
+    {
+        QMutexLocker lock { &tasksDoneLock };
+        unfinishedTaskCount++;
+    }
+    auto countedFn = [this, fn = std::move(fn)]() mutable {
+        fn();
+        // Release what the task holds on to while the TileLoader is still alive.
+        fn = nullptr;
+        // Once the count reaches zero, the TileLoader may be destroyed as soon as we unlock.
+        QMutexLocker lock { &tasksDoneLock };
+        if (--unfinishedTaskCount == 0)
+            tasksDoneCondition.wakeAll();
+    };
+    return taskScheduler->submit(pool, countedFn, priority, dependencies);
+}
+
+/*!
+ * \internal
+ * \brief Blocks until every task submitted by this TileLoader has finished.
+ * The task scheduler may be shared, so the tasks of others are not waited for.
+ */
+void TileLoader::waitForTasks()
+{
+    QMutexLocker lock { &tasksDoneLock };
+    while (unfinishedTaskCount > 0)
+        tasksDoneCondition.wait(&tasksDoneLock);
+}
+
+/*!
+ * \internal
+ * \brief Queues the stages of loading a single tile.
+ *
+ * The fetch function runs on the I/O pool and fills in the bytes of the tile if it finds any.
+ * The bytes are then parsed and inserted into the tile-memory on the CPU pool.
+ *
+ * \return The stage that inserts the tile, so that later stages can depend on it.
+ *
+ * \threadsafe
+ */
+Bach::TaskScheduler::TaskHandle TileLoader::queueTileLoadStages(
+    TileCoord coord,
+    TileType type,
+    qint64 priority,
+    FetchTileFn fetchFn,
+    TileLoadedCallbackFn signalFn)
+{
+    auto fetched = std::make_shared<FetchedTileBytes>();
+    TaskScheduler::TaskHandle fetchTask = submitTask(
+        TaskScheduler::Pool::Io,
+        [fetched, fetchFn = std::move(fetchFn)]() { fetchFn(*fetched); },
+        priority);
+    return submitTask(
+        TaskScheduler::Pool::Cpu,
+        [=]() {
+            if (!fetched->found)
+                return;
+            if (type == TileType::Vector)
+                insertIntoTileMemory_Vector(coord, fetched->view(), signalFn);
+            else
+                insertIntoTileMemory_Raster(coord, fetched->view(), signalFn);
+        },
+        priority,
+        { fetchTask });
+}
+
+/*!
+ * \brief TileLoader::writeTileToDisk writes a tile to disk cache.
+ * \param coord is the ZXY coordinate of the tile to write to disk.
+ * \param bytes is vector tile information stored as a QByteArray.
+ * \param cacheHeaders are the headers of the reply the tile came with.
+ */
+void TileLoader::writeTileToDisk_Raster(
+    TileCoord coord,
+    const QByteArray &rasterBytes,
+    const HttpCacheHeaders &cacheHeaders)
+{
+    if (diskCachePack != nullptr) {
+        diskCachePack->insert(coord, TileType::Raster, rasterBytes);
+        return;
+    }
+
+    // A revalidated tile that changed replaces the outdated file.
+    QFile::remove(getTileDiskPath(coord, TileType::Raster));
+    bool writeResult = Bach::writeTileToDiskCache_Raster(
+        tileCacheDiskPath,
+        coord,
+        rasterBytes);
+    if (writeResult && diskCache != nullptr)
+        diskCache->recordWrite(coord, TileType::Raster, rasterBytes.size(), cacheHeaders);
+}
+
+/*!
+ * \brief TileLoader::writeTileToDisk writes a tile to disk cache.
+ * \param coord is the ZXY coordinate of the tile to write to disk.
+ * \param bytes is vector tile information stored as a QByteArray.
+ * \param cacheHeaders are the headers of the reply the tile came with.
+ */
+void TileLoader::writeTileToDisk_Vector(
+    TileCoord coord,
+    const QByteArray &vectorBytes,
+    const HttpCacheHeaders &cacheHeaders)
+{
+    if (diskCachePack != nullptr) {
+        diskCachePack->insert(coord, TileType::Vector, vectorBytes);
+        return;
+    }
+
+    // A revalidated tile that changed replaces the outdated file.
+    QFile::remove(getTileDiskPath(coord, TileType::Vector));
+    bool writeResult = Bach::writeTileToDiskCache_Vector(
         tileCacheDiskPath,
         coord,
         vectorBytes);
+    if (writeResult && diskCache != nullptr)
+        diskCache->recordWrite(coord, TileType::Vector, vectorBytes.size(), cacheHeaders);
 }
 
 /*!
  * \brief TileLoader::networkReplyHandler handles a network reply when a tile is loaded from web.
  * \param reply is the network reply.
  * \param coord is the ZXY tile coordinate.
+ * \param priority is the task priority of the load job that asked for the tile.
  * \param signalFn is a callback function that signals when to insert jobs into memory.
  */
 void TileLoader::networkReplyHandler_Raster(
     QNetworkReply *rasterReply,
     TileCoord coord,
+    qint64 priority,
     TileLoadedCallbackFn signalFn)
 {
+    BACH_TRACE_SCOPE("TileLoader::networkReplyHandler_Raster");
     rasterReply->deleteLater();
+    inFlightReplies.erase(rasterReply);
+
+    // The TileLoader is being destroyed, don't start any more work.
+    if (shuttingDown)
+        return;
+
+    if (rasterReply->error() == QNetworkReply::OperationCanceledError) {
+        // We aborted the download because the tile left the viewport.
+        // If it was requested again in the meantime, start over.
+        if (!cancelTileLoadIfUnwanted(coord, TileType::Raster, 0))
+            loadFromWeb_Raster(coord, priority, signalFn);
+        return;
+    }
+
+    const HttpCacheHeaders cacheHeaders = cacheHeadersFromReply(*rasterReply);
+    const int statusCode = rasterReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (statusCode == 304) {
+        // The tile we have on disk is still up to date.
+        auto fetchFn = [=](FetchedTileBytes &out) {
+            if (TileDiskCache *cache = activeDiskCache())
+                cache->recordNotModified(coord, TileType::Raster, cacheHeaders);
+            // If the file was pruned in the meantime, download the tile in full.
+            if (!readTileFromDisk(coord, TileType::Raster, out))
+                loadFromWeb_Raster(coord, priority, signalFn);
+        };
+        queueTileLoadStages(coord, TileType::Raster, priority, fetchFn, signalFn);
+        return;
+    }
 
     // Check for errors in the reply.
     if (rasterReply->error() != QNetworkReply::NoError) {
         qDebug() << "Error when requesting tile from web: " << rasterReply->errorString() << '\n';
-        // TODO: Do something meaningful, like retrying the request later or
-        // marking this tile as non-functional to stop us from requesting it anymore.
+        // Use the expired tile on disk, if we were revalidating it.
+        // The body of the reply is an error message, not a tile, so it is never parsed.
+        auto fetchFn = [=](FetchedTileBytes &out) {
+            if (!readTileFromDisk(coord, TileType::Raster, out))
+                markTileLoadFailed(coord, TileType::Raster);
+        };
+        queueTileLoadStages(coord, TileType::Raster, priority, fetchFn, signalFn);
+        return;
     }
 
     // TODO: Reply can return 204 No Content, and this is a valid result
@@ -439,54 +2030,79 @@ void TileLoader::networkReplyHandler_Raster(
     // Extract the bytes we want and discard the reply.
     auto rasterBytes = rasterReply->readAll();
 
-    // We are now on the same thread as the QNetworkAccessManager,
-    // which means we are on the GUI thread. We need to dispatch the result of
-    // the reply onto a new thread. This is because parsing will block
-    // GUI responsiveness.
-
-    // Create async jobs to insert tile into memory
-    getThreadPool().start([=]() {
-        QImage rasterImage;
-        if (!rasterImage.loadFromData(rasterBytes)) {
-            // Error.
-            qDebug() << "TileLoader: Failed to parse byte-array into QImage when trying to write raster-tile to disk.";
-        }
-
-        QByteArray rasterFileBytes;
-        QBuffer buffer(&rasterFileBytes);
-        if (!buffer.open(QIODevice::WriteOnly)) {
-            // Failed to open buffer into outbut byte array.
-            qDebug() << "TileLoader: Failed to open buffer into output byte array when trying to write raster-tile to disk.";
-        }
-        if (!rasterImage.save(&buffer, "PNG")) {
-            qDebug() << "TileLoader: Failed to save QImage into output byte array when trying to write raster-tile to disk.";
-        }
-
-        writeTileToDisk_Raster(coord, rasterBytes);
-
-        insertIntoTileMemory_Raster(coord, rasterBytes, signalFn);
-    });
+    // We are now on the network thread. We dispatch the parsing and the
+    // disk write onto the worker threads, so that this thread is free
+    // to handle the next reply.
+
+    // Show the tile first, the disk cache can wait.
+    TaskScheduler::TaskHandle insertTask = submitTask(
+        TaskScheduler::Pool::Cpu,
+        [=]() { insertIntoTileMemory_Raster(coord, rasterBytes, signalFn); },
+        priority);
+    submitTask(
+        TaskScheduler::Pool::Io,
+        [=]() { writeTileToDisk_Raster(coord, rasterBytes, cacheHeaders); },
+        priority,
+        { insertTask });
 }
 
 /*!
  * \brief TileLoader::networkReplyHandler handles a network reply when a tile is loaded from web.
  * \param reply is the network reply.
  * \param coord is the ZXY tile coordinate.
+ * \param priority is the task priority of the load job that asked for the tile.
  * \param signalFn is a callback function that signals when to insert jobs into memory.
  */
 void TileLoader::networkReplyHandler_Vector(
     QNetworkReply *vectorReply,
     TileCoord coord,
+    qint64 priority,
     TileLoadedCallbackFn signalFn)
 {
+    BACH_TRACE_SCOPE("TileLoader::networkReplyHandler_Vector");
     vectorReply->deleteLater();
+    inFlightReplies.erase(vectorReply);
+
+    // The TileLoader is being destroyed, don't start any more work.
+    if (shuttingDown)
+        return;
+
+    if (vectorReply->error() == QNetworkReply::OperationCanceledError) {
+        // We aborted the download because the tile left the viewport.
+        // If it was requested again in the meantime, start over.
+        if (!cancelTileLoadIfUnwanted(coord, TileType::Vector, 0))
+            loadFromWeb_Vector(coord, priority, signalFn);
+        return;
+    }
+
+    const HttpCacheHeaders cacheHeaders = cacheHeadersFromReply(*vectorReply);
+    const int statusCode = vectorReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (statusCode == 304) {
+        // The tile we have on disk is still up to date.
+        auto fetchFn = [=](FetchedTileBytes &out) {
+            if (TileDiskCache *cache = activeDiskCache())
+                cache->recordNotModified(coord, TileType::Vector, cacheHeaders);
+            // If the file was pruned in the meantime, download the tile in full.
+            if (!readTileFromDisk(coord, TileType::Vector, out))
+                loadFromWeb_Vector(coord, priority, signalFn);
+        };
+        queueTileLoadStages(coord, TileType::Vector, priority, fetchFn, signalFn);
+        return;
+    }
 
     // Check for errors in the reply.
     if (vectorReply->error() != QNetworkReply::NoError) {
         qDebug() << "Error when requesting tile from web: " << vectorReply->errorString() << '\n';
-        // TODO: Do something meaningful, like retrying the request later or
-        // marking this tile as non-functional to stop us from requesting it anymore.
+        // Use the expired tile on disk, if we were revalidating it.
+        // The body of the reply is an error message, not a tile, so it is never parsed.
+        auto fetchFn = [=](FetchedTileBytes &out) {
+            if (!readTileFromDisk(coord, TileType::Vector, out))
+                markTileLoadFailed(coord, TileType::Vector);
+        };
+        queueTileLoadStages(coord, TileType::Vector, priority, fetchFn, signalFn);
+        return;
     }
+
     // TODO: Reply can return 204 No Content, and this is a valid result
     // it just means that the tile has no data and doesn't need to be rendered.
     // Only background needs to be rendered.
@@ -494,17 +2110,20 @@ void TileLoader::networkReplyHandler_Vector(
     // Extract the bytes we want and discard the reply.
     QByteArray vectorBytes = vectorReply->readAll();
 
-    // We are now on the same thread as the QNetworkAccessManager,
-    // which means we are on the GUI thread. We need to dispatch the result of
-    // the reply onto a new thread. This is because parsing will block
-    // GUI responsiveness.
-
-    // Create async jobs to insert tile into memory
-    getThreadPool().start([=]() {
-        writeTileToDisk_Vector(coord, vectorBytes);
-
-        insertIntoTileMemory_Vector(coord, vectorBytes, signalFn);
-    });
+    // We are now on the network thread. We dispatch the parsing and the
+    // disk write onto the worker threads, so that this thread is free
+    // to handle the next reply.
+
+    // Show the tile first, the disk cache can wait.
+    TaskScheduler::TaskHandle insertTask = submitTask(
+        TaskScheduler::Pool::Cpu,
+        [=]() { insertIntoTileMemory_Vector(coord, vectorBytes, signalFn); },
+        priority);
+    submitTask(
+        TaskScheduler::Pool::Io,
+        [=]() { writeTileToDisk_Vector(coord, vectorBytes, cacheHeaders); },
+        priority,
+        { insertTask });
 }
 
 
@@ -513,33 +2132,28 @@ void TileLoader::networkReplyHandler_Vector(
  * This boots an async task, returns immediately.
  * Tile will be loaded later when network request is done.
  * Tile will then be inserted into memory
- * and into disk cache when done.
+ * and into disk cache when done, with the given task priority.
  */
-void TileLoader::loadFromWeb_Raster(TileCoord coord, TileLoadedCallbackFn signalFn)
+void TileLoader::loadFromWeb_Raster(TileCoord coord, qint64 priority, TileLoadedCallbackFn signalFn)
 {
-    // Load the URL for this particular tile.
-    QString rasterTileUrl = Bach::setPbfLink(coord, pngUrlTemplate);
-
-    // We expect this function to be called on the background thread, but our
-    // QNetworkAccessManager lives on the main thread.
-    // We can't make requests from this thread. Queue a request to it.
+    QString urlTemplate;
+    {
+        QMutexLocker lock { urlTemplateLock.get() };
+        urlTemplate = pngUrlTemplate;
+    }
+    // The raster template may not be known yet, see setTileUrlTemplates.
+    if (urlTemplate.isEmpty()) {
+        markTileLoadFailed(coord, TileType::Raster);
+        return;
+    }
 
-    auto job = [=]() {
-        // We don't want to use NetworkController here, because it
-        // forces us to wait. And since we are on main GUI thread,
-        // that would block GUI logic until we get a reply.
+    // Load the URL for this particular tile.
+    QNetworkRequest rasterRequest { Bach::setPbfLink(coord, urlTemplate) };
+    // If we have an expired copy on disk, only ask for the tile if it changed.
+    if (TileDiskCache *cache = activeDiskCache())
+        addConditionalHeaders(rasterRequest, cache->validators(coord, TileType::Raster));
 
-        // We want to make two requests, one for vector tile, one for raster.
-        QNetworkReply *rasterReply = networkManager.get(QNetworkRequest{ rasterTileUrl });
-        QObject::connect(
-            rasterReply,
-            &QNetworkReply::finished,
-            this,
-            [=]() { networkReplyHandler_Raster(rasterReply, coord, signalFn); });
-    };
-    QMetaObject::invokeMethod(
-        &networkManager,
-        job);
+    queueTileDownload(rasterRequest, { coord, TileType::Raster }, priority, signalFn);
 }
 
 /*!
@@ -547,39 +2161,198 @@ void TileLoader::loadFromWeb_Raster(TileCoord coord, TileLoadedCallbackFn signal
  * This boots an async task, returns immediately.
  * Tile will be loaded later when network request is done.
  * Tile will then be inserted into memory
- * and into disk cache when done.
+ * and into disk cache when done, with the given task priority.
  */
-void TileLoader::loadFromWeb_Vector(TileCoord coord, TileLoadedCallbackFn signalFn)
+void TileLoader::loadFromWeb_Vector(TileCoord coord, qint64 priority, TileLoadedCallbackFn signalFn)
 {
+    QString urlTemplate;
+    {
+        QMutexLocker lock { urlTemplateLock.get() };
+        urlTemplate = pbfLinkTemplate;
+    }
+
     // Load the URL for this particular tile.
-    QString vectorTileUrl = Bach::setPbfLink(coord, pbfLinkTemplate);
+    QNetworkRequest vectorRequest { Bach::setPbfLink(coord, urlTemplate) };
+    // If we have an expired copy on disk, only ask for the tile if it changed.
+    if (TileDiskCache *cache = activeDiskCache())
+        addConditionalHeaders(vectorRequest, cache->validators(coord, TileType::Vector));
 
-    // We expect this function to be called on the background thread, but our
-    // QNetworkAccessManager lives on the main thread.
+    queueTileDownload(vectorRequest, { coord, TileType::Vector }, priority, signalFn);
+}
+
+/*!
+ * \brief Queues the download of a tile, to be started once the
+ * host has fewer downloads in flight than the network policy allows.
+ *
+ * If the same URL is already being downloaded, the load waits
+ * for that download instead of asking for the tile again. The
+ * download then keeps the highest priority of the loads waiting for it.
+ */
+void TileLoader::queueTileDownload(
+    const QNetworkRequest &request,
+    TileMemoryKey key,
+    qint64 priority,
+    TileLoadedCallbackFn signalFn)
+{
+    // The TileLoader is being destroyed, don't start any more work.
+    if (shuttingDown)
+        return;
+
+    // We expect this function to be called on the worker threads, but our
+    // QNetworkAccessManager lives on the network thread.
     // We can't make requests from this thread. Queue a request to it.
 
     auto job = [=]() {
         // We don't want to use NetworkController here, because it
-        // forces us to wait. And since we are on main GUI thread,
-        // that would block GUI logic until we get a reply.
+        // forces us to wait, which would hold up every other download.
 
-        QNetworkReply *vectorReply = networkManager.get(QNetworkRequest{ vectorTileUrl });
-        QObject::connect(
-            vectorReply,
-            &QNetworkReply::finished,
-            this,
-            [=]() { networkReplyHandler_Vector(vectorReply, coord, signalFn); });
+        // The tile might have left the viewport while we looked for it on disk.
+        if (cancelTileLoadIfUnwanted(key.coord, key.type, 0))
+            return;
+
+        const QString url = request.url().toString();
+        auto downloadIt = tileDownloads.find(url);
+        if (downloadIt != tileDownloads.end()) {
+            downloadIt->second.priority = qMax(downloadIt->second.priority, priority);
+            downloadIt->second.signalFns.push_back(signalFn);
+            return;
+        }
+
+        TileDownload &download = tileDownloads[url];
+        download.request = request;
+        download.key = key;
+        download.priority = priority;
+        download.signalFns.push_back(signalFn);
+        const QString host = request.url().host();
+        queuedDownloadsByHost[host].push_back(url);
+        startQueuedDownloads(host);
     };
     QMetaObject::invokeMethod(
-        &networkManager,
+        networkManager,
         job);
 }
 
+/*!
+ * \brief Starts the queued downloads against a host, as far as the network policy allows.
+ *
+ * IMPORTANT! Only use from the thread 'networkManager' lives on!
+ */
+void TileLoader::startQueuedDownloads(const QString &host)
+{
+    const TileNetworkPolicy policy = getNetworkPolicy();
+    std::deque<QString> &queue = queuedDownloadsByHost[host];
+    int &activeDownloads = activeDownloadsByHost[host];
+    while (activeDownloads < qMax(policy.maxRequestsPerHost, 1) && !queue.empty()) {
+        const QString url = queue.front();
+        queue.pop_front();
+        auto downloadIt = tileDownloads.find(url);
+        TileDownload &download = downloadIt->second;
+
+        // The tile might have left the viewport while it waited for its turn.
+        if (cancelTileLoadIfUnwanted(download.key.coord, download.key.type, 0)) {
+            tileDownloads.erase(downloadIt);
+            continue;
+        }
+
+        // We leave 'Accept-Encoding' to QNetworkAccessManager,
+        // setting it ourselves turns off the decompression of replies.
+        QNetworkRequest request = download.request;
+        request.setAttribute(QNetworkRequest::Http2AllowedAttribute, policy.allowHttp2);
+        QNetworkReply *reply = networkManager->get(request);
+        download.reply = reply;
+        activeDownloads++;
+        activeDownloadCount++;
+        inFlightReplies.insert({ reply, download.key });
+        QObject::connect(
+            reply,
+            &QNetworkReply::finished,
+            networkManager,
+            [=]() { finishTileDownload(url, reply); });
+    }
+}
+
+/*!
+ * \brief Hands a finished download to the reply handler of its tile type,
+ * and starts the next download waiting for the same host.
+ *
+ * IMPORTANT! Only use from the thread 'networkManager' lives on!
+ */
+void TileLoader::finishTileDownload(const QString &url, QNetworkReply *reply)
+{
+    auto downloadIt = tileDownloads.find(url);
+    if (downloadIt == tileDownloads.end() || downloadIt->second.reply != reply) {
+        reply->deleteLater();
+        return;
+    }
+    // Remove the download before handling the reply, so
+    // the handler can ask for the same URL again.
+    TileDownload download = std::move(downloadIt->second);
+    tileDownloads.erase(downloadIt);
+    const QString host = download.request.url().host();
+    activeDownloadsByHost[host]--;
+    activeDownloadCount--;
+
+    const QVector<TileLoadedCallbackFn> signalFns = download.signalFns;
+    TileLoadedCallbackFn signalFn = [signalFns](TileCoord coord) {
+        for (const TileLoadedCallbackFn &fn : signalFns) {
+            if (fn)
+                fn(coord);
+        }
+    };
+    if (download.key.type == TileType::Vector)
+        networkReplyHandler_Vector(reply, download.key.coord, download.priority, signalFn);
+    else
+        networkReplyHandler_Raster(reply, download.key.coord, download.priority, signalFn);
+
+    startQueuedDownloads(host);
+}
+
+/*!
+ * \internal
+ * \brief The I/O stage of a load job. Finds the encoded bytes of the tile,
+ * or starts downloading it if they are not on disk.
+ */
+void TileLoader::fetchTileForJob(const LoadJob &job, FetchedTileBytes &out, TileLoadedCallbackFn signalFn)
+{
+    // The tile might have left the viewport while this job was queued.
+    if (cancelTileLoadIfUnwanted(job.tileCoord, job.type, job.generation))
+        return;
+
+    // Check if we have a tile-load override function.
+    if (loadTileOverride) {
+        const QByteArray* fileBytes = loadTileOverride(job.tileCoord, job.type);
+        if (fileBytes == nullptr || fileBytes->isEmpty()) {
+            markTileLoadFailed(job.tileCoord, job.type);
+        } else {
+            out.found = true;
+            out.bytes = *fileBytes;
+        }
+        return;
+    }
+
+    // First we try loading from disk. If found, the parsing stage takes it from here.
+    // If not found, start the process to download from web.
+    // Expired tiles on disk are revalidated with the server before they are used.
+    const bool expiredOnDisk = needsRevalidation(job.tileCoord, job.type);
+    const bool loadedFromDiskSuccess = !expiredOnDisk && readTileFromDisk(job.tileCoord, job.type, out);
+    if (loadedFromDiskSuccess)
+        return;
+    if (!useWeb)
+        markTileLoadFailed(job.tileCoord, job.type);
+    else if (job.type == TileType::Vector)
+        loadFromWeb_Vector(job.tileCoord, job.priority, signalFn);
+    else
+        loadFromWeb_Raster(job.tileCoord, job.priority, signalFn);
+}
+
 /*!
  * \brief
  * Loads the list of tiles into memory, corresponding to the list of
  * TileCoords inputted.
  *
+ * Every job is split into a stage that reads the tile on the I/O pool and a stage
+ * that parses it on the CPU pool, see queueTileLoadStages.
+ *
  * This function launches asynchronous jobs, does not block execution!
  *
  * \threadsafe
@@ -589,47 +2362,19 @@ void TileLoader::queueTileLoadingJobs(
     const TileLoadedCallbackFn &signalFn)
 {
     // We can assume all input tiles do not exist in memory.
-
-    // We queue up one task to launch
-    // the smaller tasks to return as early as possible.
-    auto asyncJob = [=]() {
-        for (LoadJob job : input) {
-
-            // Then we spawn one async task per item.
-            getThreadPool().start([=]() {
-
-                // Check if we have a tile-load override function.
-                if (loadTileOverride) {
-                    const QByteArray* fileBytes = loadTileOverride(job.tileCoord, job.type);
-                    if (fileBytes == nullptr || fileBytes->isEmpty()) {
-                        // Handle error?
-                    } else {
-                        if (job.type == TileType::Vector) {
-                            insertIntoTileMemory_Vector(job.tileCoord, *fileBytes, signalFn);
-                        } else {
-                            insertIntoTileMemory_Raster(job.tileCoord, *fileBytes, signalFn);
-                        }
-                    }
-                } else {
-                    // First we try loading from disk. If found, the disk function will handle
-                    // the rest of this async process.
-                    // If not found, start the process to download from web.
-                    if (job.type == TileType::Vector) {
-                        bool loadedFromDiskSuccess = loadFromDisk_Vector(job.tileCoord, signalFn);
-                        if (!loadedFromDiskSuccess && useWeb) {
-                            loadFromWeb_Vector(job.tileCoord, signalFn);
-                        }
-                    } else {
-                        bool loadedFromDiskSuccess = loadFromDisk_Raster(job.tileCoord, signalFn);
-                        if (!loadedFromDiskSuccess && useWeb) {
-                            loadFromWeb_Raster(job.tileCoord, signalFn);
-                        }
-                    }
-                }
-            });
+    for (const LoadJob &job : input) {
+        // Demoted tiles are already loaded, they only need to be parsed again.
+        if (job.promote) {
+            submitTask(
+                TaskScheduler::Pool::Cpu,
+                [=]() { promoteDemotedTile_Vector(job.tileCoord, signalFn); },
+                job.priority);
+            continue;
         }
-    };
-    getThreadPool().start(asyncJob);
+
+        auto fetchFn = [=](FetchedTileBytes &out) { fetchTileForJob(job, out, signalFn); };
+        queueTileLoadStages(job.tileCoord, job.type, job.priority, fetchFn, signalFn);
+    }
 }
 
 /*!
@@ -639,17 +2384,20 @@ void TileLoader::queueTileLoadingJobs(
  * \param rasterImage is the raster image version of the tile.
  * \param signalFn is a function to call when the tiles finish loading.
  *
+ * The bytes may point into a memory-mapped file, and are not kept after the call.
+ *
  * \threadsafe
  */
 void TileLoader::insertIntoTileMemory_Raster(
     TileCoord coord,
-    const QByteArray &rasterBytes,
+    QByteArrayView rasterBytes,
     TileLoadedCallbackFn signalFn)
 {
     // Check iterator to see if it's fine to access
     // this tile-memory element.
+    TileMemoryShard &shard = getTileMemoryShard(coord);
     auto checkIterator = [&](auto tileIt) {
-        if (tileIt == rasterTileMemory.end() || tileIt->second.state != Bach::LoadedTileState::Pending) {
+        if (tileIt == shard.rasterTileMemory.end() || tileIt->second.state != Bach::LoadedTileState::Pending) {
             // Error because tile needs to exist and be pending
             // before we insert it.
             qWarning() <<
@@ -664,6 +2412,24 @@ void TileLoader::insertIntoTileMemory_Raster(
     // And try parsing the raster image.
     QImage rasterImage;
     bool rasterParseSuccess = rasterImage.loadFromData(rasterBytes);
+    QList<QImage> mipLevels;
+    if (rasterParseSuccess) {
+        // Convert the image while we are still on a worker thread, so that painting
+        // it doesn't have to convert it again every frame.
+        const QImage::Format format = rasterTileFormat;
+        if (rasterImage.format() != format)
+            rasterImage.convertTo(format);
+        const int mipLevelCount = rasterTileMipLevels;
+        for (int level = 0; level < mipLevelCount; level++) {
+            const QImage &previous = level == 0 ? rasterImage : mipLevels.last();
+            if (previous.width() < 2 || previous.height() < 2)
+                break;
+            mipLevels.append(previous.scaled(
+                previous.size() / 2,
+                Qt::IgnoreAspectRatio,
+                Qt::SmoothTransformation));
+        }
+    }
 
     // If we failed to parse our tile,
     // mark the memory as parsing failed.
@@ -671,33 +2437,43 @@ void TileLoader::insertIntoTileMemory_Raster(
         qCritical() << "Error when parsing tile " << coord.toString();
 
         // Insert into the tile memory storage.
-        QMutexLocker lock = createTileMemoryLocker();
-
-        auto tileIt = rasterTileMemory.find(coord);
-        if (!checkIterator(tileIt)) {
-            return;
-        } else {
-            StoredRasterTile &memoryItem = tileIt->second;
-            memoryItem.state = Bach::LoadedTileState::ParsingFailed;
+        {
+            QMutexLocker lock = shard.createLocker();
+
+            auto tileIt = shard.rasterTileMemory.find(coord);
+            if (!checkIterator(tileIt)) {
+                return;
+            } else {
+                StoredRasterTile &memoryItem = tileIt->second;
+                finishPendingTile_Locked(memoryItem, Bach::LoadedTileState::ParsingFailed);
+                trackLoadedTile_Locked(shard, { coord, TileType::Raster }, memoryItem);
+            }
         }
+        evictTilesOverBudget();
         emit tileFinished(coord);
         return;
     }
 
     // Create a scope for our mutex lock.
     {
-        QMutexLocker lock = createTileMemoryLocker();
-        auto tileIt = rasterTileMemory.find(coord);
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.rasterTileMemory.find(coord);
         if (!checkIterator(tileIt)) {
             return;
         } else {
             // Mark our tile as OK and insert the Tile data.
             StoredRasterTile &memoryItem = tileIt->second;
             memoryItem.image = rasterImage;
+            memoryItem.byteSize = rasterImage.sizeInBytes();
+            for (const QImage &mipLevel : mipLevels)
+                memoryItem.byteSize += mipLevel.sizeInBytes();
+            memoryItem.mipLevels = std::move(mipLevels);
 
-            memoryItem.state = Bach::LoadedTileState::Ok;
+            finishPendingTile_Locked(memoryItem, Bach::LoadedTileState::Ok);
+            trackLoadedTile_Locked(shard, { coord, TileType::Raster }, memoryItem);
         }
     }
+    evictTilesOverBudget();
     emit tileFinished(coord);
 
     // Fire the signal.
@@ -707,6 +2483,189 @@ void TileLoader::insertIntoTileMemory_Raster(
         signalFn(coord);
 }
 
+/*!
+ * \internal
+ * \brief Parses the bytes of a vector tile with the current parse options,
+ * and tessellates it and prepares its labels if enabled.
+ *
+ * \param meshByteSize Set to the size of the meshes of the tile, if it was tessellated.
+ * \param partialTileFn If set, and vector tile layers are streamed, the layers are decoded in
+ * the stages of StyleSheet::sourceLayerStages. This is called with the layers decoded so far
+ * after every stage but the last. See setStreamVectorTileLayers.
+ * \return The parsed tile, or nullptr if parsing failed.
+ *
+ * \threadsafe
+ */
+std::unique_ptr<VectorTile> TileLoader::parseVectorTile(
+    TileCoord coord,
+    QByteArrayView vectorBytes,
+    qint64 &meshByteSize,
+    const PartialTileFn &partialTileFn) const
+{
+    TileParseOptions options = getTileParseOptions();
+    // A tile is also drawn in place of its missing parent, and scaled up
+    // in place of any of its missing descendants.
+    const int minMapZoom = useDescendantFallbacks ? coord.zoom - 1 : coord.zoom;
+    if (decodeStyledLayersOnly)
+        options.layerNames = styleSheet.sourceLayersShownFrom(minMapZoom);
+
+    // The last stage decodes whatever the earlier stages left, so it is not listed.
+    std::vector<std::set<QString>> stages;
+    if (partialTileFn != nullptr && streamVectorTileLayers) {
+        stages = styleSheet.sourceLayerStages(minMapZoom);
+        if (!stages.empty())
+            stages.pop_back();
+    }
+
+    // We are still on a worker thread, so this is the place to prepare the geometry for drawing.
+    meshByteSize = 0;
+    auto decodeStage = [&](const TileParseOptions &stageOptions) -> std::optional<VectorTile> {
+        std::optional<VectorTile> tile = Bach::tileFromByteArray(vectorBytes, stageOptions);
+        if (tile.has_value() && tessellateVectorTiles) {
+            Bach::tessellateVectorTile(*tile);
+            for (const auto &[layerName, layer] : tile->m_layers)
+                meshByteSize += layer->meshes()->byteSize();
+        }
+        if (tile.has_value() && prepareTileLabels)
+            Bach::prepareTileLabels(*tile, styleSheet, coord.zoom);
+        return tile;
+    };
+
+    // Turn our VectorTile into a dedicated allocation that fits our storage.
+    auto allocatedTile = std::make_unique<VectorTile>();
+    for (const std::set<QString> &stage : stages) {
+        TileParseOptions stageOptions = options;
+        stageOptions.layerNames = std::set<QString>{};
+        for (const QString &layerName : stage) {
+            if (!options.layerNames.has_value() || options.layerNames->count(layerName) != 0)
+                stageOptions.layerNames->insert(layerName);
+        }
+        if (stageOptions.layerNames->empty())
+            continue;
+
+        std::optional<VectorTile> stageTile = decodeStage(stageOptions);
+        if (!stageTile.has_value())
+            return nullptr;
+        allocatedTile->m_layers.merge(stageTile->m_layers);
+        for (const QString &layerName : stage)
+            options.skippedLayerNames.insert(layerName);
+
+        // The layers are shared with the partial tile, and are not changed from here on.
+        auto partialTile = std::make_shared<VectorTile>();
+        partialTile->m_layers = allocatedTile->m_layers;
+        partialTile->m_partial = true;
+        partialTileFn(std::move(partialTile));
+    }
+
+    std::optional<VectorTile> lastStageTile = decodeStage(options);
+    if (!lastStageTile.has_value())
+        return nullptr;
+    allocatedTile->m_layers.merge(lastStageTile->m_layers);
+    return allocatedTile;
+}
+
+/*!
+ * \internal
+ * \brief Hands out the layers decoded so far of a pending vector tile,
+ * see setStreamVectorTileLayers.
+ *
+ * \threadsafe
+ */
+void TileLoader::publishPartialTile_Vector(
+    TileCoord coord,
+    std::shared_ptr<const VectorTile> partialTile,
+    const TileLoadedCallbackFn &signalFn)
+{
+    {
+        TileMemoryShard &shard = getTileMemoryShard(coord);
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.vectorTileMemory.find(coord);
+        if (tileIt == shard.vectorTileMemory.end() || tileIt->second.state != Bach::LoadedTileState::Pending)
+            return;
+        tileIt->second.partialTileData = std::move(partialTile);
+    }
+
+    // Lets the MapWidget draw what we have so far.
+    if (signalFn)
+        signalFn(coord);
+}
+
+/*!
+ * \internal
+ * \brief Parses a demoted vector tile again from the encoded bytes kept in memory,
+ * and makes it ready to render. See TileMemoryLimits::maxParsedVectorTiles.
+ *
+ * \threadsafe
+ */
+void TileLoader::promoteDemotedTile_Vector(TileCoord coord, TileLoadedCallbackFn signalFn)
+{
+    BACH_TRACE_SCOPE("TileLoader::promoteDemotedTile_Vector");
+    TileMemoryShard &shard = getTileMemoryShard(coord);
+
+    QByteArray encodedBytes;
+    bool compressed = false;
+    {
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.vectorTileMemory.find(coord);
+        if (tileIt == shard.vectorTileMemory.end() || !tileIt->second.demoted)
+            return;
+        // The bytes are shared, so this doesn't copy them.
+        encodedBytes = tileIt->second.encodedBytes;
+        compressed = tileIt->second.encodedBytesCompressed;
+    }
+
+    // Decompress and parse without holding the lock.
+    if (compressed)
+        encodedBytes = qUncompress(encodedBytes);
+    qint64 meshByteSize = 0;
+    std::unique_ptr<VectorTile> allocatedTile = parseVectorTile(coord, encodedBytes, meshByteSize);
+
+    {
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.vectorTileMemory.find(coord);
+        // The tile may have been evicted while we parsed it.
+        if (tileIt == shard.vectorTileMemory.end() || !tileIt->second.demoted)
+            return;
+        StoredVectorTile &memoryItem = tileIt->second;
+        memoryItem.promoting = false;
+        if (allocatedTile == nullptr) {
+            // The same bytes parsed before, so this should never happen.
+            // Mark the tile as failed, so that it isn't parsed again on every request.
+            qWarning() << "TileLoader error: Unable to parse demoted tile" << coord.toString();
+            memoryItem.demoted = false;
+            memoryItem.encodedBytes = {};
+            memoryItem.encodedBytesCompressed = false;
+            memoryItem.state = Bach::LoadedTileState::ParsingFailed;
+            tileMemoryByteSize -= memoryItem.byteSize;
+            memoryItem.byteSize = 0;
+            tileMemoryDemotedCount--;
+            lock.unlock();
+            emit tileFinished(coord);
+            return;
+        }
+
+        memoryItem.tileData = std::move(allocatedTile);
+        memoryItem.demoted = false;
+        // Keep the bytes uncompressed while the tile is parsed, like a freshly loaded tile.
+        memoryItem.encodedBytes = encodedBytes;
+        memoryItem.encodedBytesCompressed = false;
+        tileMemoryByteSize -= memoryItem.byteSize;
+        memoryItem.byteSize = 2 * encodedBytes.size() + meshByteSize;
+        tileMemoryByteSize += memoryItem.byteSize;
+        tileMemoryDemotedCount--;
+        tileMemoryParsedVectorCount++;
+        tileMemoryPromotions++;
+        // Like a tile that just finished loading, it must make it to the next render.
+        markRecentlyUsed_Locked(shard, memoryItem);
+        tileMemoryNewestInsertTick = memoryItem.lastUsedTick;
+    }
+    evictTilesOverBudget();
+    emit tileFinished(coord);
+
+    if (signalFn)
+        signalFn(coord);
+}
+
 /*!
  * \brief TileLoader::insertIntoTileMemory parses byte-array and inserts into vectorTile memory.
  * \param coord is the tile coordinate.
@@ -714,17 +2673,21 @@ void TileLoader::insertIntoTileMemory_Raster(
  * \param rasterImage is the raster image version of the tile.
  * \param signalFn is a function to call when the tiles finish loading.
  *
+ * The bytes may point into a memory-mapped file. They are only kept after the call,
+ * as a copy, if vector tiles can be demoted, see TileMemoryLimits::maxParsedVectorTiles.
+ *
  * \threadsafe
  */
 void TileLoader::insertIntoTileMemory_Vector(
     TileCoord coord,
-    const QByteArray &vectorBytes,
+    QByteArrayView vectorBytes,
     TileLoadedCallbackFn signalFn)
 {
     // Check iterator to see if it's fine to access
     // this tile-memory element.
+    TileMemoryShard &shard = getTileMemoryShard(coord);
     auto checkIterator = [&](auto tileIt) {
-        if (tileIt == vectorTileMemory.end() || tileIt->second.state != Bach::LoadedTileState::Pending) {
+        if (tileIt == shard.vectorTileMemory.end() || tileIt->second.state != Bach::LoadedTileState::Pending) {
             // Error because tile needs to exist and be pending
             // before we insert it.
             qWarning() <<
@@ -737,43 +2700,67 @@ void TileLoader::insertIntoTileMemory_Vector(
     };
 
     // Try parsing the bytes into our tile.
-    std::optional<VectorTile> newTileResult = Bach::tileFromByteArray(vectorBytes);
+    qint64 meshByteSize = 0;
+    std::unique_ptr<VectorTile> allocatedTile = parseVectorTile(
+        coord,
+        vectorBytes,
+        meshByteSize,
+        [&](std::shared_ptr<const VectorTile> partialTile) {
+            publishPartialTile_Vector(coord, std::move(partialTile), signalFn);
+        });
 
     // If we failed to parse our tile,
     // mark the memory as parsing failed.
-    if (!newTileResult.has_value()) {
+    if (allocatedTile == nullptr) {
         qCritical() << "Error when parsing tile " << coord.toString();
 
         // Insert into the tile memory storage.
-        QMutexLocker lock = createTileMemoryLocker();
-
-        auto tileIt = vectorTileMemory.find(coord);
-        if (!checkIterator(tileIt)) {
-            return;
-        } else {
-            StoredVectorTile &memoryItem = tileIt->second;
-            memoryItem.tileData = nullptr;
-            memoryItem.state = Bach::LoadedTileState::ParsingFailed;
+        {
+            QMutexLocker lock = shard.createLocker();
+
+            auto tileIt = shard.vectorTileMemory.find(coord);
+            if (!checkIterator(tileIt)) {
+                return;
+            } else {
+                StoredVectorTile &memoryItem = tileIt->second;
+                memoryItem.tileData = nullptr;
+                memoryItem.partialTileData = nullptr;
+                finishPendingTile_Locked(memoryItem, Bach::LoadedTileState::ParsingFailed);
+                trackLoadedTile_Locked(shard, { coord, TileType::Vector }, memoryItem);
+            }
         }
+        evictTilesOverBudget();
         emit tileFinished(coord);
         return;
     }
 
-    // Turn our VectorTile into a dedicated allocation that fits our storage.
-    auto allocatedTile = std::make_unique<VectorTile>(std::move(newTileResult.value()));
+    // The bytes may be memory-mapped, so they are copied if we want to keep them.
+    QByteArray encodedBytes;
+    if (keepEncodedVectorTiles)
+        encodedBytes = vectorBytes.toByteArray();
+
     // Create a scope for our mutex lock.
     {
-        QMutexLocker lock = createTileMemoryLocker();
-        auto tileIt = vectorTileMemory.find(coord);
+        QMutexLocker lock = shard.createLocker();
+        auto tileIt = shard.vectorTileMemory.find(coord);
         if (!checkIterator(tileIt)) {
             return;
         } else {
             // Mark our tile as OK and insert the Tile data.
             StoredVectorTile &memoryItem = tileIt->second;
             memoryItem.tileData = std::move(allocatedTile);
-            memoryItem.state = Bach::LoadedTileState::Ok;
+            memoryItem.partialTileData = nullptr;
+            memoryItem.encodedBytes = std::move(encodedBytes);
+            memoryItem.encodedBytesCompressed = false;
+            // We don't know the exact size of the parsed tile,
+            // so we approximate it by the size of the encoded data and its meshes.
+            memoryItem.byteSize = vectorBytes.size() + meshByteSize + memoryItem.encodedBytes.size();
+            finishPendingTile_Locked(memoryItem, Bach::LoadedTileState::Ok);
+            trackLoadedTile_Locked(shard, { coord, TileType::Vector }, memoryItem);
+            tileMemoryParsedVectorCount++;
         }
     }
+    evictTilesOverBudget();
     emit tileFinished(coord);
 
     // Fire the signal.
@@ -783,6 +2770,263 @@ void TileLoader::insertIntoTileMemory_Vector(
         signalFn(coord);
 }
 
+/*!
+ * \brief Bach::calcTilesInRegion lists every tile of the zoom range that overlaps the region.
+ * Zoom levels are clamped to the levels the map can show.
+ *
+ * \return The tiles, ordered by zoom level and then row by row.
+ */
+std::vector<TileCoord> Bach::calcTilesInRegion(const TileRegion &region)
+{
+    // North is at the top, so the largest latitude gives the smallest Y.
+    const MapCoordinate topLeft = lonLatToWorldNormCoordDegrees(region.minLon, region.maxLat);
+    const MapCoordinate bottomRight = lonLatToWorldNormCoordDegrees(region.maxLon, region.minLat);
+
+    std::vector<TileCoord> out;
+    for (int zoom = qMax(region.minZoom, 0); zoom <= qMin(region.maxZoom, maxZoomLevel); zoom++) {
+        const int tileCount = 1 << zoom;
+        auto toTile = [&](double norm) {
+            return std::clamp((int)std::floor(norm * tileCount), 0, tileCount - 1);
+        };
+        for (int y = toTile(topLeft.y); y <= toTile(bottomRight.y); y++) {
+            for (int x = toTile(topLeft.x); x <= toTile(bottomRight.x); x++)
+                out.push_back({ zoom, x, y });
+        }
+    }
+    return out;
+}
+
+/*!
+ * \brief Bach::parseTileRegionBounds reads 'minLon,minLat,maxLon,maxLat' into the bounding box of a region.
+ * The zoom levels of the region are left as they are.
+ *
+ * \return Returns false if the text is not four numbers with the minimums below the maximums.
+ * The region is not changed then.
+ */
+bool Bach::parseTileRegionBounds(const QString &text, TileRegion &region)
+{
+    const QStringList parts = text.split(',');
+    if (parts.size() != 4)
+        return false;
+    double values[4] = {};
+    for (int i = 0; i < 4; i++) {
+        bool ok = false;
+        values[i] = parts[i].toDouble(&ok);
+        if (!ok)
+            return false;
+    }
+    if (values[0] > values[2] || values[1] > values[3])
+        return false;
+    region.minLon = values[0];
+    region.minLat = values[1];
+    region.maxLon = values[2];
+    region.maxLat = values[3];
+    return true;
+}
+
+// Downloads of 'seedRegion' that take longer than this are aborted and retried.
+static constexpr int seedTransferTimeoutMs = 30000;
+// Upper bound of the delay between retries of 'seedRegion'.
+static constexpr qint64 seedMaxRetryDelayMs = 60000;
+
+/*!
+ * \internal
+ * \brief Returns true if a failed seed download is worth asking for again.
+ * That is when the server asks us to slow down or is unavailable,
+ * or when we never got a reply at all.
+ */
+static bool isRetryableSeedReply(const QNetworkReply &reply)
+{
+    const int statusCode = reply.attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    switch (statusCode) {
+        case 0:
+        case 429:
+        case 500:
+        case 502:
+        case 503:
+        case 504:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*!
+ * \internal
+ * \brief Reads the 'Retry-After' header of a reply, which can either
+ * be an amount of seconds or a date.
+ * \return The amount of milliseconds to wait, or nullopt if the header is missing.
+ */
+static std::optional<qint64> retryAfterMsFromReply(const QNetworkReply &reply)
+{
+    const QByteArray value = reply.rawHeader("Retry-After").trimmed();
+    if (value.isEmpty())
+        return std::nullopt;
+    bool isSeconds = false;
+    const qint64 seconds = value.toLongLong(&isSeconds);
+    if (isSeconds)
+        return qMax(seconds, 0ll) * 1000;
+    const QDateTime date = QDateTime::fromString(QString::fromLatin1(value), Qt::RFC2822Date);
+    if (date.isValid())
+        return qMax(QDateTime::currentDateTimeUtc().msecsTo(date), 0ll);
+    return std::nullopt;
+}
+
+/*!
+ * \brief Downloads every tile of a region into the disk cache, so that a
+ * TileLoader created with 'newLocalOnly' can show the region without
+ * any network access.
+ *
+ * This is a blocking call that runs an event loop for its downloads
+ * on the calling thread. It does not go through the tile memory or the
+ * network thread, so the TileLoader can keep serving requests meanwhile.
+ *
+ * Tiles that are already in the disk cache are skipped. A seed that was
+ * stopped, or had tiles that failed, is resumed by calling this again.
+ * The disk cache limits must leave room for the region, or the seeded
+ * tiles are pruned like any other. The packed disk cache is never pruned.
+ *
+ * \param policy Bounds the load put on the tile server, see TileSeedPolicy.
+ *
+ * \param progressFn Called on the calling thread once the cached tiles are
+ * counted, and after every download. Return false from it to stop seeding,
+ * downloads in flight are finished first.
+ *
+ * \return The outcome of the tiles in the region, or nullopt if
+ * the TileLoader has no URL template to download tiles from.
+ */
+std::optional<Bach::TileSeedProgress> TileLoader::seedRegion(
+    const TileRegion &region,
+    const TileSeedPolicy &policy,
+    const SeedProgressFn &progressFn)
+{
+    QString vectorUrlTemplate;
+    QString rasterUrlTemplate;
+    {
+        QMutexLocker lock { urlTemplateLock.get() };
+        vectorUrlTemplate = pbfLinkTemplate;
+        rasterUrlTemplate = pngUrlTemplate;
+    }
+    if (!useWeb || vectorUrlTemplate.isEmpty()) {
+        qWarning() << "Unable to seed the tile cache, the TileLoader has no tile URL to download from.";
+        return std::nullopt;
+    }
+    const bool seedRaster = policy.includeRaster && !rasterUrlTemplate.isEmpty();
+    if (policy.includeRaster && !seedRaster)
+        qWarning() << "The TileLoader has no raster tile URL, only seeding vector tiles.";
+
+    struct SeedJob {
+        TileMemoryKey key;
+        // Amount of times this tile has been asked for again.
+        int attempt = 0;
+    };
+
+    // Skipping the tiles we already have is what makes seeding resumable.
+    TileSeedProgress progress;
+    std::deque<SeedJob> queue;
+    for (TileCoord coord : calcTilesInRegion(region)) {
+        for (TileType type : { TileType::Vector, TileType::Raster }) {
+            if (type == TileType::Raster && !seedRaster)
+                continue;
+            progress.totalTiles++;
+            if (isTileOnDisk(coord, type))
+                progress.cachedTiles++;
+            else
+                queue.push_back({ { coord, type } });
+        }
+    }
+    bool stopped = progressFn && !progressFn(progress);
+    if (stopped || queue.empty())
+        return progress;
+
+    const bool allowHttp2 = getNetworkPolicy().allowHttp2;
+    const int maxConcurrentDownloads = qMax(policy.maxConcurrentDownloads, 1);
+
+    QNetworkAccessManager manager;
+    QEventLoop loop;
+    QElapsedTimer clock;
+    clock.start();
+    // Set when the server asked us to back off. No downloads are started before then.
+    qint64 pausedUntilMs = 0;
+    int inFlight = 0;
+    // Starts the next downloads once we are done waiting, see calcWaitMs.
+    QTimer wakeTimer;
+    wakeTimer.setSingleShot(true);
+
+    // Returns how long to wait before the next download can start.
+    auto calcWaitMs = [&]() {
+        const qint64 nowMs = clock.elapsed();
+        qint64 waitMs = pausedUntilMs - nowMs;
+        if (policy.maxBytesPerSecond.has_value() && policy.maxBytesPerSecond.value() > 0) {
+            // Wait until the average rate since the start is back within budget.
+            const qint64 budgetMs = progress.downloadedBytes * 1000 / policy.maxBytesPerSecond.value();
+            waitMs = qMax(waitMs, budgetMs - nowMs);
+        }
+        return waitMs;
+    };
+
+    std::function<void()> startDownloads;
+    auto handleReply = [&](SeedJob job, QNetworkReply *reply) {
+        reply->deleteLater();
+        inFlight--;
+
+        if (reply->error() == QNetworkReply::NoError) {
+            const QByteArray bytes = reply->readAll();
+            const HttpCacheHeaders cacheHeaders = cacheHeadersFromReply(*reply);
+            if (job.key.type == TileType::Vector)
+                writeTileToDisk_Vector(job.key.coord, bytes, cacheHeaders);
+            else
+                writeTileToDisk_Raster(job.key.coord, bytes, cacheHeaders);
+            progress.downloadedTiles++;
+            progress.downloadedBytes += bytes.size();
+        } else if (isRetryableSeedReply(*reply) && job.attempt < policy.maxRetries) {
+            // Every download backs off, not only this one, since the server is likely to refuse them too.
+            const qint64 backoffMs = (qint64)qMax(policy.retryDelayMs, 0) << qMin(job.attempt, 16);
+            const qint64 delayMs = qMin(retryAfterMsFromReply(*reply).value_or(backoffMs), seedMaxRetryDelayMs);
+            pausedUntilMs = qMax(pausedUntilMs, clock.elapsed() + delayMs);
+            job.attempt++;
+            queue.push_front(job);
+        } else {
+            qWarning() << "Unable to seed tile" << job.key.coord.toString() << ":" << reply->errorString();
+            progress.failedTiles++;
+        }
+
+        if (progressFn && !progressFn(progress))
+            stopped = true;
+        startDownloads();
+    };
+    startDownloads = [&]() {
+        while (!stopped && inFlight < maxConcurrentDownloads && !queue.empty()) {
+            const qint64 waitMs = calcWaitMs();
+            if (waitMs > 0) {
+                wakeTimer.start(waitMs);
+                return;
+            }
+
+            const SeedJob job = queue.front();
+            queue.pop_front();
+            const QString &urlTemplate = job.key.type == TileType::Vector ? vectorUrlTemplate : rasterUrlTemplate;
+            QNetworkRequest request { Bach::setPbfLink(job.key.coord, urlTemplate) };
+            request.setAttribute(QNetworkRequest::Http2AllowedAttribute, allowHttp2);
+            request.setTransferTimeout(seedTransferTimeoutMs);
+            QNetworkReply *reply = manager.get(request);
+            inFlight++;
+            QObject::connect(
+                reply,
+                &QNetworkReply::finished,
+                &loop,
+                [&, job, reply]() { handleReply(job, reply); });
+        }
+        if (inFlight == 0 && (stopped || queue.empty()))
+            loop.quit();
+    };
+    QObject::connect(&wakeTimer, &QTimer::timeout, &loop, [&]() { startDownloads(); });
+
+    startDownloads();
+    loop.exec();
+    return progress;
+}
+
 /*!
  * \brief writeTileToDiskCache writes tile information to the disk cache.
  *
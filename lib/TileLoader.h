@@ -5,26 +5,47 @@
 #define BACH_TILELOADER_H
 
 // Qt header files
+#include <QByteArrayView>
+#include <QImage>
+#include <QList>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QNetworkAccessManager>
+#include <QNetworkRequest>
 #include <QObject>
-#include <QThreadPool>
+#include <QPoint>
+#include <QPointF>
+#include <QFile>
+#include <QThread>
 #include <QUrl>
+#include <QWaitCondition>
 
 // STL header files
+#include <array>
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <optional>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 // Other header files
 #include "RequestTilesResult.h"
+#include "TaskScheduler.h"
 #include "TileCoord.h"
+#include "TileDiskCache.h"
+#include "TilePackFile.h"
+#include "Tracing.h"
 #include "Utilities.h"
 #include "VectorTiles.h"
 
 class UnitTesting;
+struct TileResultType;
 
 namespace Bach {
     enum class LoadedTileState {
@@ -35,6 +56,179 @@ namespace Bach {
         UnknownError
     };
 
+    /*!
+     * \brief The TileMemoryLimits struct describes how much the TileLoader
+     * is allowed to keep in its in-memory tile cache.
+     *
+     * A limit that is set to nullopt is unbounded. When both limits are set,
+     * tiles are evicted until both are satisfied.
+     */
+    struct TileMemoryLimits {
+        /*!
+         * \brief Maximum amount of loaded tile entries held in memory.
+         * Vector and raster tiles of the same coordinate count as two entries.
+         */
+        std::optional<int> maxTileCount;
+
+        /*!
+         * \brief Maximum amount of bytes used by loaded tiles held in memory.
+         *
+         * Raster tiles are measured by their decoded image size. Vector tiles
+         * are approximated by the size of their encoded MVT data.
+         */
+        std::optional<qint64> maxBytes;
+
+        /*!
+         * \brief Maximum amount of vector tiles kept parsed in memory.
+         *
+         * Beyond it, the least recently requested vector tiles are demoted to their
+         * encoded MVT bytes, which take several times less memory than the parsed tile.
+         * Demoted tiles stay in memory within the limits above, and are parsed again
+         * from memory on a worker thread when they are requested.
+         *
+         * When set, parsed vector tiles also keep a copy of their encoded bytes,
+         * which counts towards maxBytes. Unbounded by default, nothing is demoted.
+         */
+        std::optional<int> maxParsedVectorTiles;
+
+        /*!
+         * \brief Controls whether the bytes of demoted vector tiles are compressed.
+         * Saves memory at the cost of decompressing them before they are parsed again.
+         */
+        bool compressDemotedVectorTiles = false;
+    };
+
+    /*!
+     * \brief The TileMemoryStats struct contains counters describing
+     * how the in-memory tile cache of a TileLoader has been used.
+     */
+    struct TileMemoryStats {
+        // Amount of requested tiles that were ready in memory.
+        qint64 hits = 0;
+        // Amount of requested tiles that were not ready in memory.
+        qint64 misses = 0;
+        // Amount of tiles that have been removed from memory to stay within budget.
+        qint64 evictions = 0;
+        // Amount of vector tiles that have been demoted to their encoded bytes,
+        // and that have been parsed again from memory after being requested.
+        qint64 demotions = 0;
+        qint64 promotions = 0;
+        // Amount of loaded tile entries currently held in memory.
+        int tileCount = 0;
+        // Amount of bytes currently accounted for by loaded tiles.
+        qint64 byteSize = 0;
+        // Amount of the loaded vector tiles that are currently demoted.
+        int demotedTileCount = 0;
+        // Amount of tiles queued for loading by the prefetch policy.
+        qint64 prefetchLoads = 0;
+        // Amount of prefetched tiles that were ready in memory the first time they were requested.
+        // The prefetch hit rate is prefetchHits / prefetchLoads.
+        qint64 prefetchHits = 0;
+        // Amount of tile entries that are still loading.
+        int pendingTileCount = 0;
+        // Amount of tile downloads currently in flight.
+        int activeDownloads = 0;
+    };
+
+    /*!
+     * \brief The TilePrefetchPolicy struct describes which tiles the TileLoader
+     * loads ahead of time, in addition to the tiles passed to 'requestTiles'.
+     *
+     * The viewport is taken to be the bounding box of the requested tiles at the
+     * zoom level most of them are at. Prefetched tiles are always loaded after the
+     * requested tiles, and the parts of the map closest to the viewport go first.
+     */
+    struct TilePrefetchPolicy {
+        // Prefetching is disabled unless this is set.
+        bool enabled = false;
+        // Amount of tiles to load around every side of the viewport.
+        int ringWidth = 1;
+        // Amount of tiles to load ahead of the viewport in the direction it is panning.
+        int panLookaheadTiles = 2;
+        // Load the tiles one zoom level above the viewport.
+        bool loadParentZoom = true;
+        // Load the tiles one zoom level below the viewport.
+        // This is four times the amount of tiles in the viewport.
+        bool loadChildZoom = false;
+        // Maximum amount of prefetched tiles that can be loading at the same time,
+        // this bounds the bandwidth and worker time spent on tiles that might never be shown.
+        int maxPendingLoads = 16;
+    };
+
+    /*!
+     * \brief The TileNetworkPolicy struct describes how the TileLoader
+     * downloads tiles from the web.
+     *
+     * Compressed transfer is always negotiated. QNetworkAccessManager asks for
+     * gzip and deflate, and brotli when Qt is built with it, and decompresses the replies.
+     */
+    struct TileNetworkPolicy {
+        // Maximum amount of downloads in flight against a single host.
+        // Further downloads wait for their turn, in the order they were asked for.
+        int maxRequestsPerHost = 6;
+        // Lets every download against a host share one multiplexed connection,
+        // when the server supports it.
+        bool allowHttp2 = true;
+    };
+
+    /*!
+     * \brief The TileRegion struct describes an area of the map
+     * across a range of zoom levels, see calcTilesInRegion.
+     */
+    struct TileRegion {
+        // The bounding box, in degrees. Web Mercator tiles
+        // stop at roughly 85.05 degrees north and south.
+        double minLon = -180;
+        double minLat = -85.0511;
+        double maxLon = 180;
+        double maxLat = 85.0511;
+        // The range of zoom levels, both inclusive.
+        int minZoom = 0;
+        int maxZoom = 0;
+    };
+
+    /*!
+     * \brief The TileSeedPolicy struct describes how 'TileLoader::seedRegion'
+     * downloads tiles, so that it stays within what the tile server allows.
+     */
+    struct TileSeedPolicy {
+        // Maximum amount of downloads in flight at the same time.
+        int maxConcurrentDownloads = 2;
+        // Maximum average download rate, in bytes per second.
+        // Set to nullopt for an unbounded rate.
+        std::optional<qint64> maxBytesPerSecond;
+        // Amount of times a tile is retried after the server asked us to slow
+        // down, was unavailable, or the connection failed.
+        int maxRetries = 5;
+        // Delay before the first retry, doubled for every retry after it.
+        // A 'Retry-After' header from the server takes precedence.
+        int retryDelayMs = 1000;
+        // Also download the raster tiles of the region.
+        bool includeRaster = false;
+    };
+
+    /*!
+     * \brief The TileSeedProgress struct counts the outcome of the tiles in a seeded region.
+     * Vector and raster tiles of the same coordinate count as two tiles.
+     */
+    struct TileSeedProgress {
+        // Amount of tiles in the region.
+        qint64 totalTiles = 0;
+        // Amount of tiles that were already in the disk cache, and were skipped.
+        qint64 cachedTiles = 0;
+        // Amount of tiles downloaded into the disk cache.
+        qint64 downloadedTiles = 0;
+        // Amount of tiles that could not be downloaded.
+        qint64 failedTiles = 0;
+        // Amount of tile bytes downloaded.
+        qint64 downloadedBytes = 0;
+
+        qint64 doneTiles() const { return cachedTiles + downloadedTiles + failedTiles; }
+    };
+
+    std::vector<TileCoord> calcTilesInRegion(const TileRegion &region);
+    bool parseTileRegionBounds(const QString &text, TileRegion &region);
+
     /*!
      * \class System for loading, storing and caching map-tiles.
      *
@@ -50,11 +244,15 @@ namespace Bach {
         // TileLoader object.
         TileLoader();
     public:
+        // Function signature of the tile-loaded
+        // callback passed into 'requestTiles'.
+        using TileLoadedCallbackFn = std::function<void(TileCoord)>;
+
         // We disallow implicit copying.
         TileLoader(const TileLoader&) = delete;
         // Inheriting from QObject makes our class non-movable.
         TileLoader(TileLoader&&) = delete;
-        ~TileLoader(){};
+        ~TileLoader();
 
         // Disallow copying.
         TileLoader& operator=(const TileLoader&) = delete;
@@ -75,19 +273,78 @@ namespace Bach {
             const QString &pngUrlTemplate,
             StyleSheet&& styleSheet);
 
-        static std::unique_ptr<TileLoader> newLocalOnly(StyleSheet&& styleSheet);
+        static std::unique_ptr<TileLoader> newLocalOnly(
+            StyleSheet&& styleSheet,
+            const QString &diskCachePath = QString(),
+            bool loadRaster = true);
 
         using LoadTileOverrideFnT = QByteArray const*(TileCoord, TileType);
         static std::unique_ptr<TileLoader> newDummy(
             const QString &diskCachePath,
             std::function<LoadTileOverrideFnT> loadTileOverride = nullptr,
             bool loadRaster = true,
-            std::optional<int> workerThreadCount = std::nullopt);
+            std::optional<int> workerThreadCount = std::nullopt,
+            StyleSheet&& styleSheet = StyleSheet{});
 
         QString getTileDiskPath(TileCoord coord, TileType tileType);
 
+        void setTileUrlTemplates(const QString &pbfUrlTemplate, const QString &pngUrlTemplate);
+
+        // File name of the packed disk cache inside the tile cache folder.
+        static constexpr const char* packedDiskCacheFileName = "tiles.pack";
+        bool enablePackedDiskCache(const QString &packFilePath = QString());
+        bool isUsingPackedDiskCache() const;
+
+        void setDiskCacheLimits(const TileDiskCacheLimits &limits);
+        TileDiskCacheLimits getDiskCacheLimits() const;
+        TileDiskCacheStats getDiskCacheStats() const;
+
         std::optional<Bach::LoadedTileState> getTileState_Vector(TileCoord) const;
 
+        void setTileMemoryLimits(const TileMemoryLimits &limits);
+        TileMemoryLimits getTileMemoryLimits() const;
+        TileMemoryStats getTileMemoryStats() const;
+
+        void setUseDescendantFallbacks(bool enabled);
+        bool usesDescendantFallbacks() const;
+
+        void setSourceMaxZoom(std::optional<int> maxZoom);
+        std::optional<int> getSourceMaxZoom() const;
+
+        void setTessellateVectorTiles(bool enabled);
+        bool tessellatesVectorTiles() const;
+
+        void setPrepareTileLabels(bool enabled);
+        bool preparesTileLabels() const;
+
+        void setRasterTileFormat(QImage::Format format);
+        QImage::Format getRasterTileFormat() const;
+
+        void setRasterTileMipLevels(int levels);
+        int getRasterTileMipLevels() const;
+
+        void setTileParseOptions(const TileParseOptions &options);
+        TileParseOptions getTileParseOptions() const;
+
+        void setDecodeStyledLayersOnly(bool enabled);
+        bool decodesStyledLayersOnly() const;
+
+        void setStreamVectorTileLayers(bool enabled);
+        bool streamsVectorTileLayers() const;
+
+        void setPrefetchPolicy(const TilePrefetchPolicy &policy);
+        TilePrefetchPolicy getPrefetchPolicy() const;
+
+        void setNetworkPolicy(const TileNetworkPolicy &policy);
+        TileNetworkPolicy getNetworkPolicy() const;
+
+        // Called after every finished tile. Return false to stop seeding.
+        using SeedProgressFn = std::function<bool(const TileSeedProgress&)>;
+        std::optional<TileSeedProgress> seedRegion(
+            const TileRegion &region,
+            const TileSeedPolicy &policy = {},
+            const SeedProgressFn &progressFn = nullptr);
+
     signals:
         /*!
          * @brief Gets signalled whenever a tile is finished loading,
@@ -99,14 +356,24 @@ namespace Bach {
     private:
         StyleSheet styleSheet;
 
+        // The URL templates can be set after the TileLoader is created, while tiles are loading.
+        // Contained in a unique_ptr to let use the lock in const methods.
+        std::unique_ptr<QMutex> urlTemplateLock = std::make_unique<QMutex>();
+        // IMPORTANT! Only use when 'urlTemplateLock' is locked!
         QString pbfLinkTemplate;
+        // IMPORTANT! Only use when 'urlTemplateLock' is locked!
         QString pngUrlTemplate;
 
-        QNetworkAccessManager networkManager;
+        // Tile downloads and their replies are handled on this thread.
+        QThread networkThread;
+        // Lives on 'networkThread', and is deleted there when the TileLoader is destroyed.
+        QNetworkAccessManager *networkManager = nullptr;
+        // Set once the TileLoader is being destroyed, so no more work gets queued.
+        std::atomic<bool> shuttingDown = false;
 
         // Controls whether the TileLoader should try to access
         // web when loading.
-        bool useWeb = true;
+        std::atomic<bool> useWeb = true;
 
         // Controls whether we should load raster-tiles.
         bool loadRaster = true;
@@ -116,21 +383,82 @@ namespace Bach {
         // Directory path to tile cache storage.
         QString tileCacheDiskPath;
 
-        struct StoredVectorTile {
+        // If set, the disk cache is stored in this single file
+        // instead of one file per tile under 'tileCacheDiskPath'.
+        std::unique_ptr<TilePackFile> diskCachePack;
+
+        // Keeps track of the tiles in 'tileCacheDiskPath', for revalidating and pruning them.
+        // Not used when 'diskCachePack' is set, since tiles can't be removed from the pack file.
+        std::unique_ptr<TileDiskCache> diskCache;
+        TileDiskCache* activeDiskCache() const;
+        bool needsRevalidation(TileCoord coord, TileType type) const;
+        bool isTileOnDisk(TileCoord coord, TileType type) const;
+
+        // Our result type needs to unpin its tiles when it is destroyed.
+        friend struct ::TileResultType;
+
+        // Identifies a single entry in either of the tile memories.
+        struct TileMemoryKey {
+            TileCoord coord;
+            TileType type;
+        };
+        // Ordered from least recently used to most recently used.
+        using TileMemoryLruList = std::list<TileMemoryKey>;
+
+        // Book-keeping shared by both vector and raster tiles in memory.
+        struct StoredTileBase {
             // Current loading-state of this tile.
             Bach::LoadedTileState state = {};
 
+            // Amount of live RequestTilesResult objects referencing this tile.
+            // A tile can not be evicted while this is above zero.
+            int pinCount = 0;
+
+            // Amount of bytes this tile accounts for in the memory budget.
+            qint64 byteSize = 0;
+
+            // The value of the global access counter the last time this
+            // tile was inserted or requested. Used to compare LRU order across shards.
+            quint64 lastUsedTick = 0;
+
+            // Position of this tile in its shard's LRU list.
+            // Only valid once the tile is no longer pending.
+            TileMemoryLruList::iterator lruIt;
+
+            // Set when the tile was queued by the prefetch policy and
+            // has not been requested since.
+            bool prefetched = false;
+
+            // Set when the tile is loaded, but only kept in an encoded form
+            // that has to be decoded again before it can be rendered.
+            bool demoted = false;
+
+            // Tells us whether this tile is safe to return to
+            // rendering.
+            bool isReadyToRender() const {
+                return state == Bach::LoadedTileState::Ok && !demoted;
+            }
+        };
+
+        struct StoredVectorTile : StoredTileBase {
             // Stores the final vectorTile data.
             //
             // We use std::unique_ptr over QScopedPointer
             // because QScopedPointer doesn't support move semantics.
             std::unique_ptr<VectorTile> tileData;
 
-            // Tells us whether this tile is safe to return to
-            // rendering.
-            bool isReadyToRender() const {
-                return state == Bach::LoadedTileState::Ok;
-            }
+            // The encoded MVT bytes of the tile, kept so that the tile can be demoted.
+            // Compressed with qCompress if 'encodedBytesCompressed' is set.
+            // See TileMemoryLimits::maxParsedVectorTiles.
+            QByteArray encodedBytes;
+            bool encodedBytesCompressed = false;
+            // Set while a worker is parsing this demoted tile again.
+            bool promoting = false;
+
+            // The layers decoded so far of a pending tile, see setStreamVectorTileLayers.
+            // Shared with the results it was returned in, since the complete tile
+            // replaces it while they may still be drawing it.
+            std::shared_ptr<const VectorTile> partialTileData;
 
             // Creates a new tile-item with a pending state.
             static StoredVectorTile newPending() {
@@ -140,17 +468,10 @@ namespace Bach {
             }
         };
 
-        struct StoredRasterTile {
-            // Current loading-state of this tile.
-            Bach::LoadedTileState state = {};
-
+        struct StoredRasterTile : StoredTileBase {
             QImage image;
-
-            // Tells us whether this tile is safe to return to
-            // rendering.
-            bool isReadyToRender() const {
-                return state == Bach::LoadedTileState::Ok;
-            }
+            // Downscaled copies of the image, see setRasterTileMipLevels.
+            QList<QImage> mipLevels;
 
             // Creates a new tile-item with a pending state.
             static StoredRasterTile newPending() {
@@ -159,42 +480,147 @@ namespace Bach {
                 return temp;
             }
         };
-        /* This contains our memory tile-cache.
-         *
-         * IMPORTANT! Only use when 'tileMemoryLock' is locked!
-         *
-         * We had to use std::map because QMap doesn't support move semantics,
-         * which interferes with our automated resource cleanup.
-         */
-        std::map<TileCoord, StoredVectorTile> vectorTileMemory;
-        /* This contains our memory tile-cache.
+
+        /* A subset of our memory tile-cache. Each TileCoord always maps to the
+         * same shard, so the paint thread only contends with the workers that
+         * happen to publish into the same shard at the same time.
          *
-         * IMPORTANT! Only use when 'tileMemoryLock' is locked!
+         * IMPORTANT! Only access the members when the shard's lock is held!
          *
-         * We had to use std::map because QMap doesn't support move semantics,
-         * which interferes with our automated resource cleanup.
+         * We use std::unordered_map because QHash doesn't support move-only values,
+         * which interferes with our automated resource cleanup. Its nodes also stay put
+         * when it grows, so pointers to stored tiles stay valid until they are erased.
          */
-        std::map<TileCoord, StoredRasterTile> rasterTileMemory;
+        struct TileMemoryShard {
+            std::unordered_map<TileCoord, StoredVectorTile> vectorTileMemory;
+            std::unordered_map<TileCoord, StoredRasterTile> rasterTileMemory;
+
+            // Contains every loaded (non-pending) entry of this shard,
+            // ordered by how recently they were requested.
+            TileMemoryLruList lru;
+
+            // We use unique-ptr here to let use the lock in const methods.
+            std::unique_ptr<QMutex> _lock = std::make_unique<QMutex>();
+
+            // Generates the scoped lock for this shard.
+            // Will block if mutex is already held.
+            QMutexLocker<QMutex> createLocker() const
+            {
+                // Times how long we wait for the lock.
+                BACH_TRACE_SCOPE("TileMemoryShard::createLocker");
+                return QMutexLocker(_lock.get());
+            }
+
+            // Returns the stored tile for a given key, or nullptr if not found.
+            StoredTileBase* find(const TileMemoryKey &key);
+        };
 
+        static constexpr int tileMemoryShardCount = 16;
+        std::array<TileMemoryShard, tileMemoryShardCount> tileMemoryShards;
+        TileMemoryShard& getTileMemoryShard(TileCoord coord);
+        const TileMemoryShard& getTileMemoryShard(TileCoord coord) const;
+
+        // Global counter that is bumped every time a tile is inserted or requested.
+        std::atomic<quint64> tileMemoryAccessTick = 0;
+        // The tick of the tile that was inserted most recently.
+        // This tile is never picked for eviction.
+        std::atomic<quint64> tileMemoryNewestInsertTick = 0;
+
+        // Totals across all shards, used to check the memory budget.
+        std::atomic<qint64> tileMemoryTileCount = 0;
+        std::atomic<qint64> tileMemoryByteSize = 0;
+        std::atomic<qint64> tileMemoryHits = 0;
+        std::atomic<qint64> tileMemoryMisses = 0;
+        std::atomic<qint64> tileMemoryEvictions = 0;
+        std::atomic<qint64> tileMemoryDemotions = 0;
+        std::atomic<qint64> tileMemoryPromotions = 0;
+        // Amount of loaded vector tiles that are parsed, and that are demoted.
+        std::atomic<qint64> tileMemoryParsedVectorCount = 0;
+        std::atomic<qint64> tileMemoryDemotedCount = 0;
+        // Set when parsed vector tiles keep their encoded bytes around to be demoted later.
+        std::atomic<bool> keepEncodedVectorTiles = false;
+        std::atomic<qint64> prefetchLoads = 0;
+        std::atomic<qint64> prefetchHits = 0;
+        // Amount of prefetched tiles that are still pending.
+        std::atomic<int> pendingPrefetchLoads = 0;
+        // Sum of 'activeDownloadsByHost', readable from any thread.
+        std::atomic<int> activeDownloadCount = 0;
+
+        // Serializes eviction so only one thread picks victims at a time.
+        // Must never be locked while holding a shard lock.
+        //
         // We use unique-ptr here to let use the lock in const methods.
-        std::unique_ptr<QMutex> _tileMemoryLock = std::make_unique<QMutex>();
+        std::unique_ptr<QMutex> _evictionLock = std::make_unique<QMutex>();
+        // IMPORTANT! Only use when '_evictionLock' is locked!
+        TileMemoryLimits tileMemoryLimits;
+
+        // IMPORTANT! Only use when the shard's lock is held!
+        void trackLoadedTile_Locked(TileMemoryShard &shard, const TileMemoryKey &key, StoredTileBase &item);
+        // IMPORTANT! Only use when the shard's lock is held!
+        void markRecentlyUsed_Locked(TileMemoryShard &shard, StoredTileBase &item);
+        // Moves a pending tile into its new state.
+        // IMPORTANT! Only use when the shard's lock is held!
+        void finishPendingTile_Locked(StoredTileBase &item, Bach::LoadedTileState newState);
+
+        // IMPORTANT! Only use when both the shard's lock and '_evictionLock' are held!
+        bool demoteVectorTile_Locked(StoredVectorTile &item);
+        // Must be called without holding any shard lock or '_evictionLock'.
+        void compressDemotedTile_Vector(TileCoord coord);
+        void promoteDemotedTile_Vector(TileCoord coord, TileLoadedCallbackFn signalFn);
+
+        // Must be called without holding any shard lock.
+        void evictTilesOverBudget();
+
+        void unpinTiles(const QVector<TileMemoryKey> &keys);
+
+        // Controls whether the children of missing tiles are returned as fallbacks.
+        std::atomic<bool> useDescendantFallbacks = false;
+
+        // The highest zoom level of the tile source, or negative if unknown.
+        // Requested tiles above it are drawn from their ancestor at this zoom level.
+        std::atomic<int> sourceMaxZoom = -1;
+
+        // Controls whether parsed vector tiles are triangulated before they are stored.
+        std::atomic<bool> tessellateVectorTiles = false;
+
+        // Controls whether the labels of parsed vector tiles are prepared before they are stored.
+        std::atomic<bool> prepareTileLabels = false;
 
-        // Generates the scoped lock for our tile-memory.
-        // Will block if mutex is already held.
-        QMutexLocker<QMutex> createTileMemoryLocker() const { return QMutexLocker(_tileMemoryLock.get()); }
+        // The pixel format raster tiles are converted to after decoding.
+        std::atomic<QImage::Format> rasterTileFormat = QImage::Format_ARGB32_Premultiplied;
+        // The amount of downscaled copies kept of every raster tile.
+        std::atomic<int> rasterTileMipLevels = 0;
+
+        // Controls whether layers the style sheet doesn't draw are skipped when parsing.
+        std::atomic<bool> decodeStyledLayersOnly = false;
+
+        // Controls whether vector tiles are handed out while their layers are being parsed.
+        std::atomic<bool> streamVectorTileLayers = false;
+
+        // IMPORTANT! Only use when '_parseOptionsLock' is locked!
+        TileParseOptions parseOptions;
+        // We use unique-ptr here to let use the lock in const methods.
+        std::unique_ptr<QMutex> _parseOptionsLock = std::make_unique<QMutex>();
+        bool addFallbackTile(TileCoord coord, TileType type, ::TileResultType &out);
+        void addFallbackTiles(const QVector<TileCoord> &input, ::TileResultType &out);
 
     public:
-        // Function signature of the tile-loaded
-        // callback passed into 'requestTiles'.
-        using TileLoadedCallbackFn = std::function<void(TileCoord)>;
+        // Identifies a view, such as a MapWidget, that requests tiles from this TileLoader.
+        // Every client has its own set of wanted tiles, so that several views showing
+        // different parts of the map don't cancel the loads of each other's tiles.
+        // Client 0 always exists, and is used by requests that don't name a client.
+        using ClientId = int;
+        ClientId addClient();
+        void removeClient(ClientId client);
 
         QScopedPointer<Bach::RequestTilesResult> requestTiles(
-            const std::set<TileCoord> &requestInput,
+            const QVector<TileCoord> &requestInput,
             const TileLoadedCallbackFn &tileLoadedSignalFn,
-            bool loadMissingTiles);
+            bool loadMissingTiles,
+            ClientId client = 0);
         // Overload where we don't need to pass any callback function.
         auto requestTiles(
-            const std::set<TileCoord> &requestInput,
+            const QVector<TileCoord> &requestInput,
             bool loadMissingTiles)
         {
             return requestTiles(requestInput, nullptr, loadMissingTiles);
@@ -204,7 +630,7 @@ namespace Bach {
         // the TileLoader will not load missing tiles if the
         // callback is nullptr.
         auto requestTiles(
-            const std::set<TileCoord> &requestInput,
+            const QVector<TileCoord> &requestInput,
             const TileLoadedCallbackFn &tileLoadedSignalFn = nullptr)
         {
             return requestTiles(
@@ -217,41 +643,186 @@ namespace Bach {
         struct LoadJob {
             TileCoord tileCoord;
             TileType type;
+            // Jobs with a higher priority are started first.
+            qint64 priority = 0;
+            // The request generation that queued this job.
+            quint64 generation = 0;
+            // Set when the job was queued by the prefetch policy.
+            bool prefetch = false;
+            // Set when the tile is demoted, and is parsed again from the bytes kept in memory.
+            bool promote = false;
+        };
+        static void prioritizeLoadJobs(
+            QVector<LoadJob> &jobs,
+            const QVector<TileCoord> &requestedTiles,
+            quint64 generation);
+
+        // IMPORTANT! Only use when '_wantedTilesLock' is locked!
+        TilePrefetchPolicy prefetchPolicy;
+        // Tracks which way the requested area last moved, to prefetch ahead of it.
+        struct PanTracking {
+            // Zoom level of the latest request, the direction is reset when it changes.
+            int zoom = -1;
+            // Centre of the latest request, in tiles.
+            QPointF center;
+            // The sign of the last movement of the centre, along each axis.
+            QPoint direction;
         };
+        QVector<TileCoord> calcPrefetchTiles(
+            ClientId client,
+            const QVector<TileCoord> &requestedTiles,
+            const std::unordered_set<TileCoord> &requestedTileSet);
+        void queuePrefetchJobs(const QVector<TileCoord> &prefetchTiles, QVector<LoadJob> &loadJobs);
         void queueTileLoadingJobs(
             const QVector<LoadJob> &input,
             const TileLoadedCallbackFn &signalFn);
 
-        // Thread-pool for the tile-loader worker threads.
-        QThreadPool threadPool;
-        // Thread-pool for the tile-loader worker threads.
-        QThreadPool &getThreadPool() { return threadPool; }
-
-        bool loadFromDisk_Vector(TileCoord coord, TileLoadedCallbackFn signalFn);
-        bool loadFromDisk_Raster(TileCoord coord, TileLoadedCallbackFn signalFn);
+        // Bumped every time 'requestTiles' is asked to load missing tiles.
+        // Jobs queued by the latest request can skip the look-up in the wanted tiles.
+        std::atomic<quint64> requestGeneration = 0;
+        struct ClientState {
+            // The tiles asked for by the latest request of the client that loads missing tiles.
+            std::unordered_set<TileCoord> wantedTiles;
+            PanTracking panTracking;
+        };
+        // Loading jobs for tiles that no client wants are dropped before they do any work.
+        //
+        // IMPORTANT! Only use when '_wantedTilesLock' is locked!
+        std::map<ClientId, ClientState> clients { { 0, {} } };
+        // IMPORTANT! Only use when '_wantedTilesLock' is locked!
+        ClientId nextClientId = 1;
+        // We use unique-ptr here to let use the lock in const methods.
+        std::unique_ptr<QMutex> _wantedTilesLock = std::make_unique<QMutex>();
+        quint64 setWantedTiles(
+            ClientId client,
+            const std::unordered_set<TileCoord> &tiles,
+            const QVector<TileCoord> &prefetchTiles);
+        bool isTileLoadWanted(TileCoord coord, quint64 generation) const;
+        bool cancelTileLoadIfUnwanted(TileCoord coord, TileType type, quint64 generation);
+        void markTileLoadFailed(TileCoord coord, TileType type);
+
+        // Network replies that have not finished yet, along with the tile they belong to.
+        //
+        // IMPORTANT! Only use from the thread 'networkManager' lives on!
+        std::map<QNetworkReply*, TileMemoryKey> inFlightReplies;
+        void abortUnwantedReplies();
+
+        // IMPORTANT! Only use when '_networkPolicyLock' is locked!
+        TileNetworkPolicy networkPolicy;
+        // We use unique-ptr here to let use the lock in const methods.
+        std::unique_ptr<QMutex> _networkPolicyLock = std::make_unique<QMutex>();
+
+        // A download of a single URL, shared by every load that asks for it
+        // while it is queued or in flight.
+        struct TileDownload {
+            QNetworkRequest request;
+            TileMemoryKey key;
+            // Not set while the download waits for its turn.
+            QNetworkReply *reply = nullptr;
+            // The task priority of the tile stages once the download is done.
+            qint64 priority = 0;
+            // The callbacks of every load waiting for this download.
+            QVector<TileLoadedCallbackFn> signalFns;
+        };
+        // Downloads that are queued or in flight, keyed by URL.
+        //
+        // IMPORTANT! Only use from the thread 'networkManager' lives on!
+        std::map<QString, TileDownload> tileDownloads;
+        // The URLs waiting for their turn, per host.
+        //
+        // IMPORTANT! Only use from the thread 'networkManager' lives on!
+        std::map<QString, std::deque<QString>> queuedDownloadsByHost;
+        // Amount of downloads in flight, per host.
+        //
+        // IMPORTANT! Only use from the thread 'networkManager' lives on!
+        std::map<QString, int> activeDownloadsByHost;
+        void queueTileDownload(
+            const QNetworkRequest &request,
+            TileMemoryKey key,
+            qint64 priority,
+            TileLoadedCallbackFn signalFn);
+        void startQueuedDownloads(const QString &host);
+        void finishTileDownload(const QString &url, QNetworkReply *reply);
+
+        // Runs the stages of loading tiles on the tile-loader worker threads.
+        // Disk reads and writes run on the I/O pool, parsing runs on the CPU pool.
+        // Reply handlers on 'networkThread' hand their parsing and disk writes to it as well.
+        // Shared by every TileLoader, unless a dummy asks for its own thread count.
+        std::shared_ptr<TaskScheduler> taskScheduler = TaskScheduler::shared();
+        // Amount of tasks this TileLoader has submitted that have not finished yet.
+        // IMPORTANT! Only use when 'tasksDoneLock' is locked!
+        qint64 unfinishedTaskCount = 0;
+        QMutex tasksDoneLock;
+        QWaitCondition tasksDoneCondition;
+        TaskScheduler::TaskHandle submitTask(
+            TaskScheduler::Pool pool,
+            std::function<void()> fn,
+            qint64 priority = 0,
+            const std::vector<TaskScheduler::TaskHandle> &dependencies = {});
+        void waitForTasks();
+
+        // The encoded bytes of a tile, handed from the stage that reads them
+        // on the I/O pool to the stage that parses them on the CPU pool.
+        struct FetchedTileBytes {
+            // Set if bytes were found, they may still be empty.
+            bool found = false;
+            QByteArray bytes;
+            // Keeps the file open while its contents are memory-mapped.
+            std::unique_ptr<QFile> mappedFile;
+            const uchar *mappedBytes = nullptr;
+            qint64 mappedSize = 0;
+
+            QByteArrayView view() const
+            {
+                return mappedBytes != nullptr ? QByteArrayView{ mappedBytes, mappedSize } : QByteArrayView{ bytes };
+            }
+        };
+        using FetchTileFn = std::function<void(FetchedTileBytes&)>;
+        TaskScheduler::TaskHandle queueTileLoadStages(
+            TileCoord coord,
+            TileType type,
+            qint64 priority,
+            FetchTileFn fetchFn,
+            TileLoadedCallbackFn signalFn);
+        bool readTileFromDisk(TileCoord coord, TileType type, FetchedTileBytes &out);
+        void fetchTileForJob(const LoadJob &job, FetchedTileBytes &out, TileLoadedCallbackFn signalFn);
         void networkReplyHandler_Raster(
             QNetworkReply *rasterReply,
             TileCoord coord,
+            qint64 priority,
             TileLoadedCallbackFn signalFn);
         void networkReplyHandler_Vector(
             QNetworkReply *vectorReply,
             TileCoord coord,
+            qint64 priority,
             TileLoadedCallbackFn signalFn);
-        void loadFromWeb_Raster(TileCoord coord, TileLoadedCallbackFn signalFn);
-        void loadFromWeb_Vector(TileCoord coord, TileLoadedCallbackFn signalFn);
+        void loadFromWeb_Raster(TileCoord coord, qint64 priority, TileLoadedCallbackFn signalFn);
+        void loadFromWeb_Vector(TileCoord coord, qint64 priority, TileLoadedCallbackFn signalFn);
         void writeTileToDisk_Raster(
             TileCoord coord,
-            const QByteArray &rasterBytes);
+            const QByteArray &rasterBytes,
+            const HttpCacheHeaders &cacheHeaders);
         void writeTileToDisk_Vector(
             TileCoord coord,
-            const QByteArray &vectorBytes);
+            const QByteArray &vectorBytes,
+            const HttpCacheHeaders &cacheHeaders);
+        using PartialTileFn = std::function<void(std::shared_ptr<const VectorTile>)>;
+        std::unique_ptr<VectorTile> parseVectorTile(
+            TileCoord coord,
+            QByteArrayView vectorBytes,
+            qint64 &meshByteSize,
+            const PartialTileFn &partialTileFn = nullptr) const;
+        void publishPartialTile_Vector(
+            TileCoord coord,
+            std::shared_ptr<const VectorTile> partialTile,
+            const TileLoadedCallbackFn &signalFn);
         void insertIntoTileMemory_Vector(
             TileCoord coord,
-            const QByteArray &vectorBytes,
+            QByteArrayView vectorBytes,
             TileLoadedCallbackFn signalFn);
         void insertIntoTileMemory_Raster(
             TileCoord coord,
-            const QByteArray &rasterBytes,
+            QByteArrayView rasterBytes,
             TileLoadedCallbackFn signalFn);
     };
 
@@ -0,0 +1,264 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Qt header files
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+
+// STL header files
+#include <cstring>
+
+// Other header files
+#include "TilePackFile.h"
+
+using Bach::TilePackFile;
+
+// Identifies the file format, including its version.
+static constexpr char packFileMagic[8] = { 'B', 'A', 'C', 'H', 'T', 'P', 'K', '1' };
+static constexpr qint64 packFileHeaderSize = sizeof(packFileMagic);
+
+// Marks the start of every record, to detect a corrupt file.
+static constexpr quint32 recordMagic = 0x454C4954; // "TILE"
+
+/*
+ * Every record starts with this header, stored little-endian:
+ *     quint32 recordMagic
+ *     quint8  tile type
+ *     quint8  zoom
+ *     quint16 reserved
+ *     qint32  x
+ *     qint32  y
+ *     quint32 size of the tile data
+ * followed by the tile data.
+ */
+static constexpr qint64 recordHeaderSize = 20;
+
+/*!
+ * \internal
+ * \brief appendRecord appends a single record to a batch of records.
+ */
+static void appendRecord(QByteArray &batch, TileCoord coord, TileType type, const QByteArray &bytes)
+{
+    uchar header[recordHeaderSize] = {};
+    qToLittleEndian<quint32>(recordMagic, header);
+    header[4] = (uchar)(type == TileType::Vector ? 0 : 1);
+    header[5] = (uchar)coord.zoom;
+    qToLittleEndian<qint32>(coord.x, header + 8);
+    qToLittleEndian<qint32>(coord.y, header + 12);
+    qToLittleEndian<quint32>((quint32)bytes.size(), header + 16);
+    batch.append((const char*)header, recordHeaderSize);
+    batch.append(bytes);
+}
+
+/*!
+ * \brief TilePackFile::open opens a pack file, or creates it if it doesn't exist.
+ *
+ * If the file ends with an incomplete record, for example after a crash
+ * while writing, that record is dropped.
+ *
+ * \param path The path of the pack file. Missing parent directories are created.
+ * \param maxPendingTiles The amount of written tiles that are held in memory
+ * before they are appended to the file.
+ * \return The opened pack file, or nullptr if it could not be opened or is not a pack file.
+ */
+std::unique_ptr<TilePackFile> TilePackFile::open(const QString &path, int maxPendingTiles)
+{
+    auto out = std::unique_ptr<TilePackFile>(new TilePackFile());
+    TilePackFile &pack = *out;
+    pack.m_maxPendingTiles = qMax(maxPendingTiles, 1);
+
+    QDir dir = QFileInfo{ path }.dir();
+    if (!dir.exists() && !dir.mkpath(dir.absolutePath())) {
+        qWarning() << "TilePackFile: Unable to create the directory of" << path;
+        return nullptr;
+    }
+
+    pack.m_file.setFileName(path);
+    if (!pack.m_file.open(QFile::ReadWrite)) {
+        qWarning() << "TilePackFile: Unable to open" << path << ":" << pack.m_file.errorString();
+        return nullptr;
+    }
+
+    QMutexLocker lock { &pack.m_lock };
+    if (pack.m_file.size() == 0) {
+        if (pack.m_file.write(packFileMagic, packFileHeaderSize) != packFileHeaderSize) {
+            qWarning() << "TilePackFile: Unable to write the header of" << path;
+            return nullptr;
+        }
+        pack.m_file.flush();
+        pack.m_fileSize = packFileHeaderSize;
+        return out;
+    }
+
+    const qint64 fileSize = pack.m_file.size();
+    const uchar *region = pack.m_file.map(0, fileSize);
+    if (region == nullptr) {
+        qWarning() << "TilePackFile: Unable to map" << path << ":" << pack.m_file.errorString();
+        return nullptr;
+    }
+    if (fileSize < packFileHeaderSize || std::memcmp(region, packFileMagic, packFileHeaderSize) != 0) {
+        qWarning() << "TilePackFile:" << path << "is not a tile pack file.";
+        return nullptr;
+    }
+
+    const qint64 validSize = packFileHeaderSize + pack.indexRecords_Locked(
+        region + packFileHeaderSize,
+        fileSize - packFileHeaderSize);
+    pack.m_fileSize = validSize;
+    if (validSize < fileSize) {
+        // Drop the broken tail, so that new records are appended right after the last complete one.
+        // Some platforms can't shrink a file that is mapped, so the mapping is redone afterwards.
+        qWarning() << "TilePackFile: Dropping" << (fileSize - validSize) << "bytes of incomplete records from" << path;
+        pack.m_index.clear();
+        pack.m_file.unmap(const_cast<uchar*>(region));
+        if (!pack.m_file.resize(validSize)) {
+            qWarning() << "TilePackFile: Unable to truncate" << path;
+            return nullptr;
+        }
+        region = pack.m_file.map(0, validSize);
+        if (region == nullptr) {
+            qWarning() << "TilePackFile: Unable to map" << path << ":" << pack.m_file.errorString();
+            return nullptr;
+        }
+        pack.indexRecords_Locked(region + packFileHeaderSize, validSize - packFileHeaderSize);
+    }
+    return out;
+}
+
+TilePackFile::~TilePackFile()
+{
+    QMutexLocker lock { &m_lock };
+    if (m_file.isOpen())
+        flush_Locked();
+}
+
+/*!
+ * \internal
+ * \brief TilePackFile::indexRecords_Locked adds every complete record of a mapped region to the index.
+ * \return The amount of bytes at the start of the region that hold complete records.
+ */
+qint64 TilePackFile::indexRecords_Locked(const uchar *region, qint64 regionSize)
+{
+    qint64 pos = 0;
+    while (pos + recordHeaderSize <= regionSize) {
+        const uchar *header = region + pos;
+        if (qFromLittleEndian<quint32>(header) != recordMagic)
+            break;
+        const qint64 size = qFromLittleEndian<quint32>(header + 16);
+        if (pos + recordHeaderSize + size > regionSize)
+            break;
+
+        const TileType type = header[4] == 0 ? TileType::Vector : TileType::Raster;
+        const TileCoord coord {
+            (int)header[5],
+            qFromLittleEndian<qint32>(header + 8),
+            qFromLittleEndian<qint32>(header + 12) };
+        // Records later in the file replace the earlier ones.
+        m_index[{ coord, type }] = { (const char*)(header + recordHeaderSize), size };
+        pos += recordHeaderSize + size;
+    }
+    return pos;
+}
+
+/*!
+ * \brief TilePackFile::find looks up the data of a tile.
+ *
+ * The returned bytes point straight into the mapped file, and stay valid
+ * for as long as this TilePackFile is alive.
+ *
+ * \return The tile data, or nullopt if the tile is not in the pack.
+ */
+std::optional<QByteArray> TilePackFile::find(TileCoord coord, TileType type) const
+{
+    QMutexLocker lock { &m_lock };
+    auto pendingIt = m_pending.find({ coord, type });
+    if (pendingIt != m_pending.end())
+        return pendingIt->second;
+
+    auto entryIt = m_index.find({ coord, type });
+    if (entryIt == m_index.end())
+        return std::nullopt;
+    return QByteArray::fromRawData(entryIt->second.data, (qsizetype)entryIt->second.size);
+}
+
+/*!
+ * \brief TilePackFile::insert writes a tile to the pack.
+ *
+ * The tile is appended to the file together with other written tiles,
+ * once enough of them are pending. Until then it is served from memory.
+ */
+void TilePackFile::insert(TileCoord coord, TileType type, const QByteArray &bytes)
+{
+    QMutexLocker lock { &m_lock };
+    m_pending[{ coord, type }] = bytes;
+    if ((int)m_pending.size() >= m_maxPendingTiles)
+        flush_Locked();
+}
+
+/*!
+ * \brief TilePackFile::flush appends all pending tiles to the file in a single write.
+ * \return Returns true if all pending tiles were written.
+ */
+bool TilePackFile::flush()
+{
+    QMutexLocker lock { &m_lock };
+    return flush_Locked();
+}
+
+bool TilePackFile::flush_Locked()
+{
+    if (m_pending.empty())
+        return true;
+
+    QByteArray batch;
+    for (const auto &[key, bytes] : m_pending)
+        appendRecord(batch, key.first, key.second, bytes);
+
+    // On failure we try again at the same offset next time, overwriting whatever got written.
+    if (!m_file.seek(m_fileSize) || m_file.write(batch) != batch.size() || !m_file.flush()) {
+        qWarning() << "TilePackFile: Unable to write to" << m_file.fileName() << ":" << m_file.errorString();
+        return false;
+    }
+
+    const uchar *region = m_file.map(m_fileSize, batch.size());
+    if (region == nullptr) {
+        qWarning() << "TilePackFile: Unable to map" << m_file.fileName() << ":" << m_file.errorString();
+        return false;
+    }
+    indexRecords_Locked(region, batch.size());
+    m_fileSize += batch.size();
+    m_pending.clear();
+    return true;
+}
+
+/*!
+ * \brief TilePackFile::tileCount
+ * \return The amount of tiles in the pack, including the ones not written to the file yet.
+ */
+int TilePackFile::tileCount() const
+{
+    QMutexLocker lock { &m_lock };
+    int count = (int)m_index.size();
+    for (const auto &[key, bytes] : m_pending) {
+        if (m_index.find(key) == m_index.end())
+            count++;
+    }
+    return count;
+}
+
+/*!
+ * \brief TilePackFile::fileSize
+ * \return The size of the file in bytes, not counting the tiles that are still pending.
+ */
+qint64 TilePackFile::fileSize() const
+{
+    QMutexLocker lock { &m_lock };
+    return m_fileSize;
+}
+
+QString TilePackFile::path() const
+{
+    return m_file.fileName();
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TILEPACKFILE_H
+#define BACH_TILEPACKFILE_H
+
+// Qt header files
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+// STL header files
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Other header files
+#include "TileCoord.h"
+#include "Utilities.h"
+
+namespace Bach {
+    /*!
+     * \brief The TilePackFile class
+     * stores cached tiles in a single append-only file, as an alternative to
+     * one file per tile in the tile cache folder.
+     *
+     * The file starts with a short header and is followed by one record per written
+     * tile. Every record holds the tile coordinate, the tile type, the size of the tile
+     * data and the data itself. Writing a tile that already exists appends a new record,
+     * and the newest record of a tile wins when the file is opened again.
+     *
+     * The file is memory-mapped, and the index of the records is rebuilt from the
+     * mapping when the file is opened. Written tiles are held in memory and appended in
+     * batches, either when enough of them are pending or when flush() is called.
+     *
+     * Since the whole cache is one file, it can be copied onto another device as is.
+     *
+     * \threadsafe
+     */
+    class TilePackFile {
+    public:
+        /*!
+         * \brief defaultMaxPendingTiles is the amount of written tiles
+         * that are held in memory before they are appended to the file.
+         */
+        static constexpr int defaultMaxPendingTiles = 32;
+
+        static std::unique_ptr<TilePackFile> open(
+            const QString &path,
+            int maxPendingTiles = defaultMaxPendingTiles);
+
+        TilePackFile(const TilePackFile&) = delete;
+        TilePackFile& operator=(const TilePackFile&) = delete;
+        ~TilePackFile();
+
+        std::optional<QByteArray> find(TileCoord coord, TileType type) const;
+        void insert(TileCoord coord, TileType type, const QByteArray &bytes);
+        bool flush();
+
+        int tileCount() const;
+        qint64 fileSize() const;
+        QString path() const;
+
+    private:
+        TilePackFile() = default;
+
+        using Key = std::pair<TileCoord, TileType>;
+
+        // Points at the data of a tile inside one of the mapped regions of the file.
+        struct Entry {
+            const char *data = nullptr;
+            qint64 size = 0;
+        };
+
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        bool flush_Locked();
+        // IMPORTANT! Only use when 'm_lock' is locked!
+        qint64 indexRecords_Locked(const uchar *region, qint64 regionSize);
+
+        mutable QMutex m_lock;
+        QFile m_file;
+        int m_maxPendingTiles = defaultMaxPendingTiles;
+        // Size of the part of the file that holds complete records.
+        qint64 m_fileSize = 0;
+        // Mapped regions are only released when the file is closed, so
+        // the tile data returned by 'find' stays valid for the lifetime of this object.
+        std::map<Key, Entry> m_index;
+        // Tiles written since the last flush.
+        std::map<Key, QByteArray> m_pending;
+    };
+}
+
+#endif // BACH_TILEPACKFILE_H
@@ -0,0 +1,677 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+//
+// The polygon triangulation (EarClipper) follows the earcut library by Mapbox,
+// https://github.com/mapbox/earcut, which is distributed under the ISC License:
+//
+// ISC License
+//
+// Copyright (c) 2016, Mapbox
+//
+// Permission to use, copy, modify, and/or distribute this software for any purpose
+// with or without fee is hereby granted, provided that the above copyright notice
+// and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH REGARD TO
+// THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS.
+// IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+// CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+// OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+// ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// Qt header files
+#include <QtMath>
+
+// STL header files
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <vector>
+
+// Other header files
+#include "TileTessellation.h"
+
+namespace {
+    /*
+     * A vertex of a polygon ring, linked to its neighbours.
+     * Ears are clipped by unlinking their vertex.
+     */
+    struct EarNode {
+        // Index into the positions of the mesh being built.
+        quint32 i;
+        double x;
+        double y;
+        EarNode *prev = nullptr;
+        EarNode *next = nullptr;
+        // Set on holes of a single vertex, which are never filtered out.
+        bool steiner = false;
+    };
+
+    /*
+     * Triangulates a polygon with holes by ear clipping, following the earcut algorithm.
+     * Holes are bridged into the outer ring first, so that the result is a single ring.
+     */
+    class EarClipper {
+    public:
+        explicit EarClipper(std::vector<quint32> &indices) : m_indices{ indices } {}
+
+        EarNode* linkedList(const std::vector<QPointF> &positions, quint32 first, quint32 end, bool clockwise);
+        EarNode* eliminateHoles(std::vector<EarNode*> &holes, EarNode *outerNode);
+        void earcutLinked(EarNode *ear, int pass = 0);
+
+    private:
+        std::vector<quint32> &m_indices;
+        // A deque keeps the nodes in place while more are added.
+        std::deque<EarNode> m_nodes;
+
+        EarNode* insertNode(quint32 i, double x, double y, EarNode *last);
+        static void removeNode(EarNode *p);
+        void addTriangle(const EarNode *a, const EarNode *b, const EarNode *c);
+
+        EarNode* filterPoints(EarNode *start, EarNode *end = nullptr);
+        EarNode* cureLocalIntersections(EarNode *start);
+        void splitEarcut(EarNode *start);
+        EarNode* splitPolygon(EarNode *a, EarNode *b);
+        EarNode* eliminateHole(EarNode *hole, EarNode *outerNode);
+        static EarNode* findHoleBridge(EarNode *hole, EarNode *outerNode);
+    };
+}
+
+// Twice the signed area of the triangle.
+static double area(const EarNode *p, const EarNode *q, const EarNode *r)
+{
+    return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+}
+
+static bool equals(const EarNode *a, const EarNode *b)
+{
+    return a->x == b->x && a->y == b->y;
+}
+
+static bool pointInTriangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py)
+{
+    return
+        (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+static int sign(double value)
+{
+    return (value > 0) - (value < 0);
+}
+
+// Whether q lies within the bounding box of the segment pr, given the three are collinear.
+static bool onSegment(const EarNode *p, const EarNode *q, const EarNode *r)
+{
+    return
+        q->x <= qMax(p->x, r->x) && q->x >= qMin(p->x, r->x) &&
+        q->y <= qMax(p->y, r->y) && q->y >= qMin(p->y, r->y);
+}
+
+static bool intersects(const EarNode *p1, const EarNode *q1, const EarNode *p2, const EarNode *q2)
+{
+    const int o1 = sign(area(p1, q1, p2));
+    const int o2 = sign(area(p1, q1, q2));
+    const int o3 = sign(area(p2, q2, p1));
+    const int o4 = sign(area(p2, q2, q1));
+    if (o1 != o2 && o3 != o4)
+        return true;
+    return
+        (o1 == 0 && onSegment(p1, p2, q1)) ||
+        (o2 == 0 && onSegment(p1, q2, q1)) ||
+        (o3 == 0 && onSegment(p2, p1, q2)) ||
+        (o4 == 0 && onSegment(p2, q1, q2));
+}
+
+// Whether the diagonal ab intersects any edge of the polygon.
+static bool intersectsPolygon(const EarNode *a, const EarNode *b)
+{
+    const EarNode *p = a;
+    do {
+        if (p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i &&
+            intersects(p, p->next, a, b))
+            return true;
+        p = p->next;
+    } while (p != a);
+    return false;
+}
+
+// Whether the diagonal ab starts out inside the polygon at a.
+static bool locallyInside(const EarNode *a, const EarNode *b)
+{
+    if (area(a->prev, a, a->next) < 0)
+        return area(a, b, a->next) >= 0 && area(a, a->prev, b) >= 0;
+    return area(a, b, a->prev) < 0 || area(a, a->next, b) < 0;
+}
+
+// Whether the middle of the diagonal ab is inside the polygon.
+static bool middleInside(const EarNode *a, const EarNode *b)
+{
+    const EarNode *p = a;
+    bool inside = false;
+    const double px = (a->x + b->x) / 2;
+    const double py = (a->y + b->y) / 2;
+    do {
+        if (((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+            (px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x))
+            inside = !inside;
+        p = p->next;
+    } while (p != a);
+    return inside;
+}
+
+static bool isValidDiagonal(const EarNode *a, const EarNode *b)
+{
+    // Doesn't intersect other edges, and is locally visible from both ends.
+    return
+        a->next->i != b->i && a->prev->i != b->i && !intersectsPolygon(a, b) &&
+        ((locallyInside(a, b) && locallyInside(b, a) && middleInside(a, b) &&
+            (area(a->prev, a, b->prev) != 0 || area(a, b->prev, b) != 0)) ||
+        (equals(a, b) && area(a->prev, a, a->next) > 0 && area(b->prev, b, b->next) > 0));
+}
+
+static bool isEar(const EarNode *ear)
+{
+    const EarNode *a = ear->prev;
+    const EarNode *b = ear;
+    const EarNode *c = ear->next;
+    // A reflex vertex can't be an ear.
+    if (area(a, b, c) >= 0)
+        return false;
+
+    // No other vertex of the polygon may lie inside the ear.
+    for (const EarNode *p = c->next; p != a; p = p->next) {
+        if (pointInTriangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+            area(p->prev, p, p->next) >= 0)
+            return false;
+    }
+    return true;
+}
+
+static EarNode* leftmost(EarNode *start)
+{
+    EarNode *p = start;
+    EarNode *out = start;
+    do {
+        if (p->x < out->x || (p->x == out->x && p->y < out->y))
+            out = p;
+        p = p->next;
+    } while (p != start);
+    return out;
+}
+
+static bool sectorContainsSector(const EarNode *m, const EarNode *p)
+{
+    return area(m->prev, m, p->prev) < 0 && area(p->next, m, m->next) < 0;
+}
+
+EarNode* EarClipper::insertNode(quint32 i, double x, double y, EarNode *last)
+{
+    EarNode &p = m_nodes.emplace_back(EarNode{ i, x, y });
+    if (last == nullptr) {
+        p.prev = &p;
+        p.next = &p;
+    } else {
+        p.next = last->next;
+        p.prev = last;
+        last->next->prev = &p;
+        last->next = &p;
+    }
+    return &p;
+}
+
+void EarClipper::removeNode(EarNode *p)
+{
+    p->next->prev = p->prev;
+    p->prev->next = p->next;
+}
+
+void EarClipper::addTriangle(const EarNode *a, const EarNode *b, const EarNode *c)
+{
+    m_indices.push_back(a->i);
+    m_indices.push_back(b->i);
+    m_indices.push_back(c->i);
+}
+
+/*
+ * Links the ring of positions [first, end) into a circular list
+ * with the requested winding order.
+ */
+EarNode* EarClipper::linkedList(const std::vector<QPointF> &positions, quint32 first, quint32 end, bool clockwise)
+{
+    double signedArea = 0;
+    for (quint32 i = first, j = end - 1; i < end; j = i++)
+        signedArea += (positions[j].x() - positions[i].x()) * (positions[i].y() + positions[j].y());
+
+    EarNode *last = nullptr;
+    if (clockwise == (signedArea > 0)) {
+        for (quint32 i = first; i < end; i++)
+            last = insertNode(i, positions[i].x(), positions[i].y(), last);
+    } else {
+        for (quint32 i = end; i-- > first;)
+            last = insertNode(i, positions[i].x(), positions[i].y(), last);
+    }
+
+    if (last != nullptr && equals(last, last->next)) {
+        EarNode *next = last->next;
+        removeNode(last);
+        last = next;
+    }
+    return last;
+}
+
+// Removes duplicate and collinear points.
+EarNode* EarClipper::filterPoints(EarNode *start, EarNode *end)
+{
+    if (start == nullptr)
+        return start;
+    if (end == nullptr)
+        end = start;
+
+    EarNode *p = start;
+    bool again;
+    do {
+        again = false;
+        if (!p->steiner && (equals(p, p->next) || area(p->prev, p, p->next) == 0)) {
+            removeNode(p);
+            p = end = p->prev;
+            if (p == p->next)
+                break;
+            again = true;
+        } else {
+            p = p->next;
+        }
+    } while (again || p != end);
+    return end;
+}
+
+void EarClipper::earcutLinked(EarNode *ear, int pass)
+{
+    if (ear == nullptr)
+        return;
+
+    EarNode *stop = ear;
+    while (ear->prev != ear->next) {
+        EarNode *prev = ear->prev;
+        EarNode *next = ear->next;
+        if (isEar(ear)) {
+            addTriangle(prev, ear, next);
+            removeNode(ear);
+            // Skipping the next vertex leads to less sliver triangles.
+            ear = next->next;
+            stop = next->next;
+            continue;
+        }
+        ear = next;
+
+        // We went through the whole ring without finding an ear.
+        if (ear == stop) {
+            if (pass == 0) {
+                // Try again after removing duplicate and collinear points.
+                earcutLinked(filterPoints(ear), 1);
+            } else if (pass == 1) {
+                // Then after removing small self-intersections.
+                earcutLinked(cureLocalIntersections(filterPoints(ear)), 2);
+            } else if (pass == 2) {
+                // As a last resort, split the ring in two and handle both halves.
+                splitEarcut(ear);
+            }
+            break;
+        }
+    }
+}
+
+EarNode* EarClipper::cureLocalIntersections(EarNode *start)
+{
+    EarNode *p = start;
+    do {
+        EarNode *a = p->prev;
+        EarNode *b = p->next->next;
+        if (!equals(a, b) && intersects(a, p, p->next, b) && locallyInside(a, b) && locallyInside(b, a)) {
+            addTriangle(a, p, b);
+            removeNode(p);
+            removeNode(p->next);
+            p = start = b;
+        }
+        p = p->next;
+    } while (p != start);
+    return filterPoints(p);
+}
+
+void EarClipper::splitEarcut(EarNode *start)
+{
+    EarNode *a = start;
+    do {
+        for (EarNode *b = a->next->next; b != a->prev; b = b->next) {
+            if (a->i != b->i && isValidDiagonal(a, b)) {
+                EarNode *c = splitPolygon(a, b);
+                a = filterPoints(a, a->next);
+                c = filterPoints(c, c->next);
+                earcutLinked(a);
+                earcutLinked(c);
+                return;
+            }
+        }
+        a = a->next;
+    } while (a != start);
+}
+
+// Links a and b with a diagonal, splitting the ring in two.
+// Returns the copy of b that is part of the second ring.
+EarNode* EarClipper::splitPolygon(EarNode *a, EarNode *b)
+{
+    EarNode *a2 = &m_nodes.emplace_back(EarNode{ a->i, a->x, a->y });
+    EarNode *b2 = &m_nodes.emplace_back(EarNode{ b->i, b->x, b->y });
+    EarNode *an = a->next;
+    EarNode *bp = b->prev;
+
+    a->next = b;
+    b->prev = a;
+    a2->next = an;
+    an->prev = a2;
+    b2->next = a2;
+    a2->prev = b2;
+    bp->next = b2;
+    b2->prev = bp;
+    return b2;
+}
+
+EarNode* EarClipper::eliminateHoles(std::vector<EarNode*> &holes, EarNode *outerNode)
+{
+    std::vector<EarNode*> queue;
+    queue.reserve(holes.size());
+    for (EarNode *hole : holes) {
+        if (hole == hole->next)
+            hole->steiner = true;
+        queue.push_back(leftmost(hole));
+    }
+    // Bridge the holes from left to right.
+    std::sort(queue.begin(), queue.end(), [](const EarNode *a, const EarNode *b) {
+        return a->x < b->x;
+    });
+    for (EarNode *hole : queue)
+        outerNode = eliminateHole(hole, outerNode);
+    return outerNode;
+}
+
+EarNode* EarClipper::eliminateHole(EarNode *hole, EarNode *outerNode)
+{
+    EarNode *bridge = findHoleBridge(hole, outerNode);
+    if (bridge == nullptr)
+        return outerNode;
+
+    EarNode *bridgeReverse = splitPolygon(bridge, hole);
+    filterPoints(bridgeReverse, bridgeReverse->next);
+    return filterPoints(bridge, bridge->next);
+}
+
+// Finds a vertex of the outer ring that the leftmost vertex of the hole can be linked to.
+EarNode* EarClipper::findHoleBridge(EarNode *hole, EarNode *outerNode)
+{
+    EarNode *p = outerNode;
+    const double hx = hole->x;
+    const double hy = hole->y;
+    double qx = -std::numeric_limits<double>::infinity();
+    EarNode *m = nullptr;
+
+    // Find the segment to the left of the hole that a ray cast to the left hits first.
+    do {
+        if (hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+            const double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+            if (x <= hx && x > qx) {
+                qx = x;
+                m = p->x < p->next->x ? p : p->next;
+                if (x == hx)
+                    return m;
+            }
+        }
+        p = p->next;
+    } while (p != outerNode);
+
+    if (m == nullptr)
+        return nullptr;
+
+    // Look for a vertex inside the triangle of the hole vertex, the hit and the segment end,
+    // which would block the bridge. Pick the one with the smallest angle to the ray.
+    EarNode *stop = m;
+    const double mx = m->x;
+    const double my = m->y;
+    double tanMin = std::numeric_limits<double>::infinity();
+    p = m;
+    do {
+        if (hx >= p->x && p->x >= mx && hx != p->x &&
+            pointInTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y))
+        {
+            const double tan = qAbs(hy - p->y) / (hx - p->x);
+            if (locallyInside(p, hole) &&
+                (tan < tanMin || (tan == tanMin && (p->x > m->x || (p->x == m->x && sectorContainsSector(m, p))))))
+            {
+                m = p;
+                tanMin = tan;
+            }
+        }
+        p = p->next;
+    } while (p != stop);
+    return m;
+}
+
+// Twice the signed area of a ring of the geometry storage, positive when clockwise with y pointing down.
+static double ringArea(const std::vector<QPoint> &vertices, quint32 first, quint32 end)
+{
+    double out = 0;
+    for (quint32 i = first, j = end - 1; i < end; j = i++)
+        out += (double)vertices[j].x() * vertices[i].y() - (double)vertices[i].x() * vertices[j].y();
+    return out;
+}
+
+/*!
+ * \brief Bach::triangulatePolygonFeature
+ * Triangulates a polygon feature and appends the triangles to a mesh.
+ *
+ * Each ring that winds the same way as the first ring of the feature starts a new polygon,
+ * and the rings that wind the other way are holes in the polygon before them.
+ *
+ * \param geometry The geometry storage of the layer the feature belongs to.
+ * \param featureIndex The index of the feature within the geometry storage.
+ * \param out The mesh to append the vertices and triangles to.
+ */
+void Bach::triangulatePolygonFeature(
+    const TileLayerGeometry &geometry,
+    int featureIndex,
+    TileMesh &out)
+{
+    const quint32 firstPart = geometry.featurePartOffsets[featureIndex];
+    const quint32 endPart = geometry.featurePartOffsets[featureIndex + 1];
+
+    // The rings of the polygon currently being gathered, as ranges of the mesh positions.
+    std::vector<std::pair<quint32, quint32>> rings;
+    auto triangulatePolygon = [&]() {
+        if (rings.empty())
+            return;
+        EarClipper clipper { out.indices };
+        EarNode *outerNode = clipper.linkedList(out.positions, rings[0].first, rings[0].second, true);
+        if (outerNode != nullptr && outerNode->next != outerNode->prev) {
+            std::vector<EarNode*> holes;
+            for (size_t i = 1; i < rings.size(); i++) {
+                EarNode *hole = clipper.linkedList(out.positions, rings[i].first, rings[i].second, false);
+                if (hole != nullptr)
+                    holes.push_back(hole);
+            }
+            if (!holes.empty())
+                outerNode = clipper.eliminateHoles(holes, outerNode);
+            clipper.earcutLinked(outerNode);
+        }
+        rings.clear();
+    };
+
+    double firstRingArea = 0;
+    for (quint32 part = firstPart; part < endPart; part++) {
+        const quint32 firstVertex = geometry.partVertexOffsets[part];
+        const quint32 endVertex = geometry.partVertexOffsets[part + 1];
+        if (endVertex - firstVertex < 3)
+            continue;
+        const double area = ringArea(geometry.vertices, firstVertex, endVertex);
+        if (area == 0)
+            continue;
+
+        if (firstRingArea == 0)
+            firstRingArea = area;
+        if ((area > 0) == (firstRingArea > 0))
+            triangulatePolygon();
+
+        const quint32 ringStart = (quint32)out.positions.size();
+        for (quint32 vertex = firstVertex; vertex < endVertex; vertex++)
+            out.positions.push_back(geometry.vertices[vertex]);
+        rings.push_back({ ringStart, (quint32)out.positions.size() });
+    }
+    triangulatePolygon();
+}
+
+/*!
+ * \brief Bach::extrudeLineFeature
+ * Extrudes a line feature into triangles and appends them to a mesh.
+ *
+ * Every vertex gets the direction it is pushed in to give the line its width, so that
+ * the same mesh can be drawn at any line width. Corners are joined with a miter,
+ * or with a bevel if the miter would be longer than Bach::tessellationMiterLimit.
+ *
+ * \param geometry The geometry storage of the layer the feature belongs to.
+ * \param featureIndex The index of the feature within the geometry storage.
+ * \param out The mesh to append the vertices and triangles to.
+ */
+void Bach::extrudeLineFeature(
+    const TileLayerGeometry &geometry,
+    int featureIndex,
+    TileMesh &out)
+{
+    auto addVertex = [&](QPointF position, QPointF extrusion) {
+        out.positions.push_back(position);
+        out.extrusions.push_back(extrusion);
+        return (quint32)out.positions.size() - 1;
+    };
+    auto addTriangle = [&](quint32 a, quint32 b, quint32 c) {
+        out.indices.push_back(a);
+        out.indices.push_back(b);
+        out.indices.push_back(c);
+    };
+    auto normalOf = [](QPointF from, QPointF to) {
+        const QPointF delta = to - from;
+        const double length = qSqrt(QPointF::dotProduct(delta, delta));
+        return QPointF{ -delta.y() / length, delta.x() / length };
+    };
+
+    const quint32 firstPart = geometry.featurePartOffsets[featureIndex];
+    const quint32 endPart = geometry.featurePartOffsets[featureIndex + 1];
+    std::vector<QPointF> points;
+    for (quint32 part = firstPart; part < endPart; part++) {
+        // Repeated points have no direction, so they are left out.
+        points.clear();
+        for (quint32 vertex = geometry.partVertexOffsets[part]; vertex < geometry.partVertexOffsets[part + 1]; vertex++) {
+            const QPointF point = geometry.vertices[vertex];
+            if (points.empty() || points.back() != point)
+                points.push_back(point);
+        }
+        bool closed = geometry.partClosed[part];
+        if (closed && points.size() > 1 && points.front() == points.back())
+            points.pop_back();
+        if (points.size() < 2)
+            continue;
+        if (points.size() < 3)
+            closed = false;
+
+        const size_t pointCount = points.size();
+        const size_t segmentCount = closed ? pointCount : pointCount - 1;
+        std::vector<QPointF> normals(segmentCount);
+        for (size_t i = 0; i < segmentCount; i++)
+            normals[i] = normalOf(points[i], points[(i + 1) % pointCount]);
+
+        // The pair of vertices the segment leaving each point starts at,
+        // and the pair the segment arriving at each point ends at.
+        struct VertexPair { quint32 left; quint32 right; };
+        std::vector<VertexPair> segmentStarts(pointCount);
+        std::vector<VertexPair> segmentEnds(pointCount);
+        for (size_t i = 0; i < pointCount; i++) {
+            const bool hasIncoming = closed || i > 0;
+            const bool hasOutgoing = closed || i + 1 < pointCount;
+            const QPointF point = points[i];
+            if (!hasIncoming || !hasOutgoing) {
+                const QPointF normal = hasOutgoing ? normals[i] : normals[i - 1];
+                const VertexPair pair { addVertex(point, normal), addVertex(point, -normal) };
+                segmentStarts[i] = pair;
+                segmentEnds[i] = pair;
+                continue;
+            }
+
+            const QPointF incoming = normals[(i + segmentCount - 1) % segmentCount];
+            const QPointF outgoing = normals[i % segmentCount];
+            const QPointF sum = incoming + outgoing;
+            const double sumLength2 = QPointF::dotProduct(sum, sum);
+            // The miter is 2 / |sum| long.
+            if (sumLength2 > 4.0 / (tessellationMiterLimit * tessellationMiterLimit)) {
+                const QPointF miter = sum * (2.0 / sumLength2);
+                const VertexPair pair { addVertex(point, miter), addVertex(point, -miter) };
+                segmentStarts[i] = pair;
+                segmentEnds[i] = pair;
+            } else {
+                segmentEnds[i] = { addVertex(point, incoming), addVertex(point, -incoming) };
+                segmentStarts[i] = { addVertex(point, outgoing), addVertex(point, -outgoing) };
+                // Fill the gap on the outer side of the corner. Which side that is depends
+                // on the way the line turns, the triangle on the inner side is hidden under the segments.
+                const quint32 center = addVertex(point, {});
+                addTriangle(center, segmentEnds[i].left, segmentStarts[i].left);
+                addTriangle(center, segmentEnds[i].right, segmentStarts[i].right);
+            }
+        }
+
+        for (size_t i = 0; i < segmentCount; i++) {
+            const VertexPair start = segmentStarts[i];
+            const VertexPair end = segmentEnds[(i + 1) % pointCount];
+            addTriangle(start.left, start.right, end.left);
+            addTriangle(start.right, end.right, end.left);
+        }
+    }
+}
+
+/*!
+ * \brief Bach::tessellateLayer
+ * Triangulates the polygon features and extrudes the line features of a layer.
+ *
+ * \param layer The layer to tessellate.
+ * \return The meshes of the layer, with the range of triangles
+ * of every feature in the layer's TileLayerGeometry.
+ */
+std::unique_ptr<TileLayerMeshes> Bach::tessellateLayer(const TileLayer &layer)
+{
+    auto out = std::make_unique<TileLayerMeshes>();
+    const TileLayerGeometry &geometry = layer.geometry();
+    const int featureCount = geometry.featureCount();
+    out->fillIndexOffsets.reserve(featureCount + 1);
+    out->lineIndexOffsets.reserve(featureCount + 1);
+    for (int i = 0; i < featureCount; i++) {
+        switch (geometry.featureTypes[i]) {
+        case AbstractLayerFeature::featureType::polygon:
+            triangulatePolygonFeature(geometry, i, out->fills);
+            break;
+        case AbstractLayerFeature::featureType::line:
+            extrudeLineFeature(geometry, i, out->lines);
+            break;
+        default:
+            break;
+        }
+        out->fillIndexOffsets.push_back((quint32)out->fills.indices.size());
+        out->lineIndexOffsets.push_back((quint32)out->lines.indices.size());
+    }
+    return out;
+}
+
+/*!
+ * \brief Bach::tessellateVectorTile
+ * Tessellates every layer of a tile, see Bach::tessellateLayer.
+ * The meshes are stored on the layers, and can be found through TileLayer::meshes.
+ */
+void Bach::tessellateVectorTile(VectorTile &tile)
+{
+    for (auto &[layerName, layer] : tile.m_layers)
+        layer->setMeshes(tessellateLayer(*layer));
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TILETESSELLATION_H
+#define BACH_TILETESSELLATION_H
+
+// STL header files
+#include <memory>
+
+// Other header files
+#include "VectorTiles.h"
+
+namespace Bach {
+    /*!
+     * \brief tessellationMiterLimit is the longest a miter join is allowed to reach, as a multiple
+     * of the half line width. Sharper corners are beveled instead.
+     */
+    constexpr double tessellationMiterLimit = 2.0;
+
+    void triangulatePolygonFeature(
+        const TileLayerGeometry &geometry,
+        int featureIndex,
+        TileMesh &out);
+
+    void extrudeLineFeature(
+        const TileLayerGeometry &geometry,
+        int featureIndex,
+        TileMesh &out);
+
+    std::unique_ptr<TileLayerMeshes> tessellateLayer(const TileLayer &layer);
+
+    void tessellateVectorTile(VectorTile &tile);
+}
+
+#endif // BACH_TILETESSELLATION_H
@@ -0,0 +1,248 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+// Qt header files
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+
+// STL header files
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+
+// Other header files
+#include "Tracing.h"
+
+namespace Tracing = Bach::Tracing;
+
+/*!
+ * \internal
+ * \brief The RingBuffer struct holds the latest events of the process.
+ */
+struct RingBuffer {
+    QMutex lock;
+    // IMPORTANT! Only use when 'lock' is locked!
+    std::vector<Tracing::Event> events = std::vector<Tracing::Event>(Tracing::defaultCapacity);
+    // Where the next event is written.
+    // IMPORTANT! Only use when 'lock' is locked!
+    size_t next = 0;
+    // Amount of valid events, at most the size of 'events'.
+    // IMPORTANT! Only use when 'lock' is locked!
+    size_t count = 0;
+
+    // Compares the names by their text, the same literal may have several addresses.
+    struct NameLess {
+        bool operator()(const char *a, const char *b) const { return std::strcmp(a, b) < 0; }
+    };
+    // Running totals of every scope name, see Bach::Tracing::scopeTotal.
+    // IMPORTANT! Only use when 'lock' is locked!
+    std::map<const char*, Tracing::ScopeTotal, NameLess> scopeTotals;
+};
+
+static RingBuffer& ringBuffer()
+{
+    static RingBuffer buffer;
+    return buffer;
+}
+
+// Tracing starts out enabled when it is compiled in, so that startup is traced as well.
+#ifdef BACH_TRACING
+static std::atomic<bool> tracingEnabled = true;
+#else
+static std::atomic<bool> tracingEnabled = false;
+#endif
+
+/*!
+ * \internal
+ * \brief currentThreadId
+ * \return A small number identifying the calling thread, handed out in the order threads are first seen.
+ */
+static quint32 currentThreadId()
+{
+    static std::atomic<quint32> nextThreadId = 1;
+    thread_local const quint32 threadId = nextThreadId++;
+    return threadId;
+}
+
+/*!
+ * \brief Bach::Tracing::isCompiledIn
+ * \return Returns true if the library was built with BACH_TRACING,
+ * so that the BACH_TRACE_SCOPE hooks are recording.
+ */
+bool Tracing::isCompiledIn()
+{
+#ifdef BACH_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * \brief Bach::Tracing::setEnabled
+ * Turns recording on or off at runtime. Disabled scopes only cost an atomic load.
+ *
+ * \threadsafe
+ */
+void Tracing::setEnabled(bool enabled)
+{
+    tracingEnabled = enabled;
+}
+
+bool Tracing::isEnabled()
+{
+    return tracingEnabled.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Bach::Tracing::setCapacity
+ * Sets how many events are kept. Drops every event recorded so far.
+ *
+ * \threadsafe
+ */
+void Tracing::setCapacity(int capacity)
+{
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    buffer.events.assign(qMax(capacity, 1), {});
+    buffer.next = 0;
+    buffer.count = 0;
+}
+
+int Tracing::capacity()
+{
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    return (int)buffer.events.size();
+}
+
+/*!
+ * \brief Bach::Tracing::nowNs
+ * \return Nanoseconds since the tracing clock was first read.
+ *
+ * \threadsafe
+ */
+qint64 Tracing::nowNs()
+{
+    using Clock = std::chrono::steady_clock;
+    static const Clock::time_point start = Clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+/*!
+ * \brief Bach::Tracing::record
+ * Adds an event to the ring buffer, overwriting the oldest event if it is full,
+ * and to the total of its scope. The thread id of the event is filled in here.
+ *
+ * \threadsafe
+ */
+void Tracing::record(const Event &event)
+{
+    Event stored = event;
+    stored.threadId = currentThreadId();
+
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    buffer.events[buffer.next] = stored;
+    buffer.next = (buffer.next + 1) % buffer.events.size();
+    buffer.count = qMin(buffer.count + 1, buffer.events.size());
+    ScopeTotal &total = buffer.scopeTotals[stored.name];
+    total.durationNs += stored.durationNs;
+    total.count++;
+}
+
+/*!
+ * \brief Bach::Tracing::recentEvents
+ * \return A copy of the events in the ring buffer, oldest first.
+ * Nested scopes end before their parents, so they come first.
+ *
+ * \threadsafe
+ */
+std::vector<Tracing::Event> Tracing::recentEvents()
+{
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    std::vector<Event> out;
+    out.reserve(buffer.count);
+    const size_t size = buffer.events.size();
+    const size_t first = (buffer.next + size - buffer.count) % size;
+    for (size_t i = 0; i < buffer.count; i++)
+        out.push_back(buffer.events[(first + i) % size]);
+    return out;
+}
+
+/*!
+ * \brief Bach::Tracing::scopeTotal
+ * \return The sum of every event recorded under the given name since the last clear.
+ * Cheap enough to call every frame, unlike recentEvents which copies the whole ring buffer.
+ *
+ * \threadsafe
+ */
+Tracing::ScopeTotal Tracing::scopeTotal(const char *name)
+{
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    auto it = buffer.scopeTotals.find(name);
+    return it == buffer.scopeTotals.end() ? ScopeTotal{} : it->second;
+}
+
+/*!
+ * \brief Bach::Tracing::clear drops every recorded event and the totals of every scope.
+ *
+ * \threadsafe
+ */
+void Tracing::clear()
+{
+    RingBuffer &buffer = ringBuffer();
+    QMutexLocker lock { &buffer.lock };
+    buffer.next = 0;
+    buffer.count = 0;
+    buffer.scopeTotals.clear();
+}
+
+/*!
+ * \brief Bach::Tracing::toChromeTraceJson
+ * Builds a document in the Chrome trace event format,
+ * which can be opened by chrome://tracing and ui.perfetto.dev.
+ */
+QByteArray Tracing::toChromeTraceJson(const std::vector<Event> &events)
+{
+    QJsonArray traceEvents;
+    for (const Event &event : events) {
+        QJsonObject traceEvent;
+        traceEvent["name"] = event.name;
+        // Complete events, with the start and duration in microseconds.
+        traceEvent["ph"] = "X";
+        traceEvent["ts"] = event.startNs / 1000.0;
+        traceEvent["dur"] = event.durationNs / 1000.0;
+        traceEvent["pid"] = 1;
+        traceEvent["tid"] = (qint64)event.threadId;
+        traceEvents.append(traceEvent);
+    }
+    QJsonObject root;
+    root["traceEvents"] = traceEvents;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument{ root }.toJson(QJsonDocument::Compact);
+}
+
+/*!
+ * \brief Bach::Tracing::writeChromeTrace
+ * Writes the events in the ring buffer to a file, see toChromeTraceJson.
+ * \return Returns true if the file was written.
+ */
+bool Tracing::writeChromeTrace(const QString &path)
+{
+    QFile file { path };
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Tracing: Unable to open" << path << ":" << file.errorString();
+        return false;
+    }
+    const QByteArray json = toChromeTraceJson(recentEvents());
+    return file.write(json) == json.size();
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+#ifndef BACH_TRACING_H
+#define BACH_TRACING_H
+
+// Qt header files
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+// STL header files
+#include <vector>
+
+namespace Bach::Tracing {
+    /*!
+     * \brief The Event struct is a single timed scope.
+     */
+    struct Event {
+        // Name of the scope. Always a string literal.
+        const char *name = nullptr;
+        // Nanoseconds since the first event of the process.
+        qint64 startNs = 0;
+        qint64 durationNs = 0;
+        // Small number identifying the thread the scope ran on.
+        quint32 threadId = 0;
+    };
+
+    /*!
+     * \brief The ScopeTotal struct sums up every event recorded under one name.
+     * Unlike the ring buffer it never drops events, so the time spent in a scope
+     * during some period is the difference of two totals.
+     */
+    struct ScopeTotal {
+        qint64 durationNs = 0;
+        qint64 count = 0;
+    };
+
+    /*!
+     * \brief defaultCapacity is the amount of events kept by default.
+     * Older events are overwritten once it is reached.
+     */
+    constexpr int defaultCapacity = 64 * 1024;
+
+    bool isCompiledIn();
+
+    void setEnabled(bool enabled);
+    bool isEnabled();
+
+    void setCapacity(int capacity);
+    int capacity();
+
+    qint64 nowNs();
+    void record(const Event &event);
+    std::vector<Event> recentEvents();
+    ScopeTotal scopeTotal(const char *name);
+    void clear();
+
+    QByteArray toChromeTraceJson(const std::vector<Event> &events);
+    bool writeChromeTrace(const QString &path);
+
+    /*!
+     * \brief The ScopedTimer class records the time from its construction
+     * to its destruction as an Event, if tracing is enabled.
+     *
+     * Use it through BACH_TRACE_SCOPE, so that it is compiled out
+     * unless the BUILD_TRACING CMake option is on.
+     */
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(const char *name)
+        {
+            if (isEnabled()) {
+                m_name = name;
+                m_startNs = nowNs();
+            }
+        }
+        ~ScopedTimer()
+        {
+            if (m_name != nullptr)
+                record({ m_name, m_startNs, nowNs() - m_startNs, 0 });
+        }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        // Null if tracing was disabled when the scope started.
+        const char *m_name = nullptr;
+        qint64 m_startNs = 0;
+    };
+}
+
+/*
+ * BACH_TRACE_SCOPE times the rest of the enclosing scope under the given name.
+ * It expands to nothing unless the library is built with BACH_TRACING defined.
+ */
+#ifdef BACH_TRACING
+#define BACH_TRACE_CONCAT_INNER(a, b) a##b
+#define BACH_TRACE_CONCAT(a, b) BACH_TRACE_CONCAT_INNER(a, b)
+#define BACH_TRACE_SCOPE(name) \
+    const Bach::Tracing::ScopedTimer BACH_TRACE_CONCAT(bachTraceScope_, __LINE__) { name }
+#else
+#define BACH_TRACE_SCOPE(name) do {} while (false)
+#endif
+
+#endif // BACH_TRACING_H
@@ -202,7 +202,6 @@ static HttpResponse requestStyleSheetFromWeb(MapType type, const QString &key)
 }
 
 /*!
- * \internal
  * \reentrant
  *
  * \brief Loads the bytes of the stylesheet as QByteArray.
@@ -211,14 +210,14 @@ static HttpResponse requestStyleSheetFromWeb(MapType type, const QString &key)
  * If loaded from web, it will then try to write the result to disk cache.
  * This is a blocking and re-entrant function.
  */
-static HttpResponse loadStyleSheetBytes(
+HttpResponse Bach::loadStyleSheetBytes(
     MapType type,
     const std::optional<QString> &mapTilerKey)
 {
     // Create full path for the target stylesheet JSON file
     QString styleSheetCachePath =
         Bach::TileLoader::getGeneralCacheFolder() + QDir::separator() +
-        "styleSheetCache.json";
+        styleSheetJsonCacheFileName;
 
     // Try to load the style sheet from file first.
     {
@@ -578,6 +577,37 @@ ParsedLink Bach::getPbfUrlTemplate(
     return getTileUrlTemplateFromTileSheet(tileSheetJson);
 }
 
+/*!
+ * \reentrant
+ *
+ * \brief Bach::getVectorTileSourceMaxZoom
+ *
+ * Reads the highest zoom level that the vector tile source has tiles for,
+ * from the 'maxzoom' field of the tilesheet associated with the stylesheet.
+ * The tilesheet is loaded the same way as in getPbfUrlTemplate.
+ *
+ * \param styleSheet
+ * \param sourceType String that says which source for tiles to use. Example: maptiler_planet
+ *
+ * \return Returns the max zoom level, or nullopt if the tilesheet could not be loaded
+ * or doesn't list one.
+ */
+std::optional<int> Bach::getVectorTileSourceMaxZoom(
+    const QJsonDocument &styleSheet,
+    const QString &sourceType)
+{
+    std::optional<QJsonDocument> tileSheetJsonOpt = loadVectorTileSheet(
+        styleSheet,
+        sourceType);
+    if (!tileSheetJsonOpt.has_value() || !tileSheetJsonOpt->isObject())
+        return std::nullopt;
+
+    const QJsonValue maxZoomValue = tileSheetJsonOpt->object()["maxzoom"];
+    if (!maxZoomValue.isDouble())
+        return std::nullopt;
+    return maxZoomValue.toInt();
+}
+
 /*!
  * \reentrant
  *
@@ -167,6 +167,14 @@ namespace Bach {
 
     HttpResponse requestAndWait(const QString &url);
 
+    // File names of the cached stylesheet inside the general cache folder.
+    constexpr const char* styleSheetJsonCacheFileName = "styleSheetCache.json";
+    constexpr const char* styleSheetBinaryCacheFileName = "styleSheetCache.bin";
+
+    HttpResponse loadStyleSheetBytes(
+        MapType type,
+        const std::optional<QString> &mapTilerKey);
+
     std::optional<QJsonDocument> loadStyleSheetJson(
         MapType type,
         const std::optional<QString> &mapTilerKey);
@@ -182,6 +190,10 @@ namespace Bach {
         const QJsonDocument &styleSheet,
         const QString &sourceType);
 
+    std::optional<int> getVectorTileSourceMaxZoom(
+        const QJsonDocument &styleSheet,
+        const QString &sourceType);
+
     ParsedLink getRasterUrlTemplate(
         MapType mapType,
         std::optional<QString> mapTilerKey);
@@ -2,12 +2,145 @@
 // SPDX-License-Identifier: MIT
 
 //Qt header files
+#include <QDebug>
 #include <QProtobufSerializer>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+// STL header files
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// SIMD intrinsics for decoding geometry, see decodeDeltaPoints.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BACH_GEOMETRY_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define BACH_GEOMETRY_NEON
+#include <arm_neon.h>
+#endif
 
 // Other header files
+#include "Tracing.h"
 #include "VectorTiles.h"
 #include "vector_tile.qpb.h"
 
+/*!
+ * \brief TileLayerProperties::rebuildKeyIds
+ * Rebuilds the lookup table from key to key index. Must be called after the keys list has changed.
+ */
+void TileLayerProperties::rebuildKeyIds()
+{
+    keyIds.clear();
+    keyIds.reserve(keys.size());
+    for (int i = 0; i < keys.size(); i++) {
+        // Keep the first index if the layer contains the same key twice.
+        if (!keyIds.contains(keys[i]))
+            keyIds.insert(keys[i], i);
+    }
+}
+
+/*!
+ * \brief TileLayerProperties::keyId
+ * \param key the name of the property.
+ * \return the index of the key in the layer's keys list, or -1 if the layer does not have this key.
+ */
+int TileLayerProperties::keyId(const QString &key) const
+{
+    return keyIds.value(key, -1);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ */
+
+/*!
+ * \brief AbstractLayerFeature::findPropertyByKeyId
+ * Looks up the value of a property through the feature's tags.
+ * \param keyId the index of the key in the layer's keys list.
+ * \return a pointer to the value of the property, or nullptr if the feature does not have the property.
+ */
+const QVariant* AbstractLayerFeature::findPropertyByKeyId(int keyId) const
+{
+    if (m_layerProperties == nullptr || keyId < 0)
+        return nullptr;
+
+    const QList<QVariant> &values = m_layerProperties->values;
+    // Search backwards so that a key that is repeated in the tags resolves
+    // to its last value, which is what inserting the tags into a map would give.
+    for (int i = (tags.size() & ~1) - 2; i >= 0; i -= 2) {
+        if (tags[i] != (unsigned int)keyId)
+            continue;
+        unsigned int valueIndex = tags[i + 1];
+        if (valueIndex < (unsigned int)values.size() && values[valueIndex].isValid())
+            return &values[valueIndex];
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief AbstractLayerFeature::findProperty
+ * Looks up the value of a property of this feature by name.
+ * \param key the name of the property.
+ * \return a pointer to the value of the property, or nullptr if the feature does not have the property.
+ */
+const QVariant* AbstractLayerFeature::findProperty(const QString &key) const
+{
+    if (m_layerProperties == nullptr) {
+        auto it = featureMetaData.constFind(key);
+        return it != featureMetaData.constEnd() ? &it.value() : nullptr;
+    }
+    return findPropertyByKeyId(m_layerProperties->keyId(key));
+}
+
+/*!
+ * \brief AbstractLayerFeature::property
+ * \param key the name of the property.
+ * \return the value of the property, or an invalid QVariant if the feature does not have the property.
+ */
+QVariant AbstractLayerFeature::property(const QString &key) const
+{
+    const QVariant *value = findProperty(key);
+    return value != nullptr ? *value : QVariant();
+}
+
+/*!
+ * \brief AbstractLayerFeature::properties
+ * Collects all the properties of this feature into a map.
+ * This allocates, and should not be used in performance sensitive code.
+ * \return a map from property name to property value.
+ */
+QMap<QString, QVariant> AbstractLayerFeature::properties() const
+{
+    if (m_layerProperties == nullptr)
+        return featureMetaData;
+
+    QMap<QString, QVariant> output;
+    const QList<QString> &keys = m_layerProperties->keys;
+    const QList<QVariant> &values = m_layerProperties->values;
+    for (int i = 0; i + 1 < tags.size(); i += 2) {
+        unsigned int keyIndex = tags[i];
+        unsigned int valueIndex = tags[i + 1];
+        if (keyIndex >= (unsigned int)keys.size() || valueIndex >= (unsigned int)values.size())
+            continue;
+        if (values[valueIndex].isValid())
+            output.insert(keys[keyIndex], values[valueIndex]);
+    }
+    return output;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ */
+
 /*!
  * \brief PolygonFeature::type
  * \return the type of the feature
@@ -17,13 +150,31 @@ AbstractLayerFeature::featureType PolygonFeature::type() const
     return AbstractLayerFeature::featureType::polygon;
 }
 
+/*!
+ * \brief PolygonFeature::PolygonFeature
+ * Creates a polygon feature whose geometry lives in the layer's flat geometry storage.
+ * \param geometry the geometry storage of the layer this feature belongs to.
+ * \param geometryIndex the index of this feature within the geometry storage.
+ */
+PolygonFeature::PolygonFeature(const TileLayerGeometry *geometry, int geometryIndex)
+    : m_geometry(geometry),
+    m_geometryIndex(geometryIndex) {
+}
+
 /*!
  * \brief PolygonFeature::polygon
- * getter for the feature's geometry
+ * getter for the feature's geometry. The path is built from the
+ * layer's geometry storage the first time this is called.
  * \return the QPainterPath that contains the decoded geometry as a const refrence
+ *
+ * \threadsafe
  */
 QPainterPath const& PolygonFeature::polygon() const
 {
+    std::call_once(m_polygonBuilt, [this]() {
+        if (m_geometry != nullptr)
+            m_polygon = m_geometry->buildPath(m_geometryIndex);
+    });
     return m_polygon;
 }
 
@@ -33,6 +184,7 @@ QPainterPath const& PolygonFeature::polygon() const
  * \return a refrence to the QPainterPath that contains the decoded geometry
  */
 QPainterPath& PolygonFeature::polygon() {
+    std::as_const(*this).polygon();
     return m_polygon;
 }
 
@@ -40,6 +192,17 @@ QPainterPath& PolygonFeature::polygon() {
  * ----------------------------------------------------------------------------
  */
 
+/*!
+ * \brief LineFeature::LineFeature
+ * Creates a line feature whose geometry lives in the layer's flat geometry storage.
+ * \param geometry the geometry storage of the layer this feature belongs to.
+ * \param geometryIndex the index of this feature within the geometry storage.
+ */
+LineFeature::LineFeature(const TileLayerGeometry *geometry, int geometryIndex)
+    : m_geometry(geometry),
+    m_geometryIndex(geometryIndex) {
+}
+
 /*!
  * \brief LineFeature::type
  * \return the type of the feature
@@ -51,11 +214,18 @@ AbstractLayerFeature::featureType LineFeature::type() const
 
 /*!
  * \brief LineFeature::line
- * getter for the feature's geometry
+ * getter for the feature's geometry. The path is built from the
+ * layer's geometry storage the first time this is called.
  * \return the QPainterPath that contains the decoded geometry as a const refrence
+ *
+ * \threadsafe
  */
 QPainterPath const& LineFeature::line() const
 {
+    std::call_once(m_lineBuilt, [this]() {
+        if (m_geometry != nullptr)
+            m_line = m_geometry->buildPath(m_geometryIndex);
+    });
     return m_line;
 }
 
@@ -66,6 +236,7 @@ QPainterPath const& LineFeature::line() const
  */
 QPainterPath& LineFeature::line()
 {
+    std::as_const(*this).line();
     return m_line;
 }
 
@@ -101,6 +272,106 @@ QList<QPoint> PointFeature::points() const
 {
     return m_points;
 }
+/*
+ * ----------------------------------------------------------------------------
+ */
+
+/*!
+ * \brief TileLayerFilterCache::find
+ * \param styleId the unique id of the layer style whose filter was applied.
+ * \param mapZoom the map zoom level the filter was applied at.
+ * \return the indices of the features that passed the filter, or nullptr if there is no stored result.
+ *
+ * \threadsafe
+ */
+std::shared_ptr<const TileLayerFilterCache::FeatureIndices> TileLayerFilterCache::find(quint64 styleId, int mapZoom) const
+{
+    QMutexLocker lock { &m_lock };
+    if (mapZoom != m_mapZoom)
+        return nullptr;
+    return m_entries.value(styleId);
+}
+
+/*!
+ * \brief TileLayerFilterCache::insert
+ * Stores the result of applying a layer style's filter at a map zoom level.
+ * If the map zoom level is different from the one already stored, the cache is cleared first.
+ *
+ * \threadsafe
+ */
+void TileLayerFilterCache::insert(quint64 styleId, int mapZoom, std::shared_ptr<const FeatureIndices> indices)
+{
+    QMutexLocker lock { &m_lock };
+    if (mapZoom != m_mapZoom) {
+        m_entries.clear();
+        m_mapZoom = mapZoom;
+    }
+    m_entries.insert(styleId, std::move(indices));
+}
+
+/*!
+ * \brief TileLayerFilterCache::clear
+ * Removes all stored results.
+ *
+ * \threadsafe
+ */
+void TileLayerFilterCache::clear()
+{
+    QMutexLocker lock { &m_lock };
+    m_entries.clear();
+    m_mapZoom = -1;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ */
+
+/*!
+ * \brief TileLayerLabelCache::find
+ * \param styleId the unique id of the symbol layer style the labels were prepared for.
+ * \param mapZoom the map zoom level the labels were prepared at.
+ * \return the label candidates, or nullptr if there is no stored result.
+ *
+ * \threadsafe
+ */
+std::shared_ptr<const Bach::TileLabelCandidates> TileLayerLabelCache::find(quint64 styleId, int mapZoom) const
+{
+    QMutexLocker lock { &m_lock };
+    if (mapZoom != m_mapZoom)
+        return nullptr;
+    return m_entries.value(styleId);
+}
+
+/*!
+ * \brief TileLayerLabelCache::insert
+ * Stores the label candidates of a symbol layer style at a map zoom level.
+ * If the map zoom level is different from the one already stored, the cache is cleared first.
+ *
+ * \threadsafe
+ */
+void TileLayerLabelCache::insert(quint64 styleId, int mapZoom, std::shared_ptr<const Bach::TileLabelCandidates> labels)
+{
+    QMutexLocker lock { &m_lock };
+    if (mapZoom != m_mapZoom) {
+        m_entries.clear();
+        m_mapZoom = mapZoom;
+    }
+    m_entries.insert(styleId, std::move(labels));
+}
+
+/*!
+ * \brief TileLayerLabelCache::clear
+ * Removes all stored results.
+ *
+ * \threadsafe
+ */
+void TileLayerLabelCache::clear()
+{
+    QMutexLocker lock { &m_lock };
+    m_entries.clear();
+    m_mapZoom = -1;
+}
+
 /*
  * ----------------------------------------------------------------------------
  */
@@ -148,27 +419,248 @@ int TileLayer::extent() const
     return m_extent;
 }
 
+/*!
+ * \brief TileLayer::addSimplifiedPaths
+ * Stores paths of the layer's features simplified for drawing the tile at a given size.
+ * Paths already stored for the same size are replaced.
+ */
+void TileLayer::addSimplifiedPaths(SimplifiedPaths paths)
+{
+    geometry().addSimplifiedPaths(std::move(paths));
+}
+
+/*!
+ * \brief TileLayer::simplifiedPath
+ * Looks up the simplest path of a feature that is still detailed enough at the given size.
+ * \param geometryIndex The index of the feature within the layer's TileLayerGeometry.
+ * \param tilePixelSize The on-screen size of the tile, in device pixels.
+ * \return The path, or null if the tile is drawn larger than any of the simplified paths
+ * are meant for, in which case the feature's own path should be drawn.
+ */
+const QPainterPath* TileLayer::simplifiedPath(int geometryIndex, double tilePixelSize) const
+{
+    return geometry().simplifiedPath(geometryIndex, tilePixelSize);
+}
+
+/*!
+ * \brief TileLayer::featureBoundingRect
+ * Looks up the bounding box of a feature, see TileLayerGeometry::featureBoundingRect.
+ * \param geometryIndex The index of the feature within the layer's TileLayerGeometry.
+ */
+std::optional<QRect> TileLayer::featureBoundingRect(int geometryIndex) const
+{
+    return geometry().featureBoundingRect(geometryIndex);
+}
+
 /*
  * ----------------------------------------------------------------------------
  */
 
 /*!
- * \brief polygonFeatureFromProto
- * Decode the geometry of a layer's polygon feature from the desrialized protocol buffer.
- * \param feature a refrence to the layer's feature from the deserialized protocol buffer
- * \return a pointer of type PolygonFeature conatining the decoded geometry as a QPainterPath.
+ * \brief TileMesh::byteSize
+ * \return The amount of bytes used by the vertex and index data of the mesh.
  */
-std::unique_ptr<AbstractLayerFeature> polygonFeatureFromProto(
-    const vector_tile::Tile::Feature &feature)
+qint64 TileMesh::byteSize() const
 {
-    PolygonFeature *newFeature = new PolygonFeature;
-    auto featurePtr = std::unique_ptr<AbstractLayerFeature>(newFeature);
+    return
+        (qint64)(positions.size() + extrusions.size()) * (qint64)sizeof(QPointF) +
+        (qint64)indices.size() * (qint64)sizeof(quint32);
+}
 
-    qint32 x = 0;
-    qint32 y = 0;
+/*!
+ * \brief TileLayerGeometry::buildPath
+ * Builds the QPainterPath of a single feature from the flat geometry storage.
+ * \param featureIndex the index of the feature within this storage.
+ * \return the path of the feature.
+ */
+QPainterPath TileLayerGeometry::buildPath(int featureIndex) const
+{
+    ensureDecoded();
+    QPainterPath path;
+    const quint32 firstPart = featurePartOffsets[featureIndex];
+    const quint32 endPart = featurePartOffsets[featureIndex + 1];
+    for (quint32 part = firstPart; part < endPart; part++) {
+        const quint32 firstVertex = partVertexOffsets[part];
+        const quint32 endVertex = partVertexOffsets[part + 1];
+        path.moveTo(vertices[firstVertex]);
+        for (quint32 vertex = firstVertex + 1; vertex < endVertex; vertex++) {
+            path.lineTo(vertices[vertex]);
+        }
+        if (partClosed[part])
+            path.closeSubpath();
+    }
+    return path;
+}
+
+/*!
+ * \brief TileLayerGeometry::featureBoundingRect
+ * Looks up the bounding box of a feature, in tile coordinates.
+ * \return The bounding box, which is empty if the feature has no vertices.
+ * Returns std::nullopt if no bounding box is stored for the feature,
+ * in which case it must be treated as if it covers everything.
+ */
+std::optional<QRect> TileLayerGeometry::featureBoundingRect(int featureIndex) const
+{
+    ensureDecoded();
+    if (featureIndex < 0 || featureIndex >= (int)featureBounds.size())
+        return std::nullopt;
+    const FeatureBounds &bounds = featureBounds[featureIndex];
+    if (bounds.minX > bounds.maxX || bounds.minY > bounds.maxY)
+        return QRect();
+    return QRect(QPoint(bounds.minX, bounds.minY), QPoint(bounds.maxX, bounds.maxY));
+}
+
+/*!
+ * \brief TileLayerGeometry::addSimplifiedPaths
+ * Stores simplified paths of the features. Paths already stored for the same size are replaced.
+ */
+void TileLayerGeometry::addSimplifiedPaths(SimplifiedPaths paths)
+{
+    auto it = std::lower_bound(
+        simplifiedPaths.begin(),
+        simplifiedPaths.end(),
+        paths.tilePixelSize,
+        [](const SimplifiedPaths &item, int size) { return item.tilePixelSize < size; });
+    if (it != simplifiedPaths.end() && it->tilePixelSize == paths.tilePixelSize)
+        *it = std::move(paths);
+    else
+        simplifiedPaths.insert(it, std::move(paths));
+}
+
+/*!
+ * \brief TileLayerGeometry::simplifiedPath
+ * Looks up the simplest path of a feature that is still detailed enough at the given size.
+ * \return The path, or null if there are no simplified paths for a tile this large.
+ */
+const QPainterPath* TileLayerGeometry::simplifiedPath(int featureIndex, double tilePixelSize) const
+{
+    ensureDecoded();
+    for (const SimplifiedPaths &paths : simplifiedPaths) {
+        if (paths.tilePixelSize >= tilePixelSize && featureIndex >= 0 && featureIndex < (int)paths.featurePaths.size())
+            return &paths.featurePaths[featureIndex];
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief TileLayerGeometry::ensureDecoded
+ * Decodes the geometry if the tile decoder deferred it. Does nothing otherwise.
+ *
+ * \threadsafe
+ */
+void TileLayerGeometry::ensureDecoded() const
+{
+    if (deferredDecode == nullptr)
+        return;
+    std::call_once(deferredDecode->decoded, [this]() {
+        // This only runs once, before anyone gets to read the decoded geometry.
+        auto &self = const_cast<TileLayerGeometry&>(*this);
+        auto decode = std::move(self.deferredDecode->decode);
+        if (decode)
+            decode(self);
+    });
+}
+
+/*!
+ * \internal
+ * \brief decodeDeltaPoints
+ * Decodes a run of zigzag encoded (dx, dy) command parameters into absolute points.
+ *
+ * Each point is the previous point plus its delta, so this is a prefix sum over the
+ * decoded deltas. Where SSE2 or NEON is available, two points are decoded at a time.
+ *
+ * \param params the encoded parameters, two for every point.
+ * \param count the amount of points to decode.
+ * \param cursor the point before the first point. Set to the last decoded point.
+ * \param out receives the decoded points. Must have room for 'count' points.
+ */
+static void decodeDeltaPoints(const quint32 *params, qsizetype count, QPoint &cursor, QPoint *out)
+{
+    // The vector paths store the x and y of every point straight into the output.
+    static_assert(sizeof(QPoint) == 2 * sizeof(qint32));
+
+    qsizetype i = 0;
+#if defined(BACH_GEOMETRY_SSE2)
+    // Lanes hold x, y, x, y. The carry is the last decoded point in both halves.
+    __m128i carry = _mm_set_epi32(cursor.y(), cursor.x(), cursor.y(), cursor.x());
+    const __m128i one = _mm_set1_epi32(1);
+    for (; i + 2 <= count; i += 2) {
+        const __m128i encoded = _mm_loadu_si128((const __m128i*)(params + 2 * i));
+        __m128i deltas = _mm_xor_si128(
+            _mm_srli_epi32(encoded, 1),
+            _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(encoded, one)));
+        // Add the first delta onto the second, then the previous point onto both.
+        deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 8));
+        const __m128i points = _mm_add_epi32(deltas, carry);
+        _mm_storeu_si128((__m128i*)(out + i), points);
+        carry = _mm_shuffle_epi32(points, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    cursor = QPoint { _mm_cvtsi128_si32(carry), _mm_cvtsi128_si32(_mm_shuffle_epi32(carry, 1)) };
+#elif defined(BACH_GEOMETRY_NEON)
+    // Lanes hold x, y, x, y. The carry is the last decoded point in both halves.
+    int32x4_t carry = { cursor.x(), cursor.y(), cursor.x(), cursor.y() };
+    const uint32x4_t one = vdupq_n_u32(1);
+    for (; i + 2 <= count; i += 2) {
+        const uint32x4_t encoded = vld1q_u32(params + 2 * i);
+        int32x4_t deltas = veorq_s32(
+            vreinterpretq_s32_u32(vshrq_n_u32(encoded, 1)),
+            vnegq_s32(vreinterpretq_s32_u32(vandq_u32(encoded, one))));
+        // Add the first delta onto the second, then the previous point onto both.
+        deltas = vaddq_s32(deltas, vextq_s32(vdupq_n_s32(0), deltas, 2));
+        const int32x4_t points = vaddq_s32(deltas, carry);
+        vst1q_s32((int32_t*)(out + i), points);
+        carry = vcombine_s32(vget_high_s32(points), vget_high_s32(points));
+    }
+    cursor = QPoint { vgetq_lane_s32(carry, 0), vgetq_lane_s32(carry, 1) };
+#endif
+
+    qint32 x = cursor.x();
+    qint32 y = cursor.y();
+    for (; i < count; i++) {
+        const quint32 dx = params[2 * i];
+        const quint32 dy = params[2 * i + 1];
+        //this is the formula for decoding the command parameters.
+        x += ((dx >> 1) ^ (-(dx & 1)));
+        y += ((dy >> 1) ^ (-(dy & 1)));
+        out[i] = QPoint(x, y);
+    }
+    cursor = QPoint(x, y);
+}
+
+/*!
+ * \brief appendFeatureGeometry
+ * Decodes the geometry of a layer's polygon or line feature from its encoded geometry commands,
+ * and appends it to the layer's flat geometry storage.
+ * \param out the geometry storage of the layer.
+ * \param type the type of the feature. ClosePath commands are only respected for polygons.
+ * \param geometry the feature's list of encoded geometry commands and parameters.
+ * \return the index of the new feature within the geometry storage.
+ */
+template<class GeometryT>
+static int appendFeatureGeometry(
+    TileLayerGeometry &out,
+    AbstractLayerFeature::featureType type,
+    const GeometryT &geometry)
+{
+    const bool handleClosePath = type == AbstractLayerFeature::featureType::polygon;
+    const quint32 featureFirstPart = out.featurePartOffsets.back();
+    // Whether the last part of this feature can be extended with LineTo's.
+    bool partOpen = false;
+
+    auto startPart = [&](QPoint start) {
+        out.vertices.push_back(start);
+        out.partVertexOffsets.push_back((quint32)out.vertices.size());
+        out.partClosed.push_back(false);
+        partOpen = true;
+    };
+
+    // The loop below keeps within bounds itself, so we skip the checks of 'at()'.
+    const quint32 *commands = geometry.data();
+    const qsizetype size = (qsizetype)geometry.size();
+    QPoint cursor { 0, 0 };
     //iterate through the geometry commands and parameters.
-    for(int i = 0; i < feature.geometry().size(); ) {
-        quint32 point = feature.geometry().at(i);
+    for (qsizetype i = 0; i < size; ) {
+        quint32 point = commands[i];
         //the command type is encoded as the 3 LSBs of the command integer.
         //With: command 1 = MoveTo; command 2 = LineTo; command 7 = ClosePAth (takes not parameters);
         quint32 commandId = point & 0x7;
@@ -177,79 +669,392 @@ std::unique_ptr<AbstractLayerFeature> polygonFeatureFromProto(
         //should be equal to 2 * commandCount).
         quint32 count = point >> 3;
         i++;
-        if (commandId == 7) {
-            newFeature->polygon().closeSubpath();
+        if (handleClosePath && commandId == 7) {
+            if (partOpen) {
+                out.partClosed.back() = true;
+                partOpen = false;
+            }
             continue;
         }
-        while(count > 0 && i < feature.geometry().size() - 1) {
-            point = feature.geometry().at(i);
-             //this is the formula for decoding the command parameters.
-            x += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            point = feature.geometry().at(i);
-            y += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            if (commandId == 1) {
-                newFeature->polygon().moveTo(x, y);
-            } else if (commandId == 2) {
-                newFeature->polygon().lineTo(x, y);
+        // A truncated command only gets the points it has both parameters for.
+        const qsizetype pointCount = qMin((qsizetype)count, (size - i) / 2);
+        if (commandId == 2 && pointCount > 0) {
+            if (!partOpen) {
+                // Same as QPainterPath, a LineTo without a preceding MoveTo starts
+                // from the origin, or from the start of the previous closed part.
+                bool hasParts = out.partClosed.size() > featureFirstPart;
+                QPoint start = hasParts ? out.vertices[out.partVertexOffsets[out.partClosed.size() - 1]] : QPoint(0, 0);
+                startPart(start);
+            }
+            const size_t firstVertex = out.vertices.size();
+            out.vertices.resize(firstVertex + pointCount);
+            decodeDeltaPoints(commands + i, pointCount, cursor, out.vertices.data() + firstVertex);
+            out.partVertexOffsets.back() = (quint32)out.vertices.size();
+        } else {
+            // MoveTo's start a part for every point, other commands only move the cursor.
+            for (qsizetype p = 0; p < pointCount; p++) {
+                QPoint vertex;
+                decodeDeltaPoints(commands + i + 2 * p, 1, cursor, &vertex);
+                if (commandId == 1)
+                    startPart(vertex);
             }
-            count--;
         }
+        i += 2 * pointCount;
     }
-    return featurePtr;
+
+    out.featurePartOffsets.push_back((quint32)out.partClosed.size());
+    out.featureTypes.push_back(type);
+    return out.featureCount() - 1;
 }
 
+/*!
+ * \brief Bach::TileParseOptions::forTilePixelSize
+ * Builds options that clip the geometry, and simplify it for the range of sizes a tile is shown at
+ * while zooming between two map zoom levels.
+ * \param tilePixelSize The size of a tile on screen at a whole zoom level, in device pixels.
+ */
+Bach::TileParseOptions Bach::TileParseOptions::forTilePixelSize(int tilePixelSize)
+{
+    // The map zoom is rounded to the closest level, so tiles are shown between
+    // 1/sqrt(2) and sqrt(2) times their size at a whole zoom level.
+    TileParseOptions out;
+    out.clipToExtent = true;
+    out.simplifiedTilePixelSizes = { tilePixelSize, (int)std::ceil(tilePixelSize * M_SQRT2) };
+    return out;
+}
 
 /*!
- * \brief lineFeatureFromProto
- *  Decode the geometry of a layer's line feature from the desrialized protocol buffer.
- * \param feature a refrence to the layer's feature from the deserialized protocol buffer
- * \return a pointer of type LineFeature conatining the decoded geometry as a QPainterPath.
+ * \brief clipRing
+ * Clips a polygon ring to a rectangle, one edge of the rectangle at a time.
+ * Parts of the ring outside the rectangle end up running along its edges.
  */
-std::unique_ptr<AbstractLayerFeature> lineFeatureFromProto(
-    const vector_tile::Tile::Feature &feature)
+static std::vector<QPoint> clipRing(std::vector<QPoint> ring, int minX, int minY, int maxX, int maxY)
 {
-    LineFeature *newFeature = new LineFeature;
-    auto featurePtr = std::unique_ptr<AbstractLayerFeature>(newFeature);
-    qint32 x = 0;
-    qint32 y = 0;
-    QPainterPath path;
-    for(int i = 0; i < feature.geometry().size(); ) {
-        quint32 point = feature.geometry().at(i);
-        quint32 commandId = point & 0x7;
-        quint32 count = point >> 3;
-        i++;
+    auto clipEdge = [&](auto isInside, auto intersect) {
+        std::vector<QPoint> out;
+        if (ring.empty())
+            return;
+        QPoint prev = ring.back();
+        for (QPoint current : ring) {
+            if (isInside(current)) {
+                if (!isInside(prev))
+                    out.push_back(intersect(prev, current));
+                out.push_back(current);
+            } else if (isInside(prev)) {
+                out.push_back(intersect(prev, current));
+            }
+            prev = current;
+        }
+        ring = std::move(out);
+    };
+    auto atX = [](QPoint a, QPoint b, int x) {
+        return QPoint{ x, (int)std::lround(a.y() + (double)(b.y() - a.y()) * (x - a.x()) / (b.x() - a.x())) };
+    };
+    auto atY = [](QPoint a, QPoint b, int y) {
+        return QPoint{ (int)std::lround(a.x() + (double)(b.x() - a.x()) * (y - a.y()) / (b.y() - a.y())), y };
+    };
+
+    clipEdge([&](QPoint p) { return p.x() >= minX; }, [&](QPoint a, QPoint b) { return atX(a, b, minX); });
+    clipEdge([&](QPoint p) { return p.x() <= maxX; }, [&](QPoint a, QPoint b) { return atX(a, b, maxX); });
+    clipEdge([&](QPoint p) { return p.y() >= minY; }, [&](QPoint a, QPoint b) { return atY(a, b, minY); });
+    clipEdge([&](QPoint p) { return p.y() <= maxY; }, [&](QPoint a, QPoint b) { return atY(a, b, maxY); });
+    return ring;
+}
 
-        while(count > 0 && i < feature.geometry().size() - 1) {
-            point = feature.geometry().at(i);
-            x += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            point = feature.geometry().at(i);
-            y += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            if (commandId == 1) {
-                path.moveTo(x, y);
-            } else if (commandId == 2) {
-                path.lineTo(x, y);
+/*!
+ * \brief clipLineString
+ * Clips a line string to a rectangle. Every stretch of the line inside the rectangle
+ * becomes its own line string.
+ */
+static std::vector<std::vector<QPoint>> clipLineString(const std::vector<QPoint> &line, int minX, int minY, int maxX, int maxY)
+{
+    std::vector<std::vector<QPoint>> out;
+    std::vector<QPoint> current;
+    auto finishCurrent = [&]() {
+        if (current.size() >= 2)
+            out.push_back(std::move(current));
+        current.clear();
+    };
+
+    for (size_t i = 0; i + 1 < line.size(); i++) {
+        const QPoint a = line[i];
+        const QPoint b = line[i + 1];
+
+        // Liang-Barsky, the segment is a + t * (b - a) for t in [t0, t1].
+        double t0 = 0;
+        double t1 = 1;
+        const double dx = b.x() - a.x();
+        const double dy = b.y() - a.y();
+        auto clipAgainst = [&](double p, double q) {
+            if (p == 0)
+                return q >= 0;
+            const double t = q / p;
+            if (p < 0)
+                t0 = qMax(t0, t);
+            else
+                t1 = qMin(t1, t);
+            return t0 <= t1;
+        };
+        const bool visible =
+            clipAgainst(-dx, a.x() - minX) &&
+            clipAgainst(dx, maxX - a.x()) &&
+            clipAgainst(-dy, a.y() - minY) &&
+            clipAgainst(dy, maxY - a.y());
+        if (!visible) {
+            finishCurrent();
+            continue;
+        }
+
+        const QPoint start = t0 == 0 ? a : QPoint{ (int)std::lround(a.x() + t0 * dx), (int)std::lround(a.y() + t0 * dy) };
+        const QPoint end = t1 == 1 ? b : QPoint{ (int)std::lround(a.x() + t1 * dx), (int)std::lround(a.y() + t1 * dy) };
+        if (current.empty() || current.back() != start) {
+            finishCurrent();
+            current.push_back(start);
+        }
+        current.push_back(end);
+        // The line leaves the rectangle here.
+        if (t1 != 1)
+            finishCurrent();
+    }
+    finishCurrent();
+    return out;
+}
+
+/*!
+ * \brief clipLastFeatureGeometry
+ * Clips the geometry of the feature last appended to the geometry storage to a rectangle.
+ * Polygon rings and line strings that end up empty are dropped.
+ */
+static void clipLastFeatureGeometry(TileLayerGeometry &geometry, int minX, int minY, int maxX, int maxY)
+{
+    const int featureIndex = geometry.featureCount() - 1;
+    const quint32 firstPart = geometry.featurePartOffsets[featureIndex];
+    const quint32 endPart = geometry.featurePartOffsets[featureIndex + 1];
+    const quint32 firstVertex = geometry.partVertexOffsets[firstPart];
+
+    // Most features are entirely within the tile, and are left as they are.
+    const bool allInside = std::all_of(
+        geometry.vertices.begin() + firstVertex,
+        geometry.vertices.end(),
+        [&](QPoint p) { return p.x() >= minX && p.x() <= maxX && p.y() >= minY && p.y() <= maxY; });
+    if (allInside)
+        return;
+
+    // Take the parts of the feature out, and append them again clipped.
+    struct Part {
+        std::vector<QPoint> vertices;
+        bool closed;
+    };
+    std::vector<Part> parts;
+    for (quint32 part = firstPart; part < endPart; part++) {
+        parts.push_back({
+            { geometry.vertices.begin() + geometry.partVertexOffsets[part],
+              geometry.vertices.begin() + geometry.partVertexOffsets[part + 1] },
+            geometry.partClosed[part] });
+    }
+    geometry.vertices.resize(firstVertex);
+    geometry.partVertexOffsets.resize(firstPart + 1);
+    geometry.partClosed.resize(firstPart);
+
+    auto appendPart = [&](const std::vector<QPoint> &vertices, bool closed) {
+        geometry.vertices.insert(geometry.vertices.end(), vertices.begin(), vertices.end());
+        geometry.partVertexOffsets.push_back((quint32)geometry.vertices.size());
+        geometry.partClosed.push_back(closed);
+    };
+    const bool isPolygon = geometry.featureTypes[featureIndex] == AbstractLayerFeature::featureType::polygon;
+    for (const Part &part : parts) {
+        if (isPolygon) {
+            std::vector<QPoint> ring = clipRing(part.vertices, minX, minY, maxX, maxY);
+            if (ring.size() >= 3)
+                appendPart(ring, part.closed);
+        } else {
+            for (const std::vector<QPoint> &line : clipLineString(part.vertices, minX, minY, maxX, maxY))
+                appendPart(line, false);
+        }
+    }
+    geometry.featurePartOffsets.back() = (quint32)geometry.partClosed.size();
+}
+
+/*!
+ * \internal
+ * \brief storeLastFeatureBounds
+ * Stores the bounding box of the feature last appended to the geometry storage.
+ * Must run after the feature is clipped, so that the box is as tight as the geometry.
+ */
+static void storeLastFeatureBounds(TileLayerGeometry &geometry)
+{
+    const int featureIndex = geometry.featureCount() - 1;
+    const quint32 firstVertex = geometry.partVertexOffsets[geometry.featurePartOffsets[featureIndex]];
+    const quint32 endVertex = geometry.partVertexOffsets[geometry.featurePartOffsets[featureIndex + 1]];
+
+    TileLayerGeometry::FeatureBounds bounds;
+    if (firstVertex < endVertex) {
+        int minX = std::numeric_limits<int>::max();
+        int minY = std::numeric_limits<int>::max();
+        int maxX = std::numeric_limits<int>::min();
+        int maxY = std::numeric_limits<int>::min();
+        for (quint32 vertex = firstVertex; vertex < endVertex; vertex++) {
+            const QPoint &point = geometry.vertices[vertex];
+            minX = qMin(minX, point.x());
+            minY = qMin(minY, point.y());
+            maxX = qMax(maxX, point.x());
+            maxY = qMax(maxY, point.y());
+        }
+        auto clamp16 = [](int value) {
+            return (qint16)std::clamp<int>(value, std::numeric_limits<qint16>::min(), std::numeric_limits<qint16>::max());
+        };
+        bounds = { clamp16(minX), clamp16(minY), clamp16(maxX), clamp16(maxY) };
+    }
+    // Features appended without a bounding box leave the rest without one as well.
+    if ((int)geometry.featureBounds.size() == featureIndex)
+        geometry.featureBounds.push_back(bounds);
+}
+
+/*!
+ * \brief simplifyDouglasPeucker
+ * Removes the vertices of a line string that are closer than the tolerance
+ * to the simplified line. The first and last vertex are always kept.
+ */
+static std::vector<QPoint> simplifyDouglasPeucker(const std::vector<QPoint> &points, double tolerance)
+{
+    if (points.size() <= 2)
+        return points;
+
+    auto distanceSquared = [](QPoint p, QPoint a, QPoint b) {
+        const double dx = b.x() - a.x();
+        const double dy = b.y() - a.y();
+        const double lengthSquared = dx * dx + dy * dy;
+        double t = lengthSquared == 0 ? 0 : ((p.x() - a.x()) * dx + (p.y() - a.y()) * dy) / lengthSquared;
+        t = std::clamp(t, 0.0, 1.0);
+        const double ex = a.x() + t * dx - p.x();
+        const double ey = a.y() + t * dy - p.y();
+        return ex * ex + ey * ey;
+    };
+
+    std::vector<bool> keep(points.size(), false);
+    keep.front() = true;
+    keep.back() = true;
+    std::vector<std::pair<size_t, size_t>> ranges = { { 0, points.size() - 1 } };
+    const double toleranceSquared = tolerance * tolerance;
+    while (!ranges.empty()) {
+        const auto [first, last] = ranges.back();
+        ranges.pop_back();
+        double maxDistance = 0;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; i++) {
+            const double distance = distanceSquared(points[i], points[first], points[last]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                farthest = i;
             }
-            count--;
+        }
+        if (maxDistance > toleranceSquared) {
+            keep[farthest] = true;
+            ranges.push_back({ first, farthest });
+            ranges.push_back({ farthest, last });
         }
     }
-    newFeature->line() = path;
-    return featurePtr;
+
+    std::vector<QPoint> out;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (keep[i])
+            out.push_back(points[i]);
+    }
+    return out;
 }
 
 /*!
- * \brief textLineFeatureFromProto
- *  Decode the geometry of a layer's line feature from the desrialized protocol buffer.
+ * \brief buildSimplifiedPaths
+ * Builds the path of every feature in the geometry storage, leaving out the vertices
+ * that move the outline by less than the tolerance. Rings and line strings that
+ * shrink below the tolerance are left out entirely.
+ * \param tolerance The largest distance a vertex may be off, in tile coordinates.
+ */
+static std::vector<QPainterPath> buildSimplifiedPaths(const TileLayerGeometry &geometry, double tolerance)
+{
+    std::vector<QPainterPath> out;
+    out.reserve(geometry.featureCount());
+    std::vector<QPoint> points;
+    for (int featureIndex = 0; featureIndex < geometry.featureCount(); featureIndex++) {
+        QPainterPath path;
+        const quint32 firstPart = geometry.featurePartOffsets[featureIndex];
+        const quint32 endPart = geometry.featurePartOffsets[featureIndex + 1];
+        for (quint32 part = firstPart; part < endPart; part++) {
+            const bool closed = geometry.partClosed[part];
+            points.assign(
+                geometry.vertices.begin() + geometry.partVertexOffsets[part],
+                geometry.vertices.begin() + geometry.partVertexOffsets[part + 1]);
+            // A ring is simplified as a line string that ends where it starts.
+            if (closed && !points.empty())
+                points.push_back(points.front());
+            std::vector<QPoint> simplified = simplifyDouglasPeucker(points, tolerance);
+            if (closed && !simplified.empty())
+                simplified.pop_back();
+            if (simplified.size() < (closed ? 3 : 2))
+                continue;
+
+            path.moveTo(simplified.front());
+            for (size_t i = 1; i < simplified.size(); i++)
+                path.lineTo(simplified[i]);
+            if (closed)
+                path.closeSubpath();
+        }
+        out.push_back(std::move(path));
+    }
+    return out;
+}
+
+/*!
+ * \brief polygonFeatureFromGeometry
+ * Decode the geometry of a layer's polygon feature from its encoded geometry commands.
+ * \param geometry the feature's list of encoded geometry commands and parameters.
+ * \param layerGeometry the geometry storage of the layer the feature belongs to.
+ * \return a pointer of type PolygonFeature referring to the decoded geometry.
+ */
+template<class GeometryT>
+static std::unique_ptr<AbstractLayerFeature> polygonFeatureFromGeometry(
+    const GeometryT &geometry,
+    TileLayerGeometry &layerGeometry)
+{
+    int geometryIndex = appendFeatureGeometry(
+        layerGeometry,
+        AbstractLayerFeature::featureType::polygon,
+        geometry);
+    storeLastFeatureBounds(layerGeometry);
+    return std::make_unique<PolygonFeature>(&layerGeometry, geometryIndex);
+}
+
+/*!
+ * \brief lineFeatureFromGeometry
+ *  Decode the geometry of a layer's line feature from its encoded geometry commands.
+ * \param geometry the feature's list of encoded geometry commands and parameters.
+ * \param layerGeometry the geometry storage of the layer the feature belongs to.
+ * \return a pointer of type LineFeature referring to the decoded geometry.
+ */
+template<class GeometryT>
+static std::unique_ptr<AbstractLayerFeature> lineFeatureFromGeometry(
+    const GeometryT &geometry,
+    TileLayerGeometry &layerGeometry)
+{
+    int geometryIndex = appendFeatureGeometry(
+        layerGeometry,
+        AbstractLayerFeature::featureType::line,
+        geometry);
+    storeLastFeatureBounds(layerGeometry);
+    return std::make_unique<LineFeature>(&layerGeometry, geometryIndex);
+}
+
+/*!
+ * \brief textLineFeatureFromGeometry
+ *  Decode the geometry of a layer's line feature from its encoded geometry commands.
  *  This function deals with decoding line geometry for text features. It only includes the
  *  line with the largest length in the QPainterPath.
- * \param feature a refrence to the layer's feature from the deserialized protocol buffer
+ * \param geometry the feature's list of encoded geometry commands and parameters.
  * \return a pointer of type LineFeature conatining the decoded geometry as a QPainterPath.
  */
-std::unique_ptr<AbstractLayerFeature> textLineFeatureFromProto(
-    const vector_tile::Tile::Feature &feature)
+template<class GeometryT>
+static std::unique_ptr<AbstractLayerFeature> textLineFeatureFromGeometry(
+    const GeometryT &geometry)
 {
     LineFeature *newFeature = new LineFeature;
     auto featurePtr = std::unique_ptr<AbstractLayerFeature>(newFeature);
@@ -257,17 +1062,17 @@ std::unique_ptr<AbstractLayerFeature> textLineFeatureFromProto(
     qint32 x = 0;
     qint32 y = 0;
     QPainterPath path;
-    for(int i = 0; i < feature.geometry().size(); ) {
-        quint32 point = feature.geometry().at(i);
+    for(int i = 0; i < (int)geometry.size(); ) {
+        quint32 point = geometry.at(i);
         quint32 commandId = point & 0x7;
         quint32 count = point >> 3;
         i++;
 
-        while(count > 0 && i < feature.geometry().size() - 1) {
-            point = feature.geometry().at(i);
+        while(count > 0 && i < (int)geometry.size() - 1) {
+            point = geometry.at(i);
             x += ((point >> 1) ^ (-(point & 1)));
             i++;
-            point = feature.geometry().at(i);
+            point = geometry.at(i);
             y += ((point >> 1) ^ (-(point & 1)));
             i++;
             if (commandId == 1) {
@@ -286,80 +1091,75 @@ std::unique_ptr<AbstractLayerFeature> textLineFeatureFromProto(
 }
 
 /*!
- * \brief pointFeatureFromProto
- * Decode the geometry of a layer's point feature from the desrialized protocol buffer.
- * \param feature a refrence to the layer's feature from the deserialized protocol buffer.
+ * \brief pointFeatureFromGeometry
+ * Decode the geometry of a layer's point feature from its encoded geometry commands.
+ * \param geometry the feature's list of encoded geometry commands and parameters.
  * \return a pointer of type PointFeature conatining the decoded geometry as a QList<QPoint>.
  */
-std::unique_ptr<AbstractLayerFeature> pointFeatureFromProto(
-    const vector_tile::Tile::Feature &feature)
+template<class GeometryT>
+static std::unique_ptr<AbstractLayerFeature> pointFeatureFromGeometry(
+    const GeometryT &geometry)
 {
     PointFeature *newFeature = new PointFeature;
     auto featurePtr = std::unique_ptr<AbstractLayerFeature>(newFeature);
 
-    qint32 x = 0;
-    qint32 y = 0;
-
-    for(int i = 0; i < feature.geometry().size(); ) {
-        quint32 point = feature.geometry().at(i);
-        quint32 count = point >> 3;
+    const quint32 *commands = geometry.data();
+    const qsizetype size = (qsizetype)geometry.size();
+    QPoint cursor { 0, 0 };
+    for (qsizetype i = 0; i < size; ) {
+        quint32 count = commands[i] >> 3;
         i++;
-        while(count > 0) {
-            point = feature.geometry().at(i);
-            x += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            point = feature.geometry().at(i);
-            y += ((point >> 1) ^ (-(point & 1)));
-            i++;
-            newFeature->addPoint(QPoint(x, y));
-            count--;
+        const qsizetype pointCount = qMin((qsizetype)count, (size - i) / 2);
+        QPoint points[16];
+        for (qsizetype decoded = 0; decoded < pointCount; ) {
+            const qsizetype batch = qMin(pointCount - decoded, (qsizetype)std::size(points));
+            decodeDeltaPoints(commands + i + 2 * decoded, batch, cursor, points);
+            for (qsizetype p = 0; p < batch; p++)
+                newFeature->addPoint(points[p]);
+            decoded += batch;
         }
+        i += 2 * pointCount;
     }
     return featurePtr;
 }
 
 
 /*!
- * \brief populateFeatureMetaData
- * Extracts the feature's metadata from the layers keys and values lists
- * \param feature a pointer to the feature whose metadata is to be extracted.
- * \param keys a list of the keys in the encoded feature metadata
- * \param values a list of values that's used to decode the feature's keys list
+ * \brief populateLayerProperties
+ * Converts the layer's keys and values lists into the layer's property tables.
+ * \param properties the property tables to populate.
+ * \param keys the layer's list of keys.
+ * \param values the layer's list of values.
  */
-void populateFeatureMetaData(
-    AbstractLayerFeature *feature,
+static void populateLayerProperties(
+    TileLayerProperties &properties,
     const QList<QString> &keys,
     const QList<vector_tile::Tile_QtProtobufNested::Value> &values)
 {
-    //The feature's keys list is the features metadata encoded using the tile's values list.
-    //The kayes list length is always expected to be even.
-    //the nth element in the keys list corresponds to the (n/2)th element in the metadata map after decoding,
-    // and the n+1 th element in the keys list correspond to the value for the (n/2) element in the metadata map after decoding.
-    //The keys elements' values map to the tile values list's indecies.
-    if (!feature || feature->tags.length() < 2)
-        return;
-
-    for(int i = 0; i <= feature->tags.length() - 2; i += 2){
-        int keyIndex = feature->tags.at(i);
-        int valueIndex = feature->tags.at(i + 1);
-        QString key = keys.at(keyIndex);
-
-        const vector_tile::Tile_QtProtobufNested::Value &value = values.at(valueIndex);
+    properties.keys = keys;
+    properties.rebuildKeyIds();
 
+    properties.values.clear();
+    properties.values.reserve(values.size());
+    for (const vector_tile::Tile_QtProtobufNested::Value &value : values) {
         if (value.hasStringValue()) {
-            feature->featureMetaData.insert(key, QVariant(value.stringValue()));
+            properties.values.append(QVariant(value.stringValue()));
         } else if (value.hasFloatValue()) {
-            feature->featureMetaData.insert(key, QVariant(value.floatValue()));
+            properties.values.append(QVariant(value.floatValue()));
         } else if (value.hasDoubleValue()) {
-            feature->featureMetaData.insert(key, QVariant(value.doubleValue()));
+            properties.values.append(QVariant(value.doubleValue()));
         } else if (value.hasIntValue()) {
-            feature->featureMetaData.insert(key, QVariant::fromValue<QtProtobuf::int64>(value.intValue()));
+            properties.values.append(QVariant::fromValue<QtProtobuf::int64>(value.intValue()));
         } else if (value.hasUintValue()) {
-            feature->featureMetaData.insert(key, QVariant::fromValue<QtProtobuf::uint64>(value.uintValue()));
+            properties.values.append(QVariant::fromValue<QtProtobuf::uint64>(value.uintValue()));
         } else if (value.hasSintValue()) {
-            feature->featureMetaData.insert(key, QVariant::fromValue<QtProtobuf::sint64>(value.sintValue()));
+            properties.values.append(QVariant::fromValue<QtProtobuf::sint64>(value.sintValue()));
         } else if (value.hasBoolValue()) {
-            feature->featureMetaData.insert(key, QVariant(value.boolValue()));
+            properties.values.append(QVariant(value.boolValue()));
+        } else {
+            // Values without any known field set are kept as invalid entries
+            // so that the indices still line up with the tags.
+            properties.values.append(QVariant());
         }
     }
 }
@@ -371,12 +1171,77 @@ void populateFeatureMetaData(
 VectorTile::VectorTile() {
 }
 
+/*!
+ * \brief VectorTile::newUniqueId
+ * \return a new id that has not been returned before.
+ *
+ * \threadsafe
+ */
+quint64 VectorTile::newUniqueId()
+{
+    static std::atomic<quint64> nextId = 1;
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
 
 std::optional<VectorTile> VectorTile::fromByteArray(const QByteArray &bytes)
 {
     return Bach::tileFromByteArray(bytes);
 }
 
+/*!
+ * \brief parseThreadPool
+ * The pool that VectorTile::fromByteArrays parses tiles on.
+ */
+static QThreadPool& parseThreadPool()
+{
+    static QThreadPool pool;
+    return pool;
+}
+
+/*!
+ * \brief VectorTile::fromByteArrays
+ * Parses a batch of tiles in parallel, with the default parse options.
+ * \return The parsed tiles, in the same order. Tiles that could not be parsed are nullopt.
+ */
+std::vector<std::optional<VectorTile>> VectorTile::fromByteArrays(const std::vector<QByteArray> &tiles)
+{
+    return fromByteArrays(tiles, Bach::TileParseOptions{});
+}
+
+/*!
+ * \brief VectorTile::fromByteArrays
+ * Parses a batch of tiles in parallel, spread over one thread per core.
+ * Blocks until every tile is parsed.
+ * \return The parsed tiles, in the same order. Tiles that could not be parsed are nullopt.
+ */
+std::vector<std::optional<VectorTile>> VectorTile::fromByteArrays(
+    const std::vector<QByteArray> &tiles,
+    const Bach::TileParseOptions &options)
+{
+    std::vector<std::optional<VectorTile>> out(tiles.size());
+    auto parseTile = [&](size_t i) {
+        std::optional<VectorTile> tile = Bach::tileFromByteArray(tiles[i], options);
+        if (tile.has_value())
+            out[i].emplace(std::move(tile.value()));
+    };
+
+    if (tiles.size() <= 1) {
+        for (size_t i = 0; i < tiles.size(); i++)
+            parseTile(i);
+        return out;
+    }
+    QSemaphore finishedTiles;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        parseThreadPool().start([&, i]() {
+            parseTile(i);
+            finishedTiles.release();
+        });
+    }
+    finishedTiles.acquire((int)tiles.size());
+    return out;
+}
+
 std::optional<VectorTile> VectorTile::fromFile(const QString &path)
 {
     QFile file{ path };
@@ -388,14 +1253,19 @@ std::optional<VectorTile> VectorTile::fromFile(const QString &path)
 }
 
 /*!
- * \brief VectorTile::fromByteArray
+ * \brief Bach::tileFromByteArray_QtProtobuf
  * Deserialize and extracts all the layers in the tile protocol buffer,
  * then iterates through each layer's features and
  * calls the apropriate function to decode the feature's geometry and metadata.
+ *
+ * This goes through the QtProtobuf generated vector_tile::Tile message. It has been
+ * replaced by the direct decoder in Bach::tileFromByteArray, and is kept around as
+ * a reference for tests and benchmarks.
+ *
  * \param data a QByteArray containing the raw protocol buffer.
  * \return true if the tile was succesfully decoded, or false otherwise
  */
-std::optional<VectorTile> Bach::tileFromByteArray(const QByteArray &bytes)
+std::optional<VectorTile> Bach::tileFromByteArray_QtProtobuf(const QByteArray &bytes)
 {
     QProtobufSerializer serializer;
 
@@ -418,16 +1288,15 @@ std::optional<VectorTile> Bach::tileFromByteArray(const QByteArray &bytes)
 
         output.m_layers.insert({layer.name(), std::move(newLayerPtr)});
 
-        QList<QString> layerKeys = layer.keys().toList();
-        QList layerValues = layer.values().toList();
+        populateLayerProperties(newLayer->properties(), layer.keys().toList(), layer.values().toList());
         for(const auto &feature : layer.features()) {
             switch (feature.type()) {
             case vector_tile::Tile::GeomType::POLYGON:
                 {
-                    std::unique_ptr<AbstractLayerFeature> newFeaturePtr = polygonFeatureFromProto(feature);
+                    std::unique_ptr<AbstractLayerFeature> newFeaturePtr = polygonFeatureFromGeometry(feature.geometry(), newLayer->geometry());
                     AbstractLayerFeature *newFeature = newFeaturePtr.get();
                     newFeature->tags = feature.tags().toList();
-                    populateFeatureMetaData(newFeature, layerKeys, layerValues);
+                    newFeature->setLayerProperties(&newLayer->properties());
                     newLayer->m_features.push_back(std::move(newFeaturePtr));
                 }
                 break;
@@ -435,22 +1304,22 @@ std::optional<VectorTile> Bach::tileFromByteArray(const QByteArray &bytes)
                 {
                     std::unique_ptr<AbstractLayerFeature> newFeaturePtr;
                     if (newLayer->name() == "transportation_name") {
-                        newFeaturePtr= textLineFeatureFromProto(feature);
+                        newFeaturePtr= textLineFeatureFromGeometry(feature.geometry());
                     } else {
-                        newFeaturePtr = lineFeatureFromProto(feature);
+                        newFeaturePtr = lineFeatureFromGeometry(feature.geometry(), newLayer->geometry());
                     }
                     AbstractLayerFeature *newFeature = newFeaturePtr.get();
                     newFeature->tags = feature.tags().toList();
-                    populateFeatureMetaData(newFeature, layerKeys, layerValues);
+                    newFeature->setLayerProperties(&newLayer->properties());
                     newLayer->m_features.push_back(std::move(newFeaturePtr));
                 }
                 break;
             case vector_tile::Tile::GeomType::POINT:
                 {
-                    std::unique_ptr<AbstractLayerFeature> newFeaturePtr = pointFeatureFromProto(feature);
+                    std::unique_ptr<AbstractLayerFeature> newFeaturePtr = pointFeatureFromGeometry(feature.geometry());
                     AbstractLayerFeature *newFeature = newFeaturePtr.get();
                     newFeature->tags = feature.tags().toList();
-                    populateFeatureMetaData(newFeature, layerKeys, layerValues);
+                    newFeature->setLayerProperties(&newLayer->properties());
                     newLayer->m_features.push_back(std::move(newFeaturePtr));
                 }
                 break;
@@ -484,3 +1353,672 @@ std::optional<VectorTile> Bach::tileFromByteArray(const QByteArray &bytes)
 
 
 
+
+/*
+ * ----------------------------------------------------------------------------
+ */
+
+/*!
+ * \internal
+ * \brief The ProtobufWireReader class
+ * Minimal reader for the protobuf wire format. It reads values straight
+ * out of the underlying buffer, and never copies or owns any of it.
+ *
+ * Any read that would go past the end of the buffer, or that encounters
+ * malformed data, marks the reader as failed and returns false.
+ */
+class ProtobufWireReader {
+public:
+    // The wire types defined by the protobuf encoding.
+    enum class WireType : quint32 {
+        Varint = 0,
+        Fixed64 = 1,
+        LengthDelimited = 2,
+        Fixed32 = 5,
+    };
+
+    ProtobufWireReader() = default;
+    ProtobufWireReader(const char *begin, const char *end) :
+        m_pos { begin },
+        m_end { end } {}
+
+    bool atEnd() const { return m_pos >= m_end; }
+    // The bytes that have not been read yet.
+    const char* data() const { return m_pos; }
+    qsizetype size() const { return m_end - m_pos; }
+
+    bool readVarint(quint64 &out)
+    {
+        out = 0;
+        // A varint is at most 10 bytes long.
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (atEnd())
+                return false;
+            quint8 byte = (quint8)*m_pos;
+            m_pos++;
+            out |= (quint64)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool readFixed32(quint32 &out)
+    {
+        if (m_end - m_pos < 4)
+            return false;
+        out = qFromLittleEndian<quint32>(m_pos);
+        m_pos += 4;
+        return true;
+    }
+
+    bool readFixed64(quint64 &out)
+    {
+        if (m_end - m_pos < 8)
+            return false;
+        out = qFromLittleEndian<quint64>(m_pos);
+        m_pos += 8;
+        return true;
+    }
+
+    // Reads the key of the next field.
+    bool readKey(quint32 &fieldNumber, WireType &wireType)
+    {
+        quint64 key = 0;
+        if (!readVarint(key))
+            return false;
+        fieldNumber = (quint32)(key >> 3);
+        wireType = (WireType)(key & 0x7);
+        return true;
+    }
+
+    // Reads a length-delimited field and returns a reader over its contents.
+    bool readLengthDelimited(ProtobufWireReader &out)
+    {
+        quint64 length = 0;
+        if (!readVarint(length))
+            return false;
+        if (length > (quint64)(m_end - m_pos))
+            return false;
+        out = ProtobufWireReader { m_pos, m_pos + length };
+        m_pos += length;
+        return true;
+    }
+
+    bool readString(QString &out)
+    {
+        ProtobufWireReader content;
+        if (!readLengthDelimited(content))
+            return false;
+        out = QString::fromUtf8(content.m_pos, content.m_end - content.m_pos);
+        return true;
+    }
+
+    // Skips the value of a field we are not interested in.
+    bool skipField(WireType wireType)
+    {
+        switch (wireType) {
+        case WireType::Varint:
+        {
+            quint64 temp;
+            return readVarint(temp);
+        }
+        case WireType::Fixed64:
+        {
+            quint64 temp;
+            return readFixed64(temp);
+        }
+        case WireType::LengthDelimited:
+        {
+            ProtobufWireReader temp;
+            return readLengthDelimited(temp);
+        }
+        case WireType::Fixed32:
+        {
+            quint32 temp;
+            return readFixed32(temp);
+        }
+        }
+        // Groups are deprecated and never used by vector tiles.
+        return false;
+    }
+
+    // Reads a repeated uint32 field into the output, whether it's packed or not.
+    bool readRepeatedUInt32(WireType wireType, std::vector<quint32> &out)
+    {
+        if (wireType == WireType::Varint) {
+            quint64 value = 0;
+            if (!readVarint(value))
+                return false;
+            out.push_back((quint32)value);
+            return true;
+        }
+        if (wireType != WireType::LengthDelimited)
+            return false;
+
+        ProtobufWireReader content;
+        if (!readLengthDelimited(content))
+            return false;
+        // Every value takes at least one byte.
+        out.reserve(out.size() + content.size());
+        while (!content.atEnd()) {
+            // Geometry deltas and tags mostly fit in a single byte. We look at 8 bytes
+            // at a time and copy the values before the first one that continues.
+            if (content.size() >= 8) {
+                const quint64 word = qFromLittleEndian<quint64>(content.m_pos);
+                const quint64 continuationBits = word & 0x8080808080808080ull;
+                const int singleByteValues = continuationBits == 0
+                    ? 8
+                    : qCountTrailingZeroBits(continuationBits) / 8;
+                for (int i = 0; i < singleByteValues; i++)
+                    out.push_back((quint32)((word >> (8 * i)) & 0x7F));
+                content.m_pos += singleByteValues;
+                if (singleByteValues == 8)
+                    continue;
+            }
+            quint64 value = 0;
+            if (!content.readVarint(value))
+                return false;
+            out.push_back((quint32)value);
+        }
+        return true;
+    }
+
+private:
+    const char *m_pos = nullptr;
+    const char *m_end = nullptr;
+};
+
+/*!
+ * \internal
+ * \brief The TileDecodeScratch class
+ * Holds the temporary buffers used while decoding a tile. The same buffers
+ * are reused for every feature in the tile, so decoding a feature does not
+ * need to allocate anything beyond the feature itself.
+ */
+struct TileDecodeScratch {
+    std::vector<quint32> tags;
+    std::vector<quint32> geometry;
+    std::vector<ProtobufWireReader> featureReaders;
+    // Where the packed geometry of the current feature starts, when its geometry is deferred.
+    std::vector<ProtobufWireReader> geometryFields;
+    // Features of the current layer whose geometry is to be decoded later.
+    std::vector<std::pair<ProtobufWireReader, AbstractLayerFeature::featureType>> deferredFeatures;
+};
+
+/*!
+ * \internal
+ * \brief The DeferredLayerGeometry struct
+ * Holds what is needed to decode the geometry of a layer the first time it's used.
+ */
+struct DeferredLayerGeometry {
+    // A copy of the encoded layer, the tile bytes may be gone by the time we decode.
+    QByteArray layerBytes;
+    struct Feature {
+        qsizetype offset;
+        qsizetype size;
+        AbstractLayerFeature::featureType type;
+    };
+    // The polygon and line features, in the order of their geometry index.
+    std::vector<Feature> features;
+    int extent = 0;
+    Bach::TileParseOptions options;
+};
+
+// Field numbers from vector_tile.proto
+namespace MvtFields {
+    constexpr quint32 tileLayers = 3;
+
+    constexpr quint32 layerVersion = 15;
+    constexpr quint32 layerName = 1;
+    constexpr quint32 layerFeatures = 2;
+    constexpr quint32 layerKeys = 3;
+    constexpr quint32 layerValues = 4;
+    constexpr quint32 layerExtent = 5;
+
+    constexpr quint32 featureTags = 2;
+    constexpr quint32 featureType = 3;
+    constexpr quint32 featureGeometry = 4;
+
+    constexpr quint32 valueString = 1;
+    constexpr quint32 valueFloat = 2;
+    constexpr quint32 valueDouble = 3;
+    constexpr quint32 valueInt = 4;
+    constexpr quint32 valueUint = 5;
+    constexpr quint32 valueSint = 6;
+    constexpr quint32 valueBool = 7;
+
+    constexpr quint32 geomTypePoint = 1;
+    constexpr quint32 geomTypeLineString = 2;
+    constexpr quint32 geomTypePolygon = 3;
+}
+
+/*!
+ * \internal
+ * \brief decodeValue
+ * Decodes a single entry of a layer's values list into a QVariant.
+ * The resulting QVariant types match the ones produced by the QtProtobuf path.
+ * \return true if successful.
+ */
+static bool decodeValue(ProtobufWireReader reader, QVariant &out)
+{
+    using WireType = ProtobufWireReader::WireType;
+    while (!reader.atEnd()) {
+        quint32 fieldNumber = 0;
+        WireType wireType = {};
+        if (!reader.readKey(fieldNumber, wireType))
+            return false;
+
+        if (fieldNumber == MvtFields::valueString && wireType == WireType::LengthDelimited) {
+            QString temp;
+            if (!reader.readString(temp))
+                return false;
+            out = QVariant(temp);
+        } else if (fieldNumber == MvtFields::valueFloat && wireType == WireType::Fixed32) {
+            quint32 bits = 0;
+            if (!reader.readFixed32(bits))
+                return false;
+            float temp;
+            std::memcpy(&temp, &bits, sizeof(temp));
+            out = QVariant(temp);
+        } else if (fieldNumber == MvtFields::valueDouble && wireType == WireType::Fixed64) {
+            quint64 bits = 0;
+            if (!reader.readFixed64(bits))
+                return false;
+            double temp;
+            std::memcpy(&temp, &bits, sizeof(temp));
+            out = QVariant(temp);
+        } else if (wireType == WireType::Varint && fieldNumber >= MvtFields::valueInt && fieldNumber <= MvtFields::valueBool) {
+            quint64 raw = 0;
+            if (!reader.readVarint(raw))
+                return false;
+            if (fieldNumber == MvtFields::valueInt) {
+                out = QVariant::fromValue<QtProtobuf::int64>((qint64)raw);
+            } else if (fieldNumber == MvtFields::valueUint) {
+                out = QVariant::fromValue<QtProtobuf::uint64>(raw);
+            } else if (fieldNumber == MvtFields::valueSint) {
+                // Sint values are zig-zag encoded.
+                qint64 decoded = (qint64)(raw >> 1) ^ -(qint64)(raw & 1);
+                out = QVariant::fromValue<QtProtobuf::sint64>(decoded);
+            } else {
+                out = QVariant(raw != 0);
+            }
+        } else if (!reader.skipField(wireType)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \internal
+ * \brief storeFeatureGeometry
+ * Decodes the geometry of a polygon or line feature into the layer's geometry storage,
+ * clipping it if the options ask for it.
+ * \return the index of the new feature within the geometry storage.
+ */
+static int storeFeatureGeometry(
+    TileLayerGeometry &out,
+    AbstractLayerFeature::featureType type,
+    const std::vector<quint32> &commands,
+    int extent,
+    const Bach::TileParseOptions &options)
+{
+    const int geometryIndex = appendFeatureGeometry(out, type, commands);
+    if (options.clipToExtent) {
+        const int buffer = (int)std::ceil(extent * options.clipBuffer);
+        clipLastFeatureGeometry(out, -buffer, -buffer, extent + buffer, extent + buffer);
+    }
+    storeLastFeatureBounds(out);
+    return geometryIndex;
+}
+
+/*!
+ * \internal
+ * \brief storeSimplifiedPaths
+ * Builds the simplified paths the options ask for, once all the geometry of a layer is stored.
+ */
+static void storeSimplifiedPaths(TileLayerGeometry &geometry, int extent, const Bach::TileParseOptions &options)
+{
+    for (int tilePixelSize : options.simplifiedTilePixelSizes) {
+        if (tilePixelSize <= 0)
+            continue;
+        const double tolerance = options.simplifyTolerancePixels * extent / tilePixelSize;
+        geometry.addSimplifiedPaths({
+            tilePixelSize,
+            buildSimplifiedPaths(geometry, tolerance) });
+    }
+}
+
+/*!
+ * \internal
+ * \brief decodeDeferredGeometry
+ * Decodes the geometry of a layer that was put off when the tile was decoded.
+ * The layer was already walked once, so a feature can only fail here if its
+ * geometry commands are malformed. Such features end up without geometry.
+ */
+static void decodeDeferredGeometry(TileLayerGeometry &out, const DeferredLayerGeometry &deferred)
+{
+    using WireType = ProtobufWireReader::WireType;
+
+    const char *layerBegin = deferred.layerBytes.constData();
+    std::vector<quint32> commands;
+    for (const DeferredLayerGeometry::Feature &feature : deferred.features) {
+        ProtobufWireReader reader { layerBegin + feature.offset, layerBegin + feature.offset + feature.size };
+        commands.clear();
+        while (!reader.atEnd()) {
+            quint32 fieldNumber = 0;
+            WireType wireType = {};
+            bool success = reader.readKey(fieldNumber, wireType);
+            if (success && fieldNumber == MvtFields::featureGeometry)
+                success = reader.readRepeatedUInt32(wireType, commands);
+            else if (success)
+                success = reader.skipField(wireType);
+            if (!success) {
+                qWarning() << "Dropping the malformed geometry of a feature.";
+                commands.clear();
+                break;
+            }
+        }
+        storeFeatureGeometry(out, feature.type, commands, deferred.extent, deferred.options);
+    }
+    storeSimplifiedPaths(out, deferred.extent, deferred.options);
+}
+
+/*!
+ * \internal
+ * \brief decodeFeature
+ * Decodes a single feature of a layer and appends it to the layer.
+ * Features of unknown type are skipped.
+ * \return true if successful.
+ */
+static bool decodeFeature(
+    ProtobufWireReader reader,
+    TileLayer &layer,
+    const Bach::TileParseOptions &options,
+    TileDecodeScratch &scratch)
+{
+    using WireType = ProtobufWireReader::WireType;
+
+    const ProtobufWireReader featureStart = reader;
+    scratch.tags.clear();
+    scratch.geometry.clear();
+    scratch.geometryFields.clear();
+    quint64 geomType = 0;
+
+    while (!reader.atEnd()) {
+        quint32 fieldNumber = 0;
+        WireType wireType = {};
+        if (!reader.readKey(fieldNumber, wireType))
+            return false;
+
+        bool success = true;
+        if (fieldNumber == MvtFields::featureTags) {
+            success = reader.readRepeatedUInt32(wireType, scratch.tags);
+        } else if (fieldNumber == MvtFields::featureGeometry) {
+            // Deferred geometry is read from the feature again when it's first used.
+            if (options.deferGeometry && wireType == WireType::LengthDelimited) {
+                scratch.geometryFields.push_back(reader);
+                success = reader.skipField(wireType);
+            } else {
+                success = reader.readRepeatedUInt32(wireType, scratch.geometry);
+            }
+        } else if (fieldNumber == MvtFields::featureType && wireType == WireType::Varint) {
+            success = reader.readVarint(geomType);
+        } else {
+            success = reader.skipField(wireType);
+        }
+        if (!success)
+            return false;
+    }
+
+    // Points and text lines are only used for labels, and are turned into
+    // features of their own right away. Their geometry is never deferred.
+    auto readSkippedGeometry = [&]() {
+        for (ProtobufWireReader geometryField : scratch.geometryFields) {
+            if (!geometryField.readRepeatedUInt32(WireType::LengthDelimited, scratch.geometry))
+                return false;
+        }
+        return true;
+    };
+    // Stores the geometry of a polygon or line feature in the layer,
+    // or remembers where to find it if it's deferred.
+    auto storeGeometry = [&](AbstractLayerFeature::featureType type) {
+        if (!options.deferGeometry)
+            return storeFeatureGeometry(layer.geometry(), type, scratch.geometry, layer.extent(), options);
+        scratch.deferredFeatures.push_back({ featureStart, type });
+        return (int)scratch.deferredFeatures.size() - 1;
+    };
+
+    std::unique_ptr<AbstractLayerFeature> newFeaturePtr;
+    switch (geomType) {
+    case MvtFields::geomTypePolygon:
+        newFeaturePtr = std::make_unique<PolygonFeature>(
+            &layer.geometry(),
+            storeGeometry(AbstractLayerFeature::featureType::polygon));
+        break;
+    case MvtFields::geomTypeLineString:
+        if (layer.name() == "transportation_name") {
+            if (!readSkippedGeometry())
+                return false;
+            newFeaturePtr = textLineFeatureFromGeometry(scratch.geometry);
+        } else {
+            newFeaturePtr = std::make_unique<LineFeature>(
+                &layer.geometry(),
+                storeGeometry(AbstractLayerFeature::featureType::line));
+        }
+        break;
+    case MvtFields::geomTypePoint:
+        if (!readSkippedGeometry())
+            return false;
+        newFeaturePtr = pointFeatureFromGeometry(scratch.geometry);
+        break;
+    default:
+        return true;
+    }
+
+    // Tags come in pairs of indices into the layer's keys and values lists.
+    const TileLayerProperties &properties = layer.properties();
+    for (size_t i = 0; i + 1 < scratch.tags.size(); i += 2) {
+        quint32 keyIndex = scratch.tags[i];
+        quint32 valueIndex = scratch.tags[i + 1];
+        if (keyIndex >= (quint32)properties.keys.size() || valueIndex >= (quint32)properties.values.size())
+            return false;
+    }
+
+    AbstractLayerFeature *newFeature = newFeaturePtr.get();
+    newFeature->tags = QVector<unsigned int>(scratch.tags.begin(), scratch.tags.end());
+    newFeature->setLayerProperties(&properties);
+
+    layer.m_features.push_back(std::move(newFeaturePtr));
+    return true;
+}
+
+/*!
+ * \internal
+ * \brief readLayerName
+ * Finds the name of a layer without decoding the rest of it.
+ * The name is usually the first field, so this rarely looks further.
+ * \return true if successful.
+ */
+static bool readLayerName(ProtobufWireReader reader, QString &out)
+{
+    using WireType = ProtobufWireReader::WireType;
+
+    out.clear();
+    while (!reader.atEnd()) {
+        quint32 fieldNumber = 0;
+        WireType wireType = {};
+        if (!reader.readKey(fieldNumber, wireType))
+            return false;
+        if (wireType == WireType::LengthDelimited && fieldNumber == MvtFields::layerName)
+            return reader.readString(out);
+        if (!reader.skipField(wireType))
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \internal
+ * \brief decodeLayer
+ * Decodes a single layer and inserts it into the output tile.
+ *
+ * The keys and values of a layer may come after its features, so we first
+ * walk the layer to decode the key and value tables and remember where each
+ * feature is, then decode the features against the finished tables.
+ * \return true if successful.
+ */
+static bool decodeLayer(
+    ProtobufWireReader reader,
+    VectorTile &output,
+    const Bach::TileParseOptions &options,
+    TileDecodeScratch &scratch)
+{
+    using WireType = ProtobufWireReader::WireType;
+
+    const ProtobufWireReader layerStart = reader;
+    // Defaults as defined by vector_tile.proto
+    quint64 version = 1;
+    quint64 extent = 4096;
+    QString name;
+    QList<QString> keys;
+    QList<QVariant> values;
+    scratch.featureReaders.clear();
+
+    while (!reader.atEnd()) {
+        quint32 fieldNumber = 0;
+        WireType wireType = {};
+        if (!reader.readKey(fieldNumber, wireType))
+            return false;
+
+        bool success = true;
+        if (wireType == WireType::LengthDelimited && fieldNumber == MvtFields::layerName) {
+            success = reader.readString(name);
+        } else if (wireType == WireType::LengthDelimited && fieldNumber == MvtFields::layerFeatures) {
+            ProtobufWireReader featureReader;
+            success = reader.readLengthDelimited(featureReader);
+            scratch.featureReaders.push_back(featureReader);
+        } else if (wireType == WireType::LengthDelimited && fieldNumber == MvtFields::layerKeys) {
+            QString key;
+            success = reader.readString(key);
+            keys.push_back(key);
+        } else if (wireType == WireType::LengthDelimited && fieldNumber == MvtFields::layerValues) {
+            ProtobufWireReader valueReader;
+            QVariant value;
+            success = reader.readLengthDelimited(valueReader) && decodeValue(valueReader, value);
+            values.push_back(value);
+        } else if (wireType == WireType::Varint && fieldNumber == MvtFields::layerVersion) {
+            success = reader.readVarint(version);
+        } else if (wireType == WireType::Varint && fieldNumber == MvtFields::layerExtent) {
+            success = reader.readVarint(extent);
+        } else {
+            success = reader.skipField(wireType);
+        }
+        if (!success)
+            return false;
+    }
+
+    auto newLayerPtr = std::make_unique<TileLayer>((int)version, name, (int)extent);
+    TileLayerProperties &properties = newLayerPtr->properties();
+    properties.keys = std::move(keys);
+    properties.values = std::move(values);
+    properties.rebuildKeyIds();
+
+    newLayerPtr->m_features.reserve(scratch.featureReaders.size());
+    scratch.deferredFeatures.clear();
+    for (const ProtobufWireReader &featureReader : scratch.featureReaders) {
+        if (!decodeFeature(featureReader, *newLayerPtr, options, scratch))
+            return false;
+    }
+
+    if (!options.deferGeometry) {
+        storeSimplifiedPaths(newLayerPtr->geometry(), newLayerPtr->extent(), options);
+    } else {
+        DeferredLayerGeometry deferred;
+        deferred.layerBytes = QByteArray { layerStart.data(), layerStart.size() };
+        deferred.features.reserve(scratch.deferredFeatures.size());
+        for (const auto &[featureReader, type] : scratch.deferredFeatures) {
+            deferred.features.push_back({
+                featureReader.data() - layerStart.data(),
+                featureReader.size(),
+                type });
+        }
+        deferred.extent = newLayerPtr->extent();
+        deferred.options = options;
+        // The layer selection isn't needed anymore, and can be large.
+        deferred.options.layerNames.reset();
+
+        auto deferredDecode = std::make_unique<TileLayerGeometry::DeferredDecode>();
+        deferredDecode->decode = [deferred = std::move(deferred)](TileLayerGeometry &out) {
+            decodeDeferredGeometry(out, deferred);
+        };
+        newLayerPtr->geometry().deferredDecode = std::move(deferredDecode);
+    }
+
+    output.m_layers.insert({ name, std::move(newLayerPtr) });
+    return true;
+}
+
+/*!
+ * \brief Bach::tileFromByteArray
+ * Decodes a Mapbox vector tile directly from the protobuf wire format.
+ *
+ * Layers, features, tags and geometry are read straight out of the input bytes,
+ * without first materializing the whole tile as a protobuf message.
+ * Each layer's key and value tables are decoded once and shared by all its features.
+ *
+ * \param bytes the raw protocol buffer. It is only read during the call,
+ * so it can point into a memory-mapped file.
+ * \return The decoded tile if successful, or nullopt if the data was malformed.
+ */
+std::optional<VectorTile> Bach::tileFromByteArray(QByteArrayView bytes)
+{
+    return tileFromByteArray(bytes, TileParseOptions{});
+}
+
+/*!
+ * \brief Bach::tileFromByteArray
+ * Decodes a Mapbox vector tile like the overload above, and lets the caller
+ * trade geometry detail for smaller tiles that are faster to draw.
+ *
+ * \param bytes the raw protocol buffer.
+ * \param options controls the clipping and simplification of the geometry.
+ * \return The decoded tile if successful, or nullopt if the data was malformed.
+ */
+std::optional<VectorTile> Bach::tileFromByteArray(QByteArrayView bytes, const TileParseOptions &options)
+{
+    BACH_TRACE_SCOPE("tileFromByteArray");
+    using WireType = ProtobufWireReader::WireType;
+
+    ProtobufWireReader reader { bytes.constData(), bytes.constData() + bytes.size() };
+    TileDecodeScratch scratch;
+    VectorTile output;
+
+    while (!reader.atEnd()) {
+        quint32 fieldNumber = 0;
+        WireType wireType = {};
+        if (!reader.readKey(fieldNumber, wireType))
+            return std::nullopt;
+
+        if (fieldNumber == MvtFields::tileLayers && wireType == WireType::LengthDelimited) {
+            ProtobufWireReader layerReader;
+            if (!reader.readLengthDelimited(layerReader))
+                return std::nullopt;
+            if (options.layerNames.has_value() || !options.skippedLayerNames.empty()) {
+                QString name;
+                if (!readLayerName(layerReader, name))
+                    return std::nullopt;
+                if (options.layerNames.has_value() && options.layerNames->find(name) == options.layerNames->end())
+                    continue;
+                if (options.skippedLayerNames.find(name) != options.skippedLayerNames.end())
+                    continue;
+            }
+            if (!decodeLayer(layerReader, output, options, scratch))
+                return std::nullopt;
+        } else if (!reader.skipField(wireType)) {
+            return std::nullopt;
+        }
+    }
+    return output;
+}
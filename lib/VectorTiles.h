@@ -6,17 +6,42 @@
 
 //Qt header files
 #include <QByteArray>
+#include <QByteArrayView>
 #include <QFile>
+#include <QHash>
 #include <QList>
 #include <QMap>
+#include <QMutex>
 #include <QPainterPath>
+#include <QPointF>
 #include <QRect>
 #include <QVariant>
 
 // STL header files
+#include <functional> // For std::function
 #include <map>      // For std::map
+#include <mutex>    // For std::once_flag
 #include <optional> // For std::optional
 #include <memory>   // For std::unique_ptr
+#include <set>      // For std::set
+#include <utility>  // For std::move
+#include <vector>   // For std::vector
+
+/*
+ * This struct stores the property tables of a single layer, in the same form as they are
+ * encoded in the tile. Every key and value is stored only once per layer, and features
+ * refer to them through the indices in their tags.
+ */
+struct TileLayerProperties {
+    QList<QString> keys;
+    QList<QVariant> values;
+
+    // Maps each key to its index in the keys list.
+    QHash<QString, int> keyIds;
+
+    void rebuildKeyIds();
+    int keyId(const QString &key) const;
+};
 
 /*
  * This abstract class is the base for all the classes representing different layer features.
@@ -35,40 +60,177 @@ public:
     };
 
     virtual featureType type() const = 0;
+
+    void setLayerProperties(const TileLayerProperties *properties) { m_layerProperties = properties; }
+    const TileLayerProperties* layerProperties() const { return m_layerProperties; }
+
+    const QVariant* findProperty(const QString &key) const;
+    const QVariant* findPropertyByKeyId(int keyId) const;
+    bool hasProperty(const QString &key) const { return findProperty(key) != nullptr; }
+    QVariant property(const QString &key) const;
+    QMap<QString, QVariant> properties() const;
+
+    // Pairs of indices into the layer's keys and values tables.
     QVector<unsigned int> tags;
+
+    // Properties of features that are not part of a layer, such as features built by hand.
+    // Features that have layer properties look up their properties through their tags instead.
     QMap<QString, QVariant> featureMetaData;
 private:
     int m_id;
+    const TileLayerProperties *m_layerProperties = nullptr;
+};
+
+/*
+ * This struct stores the geometry of the polygon and line features of a single layer
+ * in a flat structure-of-arrays layout.
+ *
+ * The vertices of every feature are stored back to back in one buffer. Each feature
+ * consists of one or more parts (polygon rings or line strings), where a part is a run
+ * of vertices that starts with a MoveTo and continues with LineTo's.
+ */
+struct TileLayerGeometry {
+    // Every vertex in the layer, in tile coordinates.
+    std::vector<QPoint> vertices;
+
+    // Index of the first vertex of each part.
+    // Always has one more element than there are parts.
+    std::vector<quint32> partVertexOffsets = { 0 };
+
+    // Whether each part ends with a ClosePath command.
+    std::vector<bool> partClosed;
+
+    // Index of the first part of each feature.
+    // Always has one more element than there are features.
+    std::vector<quint32> featurePartOffsets = { 0 };
+
+    // The type of each feature.
+    std::vector<AbstractLayerFeature::featureType> featureTypes;
+
+    int featureCount() const { return (int)featureTypes.size(); }
+    QPainterPath buildPath(int featureIndex) const;
+
+    // Bounding box of every vertex of a feature, in tile coordinates.
+    // Coordinates beyond the range of qint16 are clamped, they are far outside the tile either way.
+    // A feature without vertices has minimums larger than its maximums.
+    struct FeatureBounds {
+        qint16 minX = 1;
+        qint16 minY = 1;
+        qint16 maxX = 0;
+        qint16 maxY = 0;
+    };
+    // One for every feature, filled in by the tile decoder.
+    std::vector<FeatureBounds> featureBounds;
+    std::optional<QRect> featureBoundingRect(int featureIndex) const;
+
+    // Paths of the features, simplified for drawing the tile at a small size.
+    struct SimplifiedPaths {
+        // The largest on-screen size of the tile, in device pixels, these paths are meant for.
+        int tilePixelSize = 0;
+        // One path for every feature.
+        std::vector<QPainterPath> featurePaths;
+    };
+    // Sorted by the tile size they are meant for.
+    std::vector<SimplifiedPaths> simplifiedPaths;
+    void addSimplifiedPaths(SimplifiedPaths paths);
+    const QPainterPath* simplifiedPath(int featureIndex, double tilePixelSize) const;
+
+    // Set by the tile decoder when the geometry is decoded the first time it's used,
+    // see Bach::TileParseOptions::deferGeometry. Until then the storage is empty.
+    struct DeferredDecode {
+        std::once_flag decoded;
+        std::function<void(TileLayerGeometry&)> decode;
+    };
+    std::unique_ptr<DeferredDecode> deferredDecode;
+    void ensureDecoded() const;
+};
+
+/*
+ * This struct stores triangles in a form that can be copied straight into vertex buffers.
+ * Every three indices make up one triangle.
+ */
+struct TileMesh {
+    // Position of every vertex, in tile coordinates.
+    std::vector<QPointF> positions;
+
+    // Only used by line meshes. The unit direction each vertex is pushed in to give the line
+    // its width, so the position drawn is 'position + extrusion * halfLineWidth'.
+    // Vertices on the center of the line have a zero extrusion.
+    std::vector<QPointF> extrusions;
+
+    std::vector<quint32> indices;
+
+    qint64 byteSize() const;
+};
+
+/*
+ * This struct stores the tessellated geometry of the polygon and line features of a single layer.
+ *
+ * The meshes don't depend on any style, line widths are applied when drawing
+ * through the extrusions of the line mesh.
+ */
+struct TileLayerMeshes {
+    // Triangles of every polygon feature in the layer.
+    TileMesh fills;
+    // Triangles of every line feature in the layer.
+    TileMesh lines;
+
+    // Index of the first index in 'fills' of each feature of the TileLayerGeometry.
+    // Always has one more element than there are features. Line features have an empty range.
+    std::vector<quint32> fillIndexOffsets = { 0 };
+    // Index of the first index in 'lines' of each feature of the TileLayerGeometry.
+    // Always has one more element than there are features. Polygon features have an empty range.
+    std::vector<quint32> lineIndexOffsets = { 0 };
+
+    qint64 byteSize() const { return fills.byteSize() + lines.byteSize(); }
 };
 
 /*
  * This class represents a plygon feature. the class contains the id and geometry of the feature.
+ *
+ * When created by the tile decoder, the geometry is stored in the layer's TileLayerGeometry
+ * and the QPainterPath is only built the first time it's requested.
  */
 class PolygonFeature : public AbstractLayerFeature
 {
 public:
     PolygonFeature() {}
+    PolygonFeature(const TileLayerGeometry *geometry, int geometryIndex);
     AbstractLayerFeature::featureType type() const override;
     QPainterPath const& polygon() const;
     QPainterPath& polygon();
 
+    int geometryIndex() const { return m_geometryIndex; }
+
 private:
-    QPainterPath m_polygon;
+    const TileLayerGeometry *m_geometry = nullptr;
+    int m_geometryIndex = -1;
+    mutable std::once_flag m_polygonBuilt;
+    mutable QPainterPath m_polygon;
 };
 
 /*
  * This class represents a linsestring feature. the class contains the id and geometry of the feature.
+ *
+ * When created by the tile decoder, the geometry is stored in the layer's TileLayerGeometry
+ * and the QPainterPath is only built the first time it's requested.
  */
 class LineFeature : public AbstractLayerFeature
 {
 public:
     LineFeature(){}
+    LineFeature(const TileLayerGeometry *geometry, int geometryIndex);
     AbstractLayerFeature::featureType type() const override;
     QPainterPath const& line() const;
     QPainterPath& line();
 
+    int geometryIndex() const { return m_geometryIndex; }
+
 private:
-    QPainterPath m_line;
+    const TileLayerGeometry *m_geometry = nullptr;
+    int m_geometryIndex = -1;
+    mutable std::once_flag m_lineBuilt;
+    mutable QPainterPath m_line;
 };
 
 /*
@@ -97,6 +259,51 @@ public:
     AbstractLayerFeature::featureType type() const override;
 };
 
+/*
+ * This class caches which features of a layer pass the filter of each layer style,
+ * for a single map zoom level at a time. Storing a result for another map zoom level
+ * discards everything stored for the previous one.
+ *
+ * The results are stored as sorted lists of indices into the layer's features.
+ * This class is thread-safe.
+ */
+class TileLayerFilterCache {
+public:
+    using FeatureIndices = std::vector<int>;
+
+    std::shared_ptr<const FeatureIndices> find(quint64 styleId, int mapZoom) const;
+    void insert(quint64 styleId, int mapZoom, std::shared_ptr<const FeatureIndices> indices);
+    void clear();
+
+private:
+    mutable QMutex m_lock;
+    int m_mapZoom = -1;
+    QHash<quint64, std::shared_ptr<const FeatureIndices>> m_entries;
+};
+
+namespace Bach {
+    struct TileLabelCandidates;
+}
+
+/*
+ * This class caches the label candidates of a layer for each layer style,
+ * see Bach::TileLabelCandidates. Like TileLayerFilterCache, it only holds
+ * a single map zoom level at a time.
+ *
+ * This class is thread-safe.
+ */
+class TileLayerLabelCache {
+public:
+    std::shared_ptr<const Bach::TileLabelCandidates> find(quint64 styleId, int mapZoom) const;
+    void insert(quint64 styleId, int mapZoom, std::shared_ptr<const Bach::TileLabelCandidates> labels);
+    void clear();
+
+private:
+    mutable QMutex m_lock;
+    int m_mapZoom = -1;
+    QHash<quint64, std::shared_ptr<const Bach::TileLabelCandidates>> m_entries;
+};
+
 /*
  *This class represents a single layer in a vector tile.
  *the class contains a list with all the features in the layer as well as other layer details.
@@ -115,14 +322,53 @@ public:
 
     int extent() const;
 
+    // Flat storage for the geometry of this layer's polygon and line features.
+    // Deferred geometry is decoded on the first call.
+    const TileLayerGeometry& geometry() const { m_geometry->ensureDecoded(); return *m_geometry; }
+    TileLayerGeometry& geometry() { m_geometry->ensureDecoded(); return *m_geometry; }
+
+    // Key and value tables shared by all the features of this layer.
+    const TileLayerProperties& properties() const { return *m_properties; }
+    TileLayerProperties& properties() { return *m_properties; }
+
+    // Cache of the features that pass the filter of each layer style. Filled in by the renderer.
+    TileLayerFilterCache& filterCache() const { return *m_filterCache; }
+
+    // Cache of the label candidates of each symbol layer style.
+    // Filled in by Bach::prepareTileLabels, or by the renderer.
+    TileLayerLabelCache& labelCache() const { return *m_labelCache; }
+
+    // Triangulated geometry of this layer, if the tile has been through Bach::tessellateVectorTile.
+    // Null otherwise. Not drawn by the renderers of this library, see TileLoader::setTessellateVectorTiles.
+    const TileLayerMeshes* meshes() const { return m_meshes.get(); }
+    void setMeshes(std::unique_ptr<TileLayerMeshes> meshes) { m_meshes = std::move(meshes); }
+
+    // Paths of the polygon and line features, simplified for drawing the tile at a small size.
+    using SimplifiedPaths = TileLayerGeometry::SimplifiedPaths;
+    void addSimplifiedPaths(SimplifiedPaths paths);
+    const QPainterPath* simplifiedPath(int geometryIndex, double tilePixelSize) const;
+
+    std::optional<QRect> featureBoundingRect(int geometryIndex) const;
+
     std::vector<std::unique_ptr<AbstractLayerFeature>> m_features;
 
 private:
     const int m_version;
     const QString m_name;
     const int m_extent;
+    // Stored behind pointers so that features can keep referring
+    // to them when the layer is moved.
+    std::unique_ptr<TileLayerGeometry> m_geometry = std::make_unique<TileLayerGeometry>();
+    std::unique_ptr<TileLayerProperties> m_properties = std::make_unique<TileLayerProperties>();
+    std::unique_ptr<TileLayerFilterCache> m_filterCache = std::make_unique<TileLayerFilterCache>();
+    std::unique_ptr<TileLayerLabelCache> m_labelCache = std::make_unique<TileLayerLabelCache>();
+    std::unique_ptr<TileLayerMeshes> m_meshes;
 };
 
+namespace Bach {
+    struct TileParseOptions;
+}
+
 /*
  * This class represents a vector tile deserialized form a protobuf file.
  * the class contains all map with all the layers within the tile.
@@ -143,13 +389,61 @@ public:
     bool DeserializeMessage(QByteArray data);
     static std::optional<VectorTile> fromByteArray(const QByteArray &bytes);
     static std::optional<VectorTile> fromFile(const QString &path);
-    std::map<QString, std::unique_ptr<TileLayer>> m_layers;
+    static std::vector<std::optional<VectorTile>> fromByteArrays(const std::vector<QByteArray> &tiles);
+    static std::vector<std::optional<VectorTile>> fromByteArrays(
+        const std::vector<QByteArray> &tiles,
+        const Bach::TileParseOptions &options);
+    // The layers are shared so that a tile that is still being parsed can hand out
+    // the layers decoded so far, while the complete tile is built from the same layers.
+    std::map<QString, std::shared_ptr<TileLayer>> m_layers;
+    // Set on a tile that only holds the layers decoded so far,
+    // see Bach::TileLoader::setStreamVectorTileLayers. Its other layers are on their way.
+    bool m_partial = false;
+
+    // Unique for every tile that is created, so a tile that was loaded again
+    // never shares an id with the tile it replaces. Used as a cache key when rendering.
+    quint64 uniqueId() const { return m_uniqueId; }
+
+private:
+    static quint64 newUniqueId();
+    quint64 m_uniqueId = newUniqueId();
 };
 
 namespace Bach {
     inline QString testDataDir = "testdata/";
 
-    std::optional<VectorTile> tileFromByteArray(const QByteArray &bytes);
+    /*!
+     * \brief The TileParseOptions struct controls how much of a tile
+     * is decoded, and when. The defaults decode every layer and keep every vertex.
+     */
+    struct TileParseOptions {
+        // Only the layers with these names are decoded, the rest are skipped unread.
+        // Set to nullopt to decode every layer. See StyleSheet::sourceLayersShownFrom.
+        std::optional<std::set<QString>> layerNames;
+        // These layers are skipped unread, even if they are in 'layerNames'.
+        // Lets a tile be decoded in several passes, each picking up where the last one stopped.
+        std::set<QString> skippedLayerNames;
+        // Puts off decoding the geometry of each layer until it's first used.
+        // The encoded layer is kept in memory until then.
+        bool deferGeometry = false;
+
+        // Clips polygon and line geometry to the layer's extent, grown by 'clipBuffer' on every side.
+        bool clipToExtent = false;
+        // How far geometry is kept outside the extent, as a fraction of the extent.
+        // Line widths and antialiasing along the tile edges need a little room.
+        double clipBuffer = 1.0 / 32;
+        // On-screen tile sizes, in device pixels, to keep simplified paths of every layer for.
+        std::vector<int> simplifiedTilePixelSizes;
+        // How far a vertex may be moved by the simplification,
+        // in pixels of the tile size it is simplified for.
+        double simplifyTolerancePixels = 0.5;
+
+        static TileParseOptions forTilePixelSize(int tilePixelSize);
+    };
+
+    std::optional<VectorTile> tileFromByteArray(QByteArrayView bytes);
+    std::optional<VectorTile> tileFromByteArray(QByteArrayView bytes, const TileParseOptions &options);
+    std::optional<VectorTile> tileFromByteArray_QtProtobuf(const QByteArray &bytes);
 }
 
 #endif // VECTORTILES_H
@@ -0,0 +1,152 @@
+#include <QtLogging>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include <LabelCollisionIndex.h>
+#include <VectorTiles.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// Helper function to let us do early shutdown.
+[[noreturn]] void shutdown(const QString &msg = "")
+{
+    if (msg != "") {
+        qCritical() << msg;
+    }
+    std::exit(EXIT_FAILURE);
+}
+
+/*!
+ * \brief
+ * Number of iterations per test.
+ */
+static constexpr int iterations = 5;
+
+/*!
+ * \brief
+ * Width and height of every tile on the virtual canvas, in pixels.
+ * With 8 tiles per row at zoom level 3 this gives a 4096x4096 pixel canvas.
+ */
+static constexpr int tileSizePixels = 512;
+
+/*!
+ * \brief loadLabelCandidates
+ * Decodes every bundled zoom level 3 tile and builds a label box for every point feature.
+ * The boxes are placed on a virtual canvas where all the tiles are laid out side by side.
+ * \return The label boxes, in the order the renderer would visit them.
+ */
+static QVector<QRect> loadLabelCandidates()
+{
+    QVector<QRect> out;
+    const QStringList fileNames = QDir(":/").entryList({ "*.mvt" }, QDir::Files, QDir::Name);
+    if (fileNames.isEmpty())
+        shutdown("Unable to find any test tiles.");
+
+    for (const QString &fileName : fileNames) {
+        int zoom = 0;
+        int tileX = 0;
+        int tileY = 0;
+        if (std::sscanf(fileName.toUtf8().constData(), "z%dx%dy%d.mvt", &zoom, &tileX, &tileY) != 3)
+            shutdown("Unexpected tile file name " + fileName);
+
+        QFile file{ ":/" + fileName };
+        if (!file.open(QFile::ReadOnly))
+            shutdown("Unable to open file " + fileName);
+        std::optional<VectorTile> tileOpt = Bach::tileFromByteArray(file.readAll());
+        if (!tileOpt.has_value())
+            shutdown("Benchmark expects all files to be parsed successfully.");
+
+        const QPoint tileOrigin{ tileX * tileSizePixels, tileY * tileSizePixels };
+        for (const auto &[layerName, layer] : tileOpt->m_layers) {
+            const double scale = (double)tileSizePixels / layer->extent();
+            for (const auto &abstractFeature : layer->m_features) {
+                if (abstractFeature->type() != AbstractLayerFeature::featureType::point)
+                    continue;
+                const auto &feature = *static_cast<const PointFeature*>(abstractFeature.get());
+                if (feature.points().isEmpty())
+                    continue;
+
+                // Approximate the size of the rendered label from the length of its name.
+                const QVariant *name = feature.findProperty("name");
+                const int width = name != nullptr ? 7 * name->toString().size() : 40;
+                const int height = 14;
+                const QPoint center = tileOrigin + feature.points().first() * scale;
+                out.append({ center.x() - width / 2, center.y() - height / 2, width, height });
+            }
+        }
+    }
+    return out;
+}
+
+/*!
+ * \brief runPlacement
+ * Places the candidates N times with the given placement function.
+ * \return The total time spent, in milliseconds, and the number of labels placed in the last iteration.
+ */
+static std::pair<double, int> runPlacement(
+    const QVector<QRect> &candidates,
+    const std::function<int(const QVector<QRect>&)> &placeFn)
+{
+    int placed = 0;
+    auto timeStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++)
+        placed = placeFn(candidates);
+    auto timeEnd = std::chrono::high_resolution_clock::now();
+    return { std::chrono::duration<double, std::milli>(timeEnd - timeStart).count(), placed };
+}
+
+int main() {
+    const QVector<QRect> candidates = loadLabelCandidates();
+
+    // Basic info about the test.
+    qDebug() << "Number of label candidates: " << candidates.size();
+    qDebug() << "Number of test iterations: " << iterations;
+
+    struct Placement {
+        QString name;
+        std::function<int(const QVector<QRect>&)> placeFn;
+    };
+    const std::vector<Placement> placements = {
+        { "Linear scan", [](const QVector<QRect> &candidates) {
+            QVector<QRect> placed;
+            for (const QRect &candidate : candidates) {
+                bool overlapping = false;
+                for (const QRect &rect : placed) {
+                    if (rect.intersects(candidate)) {
+                        overlapping = true;
+                        break;
+                    }
+                }
+                if (!overlapping)
+                    placed.append(candidate);
+            }
+            return (int)placed.size();
+        } },
+        { "Collision grid", [](const QVector<QRect> &candidates) {
+            Bach::LabelCollisionIndex index;
+            for (const QRect &candidate : candidates) {
+                if (!index.overlaps(candidate))
+                    index.insert(candidate);
+            }
+            return (int)index.boxes().size();
+        } },
+    };
+
+    int expectedPlaced = -1;
+    for (const Placement &placement : placements) {
+        auto [totalTimeMilli, placed] = runPlacement(candidates, placement.placeFn);
+        if (expectedPlaced != -1 && placed != expectedPlaced)
+            shutdown("All placement methods are expected to place the same labels.");
+        expectedPlaced = placed;
+
+        qDebug() << "";
+        qDebug() << placement.name;
+        qDebug() << "Labels placed: " << placed;
+        qDebug() << "Total time: " << totalTimeMilli << " millisec";
+        qDebug() << "Average time per placement pass: " << (totalTimeMilli / iterations) << " millisec";
+    }
+}
@@ -0,0 +1,343 @@
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFontDatabase>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+
+#include <Rendering.h>
+#include <VectorTiles.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <vector>
+
+// Every heap allocation in the process is counted, so that the allocations of a frame can be reported.
+static std::atomic<qint64> heapAllocationCount = 0;
+
+void* operator new(std::size_t size)
+{
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// Helper function to let us do early shutdown.
+[[noreturn]] void shutdown(const QString &msg = "")
+{
+    if (msg != "") {
+        qCritical() << msg;
+    }
+    std::exit(EXIT_FAILURE);
+}
+
+/*!
+ * \brief
+ * Size of the offscreen viewport every frame is rendered into.
+ * With this size, the viewport zoom levels used below all render map zoom level 3,
+ * which is the zoom level of the bundled tiles.
+ */
+static constexpr int viewportWidth = 1024;
+static constexpr int viewportHeight = 768;
+
+/*!
+ * \brief
+ * Amount of frames in each camera path.
+ */
+static constexpr int framesPerPath = 120;
+
+/*!
+ * \brief The Camera struct is the viewport of a single frame.
+ */
+struct Camera {
+    double x = 0.5;
+    double y = 0.5;
+    double zoom = 2;
+};
+
+/*!
+ * \brief The CameraPath struct is a scripted list of frames to replay.
+ */
+struct CameraPath {
+    QString name;
+    std::vector<Camera> frames;
+};
+
+/*!
+ * \brief The Phase struct is one part of the frame to time on its own.
+ */
+struct Phase {
+    QString name;
+    Bach::PaintVectorTileSettings settings;
+};
+
+/*!
+ * \brief The FrameStats struct holds the percentiles of a list of frame times.
+ */
+struct FrameStats {
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+/*!
+ * \brief The PathResult struct holds the measurements of every frame of a camera path.
+ */
+struct PathResult {
+    // In milliseconds.
+    std::vector<double> frameTimes;
+    // Amount of heap allocations made by each frame.
+    std::vector<double> allocations;
+};
+
+/*!
+ * \brief loadTiles
+ * Decodes every bundled zoom level 3 tile.
+ */
+static std::map<TileCoord, std::unique_ptr<VectorTile>> loadTiles()
+{
+    std::map<TileCoord, std::unique_ptr<VectorTile>> out;
+    const QStringList fileNames = QDir(":/tiles").entryList({ "*.mvt" }, QDir::Files, QDir::Name);
+    if (fileNames.isEmpty())
+        shutdown("Unable to find any test tiles.");
+
+    for (const QString &fileName : fileNames) {
+        TileCoord coord;
+        if (std::sscanf(fileName.toUtf8().constData(), "z%dx%dy%d.mvt", &coord.zoom, &coord.x, &coord.y) != 3)
+            shutdown("Unexpected tile file name " + fileName);
+
+        QFile file{ ":/tiles/" + fileName };
+        if (!file.open(QFile::ReadOnly))
+            shutdown("Unable to open file " + fileName);
+        std::optional<VectorTile> tileOpt = Bach::tileFromByteArray(file.readAll());
+        if (!tileOpt.has_value())
+            shutdown("Benchmark expects all files to be parsed successfully.");
+        out.insert({ coord, std::make_unique<VectorTile>(std::move(tileOpt.value())) });
+    }
+    return out;
+}
+
+/*!
+ * \brief buildCameraPaths
+ * \return The camera paths to replay. They stay within the area covered by the bundled tiles.
+ */
+static std::vector<CameraPath> buildCameraPaths()
+{
+    auto lerp = [](double a, double b, double t) { return a + (b - a) * t; };
+
+    CameraPath pan { "Pan" };
+    CameraPath zoom { "Zoom" };
+    CameraPath panAndZoom { "Pan and zoom" };
+    for (int i = 0; i < framesPerPath; i++) {
+        const double t = (double)i / (framesPerPath - 1);
+        pan.frames.push_back({ lerp(0.3, 0.7, t), lerp(0.35, 0.45, t), 2.0 });
+
+        // Zoom in and back out again, like a wheel gesture.
+        const double zoomT = 1 - std::abs(2 * t - 1);
+        zoom.frames.push_back({ 0.5, 0.4, lerp(1.6, 2.4, zoomT) });
+
+        panAndZoom.frames.push_back({ lerp(0.6, 0.35, t), lerp(0.3, 0.5, t), lerp(1.6, 2.4, t) });
+    }
+    return { pan, zoom, panAndZoom };
+}
+
+static FrameStats calcFrameStats(std::vector<double> frameTimes)
+{
+    FrameStats out;
+    if (frameTimes.empty())
+        return out;
+    std::sort(frameTimes.begin(), frameTimes.end());
+    auto percentile = [&](double p) {
+        const size_t index = std::min(frameTimes.size() - 1, (size_t)std::ceil(p * frameTimes.size()) - 1);
+        return frameTimes[index];
+    };
+    out.p50 = percentile(0.50);
+    out.p95 = percentile(0.95);
+    out.p99 = percentile(0.99);
+    out.max = frameTimes.back();
+    return out;
+}
+
+/*!
+ * \brief runPath
+ * Replays a camera path, rendering only the parts of the frame enabled by the phase.
+ * \return The time and the amount of heap allocations of every frame.
+ */
+static PathResult runPath(
+    const CameraPath &path,
+    const Phase &phase,
+    const QMap<TileCoord, const VectorTile*> &tiles,
+    const StyleSheet &styleSheet,
+    QImage &image)
+{
+    // Like the application, labels are kept from one frame to the next.
+    Bach::LabelPlacementState labelPlacement;
+    Bach::RenderFrameScratch frameScratch;
+    PathResult out;
+    out.frameTimes.reserve(path.frames.size());
+    out.allocations.reserve(path.frames.size());
+    for (const Camera &camera : path.frames) {
+        const qint64 allocationsStart = heapAllocationCount.load(std::memory_order_relaxed);
+        auto timeStart = std::chrono::high_resolution_clock::now();
+        {
+            QPainter painter(&image);
+            painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+            const int mapZoom = Bach::calcMapZoomLevelForTileSizePixels(
+                viewportWidth,
+                viewportHeight,
+                camera.zoom);
+            Bach::paintVectorTiles(
+                painter,
+                camera.x,
+                camera.y,
+                camera.zoom,
+                mapZoom,
+                tiles,
+                styleSheet,
+                phase.settings,
+                false,
+                nullptr,
+                &labelPlacement,
+                nullptr,
+                nullptr,
+                &frameScratch);
+        }
+        auto timeEnd = std::chrono::high_resolution_clock::now();
+        out.frameTimes.push_back(std::chrono::duration<double, std::milli>(timeEnd - timeStart).count());
+        out.allocations.push_back(heapAllocationCount.load(std::memory_order_relaxed) - allocationsStart);
+    }
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    // Nothing is shown on screen, but text rendering needs a QGuiApplication.
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the frame times of paintVectorTiles along scripted camera paths.");
+    parser.addHelpOption();
+    QCommandLineOption jsonOption("json", "Also write the results as JSON to this file.", "path");
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    // Use the same font and style sheet as the rendering output tests, so that results are comparable.
+    const int fontId = QFontDatabase::addApplicationFont(":/merlin/RobotoMono-Regular.ttf");
+    const QStringList fontFamilies = QFontDatabase::applicationFontFamilies(fontId);
+    if (fontFamilies.isEmpty())
+        shutdown("Unable to load font file.");
+    QGuiApplication::setFont(QFont{ fontFamilies.first() });
+
+    std::optional<StyleSheet> styleSheetOpt = StyleSheet::fromJsonFile(":/merlin/styleSheet.json");
+    if (!styleSheetOpt.has_value())
+        shutdown("Unable to parse the style sheet.");
+    const StyleSheet &styleSheet = styleSheetOpt.value();
+
+    const std::map<TileCoord, std::unique_ptr<VectorTile>> tileStorage = loadTiles();
+    QMap<TileCoord, const VectorTile*> tiles;
+    for (const auto &[coord, tile] : tileStorage)
+        tiles.insert(coord, tile.get());
+
+    // Every phase is timed on its own pass over the path, the full frame is timed as well.
+    auto makePhase = [](const QString &name, bool fill, bool lines, bool text) {
+        Phase phase { name, Bach::PaintVectorTileSettings::getDefault() };
+        phase.settings.drawFill = fill;
+        phase.settings.drawLines = lines;
+        phase.settings.drawText = text;
+        return phase;
+    };
+    const std::vector<Phase> phases = {
+        makePhase("Full frame", true, true, true),
+        makePhase("Fill", true, false, false),
+        makePhase("Line", false, true, false),
+        makePhase("Text", false, false, true),
+    };
+
+    QImage image(viewportWidth, viewportHeight, QImage::Format_ARGB32_Premultiplied);
+
+    // Basic info about the test.
+    qDebug() << "Number of tiles: " << tiles.size();
+    qDebug() << "Viewport size: " << viewportWidth << "x" << viewportHeight;
+    qDebug() << "Frames per camera path: " << framesPerPath;
+
+    QJsonArray jsonPaths;
+    for (const CameraPath &path : buildCameraPaths()) {
+        qDebug() << "";
+        qDebug() << path.name;
+
+        QJsonObject jsonPhases;
+        for (const Phase &phase : phases) {
+            // Warm up the caches of the tiles before timing.
+            runPath(path, phase, tiles, styleSheet, image);
+            const PathResult result = runPath(path, phase, tiles, styleSheet, image);
+            const FrameStats stats = calcFrameStats(result.frameTimes);
+            const FrameStats allocationStats = calcFrameStats(result.allocations);
+
+            qDebug().noquote() << QString("%1: p50 %2 ms, p95 %3 ms, p99 %4 ms, max %5 ms, allocations p50 %6, max %7")
+                .arg(phase.name, -10)
+                .arg(stats.p50, 0, 'f', 2)
+                .arg(stats.p95, 0, 'f', 2)
+                .arg(stats.p99, 0, 'f', 2)
+                .arg(stats.max, 0, 'f', 2)
+                .arg(allocationStats.p50, 0, 'f', 0)
+                .arg(allocationStats.max, 0, 'f', 0);
+
+            QJsonObject jsonStats;
+            jsonStats["p50"] = stats.p50;
+            jsonStats["p95"] = stats.p95;
+            jsonStats["p99"] = stats.p99;
+            jsonStats["max"] = stats.max;
+            QJsonObject jsonAllocations;
+            jsonAllocations["p50"] = allocationStats.p50;
+            jsonAllocations["p95"] = allocationStats.p95;
+            jsonAllocations["max"] = allocationStats.max;
+            jsonStats["allocationsPerFrame"] = jsonAllocations;
+            jsonPhases[phase.name] = jsonStats;
+        }
+
+        QJsonObject jsonPath;
+        jsonPath["name"] = path.name;
+        jsonPath["frames"] = (int)path.frames.size();
+        jsonPath["phases"] = jsonPhases;
+        jsonPaths.append(jsonPath);
+    }
+
+    if (parser.isSet(jsonOption)) {
+        QJsonObject root;
+        root["viewportWidth"] = viewportWidth;
+        root["viewportHeight"] = viewportHeight;
+        root["paths"] = jsonPaths;
+
+        QFile jsonFile{ parser.value(jsonOption) };
+        if (!jsonFile.open(QFile::WriteOnly | QFile::Truncate))
+            shutdown("Unable to open " + parser.value(jsonOption) + " for writing.");
+        jsonFile.write(QJsonDocument{ root }.toJson());
+        qDebug() << "";
+        qDebug() << "Results written to" << parser.value(jsonOption);
+    }
+}
@@ -4,6 +4,7 @@
 #include <VectorTiles.h>
 
 #include <chrono>
+#include <functional>
 #include <vector>
 
 // Helper function to let us do early shutdown.
@@ -42,37 +43,104 @@ static std::vector<QByteArray> loadTestFilesIntoMemory() {
  */
 static constexpr int iterations = 5;
 
-int main() {
-    std::vector<QByteArray> testFiles = loadTestFilesIntoMemory();
+/*!
+ * \brief The DecodeResult struct holds the totals of decoding the test files N times.
+ */
+struct DecodeResult {
+    double totalTimeMilli = 0;
+    qint64 featureCount = 0;
+};
 
-    // Basic info about the test.
-    qDebug() << "Parsing number of files: " << testFiles.size();
-    qDebug() << "Number of test iterations: " << iterations;
+static qint64 countFeatures(const VectorTile &tile)
+{
+    qint64 out = 0;
+    for (const auto &[layerName, layer] : tile.m_layers)
+        out += (qint64)layer->m_features.size();
+    return out;
+}
 
+/*!
+ * \brief runDecoder
+ * Decodes every test file N times with the given decoder.
+ * The decoder gets all the test files at once, and returns the decoded tiles in the same order.
+ */
+static DecodeResult runDecoder(
+    const std::vector<QByteArray> &testFiles,
+    const std::function<std::vector<std::optional<VectorTile>>(const std::vector<QByteArray>&)> &decodeFn)
+{
+    DecodeResult out;
     auto timeStart = std::chrono::high_resolution_clock::now();
 
     // Iterate over the entire N times.
     for (int i = 0; i < iterations; i++) {
-        // Iterate over every file we have preloaded into memory.
-        for (const QByteArray& bytes : testFiles) {
-            std::optional<VectorTile> newTileOpt = VectorTile::fromByteArray(bytes);
-            if (!newTileOpt.has_value()) {
+        std::vector<std::optional<VectorTile>> tiles = decodeFn(testFiles);
+        for (const std::optional<VectorTile> &tileOpt : tiles) {
+            if (!tileOpt.has_value()) {
                 shutdown("Benchmark expects all files to be parsed successfully.");
             }
+            out.featureCount += countFeatures(tileOpt.value());
         }
     }
 
     auto timeEnd = std::chrono::high_resolution_clock::now();
 
-
     // Calculate the total time it took to load.
-    double totalTimeMilli = std::chrono::duration<double, std::milli>(timeEnd - timeStart).count();
+    out.totalTimeMilli = std::chrono::duration<double, std::milli>(timeEnd - timeStart).count();
+    return out;
+}
+
+/*!
+ * \brief oneByOne
+ * Turns a decoder of a single tile into one that decodes the test files one after the other.
+ */
+static auto oneByOne(std::function<std::optional<VectorTile>(const QByteArray&)> decodeFn)
+{
+    return [decodeFn](const std::vector<QByteArray> &testFiles) {
+        std::vector<std::optional<VectorTile>> out;
+        for (const QByteArray &bytes : testFiles)
+            out.push_back(decodeFn(bytes));
+        return out;
+    };
+}
 
+int main() {
+    std::vector<QByteArray> testFiles = loadTestFilesIntoMemory();
 
-    qDebug() << "Total time: " << totalTimeMilli << " millisec";
+    // Basic info about the test.
+    qDebug() << "Parsing number of files: " << testFiles.size();
+    qDebug() << "Number of test iterations: " << iterations;
 
-    // Total amount of tiles we parsed.ns
+    // Total amount of tiles we parsed.
     int tilesParsedTotal = testFiles.size() * iterations;
-
-    qDebug() << "Average time per file: " << (totalTimeMilli / tilesParsedTotal) << " millisec";
+    // Total amount of encoded bytes we parsed.
+    qint64 bytesParsedTotal = 0;
+    for (const QByteArray &bytes : testFiles)
+        bytesParsedTotal += bytes.size() * iterations;
+
+    struct Decoder {
+        QString name;
+        std::function<std::vector<std::optional<VectorTile>>(const std::vector<QByteArray>&)> decodeFn;
+    };
+    const std::vector<Decoder> decoders = {
+        { "QtProtobuf", oneByOne(Bach::tileFromByteArray_QtProtobuf) },
+        { "Wire decoder", oneByOne([](const QByteArray &bytes) { return Bach::tileFromByteArray(bytes); }) },
+        { "Wire decoder, clipped and simplified", oneByOne([](const QByteArray &bytes) {
+            return Bach::tileFromByteArray(bytes, Bach::TileParseOptions::forTilePixelSize(512));
+        }) },
+        { "Wire decoder, batched in parallel", [](const std::vector<QByteArray> &testFiles) {
+            return VectorTile::fromByteArrays(testFiles);
+        } },
+    };
+
+    for (const Decoder &decoder : decoders) {
+        DecodeResult result = runDecoder(testFiles, decoder.decodeFn);
+        const double totalTimeSecs = result.totalTimeMilli / 1000.0;
+
+        qDebug() << "";
+        qDebug() << decoder.name;
+        qDebug() << "Total time: " << result.totalTimeMilli << " millisec";
+        qDebug() << "Average time per file: " << (result.totalTimeMilli / tilesParsedTotal) << " millisec";
+        qDebug() << "Throughput: " << (bytesParsedTotal / (1024.0 * 1024.0) / totalTimeSecs) << " MB/s";
+        qDebug() << "Features per second: " << (result.featureCount / totalTimeSecs);
+    }
 }
@@ -1,19 +1,41 @@
+#include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStorageInfo>
+#include <QTextStream>
+#include <QTimer>
 
 #include <TileLoader.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <map>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 /*!
- * \brief iterations
- * Controls how many iterations we should do on each test.
+ * \brief defaultIterations
+ * Controls how many measured iterations we do on each test case by default.
  */
-constexpr int iterations = 5;
+constexpr int defaultIterations = 10;
 
-constexpr bool loadFromMemory = false;
+/*!
+ * \brief defaultWarmupIterations
+ * Controls how many iterations are run before measuring each test case.
+ * They are not part of the results.
+ */
+constexpr int defaultWarmupIterations = 2;
 
 namespace Bach::TestUtils {
     /*!
@@ -146,24 +168,17 @@ static QMap<TileCoord, QByteArray> loadTileFiles()
     return out;
 }
 
+// Same as writeTestFilesToCacheDir_Dummy, every coordinate holds the biggest file.
 static QMap<TileCoord, QByteArray> loadTileFiles_Dummy()
 {
     QMap<TileCoord, QByteArray> out;
 
-    QMap<TileCoord, QString> filePaths = loadTilePaths();
-    for (const auto &[coord, path] : filePaths.asKeyValueRange()) {
-        QFile file{ path };
-        if (!file.open(QFile::ReadOnly)) {
-            shutdown("Unable to open vector file");
-        }
-
-        QByteArray fileBytes = file.readAll();
-
-        if (fileBytes.isEmpty()) {
-            shutdown("Vector file was empty");
-        }
+    QVector<TileCoord> allCoords = loadFullTileCoordList_Sorted();
+    QMap<TileCoord, QByteArray> tileFiles = loadTileFiles();
+    QByteArray biggestTileFile = tileFiles[allCoords[0]];
 
-        out.insert(coord, fileBytes);
+    for (TileCoord coord : allCoords) {
+        out.insert(coord, biggestTileFile);
     }
 
     return out;
@@ -208,100 +223,164 @@ static void writeTestFilesToCacheDir_Dummy(
     }
 }
 
+/*!
+ * \brief dropFromPageCache
+ * Asks the OS to evict every file in the folder from its page cache,
+ * so that the next load has to read them from the storage device.
+ * Only supported on Linux.
+ *
+ * \return False if the files could not be evicted.
+ */
+static bool dropFromPageCache(const QString &dirPath)
+{
+#ifdef Q_OS_LINUX
+    QDirIterator it{ dirPath, QDir::Files, QDirIterator::Subdirectories };
+    while (it.hasNext()) {
+        const QByteArray path = QFile::encodeName(it.next());
+        const int fd = ::open(path.constData(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        // Dirty pages are never evicted, so write them out first.
+        ::fdatasync(fd);
+        const int result = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+        if (result != 0) {
+            return false;
+        }
+    }
+    return true;
+#else
+    Q_UNUSED(dirPath);
+    return false;
+#endif
+}
+
+/*!
+ * \brief The TileSource enum is where the TileLoader gets the tile files from.
+ */
+enum class TileSource {
+    // The files are handed over from memory through the load override, like a network with no latency.
+    Override,
+    // The files are read from the disk cache.
+    Disk,
+};
+
+/*!
+ * \brief The DiskCacheState enum is whether the disk cache files
+ * are in the OS page cache when the test case starts.
+ */
+enum class DiskCacheState {
+    // The disk cache is not used.
+    None,
+    // The files are evicted from the page cache before every iteration.
+    Cold,
+    // The files stay in the page cache from one iteration to the next.
+    Warm,
+};
+
+/*!
+ * \brief The TileSet enum is which files are loaded.
+ */
+enum class TileSet {
+    // Every tile is the bundled file of its coordinate.
+    Distinct,
+    // Every tile is the biggest bundled file, so every tile costs the same.
+    SameTile,
+};
+
 /*!
  * \class
  * \brief The TestItem class is a helper class to
  * define a single test-configuration. It holds values as to what
- * tile-coords we should load and whether we should do so single or
- * multi-threadedly.
+ * tile-coords we should load, where from, and with how many threads.
  */
 struct TestItem {
     int threadCount;
-    std::set<TileCoord> tileCoords;
+    QVector<TileCoord> tileCoords;
+    TileSource source = TileSource::Disk;
+    DiskCacheState cacheState = DiskCacheState::Warm;
+    TileSet tileSet = TileSet::Distinct;
+
+    // Identifies the configuration apart from the thread count,
+    // so results can be compared across thread counts.
+    QString configName() const
+    {
+        QString out = tileSet == TileSet::Distinct ? "distinct" : "same-tile";
+        if (source == TileSource::Override) {
+            out += " override";
+        } else {
+            out += cacheState == DiskCacheState::Cold ? " disk-cold" : " disk-warm";
+        }
+        return out + QString(" %1 tiles").arg(tileCoords.size());
+    }
 };
 
 /*!
  * \brief setupTestItems
- * Helper function to set up our list of
- * test items.
- * \return
+ * Helper function to set up our list of test items,
+ * every tile count and source for every thread count.
+ *
+ * \param threadCounts The worker thread counts to sweep.
+ * \param includeColdCache Whether to include the cold disk cache cases.
  */
-static QVector<TestItem> setupTestItems()
+static QVector<TestItem> setupTestItems(const QVector<int> &threadCounts, bool includeColdCache)
 {
     QVector<TileCoord> coordsSortedBySize = loadFullTileCoordList_Sorted();
 
     auto grabFirst = [&](int n) {
-        std::set<TileCoord> out;
-        for (TileCoord item : coordsSortedBySize.first(n)) {
-            out.insert(item);
-        }
-        return out;
+        return coordsSortedBySize.first(qMin(n, (int)coordsSortedBySize.size()));
     };
 
-    QVector<TestItem> out;
-
-    // Single thread, 1
-    out.push_back({
-        1,
-        grabFirst(1) });
-
-    // Single thread, 4 tiles
-    out.push_back({
-        1,
-        grabFirst(4) });
-
-    // Single thread, 8 tiles
-    out.push_back({
-        1,
-        grabFirst(8) });
-
-    // Single thread, 16 tiles
-    out.push_back({
-        1,
-        grabFirst(16) });
-
-    // Single thread, 32 tiles
-    out.push_back({
-        1,
-        grabFirst(32) });
-
-    // Now duplicate the test cases but make them use 4 threads.
-    int oldItemCount = out.size();
-    for (int i = 0; i < oldItemCount; i++) {
-        TestItem temp = out[i];
-        temp.threadCount = 4;
-        out.push_back(temp);
+    struct Source {
+        TileSource source;
+        DiskCacheState cacheState;
+    };
+    QVector<Source> sources = {
+        { TileSource::Override, DiskCacheState::None },
+        { TileSource::Disk, DiskCacheState::Warm },
+    };
+    if (includeColdCache) {
+        sources.push_back({ TileSource::Disk, DiskCacheState::Cold });
     }
 
-    // Now duplicate the test cases but make them use 8 threads.
-    for (int i = 0; i < oldItemCount; i++) {
-        TestItem temp = out[i];
-        temp.threadCount = 8;
-        out.push_back(temp);
-    }
-    if (QThread::idealThreadCount() > 8) {
-        // Now duplicate the test cases but make them use 16 threads.
-        for (int i = 0; i < oldItemCount; i++) {
-            TestItem temp = out[i];
-            temp.threadCount = QThread::idealThreadCount();
-            out.push_back(temp);
+    QVector<TestItem> out;
+    for (TileSet tileSet : { TileSet::Distinct, TileSet::SameTile }) {
+        for (const Source &source : sources) {
+            for (int tileCount : { 1, 4, 8, 16, 32 }) {
+                for (int threadCount : threadCounts) {
+                    out.push_back({
+                        threadCount,
+                        grabFirst(tileCount),
+                        source.source,
+                        source.cacheState,
+                        tileSet });
+                }
+            }
         }
     }
-
-
-
     return out;
 }
 
+/*!
+ * \brief The CaseTiming class holds the timings of a single iteration.
+ */
+struct CaseTiming {
+    // From the request until every tile is loaded.
+    double allTilesMilli = 0;
+    // From the request until the first tile is loaded.
+    double firstTileMilli = 0;
+};
 
 /*!
  * \brief runSingleCase
  * Runs the benchmark for a single test case and returns
  * time spent during the critical portion.
  *
- * \return Time spent in milliseconds.
+ * \param fileBytes The files to load through the load override,
+ * or null to load them from the cache folder.
  */
-static double runSingleCase(
+static CaseTiming runSingleCase(
     const TestItem &testItem,
     const QMap<TileCoord, QByteArray> *fileBytes,
     QString cacheDir)
@@ -337,7 +416,9 @@ static double runSingleCase(
     // QBENCHMARK will also only do 1 iteration of the benchmark, which gives us poor
     // sample size.
     // So we do it manually using std::chrono instead.
-    auto timeStart = std::chrono::high_resolution_clock::now();
+    using Clock = std::chrono::high_resolution_clock;
+    auto timeStart = Clock::now();
+    Clock::time_point timeFirstTile;
 
     // Count how many tiles we have loaded, when all are loaded we want
     // to break out.
@@ -348,13 +429,14 @@ static double runSingleCase(
         [&](TileCoord) {
             // This lambda is called on the TileLoader worker thread.
             // We don't have atomic access to the integer counter here.
-            // So we dispatch it to the event-loop instead.
-
-            QMetaObject::invokeMethod(&eventLoop, [&]() {
+            // So we dispatch it to the event-loop instead, along with when the tile was loaded.
+            const Clock::time_point timeLoaded = Clock::now();
+            QMetaObject::invokeMethod(&eventLoop, [&, timeLoaded]() {
+                if (tileLoadedCounter == 0) {
+                    timeFirstTile = timeLoaded;
+                }
                 // Increment counter, if all tiles are loaded, exit loop.
                 tileLoadedCounter++;
-                //static int counter = 0;
-                //std::cout << "tile loaded " << counter++ << std::endl;
                 if (tileLoadedCounter >= testItem.tileCoords.size()) {
                     eventLoop.exit();
                 }
@@ -364,102 +446,415 @@ static double runSingleCase(
     // This will block until all our tiles are done loading.
     eventLoop.exec();
 
-    auto timeEnd = std::chrono::high_resolution_clock::now();
+    auto timeEnd = Clock::now();
 
-    // Calulate duration
-    double timeDurMilli = std::chrono::duration<double, std::milli>(timeEnd - timeStart).count();
-    return timeDurMilli;
+    // Calulate durations
+    CaseTiming out;
+    out.allTilesMilli = std::chrono::duration<double, std::milli>(timeEnd - timeStart).count();
+    out.firstTileMilli = std::chrono::duration<double, std::milli>(timeFirstTile - timeStart).count();
+    return out;
+}
+
+/*!
+ * \brief The SampleStats class summarizes the timings of all iterations of a test case.
+ */
+struct SampleStats {
+    double mean = 0;
+    // Sample standard deviation.
+    double stddev = 0;
+    double min = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+static SampleStats calcSampleStats(std::vector<double> samples)
+{
+    SampleStats out;
+    if (samples.empty()) {
+        return out;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0;
+    for (double sample : samples) {
+        total += sample;
+    }
+    out.mean = total / samples.size();
+
+    double squaredDiffs = 0;
+    for (double sample : samples) {
+        squaredDiffs += (sample - out.mean) * (sample - out.mean);
+    }
+    out.stddev = samples.size() > 1 ? std::sqrt(squaredDiffs / (samples.size() - 1)) : 0;
+
+    // Nearest-rank percentiles.
+    auto percentile = [&](double p) {
+        const size_t index = std::min(samples.size() - 1, (size_t)std::ceil(p * samples.size()) - 1);
+        return samples[index];
+    };
+    out.min = samples.front();
+    out.p50 = percentile(0.50);
+    out.p95 = percentile(0.95);
+    out.p99 = percentile(0.99);
+    out.max = samples.back();
+    return out;
+}
+
+static QJsonObject toJson(const SampleStats &stats)
+{
+    QJsonObject out;
+    out["mean"] = stats.mean;
+    out["stddev"] = stats.stddev;
+    out["min"] = stats.min;
+    out["p50"] = stats.p50;
+    out["p95"] = stats.p95;
+    out["p99"] = stats.p99;
+    out["max"] = stats.max;
+    return out;
+}
+
+/*!
+ * \brief The CaseResult class holds the results of a single test case.
+ */
+struct CaseResult {
+    TestItem testItem;
+    SampleStats allTiles;
+    SampleStats firstTile;
+    // Mean time to load all tiles with one thread divided by
+    // the mean time with this case's thread count. Zero if there was no single thread case.
+    double speedup = 0;
+};
+
+/*!
+ * \brief parseThreadCounts
+ * Parses a comma-separated list of thread counts.
+ */
+static QVector<int> parseThreadCounts(const QString &text)
+{
+    QVector<int> out;
+    for (const QString &part : text.split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const int threadCount = part.trimmed().toInt(&ok);
+        if (!ok || threadCount < 1) {
+            shutdown("Invalid thread count " + part);
+        }
+        out.push_back(threadCount);
+    }
+    if (out.isEmpty()) {
+        shutdown("No thread counts given.");
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+/*!
+ * \brief defaultThreadCounts
+ * Powers of two up to the core count, and the core count itself.
+ */
+static QString defaultThreadCounts()
+{
+    QStringList out;
+    const int idealThreadCount = QThread::idealThreadCount();
+    for (int threadCount = 1; threadCount < idealThreadCount; threadCount *= 2) {
+        out << QString::number(threadCount);
+    }
+    out << QString::number(idealThreadCount);
+    return out.join(',');
+}
+
+/*!
+ * \brief The LookupLatencyResult class holds the timings
+ * of the paint-side lookups done during a single test case.
+ */
+struct LookupLatencyResult {
+    int lookupCount = 0;
+    double avgMicro = 0;
+    double p99Micro = 0;
+    double maxMicro = 0;
+};
+
+/*!
+ * \brief runPaintLookupCase
+ * Loads the tiles of the test case from memory in the background, while
+ * the main thread repeatedly requests the full set of tiles without loading,
+ * the same way MapWidget::paintEvent does.
+ *
+ * This measures how long the paint-side lookups get stalled while
+ * the worker threads are publishing tiles.
+ *
+ * \return The timings of the lookups, in microseconds.
+ */
+static LookupLatencyResult runPaintLookupCase(
+    const TestItem &testItem,
+    const QMap<TileCoord, QByteArray> &fileBytes)
+{
+    auto grabFileBytesFn = [&](TileCoord coord, TileType type) -> const QByteArray* {
+        if (type == TileType::Raster) {
+            return nullptr;
+        }
+        auto it = fileBytes.find(coord);
+        if (it == fileBytes.end()) {
+            return nullptr;
+        }
+        return &*it;
+    };
+
+    QEventLoop eventLoop;
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        grabFileBytesFn,
+        false, // Don't load raster tiles.
+        testItem.threadCount);
+    TileLoader& tileLoader = *tileLoaderPtr;
+
+    std::vector<double> lookupTimes;
+
+    // Simulate paint events by running one lookup each time the
+    // event loop is idle.
+    QTimer paintTimer;
+    paintTimer.setInterval(0);
+    QObject::connect(&paintTimer, &QTimer::timeout, [&]() {
+        auto timeStart = std::chrono::high_resolution_clock::now();
+        auto result = tileLoader.requestTiles(testItem.tileCoords, false);
+        auto timeEnd = std::chrono::high_resolution_clock::now();
+        lookupTimes.push_back(std::chrono::duration<double, std::micro>(timeEnd - timeStart).count());
+    });
+
+    int tileLoadedCounter = 0;
+    tileLoader.requestTiles(
+        testItem.tileCoords,
+        [&](TileCoord) {
+            // This lambda is called on the TileLoader worker thread.
+            // Dispatch to the event-loop to avoid racing on the counter.
+            QMetaObject::invokeMethod(&eventLoop, [&]() {
+                tileLoadedCounter++;
+                if (tileLoadedCounter >= testItem.tileCoords.size()) {
+                    eventLoop.exit();
+                }
+            });
+        });
+
+    paintTimer.start();
+    // This will block until all our tiles are done loading.
+    eventLoop.exec();
+    paintTimer.stop();
+
+    LookupLatencyResult out;
+    out.lookupCount = (int)lookupTimes.size();
+    if (lookupTimes.empty()) {
+        return out;
+    }
+    std::sort(lookupTimes.begin(), lookupTimes.end());
+    double total = 0;
+    for (double time : lookupTimes) {
+        total += time;
+    }
+    out.avgMicro = total / lookupTimes.size();
+    out.p99Micro = lookupTimes[(lookupTimes.size() - 1) * 99 / 100];
+    out.maxMicro = lookupTimes.back();
+    return out;
 }
 
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Measures how long the TileLoader takes to load sets of tiles, "
+        "for every worker thread count, tile source and disk cache state.");
+    parser.addHelpOption();
+    QCommandLineOption iterationsOption(
+        "iterations",
+        "Measured iterations per test case.",
+        "count",
+        QString::number(defaultIterations));
+    QCommandLineOption warmupOption(
+        "warmup",
+        "Iterations run and discarded before measuring each test case.",
+        "count",
+        QString::number(defaultWarmupIterations));
+    QCommandLineOption threadsOption(
+        "threads",
+        "Comma-separated list of worker thread counts to sweep.",
+        "list",
+        defaultThreadCounts());
+    QCommandLineOption csvOption("csv", "Also write the results as CSV to this file.", "path");
+    QCommandLineOption jsonOption("json", "Also write the results as JSON to this file.", "path");
+    parser.addOptions({ iterationsOption, warmupOption, threadsOption, csvOption, jsonOption });
+    parser.process(a);
+
+    const int iterations = qMax(parser.value(iterationsOption).toInt(), 1);
+    const int warmupIterations = qMax(parser.value(warmupOption).toInt(), 0);
+    const QVector<int> threadCounts = parseThreadCounts(parser.value(threadsOption));
 
     std::cout << "Iterations per test case: " << iterations << std::endl;
-    if (loadFromMemory) {
-        std::cout << "Loading tiles from memory" << std::endl;
-    } else {
-        std::cout << "Loading tiles from files" << std::endl;
-    }
+    std::cout << "Warmup iterations per test case: " << warmupIterations << std::endl;
+    std::cout << std::endl;
 
+    // Create the temp-dirs that we want to store our files into.
+    // One holds every bundled tile, the other holds the biggest tile at every coordinate.
+    Bach::TestUtils::TempDir distinctTempDir;
+    writeTestFilesToCacheDir(distinctTempDir.path());
+    Bach::TestUtils::TempDir sameTileTempDir;
+    writeTestFilesToCacheDir_Dummy(sameTileTempDir.path());
+
+    const QMap<TileCoord, QByteArray> distinctMemoryFiles = loadTileFiles();
+    const QMap<TileCoord, QByteArray> sameTileMemoryFiles = loadTileFiles_Dummy();
+
+    // Cold cases need the OS to let go of the files, which is not possible everywhere.
+    bool includeColdCache = dropFromPageCache(distinctTempDir.path());
+    if (!includeColdCache) {
+        std::cout << "Unable to evict files from the page cache, skipping the cold disk cache cases." << std::endl;
+    } else if (QStorageInfo(distinctTempDir.path()).fileSystemType() == "tmpfs") {
+        // The page cache is the storage on tmpfs, so cold and warm would measure the same.
+        std::cout << "The temp folder is on tmpfs, skipping the cold disk cache cases." << std::endl;
+        includeColdCache = false;
+    }
     std::cout << std::endl;
 
-    QMap<TileCoord, QString> tileFilePaths = loadTilePaths();
-    // Sorted by size of the corresponding file.
-    QVector<TileCoord> tileCoordsSorted = loadFullTileCoordList_Sorted();
-    std::pair<TileCoord, QString> biggestTile = {
-        tileCoordsSorted.first(),
-        tileFilePaths[tileCoordsSorted.first()]
-    };
+    const QVector<TestItem> testItems = setupTestItems(threadCounts, includeColdCache);
+
+    // Iterate over all test-items and run the benchmark on each of them.
+    std::vector<CaseResult> results;
+    std::map<QString, double> singleThreadMeans;
+    for (const TestItem &testItem : testItems) {
+        const bool sameTile = testItem.tileSet == TileSet::SameTile;
+        const QMap<TileCoord, QByteArray> *memoryFiles = nullptr;
+        QString cacheDir = sameTile ? sameTileTempDir.path() : distinctTempDir.path();
+        if (testItem.source == TileSource::Override) {
+            memoryFiles = sameTile ? &sameTileMemoryFiles : &distinctMemoryFiles;
+            cacheDir = "";
+        }
 
-    QVector<TestItem> testItems = setupTestItems();
+        auto runIteration = [&]() {
+            if (testItem.cacheState == DiskCacheState::Cold && !dropFromPageCache(cacheDir)) {
+                shutdown("Unable to evict files from the page cache.");
+            }
+            return runSingleCase(testItem, memoryFiles, cacheDir);
+        };
 
-    {
-        // Create the temp-dir that we want to store
-        // our files into.
-        Bach::TestUtils::TempDir tempDir;
-        writeTestFilesToCacheDir(tempDir.path());
+        for (int iter = 0; iter < warmupIterations; iter++) {
+            runIteration();
+        }
 
-        QMap<TileCoord, QByteArray> memoryFiles = loadTileFiles();
+        std::vector<double> allTilesTimes;
+        std::vector<double> firstTileTimes;
+        for (int iter = 0; iter < iterations; iter++) {
+            const CaseTiming timing = runIteration();
+            allTilesTimes.push_back(timing.allTilesMilli);
+            firstTileTimes.push_back(timing.firstTileMilli);
+        }
 
-        // Iterate over all test-items and run the benchmark on each of them.
-        for (const TestItem &testItem : testItems) {
-            double totalTestItemTime = 0;
-
-            // Perform each test case N amount of times and calc the average.
-            for (int iter = 0; iter < iterations; iter++) {
-                double timeMilli = runSingleCase(
-                    testItem,
-                    loadFromMemory ? &memoryFiles : nullptr,
-                    tempDir.path());
-                totalTestItemTime += timeMilli;
-            }
+        CaseResult result { testItem, calcSampleStats(allTilesTimes), calcSampleStats(firstTileTimes) };
+        if (testItem.threadCount == 1) {
+            singleThreadMeans[testItem.configName()] = result.allTiles.mean;
+        }
+        auto singleThreadIt = singleThreadMeans.find(testItem.configName());
+        if (singleThreadIt != singleThreadMeans.end() && result.allTiles.mean > 0) {
+            result.speedup = singleThreadIt->second / result.allTiles.mean;
+        }
+        results.push_back(result);
+
+        QString lineOut = QString("%1, %2 thread(s): all tiles %3 ms (sd %4, p50 %5, p95 %6, max %7), first tile %8 ms (p50 %9, p95 %10)")
+            .arg(testItem.configName())
+            .arg(testItem.threadCount)
+            .arg(result.allTiles.mean, 0, 'f', 2)
+            .arg(result.allTiles.stddev, 0, 'f', 2)
+            .arg(result.allTiles.p50, 0, 'f', 2)
+            .arg(result.allTiles.p95, 0, 'f', 2)
+            .arg(result.allTiles.max, 0, 'f', 2)
+            .arg(result.firstTile.mean, 0, 'f', 2)
+            .arg(result.firstTile.p50, 0, 'f', 2)
+            .arg(result.firstTile.p95, 0, 'f', 2);
+        if (result.speedup > 0) {
+            lineOut += QString(", %1x speedup").arg(result.speedup, 0, 'f', 2);
+        }
+        std::cout << lineOut.toStdString() << std::endl;
+    }
 
-            // Print out the average time it took for this test case.
-            // We print it out in seconds
-            QString lineOut = QString("%1 thread(s), %2 tiles: avg. %3 millisec")
-                .arg(testItem.threadCount)
-                .arg(testItem.tileCoords.size())
-                .arg(totalTestItemTime / iterations);
-            std::cout << lineOut.toStdString() << std::endl;;
+    if (parser.isSet(csvOption)) {
+        QFile csvFile{ parser.value(csvOption) };
+        if (!csvFile.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+            shutdown("Unable to open " + parser.value(csvOption) + " for writing.");
+        }
+        QTextStream csv{ &csvFile };
+        csv << "tile_set,source,disk_cache,threads,tiles,iterations,"
+               "all_mean_ms,all_stddev_ms,all_min_ms,all_p50_ms,all_p95_ms,all_p99_ms,all_max_ms,"
+               "first_mean_ms,first_stddev_ms,first_min_ms,first_p50_ms,first_p95_ms,first_p99_ms,first_max_ms,"
+               "speedup\n";
+        auto writeStats = [&](const SampleStats &stats) {
+            csv << stats.mean << ',' << stats.stddev << ',' << stats.min << ','
+                << stats.p50 << ',' << stats.p95 << ',' << stats.p99 << ',' << stats.max << ',';
+        };
+        for (const CaseResult &result : results) {
+            const TestItem &item = result.testItem;
+            csv << (item.tileSet == TileSet::Distinct ? "distinct" : "same-tile") << ','
+                << (item.source == TileSource::Override ? "override" : "disk") << ','
+                << (item.cacheState == DiskCacheState::None ? "none" : item.cacheState == DiskCacheState::Cold ? "cold" : "warm") << ','
+                << item.threadCount << ','
+                << item.tileCoords.size() << ','
+                << iterations << ',';
+            writeStats(result.allTiles);
+            writeStats(result.firstTile);
+            csv << result.speedup << '\n';
         }
+        std::cout << std::endl << "CSV written to " << parser.value(csvOption).toStdString() << std::endl;
+    }
+
+    if (parser.isSet(jsonOption)) {
+        QJsonArray jsonCases;
+        for (const CaseResult &result : results) {
+            const TestItem &item = result.testItem;
+            QJsonObject jsonCase;
+            jsonCase["tileSet"] = item.tileSet == TileSet::Distinct ? "distinct" : "same-tile";
+            jsonCase["source"] = item.source == TileSource::Override ? "override" : "disk";
+            jsonCase["diskCache"] = item.cacheState == DiskCacheState::None ? "none" : item.cacheState == DiskCacheState::Cold ? "cold" : "warm";
+            jsonCase["threads"] = item.threadCount;
+            jsonCase["tiles"] = (int)item.tileCoords.size();
+            jsonCase["allTilesMs"] = toJson(result.allTiles);
+            jsonCase["firstTileMs"] = toJson(result.firstTile);
+            jsonCase["speedup"] = result.speedup;
+            jsonCases.append(jsonCase);
+        }
+        QJsonObject root;
+        root["iterations"] = iterations;
+        root["warmupIterations"] = warmupIterations;
+        root["idealThreadCount"] = QThread::idealThreadCount();
+        root["cases"] = jsonCases;
+
+        QFile jsonFile{ parser.value(jsonOption) };
+        if (!jsonFile.open(QFile::WriteOnly | QFile::Truncate)) {
+            shutdown("Unable to open " + parser.value(jsonOption) + " for writing.");
+        }
+        jsonFile.write(QJsonDocument{ root }.toJson());
+        std::cout << std::endl << "JSON written to " << parser.value(jsonOption).toStdString() << std::endl;
     }
 
     std::cout << std::endl;
-    std::cout << "Same-tile test" << std::endl;
+    std::cout << "Paint-side lookup latency test" << std::endl;
     {
-        // Create the temp-dir that we want to store
-        // our files into.
-        Bach::TestUtils::TempDir tempDir;
-
-        QMap<TileCoord, QByteArray> memoryFiles = loadTileFiles_Dummy();
-
-        // Write our vector tile files to temp directory.
-        writeTestFilesToCacheDir_Dummy(tempDir.path());
-
-        QVector<TestItem> testItems = setupTestItems();
+        QMap<TileCoord, QByteArray> memoryFiles = loadTileFiles();
 
-        // Iterate over all test-items and run the benchmark on each of them.
         for (const TestItem &testItem : testItems) {
-            double totalTestItemTime = 0;
-
-            // Perform each test case N amount of times and calc the average.
-            for (int iter = 0; iter < iterations; iter++) {
-                double timeMilli = runSingleCase(
-                    testItem,
-                    loadFromMemory ? &memoryFiles : nullptr,
-                    tempDir.path());
-                totalTestItemTime += timeMilli;
+            // The lookups don't depend on where the tiles come from, so one configuration is enough.
+            if (testItem.source != TileSource::Override || testItem.tileSet != TileSet::Distinct) {
+                continue;
             }
+            LookupLatencyResult result = runPaintLookupCase(testItem, memoryFiles);
 
-            // Print out the average time it took for this test case.
-            // We print it out in seconds
-            QString lineOut = QString("%1 thread(s), %2 tiles: avg. %3 millisec")
+            QString lineOut = QString("%1 thread(s), %2 tiles: %3 lookups, avg. %4 microsec, p99 %5 microsec, max %6 microsec")
                 .arg(testItem.threadCount)
                 .arg(testItem.tileCoords.size())
-                .arg(totalTestItemTime / iterations);
-            std::cout << lineOut.toStdString() << std::endl;;
+                .arg(result.lookupCount)
+                .arg(result.avgMicro)
+                .arg(result.p99Micro)
+                .arg(result.maxMicro);
+            std::cout << lineOut.toStdString() << std::endl;
         }
     }
 }
@@ -1,12 +1,34 @@
 // Qt header files
+#include <QBuffer>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QImage>
+#include <QMutex>
 #include <QObject>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
 #include <QtEnvironmentVariables>
 #include <QTest>
 #include <QTimer>
+#include <QTimeZone>
+
+// STL header files
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <set>
+#include <vector>
 
 // Other header files
+#include "TaskScheduler.h"
+#include "TileDiskCache.h"
 #include "TileLoader.h"
+#include "TilePackFile.h"
 #include "Utilities.h"
 
 using TileLoader = Bach::TileLoader;
@@ -27,6 +49,32 @@ private slots:
     void loadTileFromCache_fails_on_broken_file();
     void loadTileFromCache_parses_cached_file_successfully();
     void check_new_tileLoader_has_no_tiles();
+    void tileMemory_evicts_least_recently_used_tiles();
+    void tileMemory_does_not_evict_pinned_tiles();
+    void requestTiles_cancels_tiles_that_are_no_longer_wanted();
+    void requestTiles_keeps_the_wanted_tiles_of_every_client();
+    void requestTiles_loads_raster_tiles_before_vector_tiles_at_equal_distance();
+    void requestTiles_returns_loaded_fallbacks_for_missing_tiles();
+    void requestTiles_draws_tiles_above_source_max_zoom_from_ancestor();
+    void tileCoord_packed_key_round_trips_in_coordinate_order();
+    void requestTiles_handles_repeated_coords_once();
+    void tileMemory_demotes_cold_vector_tiles_and_parses_them_again();
+    void rasterTiles_are_converted_and_downscaled_on_load();
+    void requestTiles_prefetches_tiles_around_the_request();
+    void requestTiles_keeps_prefetching_within_budget();
+    void tilePackFile_reads_back_written_tiles();
+    void loadTileFromPackedCache_parses_cached_file_successfully();
+    void tileDiskCache_prunes_least_recently_used_tiles();
+    void tileDiskCache_tracks_expiry_and_validators();
+    void requestTiles_returns_partial_tiles_while_they_are_parsed();
+    void downloads_that_fail_are_not_parsed_or_cached();
+    void downloads_are_shared_and_limited_per_host();
+    void seedRegion_skips_tiles_that_are_already_cached();
+    void parseTileRegionBounds_reads_bounding_box();
+    void seedRegion_backs_off_and_retries();
+    void seedRegion_waits_as_long_as_retry_after_says();
+    void seedRegion_stays_within_the_rate_limit();
+    void taskScheduler_runs_stages_after_their_dependencies();
 };
 
 QTEST_MAIN(UnitTesting)
@@ -201,6 +249,93 @@ namespace Bach::UnitTesting {
     private:
         QString _dir;
     };
+
+    /*
+     * A minimal HTTP server on localhost, answering every request with
+     * the reply returned by the given function. It runs on the thread
+     * that created it, so the test has to spin an event loop meanwhile.
+     */
+    class FakeTileServer {
+    public:
+        struct Reply {
+            int statusCode = 200;
+            QByteArray body;
+            // Extra header lines, such as "Retry-After: 1".
+            QList<QByteArray> headers;
+            // How long to hold on to the request before replying.
+            int delayMs = 0;
+        };
+        using ReplyFn = std::function<Reply(const QByteArray &path)>;
+
+        struct Request {
+            QByteArray path;
+            // When the request arrived, counted from the creation of the server.
+            qint64 receivedMs = 0;
+        };
+
+        explicit FakeTileServer(ReplyFn replyFn) : _replyFn{ std::move(replyFn) }
+        {
+            _clock.start();
+            QObject::connect(&_server, &QTcpServer::newConnection, [this]() {
+                while (QTcpSocket *socket = _server.nextPendingConnection())
+                    handleConnection(socket);
+            });
+            _server.listen(QHostAddress::LocalHost);
+        }
+        FakeTileServer(const FakeTileServer&) = delete;
+
+        QString urlTemplate() const
+        {
+            return QString("http://127.0.0.1:%1/{z}/{x}/{y}.pbf").arg(_server.serverPort());
+        }
+
+        // Every request so far, in the order they arrived.
+        const std::vector<Request>& requests() const { return _requests; }
+        // The most requests that were waiting for their reply at the same time.
+        int maxInFlight() const { return _maxInFlight; }
+
+    private:
+        void handleConnection(QTcpSocket *socket)
+        {
+            auto received = std::make_shared<QByteArray>();
+            QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, received]() {
+                received->append(socket->readAll());
+                // A kept-alive connection carries one request after the other.
+                qsizetype headerEnd;
+                while ((headerEnd = received->indexOf("\r\n\r\n")) >= 0) {
+                    const QByteArray requestLine = received->left(received->indexOf("\r\n"));
+                    received->remove(0, headerEnd + 4);
+                    handleRequest(socket, requestLine.split(' ').value(1));
+                }
+            });
+            QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        }
+
+        void handleRequest(QTcpSocket *socket, const QByteArray &path)
+        {
+            _requests.push_back({ path, _clock.elapsed() });
+            _inFlight++;
+            _maxInFlight = qMax(_maxInFlight, _inFlight);
+
+            const Reply reply = _replyFn(path);
+            QTimer::singleShot(reply.delayMs, socket, [this, socket, reply]() {
+                QByteArray response = "HTTP/1.1 " + QByteArray::number(reply.statusCode) + " Fake\r\n";
+                response += "Content-Length: " + QByteArray::number(reply.body.size()) + "\r\n";
+                for (const QByteArray &header : reply.headers)
+                    response += header + "\r\n";
+                response += "\r\n" + reply.body;
+                socket->write(response);
+                _inFlight--;
+            });
+        }
+
+        ReplyFn _replyFn;
+        QTcpServer _server;
+        QElapsedTimer _clock;
+        std::vector<Request> _requests;
+        int _inFlight = 0;
+        int _maxInFlight = 0;
+    };
 }
 
 // This test uses a predetermined cached file that is known to be corrupt.
@@ -332,4 +467,1175 @@ void UnitTesting::check_new_tileLoader_has_no_tiles()
     QVERIFY(rasterMap.size() == 0);
 }
 
+// Runs an event loop until the TileLoader has reported the given amount of tiles as finished.
+// The request function is invoked after we start listening for the signal.
+static bool waitForTilesFinished(
+    TileLoader &tileLoader,
+    int tileCount,
+    const std::function<void()> &requestFn)
+{
+    QEventLoop loop;
+    int finishedCount = 0;
+    bool timedOut = false;
+    QObject::connect(
+        &tileLoader,
+        &TileLoader::tileFinished,
+        &loop,
+        [&]() {
+            finishedCount++;
+            if (finishedCount >= tileCount)
+                loop.quit();
+        });
+
+    // If loading has a bug somewhere, it might never get finished.
+    QTimer::singleShot(
+        3000,
+        &loop,
+        [&]() {
+            timedOut = true;
+            loop.quit();
+        });
+
+    requestFn();
+    loop.exec();
+    return !timedOut;
+}
+
+void UnitTesting::tileMemory_evicts_least_recently_used_tiles()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    Bach::TileMemoryLimits limits;
+    limits.maxTileCount = 2;
+    tileLoader.setTileMemoryLimits(limits);
+
+    const TileCoord firstCoord = {1, 0, 0};
+    const TileCoord secondCoord = {1, 1, 0};
+    const TileCoord thirdCoord = {1, 0, 1};
+
+    // Load the tiles one by one so that the LRU order is deterministic.
+    for (TileCoord coord : { firstCoord, secondCoord }) {
+        bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+            tileLoader.requestTiles({ coord }, true);
+        });
+        QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    }
+
+    // Mark the first tile as recently used, so the second tile is the one to go.
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ firstCoord }, false);
+        QVERIFY(result->vectorMap().contains(firstCoord));
+    }
+
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ thirdCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+
+    QVERIFY(tileLoader.getTileState_Vector(firstCoord).has_value());
+    QVERIFY2(
+        !tileLoader.getTileState_Vector(secondCoord).has_value(),
+        "Expected the least recently used tile to be evicted.");
+    QVERIFY(tileLoader.getTileState_Vector(thirdCoord).has_value());
+
+    Bach::TileMemoryStats stats = tileLoader.getTileMemoryStats();
+    QCOMPARE(stats.tileCount, 2);
+    QCOMPARE(stats.evictions, 1);
+    QCOMPARE(stats.hits, 1);
+    QCOMPARE(stats.misses, 3);
+    // Every load has finished, and nothing was downloaded.
+    QCOMPARE(stats.pendingTileCount, 0);
+    QCOMPARE(stats.activeDownloads, 0);
+}
+
+void UnitTesting::tileMemory_does_not_evict_pinned_tiles()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    Bach::TileMemoryLimits limits;
+    limits.maxTileCount = 1;
+    tileLoader.setTileMemoryLimits(limits);
+
+    const TileCoord pinnedCoord = {1, 0, 0};
+    const TileCoord otherCoord = {1, 1, 0};
+
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ pinnedCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+
+    // Hold on to the result, this should keep the tile alive.
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ pinnedCoord }, false);
+    QVERIFY(result->vectorMap().contains(pinnedCoord));
+
+    loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ otherCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+
+    QVERIFY2(
+        tileLoader.getTileState_Vector(pinnedCoord).has_value(),
+        "Tile referenced by a live RequestTilesResult was evicted.");
+    QCOMPARE(tileLoader.getTileMemoryStats().tileCount, 2);
+
+    // Releasing the result should let the TileLoader return to its budget.
+    result.reset();
+    QVERIFY(!tileLoader.getTileState_Vector(pinnedCoord).has_value());
+    QVERIFY(tileLoader.getTileState_Vector(otherCoord).has_value());
+    QCOMPARE(tileLoader.getTileMemoryStats().tileCount, 1);
+    QCOMPARE(tileLoader.getTileMemoryStats().evictions, 1);
+}
+
+void UnitTesting::requestTiles_cancels_tiles_that_are_no_longer_wanted()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    const TileCoord blockingCoord = {2, 0, 0};
+    const TileCoord staleCoord = {2, 1, 0};
+    const TileCoord wantedCoord = {2, 3, 3};
+
+    // We keep the only worker thread busy with the first tile, so that
+    // the stale tile is still queued when the next request replaces it.
+    QSemaphore blockingLoadStarted;
+    QSemaphore releaseBlockingLoad;
+    QMutex loadedCoordsLock;
+    QVector<TileCoord> loadedCoords;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord coord, TileType) {
+            {
+                QMutexLocker lock { &loadedCoordsLock };
+                loadedCoords.push_back(coord);
+            }
+            if (coord == blockingCoord) {
+                blockingLoadStarted.release();
+                releaseBlockingLoad.acquire();
+            }
+            return &vectorFileBytes;
+        },
+        false,
+        1);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    tileLoader.requestTiles({ blockingCoord }, true);
+    QVERIFY2(blockingLoadStarted.tryAcquire(1, 3000), "Timed out when waiting for the first tile to start loading.");
+
+    tileLoader.requestTiles({ staleCoord }, true);
+    bool loadSuccess = waitForTilesFinished(tileLoader, 2, [&]() {
+        tileLoader.requestTiles({ wantedCoord }, true);
+        releaseBlockingLoad.release();
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+
+    QTRY_VERIFY(tileLoader.getTileState_Vector(staleCoord) == Bach::LoadedTileState::Cancelled);
+    QVERIFY(tileLoader.getTileState_Vector(wantedCoord) == Bach::LoadedTileState::Ok);
+    {
+        QMutexLocker lock { &loadedCoordsLock };
+        QVERIFY2(!loadedCoords.contains(staleCoord), "Expected the stale tile to never be loaded.");
+    }
+
+    // Requesting the cancelled tile again should load it.
+    loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ staleCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    QVERIFY(tileLoader.getTileState_Vector(staleCoord) == Bach::LoadedTileState::Ok);
+}
+
+void UnitTesting::requestTiles_keeps_the_wanted_tiles_of_every_client()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    const TileCoord blockingCoord = {2, 0, 0};
+    const TileCoord firstClientCoord = {2, 1, 0};
+    const TileCoord secondClientCoord = {2, 3, 3};
+
+    // Like with a single client, the only worker is kept busy so that
+    // the tile of the first client is still queued when the second client requests its tiles.
+    QSemaphore blockingLoadStarted;
+    QSemaphore releaseBlockingLoad;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord coord, TileType) {
+            if (coord == blockingCoord) {
+                blockingLoadStarted.release();
+                releaseBlockingLoad.acquire();
+            }
+            return &vectorFileBytes;
+        },
+        false,
+        1);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    const TileLoader::ClientId firstClient = tileLoader.addClient();
+    const TileLoader::ClientId secondClient = tileLoader.addClient();
+    QVERIFY(firstClient != secondClient);
+
+    tileLoader.requestTiles({ blockingCoord }, nullptr, true, secondClient);
+    QVERIFY2(blockingLoadStarted.tryAcquire(1, 3000), "Timed out when waiting for the first tile to start loading.");
+
+    tileLoader.requestTiles({ firstClientCoord }, nullptr, true, firstClient);
+    bool loadSuccess = waitForTilesFinished(tileLoader, 3, [&]() {
+        tileLoader.requestTiles({ secondClientCoord }, nullptr, true, secondClient);
+        releaseBlockingLoad.release();
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    QVERIFY(tileLoader.getTileState_Vector(firstClientCoord) == Bach::LoadedTileState::Ok);
+    QVERIFY(tileLoader.getTileState_Vector(secondClientCoord) == Bach::LoadedTileState::Ok);
+
+    tileLoader.removeClient(firstClient);
+    tileLoader.removeClient(secondClient);
+}
+
+void UnitTesting::requestTiles_loads_raster_tiles_before_vector_tiles_at_equal_distance()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    const TileCoord blockingCoord = {2, 0, 0};
+    // Every one of these is just as far from the centre of the request.
+    const QVector<TileCoord> requestedCoords = { {2, 1, 1}, {2, 2, 1}, {2, 1, 2}, {2, 2, 2} };
+
+    // The only worker is kept busy so that every job of the request is queued before any starts.
+    QSemaphore blockingLoadStarted;
+    QSemaphore releaseBlockingLoad;
+    QSemaphore recordedLoads;
+    QMutex loadOrderLock;
+    QVector<QPair<TileCoord, TileType>> loadOrder;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord coord, TileType type) {
+            if (coord == blockingCoord) {
+                if (type == TileType::Raster) {
+                    blockingLoadStarted.release();
+                    releaseBlockingLoad.acquire();
+                }
+                return &vectorFileBytes;
+            }
+            {
+                QMutexLocker lock { &loadOrderLock };
+                loadOrder.append({ coord, type });
+            }
+            recordedLoads.release();
+            return &vectorFileBytes;
+        },
+        true,
+        1);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    tileLoader.requestTiles({ blockingCoord }, true);
+    QVERIFY2(blockingLoadStarted.tryAcquire(1, 3000), "Timed out when waiting for the first tile to start loading.");
+    tileLoader.requestTiles(requestedCoords, true);
+    releaseBlockingLoad.release();
+    QVERIFY2(
+        recordedLoads.tryAcquire(2 * requestedCoords.size(), 3000),
+        "Timed out when loading the requested tiles.");
+
+    // The raster tiles of all the tied coordinates come first, then their vector tiles.
+    QMutexLocker lock { &loadOrderLock };
+    QCOMPARE(loadOrder.size(), 2 * requestedCoords.size());
+    for (int i = 0; i < loadOrder.size(); i++) {
+        const TileType expectedType = i < requestedCoords.size() ? TileType::Raster : TileType::Vector;
+        QVERIFY2(loadOrder[i].second == expectedType, "Expected raster tiles to be loaded before vector tiles.");
+    }
+}
+
+void UnitTesting::requestTiles_returns_loaded_fallbacks_for_missing_tiles()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    const TileCoord ancestorCoord = {1, 0, 0};
+    const TileCoord missingCoord = {3, 1, 2};
+    const TileCoord childCoord = {4, 3, 4};
+
+    for (TileCoord coord : { ancestorCoord, childCoord }) {
+        bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+            tileLoader.requestTiles({ coord }, true);
+        });
+        QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    }
+
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ missingCoord }, false);
+        QVERIFY(result->vectorMap().isEmpty());
+        QCOMPARE(result->fallbackVectorMap().size(), 1);
+        QVERIFY2(
+            result->fallbackVectorMap().contains(ancestorCoord),
+            "Expected the closest loaded ancestor to be returned for the missing tile.");
+    }
+
+    tileLoader.setUseDescendantFallbacks(true);
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ missingCoord }, false);
+        QCOMPARE(result->fallbackVectorMap().size(), 2);
+        QVERIFY(result->fallbackVectorMap().contains(ancestorCoord));
+        QVERIFY2(
+            result->fallbackVectorMap().contains(childCoord),
+            "Expected the loaded child to be returned for the missing tile.");
+    }
+}
+
+// Tiles above the source max zoom should never be loaded,
+// their ancestor at the source max zoom should be returned in their place.
+void UnitTesting::requestTiles_draws_tiles_above_source_max_zoom_from_ancestor()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    QMutex loadedTilesLock;
+    std::set<TileCoord> loadedTiles;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord coord, TileType) {
+            QMutexLocker lock { &loadedTilesLock };
+            loadedTiles.insert(coord);
+            return &vectorFileBytes;
+        },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    tileLoader.setSourceMaxZoom(3);
+
+    // Siblings two zoom levels above the source max zoom share the same ancestor.
+    const TileCoord ancestorCoord = {3, 2, 5};
+    const TileCoord firstCoord = {5, 8, 20};
+    const TileCoord secondCoord = {5, 11, 23};
+    const TileCoord regularCoord = {2, 1, 1};
+
+    bool loadSuccess = waitForTilesFinished(tileLoader, 2, [&]() {
+        tileLoader.requestTiles({ firstCoord, secondCoord, regularCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tiles.");
+    {
+        QMutexLocker lock { &loadedTilesLock };
+        QVERIFY2(
+            loadedTiles == std::set<TileCoord>({ ancestorCoord, regularCoord }),
+            "Expected only the ancestor and the tile within the source zoom levels to be loaded.");
+    }
+
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles(
+        { firstCoord, secondCoord, regularCoord },
+        false);
+    QCOMPARE(result->vectorMap().size(), 2);
+    QVERIFY(result->vectorMap().contains(ancestorCoord));
+    QVERIFY(result->vectorMap().contains(regularCoord));
+    QCOMPARE(result->overzoomMap().size(), 2);
+    QVERIFY(result->overzoomMap().value(firstCoord) == ancestorCoord);
+    QVERIFY(result->overzoomMap().value(secondCoord) == ancestorCoord);
+}
+
+// Packed keys should unpack to the same tile, sort like TileCoord and hash apart neighbouring tiles.
+void UnitTesting::tileCoord_packed_key_round_trips_in_coordinate_order()
+{
+    const QVector<TileCoord> coords = {
+        {0, 0, 0},
+        {1, 1, 0},
+        {3, 2, 5},
+        {3, 5, 2},
+        {16, 65535, 0},
+        {28, (1 << 28) - 1, (1 << 28) - 1},
+    };
+    for (TileCoord coord : coords)
+        QVERIFY2(TileCoord::fromPacked(coord.packed()) == coord, qPrintable(coord.toString()));
+    for (int i = 0; i + 1 < coords.size(); i++) {
+        QVERIFY(coords[i] < coords[i + 1]);
+        QVERIFY(coords[i].packed() < coords[i + 1].packed());
+    }
+
+    std::unordered_set<size_t> hashes;
+    for (int x = 0; x < 16; x++) {
+        for (int y = 0; y < 16; y++)
+            hashes.insert(qHash(TileCoord{ 4, x, y }));
+    }
+    QCOMPARE(hashes.size(), size_t(16 * 16));
+}
+
+// Coordinates listed more than once should only be loaded and pinned once.
+void UnitTesting::requestTiles_handles_repeated_coords_once()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    QMutex loadCountLock;
+    int loadCount = 0;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) {
+            QMutexLocker lock { &loadCountLock };
+            loadCount++;
+            return &vectorFileBytes;
+        },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    const TileCoord coord = {2, 1, 1};
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ coord, coord, coord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tiles.");
+
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ coord, coord }, false);
+    QCOMPARE(result->vectorMap().size(), 1);
+    {
+        QMutexLocker lock { &loadCountLock };
+        QCOMPARE(loadCount, 1);
+    }
+    QCOMPARE(tileLoader.getTileMemoryStats().tileCount, 1);
+}
+
+// Vector tiles over the parsed tile limit should be kept as their encoded bytes,
+// and be parsed again from memory instead of being loaded again.
+void UnitTesting::tileMemory_demotes_cold_vector_tiles_and_parses_them_again()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::atomic<int> loadCount = 0;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) {
+            loadCount++;
+            return &vectorFileBytes;
+        },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    Bach::TileMemoryLimits limits;
+    limits.maxParsedVectorTiles = 1;
+    limits.compressDemotedVectorTiles = true;
+    tileLoader.setTileMemoryLimits(limits);
+
+    const TileCoord firstCoord = {2, 1, 1};
+    const TileCoord secondCoord = {2, 2, 1};
+    for (TileCoord coord : { firstCoord, secondCoord }) {
+        bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+            tileLoader.requestTiles({ coord }, true);
+        });
+        QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    }
+
+    Bach::TileMemoryStats stats = tileLoader.getTileMemoryStats();
+    QCOMPARE(stats.demotions, qint64(1));
+    QCOMPARE(stats.demotedTileCount, 1);
+    QCOMPARE(stats.tileCount, 2);
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ firstCoord }, false);
+        QVERIFY2(result->vectorMap().isEmpty(), "Expected the oldest tile to be demoted.");
+    }
+
+    bool promoteSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ firstCoord }, true);
+    });
+    QVERIFY2(promoteSuccess, "Timed out when parsing the demoted tile again.");
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ firstCoord }, false);
+        QVERIFY(result->vectorMap().contains(firstCoord));
+    }
+
+    stats = tileLoader.getTileMemoryStats();
+    QCOMPARE(stats.promotions, qint64(1));
+    // The other tile took its place among the demoted tiles.
+    QCOMPARE(stats.demotions, qint64(2));
+    QCOMPARE(stats.demotedTileCount, 1);
+    QCOMPARE(loadCount.load(), 2);
+}
+
+// Raster tiles should be handed out in the configured pixel format,
+// along with the configured amount of downscaled copies.
+void UnitTesting::rasterTiles_are_converted_and_downscaled_on_load()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+    QImage sourceImage(256, 256, QImage::Format_RGB32);
+    sourceImage.fill(Qt::darkGreen);
+    QByteArray rasterFileBytes;
+    QBuffer rasterBuffer(&rasterFileBytes);
+    QVERIFY(rasterBuffer.open(QBuffer::WriteOnly));
+    QVERIFY(sourceImage.save(&rasterBuffer, "PNG"));
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType type) { return type == TileType::Raster ? &rasterFileBytes : &vectorFileBytes; });
+    TileLoader &tileLoader = *tileLoaderPtr;
+    QCOMPARE(tileLoader.getRasterTileFormat(), QImage::Format_ARGB32_Premultiplied);
+    tileLoader.setRasterTileFormat(QImage::Format_RGB16);
+    tileLoader.setRasterTileMipLevels(2);
+
+    const TileCoord coord = {0, 0, 0};
+    // Both the vector and the raster tile report when they are finished.
+    bool loadSuccess = waitForTilesFinished(tileLoader, 2, [&]() {
+        tileLoader.requestTiles({ coord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ coord }, false);
+    QVERIFY(result->rasterImageMap().contains(coord));
+    const QImage &image = **result->rasterImageMap().find(coord);
+    QCOMPARE(image.format(), QImage::Format_RGB16);
+
+    QVERIFY(result->rasterMipLevelMap().contains(coord));
+    const QList<QImage> &mipLevels = **result->rasterMipLevelMap().find(coord);
+    QCOMPARE(mipLevels.size(), 2);
+    QCOMPARE(mipLevels[0].size(), image.size() / 2);
+    QCOMPARE(mipLevels[1].size(), image.size() / 4);
+}
+
+void UnitTesting::requestTiles_prefetches_tiles_around_the_request()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    Bach::TilePrefetchPolicy policy;
+    policy.enabled = true;
+    policy.ringWidth = 1;
+    policy.loadParentZoom = true;
+    policy.loadChildZoom = false;
+    tileLoader.setPrefetchPolicy(policy);
+
+    // The 8 tiles around the requested tile, and its parent.
+    const TileCoord requestedCoord = {2, 1, 1};
+    const int expectedPrefetchCount = 9;
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1 + expectedPrefetchCount, [&]() {
+        tileLoader.requestTiles({ requestedCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tiles.");
+
+    QVERIFY(tileLoader.getTileState_Vector({2, 0, 0}) == Bach::LoadedTileState::Ok);
+    QVERIFY(tileLoader.getTileState_Vector({2, 2, 2}) == Bach::LoadedTileState::Ok);
+    QVERIFY(tileLoader.getTileState_Vector({1, 0, 0}) == Bach::LoadedTileState::Ok);
+    QVERIFY(!tileLoader.getTileState_Vector({2, 3, 3}).has_value());
+    QCOMPARE(tileLoader.getTileMemoryStats().prefetchLoads, expectedPrefetchCount);
+    QCOMPARE(tileLoader.getTileMemoryStats().prefetchHits, 0);
+
+    // Panning onto a prefetched tile should find it in memory.
+    {
+        QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ {2, 2, 1} }, false);
+        QVERIFY(result->vectorMap().contains({2, 2, 1}));
+    }
+    // A prefetched tile only counts as a hit the first time.
+    tileLoader.requestTiles({ {2, 2, 1} }, false);
+    QCOMPARE(tileLoader.getTileMemoryStats().prefetchHits, 1);
+}
+
+void UnitTesting::requestTiles_keeps_prefetching_within_budget()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+
+    Bach::TilePrefetchPolicy policy;
+    policy.enabled = true;
+    policy.ringWidth = 2;
+    policy.maxPendingLoads = 3;
+    tileLoader.setPrefetchPolicy(policy);
+
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1 + policy.maxPendingLoads, [&]() {
+        tileLoader.requestTiles({ {3, 4, 4} }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tiles.");
+    QCOMPARE(tileLoader.getTileMemoryStats().prefetchLoads, policy.maxPendingLoads);
+
+    // The closest tiles are prefetched first.
+    QVERIFY(tileLoader.getTileState_Vector({3, 3, 4}) == Bach::LoadedTileState::Ok);
+    QVERIFY(!tileLoader.getTileState_Vector({3, 2, 2}).has_value());
+}
+
+void UnitTesting::tilePackFile_reads_back_written_tiles()
+{
+    Bach::UnitTesting::TempDir tempDir;
+    const QString packPath = tempDir.path() + QDir::separator() + "tiles.pack";
+    const TileCoord firstCoord = {3, 2, 5};
+    const TileCoord secondCoord = {12, 2047, 1024};
+
+    {
+        std::unique_ptr<Bach::TilePackFile> pack = Bach::TilePackFile::open(packPath);
+        QVERIFY(pack != nullptr);
+        pack->insert(firstCoord, TileType::Vector, "first vector");
+        pack->insert(firstCoord, TileType::Raster, "first raster");
+        pack->insert(secondCoord, TileType::Vector, "second vector");
+        // Pending tiles are served before they are written.
+        QCOMPARE(pack->find(firstCoord, TileType::Vector).value_or(QByteArray()), QByteArray("first vector"));
+        QVERIFY(pack->flush());
+        QCOMPARE(pack->tileCount(), 3);
+
+        // Writing a tile again replaces it.
+        pack->insert(secondCoord, TileType::Vector, "second vector, again");
+    }
+
+    std::unique_ptr<Bach::TilePackFile> pack = Bach::TilePackFile::open(packPath);
+    QVERIFY(pack != nullptr);
+    QCOMPARE(pack->tileCount(), 3);
+    QCOMPARE(pack->find(firstCoord, TileType::Vector).value_or(QByteArray()), QByteArray("first vector"));
+    QCOMPARE(pack->find(firstCoord, TileType::Raster).value_or(QByteArray()), QByteArray("first raster"));
+    QCOMPARE(pack->find(secondCoord, TileType::Vector).value_or(QByteArray()), QByteArray("second vector, again"));
+    QVERIFY(!pack->find(secondCoord, TileType::Raster).has_value());
+    const qint64 validSize = pack->fileSize();
+    pack.reset();
+
+    // A record cut short, like after a crash while writing, is dropped.
+    {
+        QFile file(packPath);
+        QVERIFY(file.open(QFile::Append));
+        file.write("TILE and then nothing");
+    }
+    pack = Bach::TilePackFile::open(packPath);
+    QVERIFY(pack != nullptr);
+    QCOMPARE(pack->fileSize(), validSize);
+    QCOMPARE(pack->tileCount(), 3);
+}
+
+void UnitTesting::loadTileFromPackedCache_parses_cached_file_successfully()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const TileCoord expectedCoord = {0, 0, 0};
+
+    Bach::UnitTesting::TempDir tempDir;
+    const QString packPath = tempDir.path() + QDir::separator() + TileLoader::packedDiskCacheFileName;
+    {
+        std::unique_ptr<Bach::TilePackFile> pack = Bach::TilePackFile::open(packPath);
+        QVERIFY(pack != nullptr);
+        pack->insert(expectedCoord, TileType::Vector, vectorFile.readAll());
+    }
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        tempDir.path(),
+        nullptr,
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    QVERIFY(tileLoader.enablePackedDiskCache());
+
+    bool loadSuccess = waitForTilesFinished(tileLoader, 1, [&]() {
+        tileLoader.requestTiles({ expectedCoord }, true);
+    });
+    QVERIFY2(loadSuccess, "Timed out when loading tile.");
+    QVERIFY(tileLoader.getTileState_Vector(expectedCoord) == Bach::LoadedTileState::Ok);
+}
+
+void UnitTesting::tileDiskCache_prunes_least_recently_used_tiles()
+{
+    Bach::UnitTesting::TempDir tempDir;
+    const QVector<TileCoord> coords = { {1, 0, 0}, {1, 0, 1}, {1, 1, 0}, {1, 1, 1} };
+    for (TileCoord coord : coords)
+        QVERIFY(Bach::writeTileToDiskCache_Vector(tempDir.path(), coord, QByteArray(100, 'a')));
+
+    std::unique_ptr<Bach::TileDiskCache> cache = Bach::TileDiskCache::open(tempDir.path());
+    // Let the cache pick up the files already in the folder.
+    cache->waitForMaintenance();
+    QCOMPARE(cache->stats().tileCount, 4);
+    QCOMPARE(cache->stats().byteSize, 400);
+
+    // Use the first tile last, so that the second and third tile are the oldest.
+    for (int i : { 1, 2, 3, 0 })
+        cache->recordAccess(coords[i], TileType::Vector);
+
+    Bach::TileDiskCacheLimits limits;
+    limits.maxBytes = 250;
+    cache->setLimits(limits);
+    cache->waitForMaintenance();
+
+    const Bach::TileDiskCacheStats stats = cache->stats();
+    QCOMPARE(stats.tileCount, 2);
+    QCOMPARE(stats.byteSize, 200);
+    QCOMPARE(stats.prunedTiles, 2);
+    auto existsOnDisk = [&](TileCoord coord) {
+        return QFile::exists(tempDir.path() + QDir::separator() + Bach::tileDiskCacheSubPath(coord, TileType::Vector));
+    };
+    QVERIFY(existsOnDisk(coords[0]));
+    QVERIFY(!existsOnDisk(coords[1]));
+    QVERIFY(!existsOnDisk(coords[2]));
+    QVERIFY(existsOnDisk(coords[3]));
+}
+
+void UnitTesting::tileDiskCache_tracks_expiry_and_validators()
+{
+    Bach::UnitTesting::TempDir tempDir;
+    const TileCoord freshCoord = {2, 1, 1};
+    const TileCoord expiredCoord = {2, 1, 2};
+    QVERIFY(Bach::writeTileToDiskCache_Vector(tempDir.path(), freshCoord, QByteArray(10, 'a')));
+    QVERIFY(Bach::writeTileToDiskCache_Vector(tempDir.path(), expiredCoord, QByteArray(10, 'a')));
+
+    {
+        std::unique_ptr<Bach::TileDiskCache> cache = Bach::TileDiskCache::open(tempDir.path());
+        Bach::HttpCacheHeaders freshHeaders;
+        freshHeaders.etag = "\"fresh\"";
+        freshHeaders.cacheControl = "public, max-age=3600";
+        cache->recordWrite(freshCoord, TileType::Vector, 10, freshHeaders);
+        Bach::HttpCacheHeaders expiredHeaders;
+        expiredHeaders.etag = "\"expired\"";
+        expiredHeaders.lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+        expiredHeaders.cacheControl = "no-cache";
+        cache->recordWrite(expiredCoord, TileType::Vector, 10, expiredHeaders);
+
+        QVERIFY(!cache->needsRevalidation(freshCoord, TileType::Vector));
+        QVERIFY(cache->needsRevalidation(expiredCoord, TileType::Vector));
+        QVERIFY(!cache->needsRevalidation(freshCoord, TileType::Raster));
+    }
+
+    // The book-keeping is read back from the index.
+    std::unique_ptr<Bach::TileDiskCache> cache = Bach::TileDiskCache::open(tempDir.path());
+    QVERIFY(!cache->needsRevalidation(freshCoord, TileType::Vector));
+    QVERIFY(cache->needsRevalidation(expiredCoord, TileType::Vector));
+    std::optional<Bach::TileDiskCache::Validators> validators = cache->validators(expiredCoord, TileType::Vector);
+    QVERIFY(validators.has_value());
+    QCOMPARE(validators->etag, QByteArray("\"expired\""));
+    QCOMPARE(validators->lastModified, QByteArray("Wed, 21 Oct 2015 07:28:00 GMT"));
+
+    // A '304 Not Modified' reply makes the tile fresh again and keeps the validators we had.
+    Bach::HttpCacheHeaders notModifiedHeaders;
+    notModifiedHeaders.cacheControl = "max-age=60";
+    cache->recordNotModified(expiredCoord, TileType::Vector, notModifiedHeaders);
+    QVERIFY(!cache->needsRevalidation(expiredCoord, TileType::Vector));
+    QCOMPARE(cache->validators(expiredCoord, TileType::Vector)->etag, QByteArray("\"expired\""));
+    QCOMPARE(cache->stats().notModifiedReplies, 1);
+
+    // 'Expires' is used when there is no 'Cache-Control'.
+    Bach::HttpCacheHeaders expiresHeaders;
+    expiresHeaders.expires = "Wed, 21 Oct 2015 07:28:00 GMT";
+    const QDateTime expected { QDate(2015, 10, 21), QTime(7, 28), QTimeZone::utc() };
+    QCOMPARE(Bach::TileDiskCache::expiryFromHeaders(expiresHeaders, 0), expected.toMSecsSinceEpoch());
+}
+
+void UnitTesting::requestTiles_returns_partial_tiles_while_they_are_parsed()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    // A fill, a line and a symbol style make for three stages: 'water', 'boundary' and 'place'.
+    auto layerStyle = [](const QString &id, const QString &type, const QString &sourceLayer) {
+        return QJsonObject {
+            { "id", id },
+            { "type", type },
+            { "source-layer", sourceLayer },
+            { "layout", QJsonObject { { "visibility", "visible" } } },
+        };
+    };
+    const QJsonObject styleJson {
+        { "version", 8 },
+        { "id", "stages" },
+        { "name", "Stages" },
+        { "layers", QJsonArray {
+            layerStyle("Water", "fill", "water"),
+            layerStyle("Boundary", "line", "boundary"),
+            layerStyle("Place", "symbol", "place"),
+        } },
+    };
+    std::optional<StyleSheet> styleSheet = StyleSheet::fromJson(QJsonDocument { styleJson });
+    QVERIFY(styleSheet.has_value());
+
+    const TileCoord coord = { 0, 0, 0 };
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newDummy(
+        "",
+        [&](TileCoord, TileType) { return &vectorFileBytes; },
+        false,
+        std::nullopt,
+        std::move(*styleSheet));
+    TileLoader &tileLoader = *tileLoaderPtr;
+    tileLoader.setStreamVectorTileLayers(true);
+
+    // The worker waits in the first callback until we looked at the partial tile.
+    QSemaphore firstStageDone;
+    QSemaphore resumeParsing;
+    std::atomic<int> callbackCount = 0;
+    QEventLoop loop;
+    QObject::connect(&tileLoader, &TileLoader::tileFinished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(3000, &loop, [&]() {
+        resumeParsing.release(10);
+        QFAIL("Timed out when loading tile.");
+        loop.quit();
+    });
+
+    QScopedPointer<Bach::RequestTilesResult> loadResult = tileLoader.requestTiles(
+        { coord },
+        [&](TileCoord) {
+            if (callbackCount++ == 0) {
+                firstStageDone.release();
+                resumeParsing.acquire();
+            }
+        });
+    QVERIFY(firstStageDone.tryAcquire(1, 3000));
+
+    // Only the base map is in the partial tile, while the tile is still pending.
+    std::shared_ptr<TileLayer> waterLayer;
+    {
+        QScopedPointer<Bach::RequestTilesResult> partialResult = tileLoader.requestTiles({ coord }, false);
+        QVERIFY(tileLoader.getTileState_Vector(coord) == Bach::LoadedTileState::Pending);
+        QCOMPARE(partialResult->partialVectorMap().size(), 1);
+        const VectorTile *partialTile = partialResult->vectorMap().value(coord);
+        QVERIFY(partialTile != nullptr);
+        QCOMPARE(partialResult->partialVectorMap().value(coord), partialTile);
+        QVERIFY(partialTile->m_partial);
+        QCOMPARE(partialTile->m_layers.size(), (size_t)1);
+        QVERIFY(partialTile->m_layers.count("water") != 0);
+        waterLayer = partialTile->m_layers.at("water");
+    }
+    resumeParsing.release();
+    loop.exec();
+
+    // One callback for each of the two partial stages, and one for the complete tile.
+    // The last one may run just after 'tileFinished' is emitted.
+    QTRY_COMPARE(callbackCount.load(), 3);
+    QVERIFY(tileLoader.getTileState_Vector(coord) == Bach::LoadedTileState::Ok);
+
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles({ coord }, false);
+    QVERIFY(result->partialVectorMap().isEmpty());
+    const VectorTile *completeTile = result->vectorMap().value(coord);
+    QVERIFY(completeTile != nullptr);
+    QVERIFY(!completeTile->m_partial);
+    QVERIFY(completeTile->m_layers.count("boundary") != 0);
+    QVERIFY(completeTile->m_layers.count("place") != 0);
+    // The complete tile shares the layers of the partial one, which nothing else holds on to anymore.
+    QVERIFY(completeTile->m_layers.at("water") == waterLayer);
+    QCOMPARE(waterLayer.use_count(), 2);
+}
+
+void UnitTesting::downloads_that_fail_are_not_parsed_or_cached()
+{
+    Bach::UnitTesting::FakeTileServer server { [](const QByteArray &) {
+        Bach::UnitTesting::FakeTileServer::Reply reply;
+        reply.statusCode = 404;
+        reply.body = "Tile not found";
+        return reply;
+    } };
+
+    Bach::UnitTesting::TempDir tempDir;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    tileLoader.setTileUrlTemplates(server.urlTemplate(), "");
+
+    QEventLoop loop;
+    QObject::connect(&tileLoader, &TileLoader::tileFinished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(3000, &loop, [&]() {
+        QFAIL("Timed out when loading tile.");
+        loop.quit();
+    });
+    const TileCoord coord = { 0, 0, 0 };
+    tileLoader.requestTiles({ coord }, true);
+    loop.exec();
+
+    // The error message in the body is neither parsed as a tile nor written to the disk cache.
+    QCOMPARE(server.requests().size(), (size_t)1);
+    QVERIFY(tileLoader.getTileState_Vector(coord) == Bach::LoadedTileState::UnknownError);
+    QVERIFY(!QFile::exists(tileLoader.getTileDiskPath(coord, TileType::Vector)));
+}
+
+void UnitTesting::downloads_are_shared_and_limited_per_host()
+{
+    QFile vectorFile(":loadTileFromCache_parses_cached_file_successfully/file.mvt");
+    QVERIFY(vectorFile.open(QFile::ReadOnly));
+    const QByteArray vectorFileBytes = vectorFile.readAll();
+
+    // Slow replies, so that the downloads pile up.
+    Bach::UnitTesting::FakeTileServer server { [&](const QByteArray &) {
+        Bach::UnitTesting::FakeTileServer::Reply reply;
+        reply.body = vectorFileBytes;
+        reply.delayMs = 50;
+        return reply;
+    } };
+
+    Bach::UnitTesting::TempDir tempDir;
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    tileLoader.setTileUrlTemplates(server.urlTemplate(), "");
+    Bach::TileNetworkPolicy networkPolicy;
+    networkPolicy.maxRequestsPerHost = 2;
+    tileLoader.setNetworkPolicy(networkPolicy);
+
+    // Two clients that want some of the same tiles, one of them asking twice.
+    const TileLoader::ClientId firstClient = tileLoader.addClient();
+    const TileLoader::ClientId secondClient = tileLoader.addClient();
+    const QVector<TileCoord> firstTiles = { { 2, 0, 0 }, { 2, 1, 0 }, { 2, 2, 0 }, { 2, 3, 0 } };
+    const QVector<TileCoord> secondTiles = { { 2, 2, 0 }, { 2, 3, 0 }, { 2, 0, 1 }, { 2, 1, 1 } };
+    const std::set<TileCoord> allTiles = {
+        { 2, 0, 0 }, { 2, 1, 0 }, { 2, 2, 0 }, { 2, 3, 0 }, { 2, 0, 1 }, { 2, 1, 1 } };
+
+    QEventLoop loop;
+    std::set<TileCoord> finishedTiles;
+    QObject::connect(&tileLoader, &TileLoader::tileFinished, &loop, [&](TileCoord coord) {
+        finishedTiles.insert(coord);
+        if (finishedTiles.size() == allTiles.size())
+            loop.quit();
+    });
+    QTimer::singleShot(5000, &loop, [&]() {
+        QFAIL("Timed out when loading tiles.");
+        loop.quit();
+    });
+    tileLoader.requestTiles(firstTiles, nullptr, true, firstClient);
+    tileLoader.requestTiles(secondTiles, nullptr, true, secondClient);
+    tileLoader.requestTiles(firstTiles, nullptr, true, firstClient);
+    loop.exec();
+    QVERIFY(finishedTiles == allTiles);
+
+    // Every tile was downloaded once, never more than two at a time.
+    std::set<QByteArray> requestedPaths;
+    for (const Bach::UnitTesting::FakeTileServer::Request &request : server.requests())
+        QVERIFY2(requestedPaths.insert(request.path).second, qPrintable("Downloaded twice: " + request.path));
+    QCOMPARE(requestedPaths.size(), allTiles.size());
+    QCOMPARE(server.maxInFlight(), 2);
+    for (TileCoord coord : allTiles)
+        QVERIFY(tileLoader.getTileState_Vector(coord) == Bach::LoadedTileState::Ok);
+}
+
+void UnitTesting::seedRegion_skips_tiles_that_are_already_cached()
+{
+    // A small box around Oslo is a single tile at every zoom level.
+    Bach::TileRegion oslo;
+    oslo.minLon = 10.7;
+    oslo.minLat = 59.9;
+    oslo.maxLon = 10.8;
+    oslo.maxLat = 59.95;
+    oslo.minZoom = 2;
+    oslo.maxZoom = 3;
+    const std::vector<TileCoord> osloTiles = Bach::calcTilesInRegion(oslo);
+    QCOMPARE(osloTiles.size(), (size_t)2);
+    QVERIFY(osloTiles[0] == (TileCoord{ 2, 2, 1 }));
+    QVERIFY(osloTiles[1] == (TileCoord{ 3, 4, 2 }));
+
+    // The whole world at zoom levels 0 and 1.
+    Bach::TileRegion world;
+    world.maxZoom = 1;
+    Bach::UnitTesting::TempDir tempDir;
+    for (TileCoord coord : Bach::calcTilesInRegion(world))
+        QVERIFY(Bach::writeTileToDiskCache_Vector(tempDir.path(), coord, QByteArray(10, 'a')));
+
+    std::unique_ptr<TileLoader> tileLoader = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    // There is nothing to download from.
+    QVERIFY(!tileLoader->seedRegion(world).has_value());
+
+    // Nothing listens on this port, so any download would fail.
+    tileLoader->setTileUrlTemplates("http://127.0.0.1:9/{z}/{x}/{y}.pbf", "");
+    Bach::TileSeedPolicy policy;
+    policy.maxRetries = 0;
+    int progressCalls = 0;
+    std::optional<Bach::TileSeedProgress> progress = tileLoader->seedRegion(
+        world,
+        policy,
+        [&](const Bach::TileSeedProgress &) { progressCalls++; return true; });
+    QVERIFY(progress.has_value());
+    QCOMPARE(progress->totalTiles, 5);
+    QCOMPARE(progress->cachedTiles, 5);
+    QCOMPARE(progress->downloadedTiles, 0);
+    QCOMPARE(progress->failedTiles, 0);
+    QCOMPARE(progressCalls, 1);
+}
+
+void UnitTesting::parseTileRegionBounds_reads_bounding_box()
+{
+    Bach::TileRegion region;
+    region.maxZoom = 4;
+    QVERIFY(Bach::parseTileRegionBounds("10.7,59.9,10.8,59.95", region));
+    QCOMPARE(region.minLon, 10.7);
+    QCOMPARE(region.minLat, 59.9);
+    QCOMPARE(region.maxLon, 10.8);
+    QCOMPARE(region.maxLat, 59.95);
+    QCOMPARE(region.maxZoom, 4);
+
+    // Anything but four numbers in order leaves the region as it was.
+    QVERIFY(!Bach::parseTileRegionBounds("10.7,59.9,10.8", region));
+    QVERIFY(!Bach::parseTileRegionBounds("10.7,59.9,10.8,north", region));
+    QVERIFY(!Bach::parseTileRegionBounds("10.8,59.9,10.7,59.95", region));
+    QCOMPARE(region.minLon, 10.7);
+}
+
+void UnitTesting::seedRegion_backs_off_and_retries()
+{
+    // The first two requests are refused, the third one goes through.
+    int requestCount = 0;
+    Bach::UnitTesting::FakeTileServer server { [&](const QByteArray &) {
+        requestCount++;
+        Bach::UnitTesting::FakeTileServer::Reply reply;
+        if (requestCount <= 2)
+            reply.statusCode = 503;
+        else
+            reply.body = QByteArray(100, 'a');
+        return reply;
+    } };
+
+    Bach::UnitTesting::TempDir tempDir;
+    std::unique_ptr<TileLoader> tileLoader = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    tileLoader->setTileUrlTemplates(server.urlTemplate(), "");
+
+    // The single tile of zoom level 0.
+    const Bach::TileRegion world;
+    Bach::TileSeedPolicy policy;
+    policy.maxConcurrentDownloads = 1;
+    policy.retryDelayMs = 100;
+    policy.maxRetries = 2;
+    std::optional<Bach::TileSeedProgress> progress = tileLoader->seedRegion(world, policy);
+    QVERIFY(progress.has_value());
+    QCOMPARE(progress->downloadedTiles, 1);
+    QCOMPARE(progress->failedTiles, 0);
+    QCOMPARE(progress->downloadedBytes, 100);
+
+    // The delay doubles with every retry. Timers may fire a little early, so allow for some slack.
+    const auto &requests = server.requests();
+    QCOMPARE(requests.size(), (size_t)3);
+    QVERIFY(requests[1].receivedMs - requests[0].receivedMs >= 90);
+    QVERIFY(requests[2].receivedMs - requests[1].receivedMs >= 180);
+
+    // Once the retries are used up the tile has failed.
+    Bach::UnitTesting::TempDir otherTempDir;
+    tileLoader = TileLoader::newLocalOnly(StyleSheet{}, otherTempDir.path(), false);
+    tileLoader->setTileUrlTemplates(server.urlTemplate(), "");
+    requestCount = 0;
+    policy.retryDelayMs = 10;
+    policy.maxRetries = 1;
+    progress = tileLoader->seedRegion(world, policy);
+    QVERIFY(progress.has_value());
+    QCOMPARE(progress->downloadedTiles, 0);
+    QCOMPARE(progress->failedTiles, 1);
+    QCOMPARE(requests.size(), (size_t)5);
+}
+
+void UnitTesting::seedRegion_waits_as_long_as_retry_after_says()
+{
+    // The first request is told to come back in a second.
+    int requestCount = 0;
+    Bach::UnitTesting::FakeTileServer server { [&](const QByteArray &) {
+        requestCount++;
+        Bach::UnitTesting::FakeTileServer::Reply reply;
+        if (requestCount == 1) {
+            reply.statusCode = 429;
+            reply.headers = { "Retry-After: 1" };
+        } else {
+            reply.body = QByteArray(100, 'a');
+        }
+        return reply;
+    } };
+
+    Bach::UnitTesting::TempDir tempDir;
+    std::unique_ptr<TileLoader> tileLoader = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    tileLoader->setTileUrlTemplates(server.urlTemplate(), "");
+
+    // 'Retry-After' takes precedence over the much shorter delay of the policy.
+    const Bach::TileRegion world;
+    Bach::TileSeedPolicy policy;
+    policy.maxConcurrentDownloads = 1;
+    policy.retryDelayMs = 10;
+    std::optional<Bach::TileSeedProgress> progress = tileLoader->seedRegion(world, policy);
+    QVERIFY(progress.has_value());
+    QCOMPARE(progress->downloadedTiles, 1);
+
+    const auto &requests = server.requests();
+    QCOMPARE(requests.size(), (size_t)2);
+    QVERIFY(requests[1].receivedMs - requests[0].receivedMs >= 900);
+}
+
+void UnitTesting::seedRegion_stays_within_the_rate_limit()
+{
+    Bach::UnitTesting::FakeTileServer server { [](const QByteArray &) {
+        Bach::UnitTesting::FakeTileServer::Reply reply;
+        reply.body = QByteArray(2000, 'a');
+        return reply;
+    } };
+
+    Bach::UnitTesting::TempDir tempDir;
+    std::unique_ptr<TileLoader> tileLoader = TileLoader::newLocalOnly(StyleSheet{}, tempDir.path(), false);
+    tileLoader->setTileUrlTemplates(server.urlTemplate(), "");
+
+    // The 5 tiles of zoom levels 0 and 1, at 10 KB per second.
+    Bach::TileRegion world;
+    world.maxZoom = 1;
+    Bach::TileSeedPolicy policy;
+    policy.maxConcurrentDownloads = 1;
+    policy.maxBytesPerSecond = 10000;
+    std::optional<Bach::TileSeedProgress> progress = tileLoader->seedRegion(world, policy);
+    QVERIFY(progress.has_value());
+    QCOMPARE(progress->downloadedTiles, 5);
+    QCOMPARE(progress->downloadedBytes, 10000);
+
+    // Every download of 2 KB is followed by 200 ms without any, so the last one starts after 800 ms.
+    const auto &requests = server.requests();
+    QCOMPARE(requests.size(), (size_t)5);
+    QVERIFY(requests[4].receivedMs - requests[0].receivedMs >= 720);
+    QCOMPARE(server.maxInFlight(), 1);
+}
+
+void UnitTesting::taskScheduler_runs_stages_after_their_dependencies()
+{
+    using Pool = Bach::TaskScheduler::Pool;
+    Bach::TaskScheduler scheduler { "Test" };
+    scheduler.setThreadCount(Pool::Io, 2);
+    scheduler.setThreadCount(Pool::Cpu, 3);
+    QCOMPARE(scheduler.threadCount(Pool::Io), 2);
+    QCOMPARE(scheduler.threadCount(Pool::Cpu), 3);
+
+    // Many small read, parse and finish pipelines, checking every stage sees the one before it done.
+    constexpr int pipelineCount = 200;
+    std::vector<std::atomic<int>> stages(pipelineCount);
+    std::atomic<int> outOfOrder = 0;
+    for (int i = 0; i < pipelineCount; i++) {
+        auto read = scheduler.submit(Pool::Io, [&, i]() {
+            stages[i] = 1;
+        }, i);
+        auto parse = scheduler.submit(Pool::Cpu, [&, i]() {
+            if (stages[i] != 1)
+                outOfOrder++;
+            stages[i] = 2;
+        }, i, { read });
+        scheduler.submit(Pool::Io, [&, i]() {
+            if (stages[i] != 2)
+                outOfOrder++;
+            stages[i] = 3;
+        }, i, { parse, read });
+    }
+    scheduler.waitForDone();
 
+    QCOMPARE(outOfOrder.load(), 0);
+    for (int i = 0; i < pipelineCount; i++)
+        QCOMPARE(stages[i].load(), 3);
+
+    // Dependencies that have already finished don't hold a task back.
+    auto finished = scheduler.submit(Pool::Cpu, []() {});
+    scheduler.waitForDone();
+    QVERIFY(finished->isFinished());
+    std::atomic<bool> ran = false;
+    scheduler.submit(Pool::Cpu, [&]() { ran = true; }, 0, { finished, nullptr });
+    scheduler.waitForDone();
+    QVERIFY(ran);
+}
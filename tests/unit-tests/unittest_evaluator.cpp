@@ -48,6 +48,9 @@ private slots:
     void resolveExpression_with_match_value();
     void resolveExpression_with_interpolate_value();
     void resolveExpression_with_compound_value();
+    void compiledExpression_matches_resolveExpression();
+    void benchmark_resolveExpression_compound();
+    void benchmark_compiledExpression_compound();
     void cleanupTestCase();
 };
 
@@ -577,6 +580,93 @@ void UnitTesting::resolveExpression_with_compound_value()
     QVERIFY2(validDoubleError, errorMessage.toUtf8());
 }
 
+// Collects every expression in the test file.
+static QList<QJsonArray> collectTestExpressions(const QJsonObject &obj)
+{
+    QList<QJsonArray> output;
+    for (const QJsonValue &value : obj) {
+        if (value.isArray())
+            output.append(value.toArray());
+        else if (value.isObject())
+            output.append(collectTestExpressions(value.toObject()));
+    }
+    return output;
+}
+
+// Checks that the compiled form of every test expression gives the same result
+// as resolving the expression directly, across several features and zoom levels.
+void UnitTesting::compiledExpression_matches_resolveExpression()
+{
+    using MetaData = QMap<QString, QVariant>;
+    const QList<MetaData> metaDataList = {
+        MetaData(),
+        MetaData { { "class", "neighbourhood" }, { "intermittent", 1 }, { "subclass", "farm" } },
+        MetaData { { "class", "residential" } },
+        MetaData { { "class", "motorway" }, { "brunnel", "bridge" } },
+        MetaData { { "class", "motorway" }, { "ramp", 1 } },
+        MetaData { { "class", "service" }, { "intermittent", 20 } },
+    };
+
+    const QList<QJsonArray> expressions = collectTestExpressions(expressionsObject());
+    QVERIFY(!expressions.isEmpty());
+
+    for (const QJsonArray &expression : expressions) {
+        Bach::CompiledExpression compiled = Bach::CompiledExpression::compile(expression);
+        for (const MetaData &metaData : metaDataList) {
+            PolygonFeature polygon;
+            polygon.featureMetaData = metaData;
+            LineFeature line;
+            line.featureMetaData = metaData;
+            const AbstractLayerFeature *features[] = { &polygon, &line };
+
+            for (const AbstractLayerFeature *feature : features) {
+                for (int mapZoom = 0; mapZoom <= 20; mapZoom++) {
+                    QVariant expected = Evaluator::resolveExpression(expression, feature, mapZoom, 0);
+                    QVariant result = compiled.evaluate(feature, mapZoom, 0);
+                    QVERIFY2(result == expected, qPrintable(
+                        QString("Compiled expression %1 gave %2 but expected %3 at zoom level %4")
+                            .arg(QString::fromUtf8(QJsonDocument(expression).toJson(QJsonDocument::Compact)))
+                            .arg(result.toString())
+                            .arg(expected.toString())
+                            .arg(mapZoom)));
+                }
+            }
+        }
+    }
+}
+
+// Measures resolving the compound expression directly from its QJsonArray.
+void UnitTesting::benchmark_resolveExpression_compound()
+{
+    PolygonFeature feature;
+    feature.featureMetaData.insert("class", "motorway");
+    feature.featureMetaData.insert("ramp", 1);
+    QJsonArray expression = expressionsObject().value("compound").toObject().value("expression1").toArray();
+
+    QVariant result;
+    QBENCHMARK {
+        for (int mapZoom = 0; mapZoom <= 20; mapZoom++)
+            result = Evaluator::resolveExpression(expression, &feature, mapZoom, 0);
+    }
+    QVERIFY(result.isValid());
+}
+
+// Measures evaluating the compiled form of the compound expression.
+void UnitTesting::benchmark_compiledExpression_compound()
+{
+    PolygonFeature feature;
+    feature.featureMetaData.insert("class", "motorway");
+    feature.featureMetaData.insert("ramp", 1);
+    QJsonArray expression = expressionsObject().value("compound").toObject().value("expression1").toArray();
+    Bach::CompiledExpression compiled = Bach::CompiledExpression::compile(expression);
+
+    QVariant result;
+    QBENCHMARK {
+        for (int mapZoom = 0; mapZoom <= 20; mapZoom++)
+            result = compiled.evaluate(&feature, mapZoom, 0);
+    }
+    QVERIFY(result.isValid());
+}
 
 void UnitTesting::cleanupTestCase()
 {
@@ -1,7 +1,13 @@
 // Qt header files
+#include <QJsonArray>
+#include <QJsonObject>
 #include <QObject>
 #include <QTest>
 
+// STL header files
+#include <set>
+#include <vector>
+
 #include "LayerStyle.h"
 
 class UnitTesting : public QObject
@@ -28,6 +34,8 @@ private slots:
     void test_line_layer_parsing();
     void test_symbol_layer_parsing();
     void test_unknown_layer_parsing();
+    void binaryStyleSheet_round_trips();
+    void sourceLayerStages_groups_layers_by_when_they_are_drawn();
     void cleanupTestCase();
 };
 
@@ -299,6 +307,13 @@ void UnitTesting::test_line_layer_parsing()
                     .arg(lineWidth);
     QVERIFY2(lineWidth == expectedLineWidthStop2, testError.toUtf8());
 
+    // Zoom levels outside the precomputed range must still resolve through the stops.
+    lineWidth = lineLayerStyle.getLineWidthAtZoom(30).toInt();
+    testError =  QString("The line width does not match at zoom 30, expected %1 but got %2")
+                    .arg(expectedLineWidthStop2)
+                    .arg(lineWidth);
+    QVERIFY2(lineWidth == expectedLineWidthStop2, testError.toUtf8());
+
     testError =  QString("The line opacity variable type is not correct");
     QVERIFY2(lineLayerStyle.getLineOpacityAtZoom(1).typeId() == QMetaType::Type::QJsonArray, testError.toUtf8());
 
@@ -466,6 +481,106 @@ void UnitTesting::parseSheet_returns_basic_values()
 
 }
 
+void UnitTesting::binaryStyleSheet_round_trips()
+{
+    const QByteArray jsonBytes = styleSheetDoc.toJson();
+    const QByteArray sourceHash = StyleSheet::hashJsonBytes(jsonBytes);
+    const QByteArray binary = styleSheet.toBinary(sourceHash);
+    QVERIFY2(!binary.isEmpty(), "Expected every property of the style sheet to be stored.");
+
+    std::optional<StyleSheet> loadedOpt = StyleSheet::fromBinary(binary, sourceHash);
+    QVERIFY2(loadedOpt.has_value(), "Failed to load the binary style sheet.");
+    const StyleSheet &loaded = loadedOpt.value();
+    QCOMPARE(loaded.m_id, styleSheet.m_id);
+    QCOMPARE(loaded.m_version, styleSheet.m_version);
+    QCOMPARE(loaded.m_name, styleSheet.m_name);
+    QCOMPARE(loaded.m_layerStyles.size(), styleSheet.m_layerStyles.size());
+
+    for (size_t i = 0; i < styleSheet.m_layerStyles.size(); i++) {
+        const AbstractLayerStyle &expected = *styleSheet.m_layerStyles[i];
+        const AbstractLayerStyle &actual = *loaded.m_layerStyles[i];
+        QCOMPARE(actual.type(), expected.type());
+        QCOMPARE(actual.m_id, expected.m_id);
+        QCOMPARE(actual.m_sourceLayer, expected.m_sourceLayer);
+        QCOMPARE(actual.m_minZoom, expected.m_minZoom);
+        QCOMPARE(actual.m_maxZoom, expected.m_maxZoom);
+        QCOMPARE(actual.m_visibility, expected.m_visibility);
+        QCOMPARE(actual.m_filter, expected.m_filter);
+        QCOMPARE(actual.m_compiledFilter.isEmpty(), expected.m_compiledFilter.isEmpty());
+    }
+
+    // The properties keep their values and types at every zoom level.
+    auto const& expectedFill = *static_cast<FillLayerStyle const*>(fillLayer);
+    auto const& actualFill = *static_cast<FillLayerStyle const*>(loaded.m_layerStyles.at(1).get());
+    auto const& expectedLine = *static_cast<LineLayerStyle const*>(lineLayer);
+    auto const& actualLine = *static_cast<LineLayerStyle const*>(loaded.m_layerStyles.at(2).get());
+    auto const& expectedSymbol = *static_cast<SymbolLayerStyle const*>(symbolLayer);
+    auto const& actualSymbol = *static_cast<SymbolLayerStyle const*>(loaded.m_layerStyles.at(3).get());
+    for (int zoom = 0; zoom <= 24; zoom++) {
+        QCOMPARE(actualFill.getFillColorAtZoom(zoom), expectedFill.getFillColorAtZoom(zoom));
+        QCOMPARE(actualFill.getFillOpacityAtZoom(zoom), expectedFill.getFillOpacityAtZoom(zoom));
+        QCOMPARE(actualLine.getLineColorAtZoom(zoom), expectedLine.getLineColorAtZoom(zoom));
+        QCOMPARE(actualLine.getLineWidthAtZoom(zoom), expectedLine.getLineWidthAtZoom(zoom));
+        QCOMPARE(actualSymbol.getTextSizeAtZoom(zoom), expectedSymbol.getTextSizeAtZoom(zoom));
+        QCOMPARE(actualSymbol.getTextColorAtZoom(zoom), expectedSymbol.getTextColorAtZoom(zoom));
+    }
+    QCOMPARE(actualLine.m_lineDashArray, expectedLine.m_lineDashArray);
+    QCOMPARE(actualSymbol.m_textField, expectedSymbol.m_textField);
+    QCOMPARE(actualSymbol.m_textFont, expectedSymbol.m_textFont);
+
+    // A binary style sheet made from other JSON is rejected.
+    QVERIFY(!StyleSheet::fromBinary(binary, StyleSheet::hashJsonBytes("{}")).has_value());
+    QVERIFY(!StyleSheet::fromBinary(binary.first(binary.size() / 2), sourceHash).has_value());
+}
+
+void UnitTesting::sourceLayerStages_groups_layers_by_when_they_are_drawn()
+{
+    auto layerStyle = [](const QString &id, const QString &type, const QString &sourceLayer, int maxZoom = 24) {
+        QJsonObject layer {
+            { "id", id },
+            { "type", type },
+            { "maxzoom", maxZoom },
+            { "layout", QJsonObject { { "visibility", "visible" } } },
+        };
+        if (!sourceLayer.isEmpty())
+            layer.insert("source-layer", sourceLayer);
+        return layer;
+    };
+    const QJsonArray layers {
+        layerStyle("Background", "background", ""),
+        layerStyle("Water", "fill", "water"),
+        layerStyle("Landcover", "fill", "landcover"),
+        layerStyle("Road", "line", "transportation"),
+        // Fills after the first line are drawn on top of it.
+        layerStyle("Building", "fill", "building"),
+        // Only the first style decides the stage of a layer.
+        layerStyle("Water outline", "line", "water"),
+        layerStyle("Road name", "symbol", "transportation_name"),
+        // Styles hidden at the zoom level are left out.
+        layerStyle("Country name", "symbol", "place", 4),
+    };
+    const QJsonObject styleJson {
+        { "version", 8 },
+        { "id", "stages" },
+        { "name", "Stages" },
+        { "layers", layers },
+    };
+    std::optional<StyleSheet> styleSheetOpt = StyleSheet::fromJson(QJsonDocument { styleJson });
+    QVERIFY(styleSheetOpt.has_value());
+
+    const std::vector<std::set<QString>> stages = styleSheetOpt->sourceLayerStages(10);
+    QCOMPARE(stages.size(), (size_t)3);
+    QCOMPARE(stages[0], (std::set<QString>{ "water", "landcover" }));
+    QCOMPARE(stages[1], (std::set<QString>{ "transportation", "building" }));
+    QCOMPARE(stages[2], (std::set<QString>{ "transportation_name" }));
+
+    // Every layer of the stages is one that the style sheet draws.
+    std::set<QString> allLayers;
+    for (const std::set<QString> &stage : stages)
+        allLayers.insert(stage.begin(), stage.end());
+    QCOMPARE(allLayers, styleSheetOpt->sourceLayersShownFrom(10));
+}
+
 void UnitTesting::cleanupTestCase()
 {
     styleFile.close();
@@ -1,9 +1,19 @@
 // Qt header files
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QObject>
+#include <QPainter>
 #include <QTest>
 
+// STL header files
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
 // Other header files
 #include "Rendering.h"
+#include "Tracing.h"
 
 class UnitTesting : public QObject
 {
@@ -11,11 +21,20 @@ class UnitTesting : public QObject
 
 private slots:
     void calcVisibleTiles_returns_expected_basic_cases();
+    void calcTileScreenRects_covers_viewport();
     void calcViewportSizeNorm_returns_expected_basic_cases();
     void calcMapZoomLevelForTileSizePixels_returns_expected_basic_values();
+    void calcViewportZoomForMapZoom_gives_desired_tile_size();
     void longLatToWorldNormCoordDegrees_returns_expected_basic_values();
     void normalizeValueToZeroOneRange_returns_zero_when_small_divisor();
     void normalizeValueToZeroOneRange_returns_number_when_large_divisor();
+    void tileBitmapCache_evicts_least_recently_used();
+    void paintVectorTiles_draws_raster_placeholders_for_loading_tiles();
+    void labelCollisionIndex_matches_linear_scan();
+    void frameArena_reuses_memory_after_reset();
+    void textShapeCache_reuses_shaped_text();
+    void prepareTileLabels_stores_labels_in_rank_order();
+    void tracing_keeps_latest_events();
 };
 
 QTEST_MAIN(UnitTesting)
@@ -124,6 +143,52 @@ void UnitTesting::calcMapZoomLevelForTileSizePixels_returns_expected_basic_value
     }
 }
 
+void UnitTesting::calcViewportZoomForMapZoom_gives_desired_tile_size()
+{
+    struct TestItem {
+        int vpWidth;
+        int vpHeight;
+        int mapZoom;
+        int pixelSize;
+    };
+    const QVector<TestItem> testItems = {
+        { 512, 512, 0, 512 },
+        { 800, 600, 3, 512 },
+        { 600, 1000, 7, 256 },
+    };
+
+    for (int i = 0; i < testItems.size(); i++) {
+        const TestItem &item = testItems[i];
+        const double vpZoom = Bach::calcViewportZoomForMapZoom(
+            item.vpWidth,
+            item.vpHeight,
+            item.mapZoom,
+            item.pixelSize);
+
+        // The viewport zoom maps back to the same map zoom, even when nudged a bit.
+        for (double offset : { -0.4, 0.0, 0.4 }) {
+            const int mapZoom = Bach::calcMapZoomLevelForTileSizePixels(
+                item.vpWidth,
+                item.vpHeight,
+                vpZoom + offset,
+                item.pixelSize);
+            QVERIFY2(mapZoom == item.mapZoom, qPrintable(QString("Test item %1, offset %2").arg(i).arg(offset)));
+        }
+
+        // And the tiles are displayed at the desired size.
+        const QMap<TileCoord, QRect> tileRects = Bach::calcTileScreenRects(
+            item.vpWidth,
+            item.vpHeight,
+            0.5,
+            0.5,
+            vpZoom,
+            item.mapZoom);
+        QVERIFY(!tileRects.isEmpty());
+        for (const QRect &rect : tileRects)
+            QVERIFY2(qAbs(rect.width() - item.pixelSize) <= 1, qPrintable(QString("Test item %1").arg(i)));
+    }
+}
+
 void UnitTesting::longLatToWorldNormCoordDegrees_returns_expected_basic_values()
 {
     constexpr double epsilon = 0.001;
@@ -246,3 +311,396 @@ void UnitTesting::calcVisibleTiles_returns_expected_basic_cases()
         QVERIFY2(success, errorMsg.toUtf8());
     }
 }
+
+void UnitTesting::calcTileScreenRects_covers_viewport()
+{
+    struct TestItem {
+        int vpWidth;
+        int vpHeight;
+        double vpX;
+        double vpY;
+        double vpZoom;
+    };
+    const QVector<TestItem> testItems = {
+        { 512, 512, 0.5, 0.5, 1 },
+        { 800, 600, 0.5, 0.5, 2.5 },
+        { 600, 800, 0.3, 0.7, 4.2 },
+    };
+
+    for (int i = 0; i < testItems.size(); i++) {
+        const TestItem &item = testItems[i];
+        const int mapZoom = Bach::calcMapZoomLevelForTileSizePixels(item.vpWidth, item.vpHeight, item.vpZoom);
+        const QMap<TileCoord, QRect> tileRects = Bach::calcTileScreenRects(
+            item.vpWidth,
+            item.vpHeight,
+            item.vpX,
+            item.vpY,
+            item.vpZoom,
+            mapZoom);
+
+        // Every visible tile gets a rect, and nothing else.
+        const QVector<TileCoord> visibleTiles = Bach::calcVisibleTiles(
+            item.vpX,
+            item.vpY,
+            (double)item.vpWidth / item.vpHeight,
+            item.vpZoom,
+            mapZoom);
+        QCOMPARE(tileRects.size(), visibleTiles.size());
+        for (const TileCoord &tile : visibleTiles)
+            QVERIFY2(tileRects.contains(tile), qPrintable(QString("Test item %1: ").arg(i) + tile.toString()));
+
+        // Together the rects leave no gap in the viewport.
+        const QRect viewport { 0, 0, item.vpWidth, item.vpHeight };
+        QRegion covered;
+        for (const QRect &rect : tileRects)
+            covered += rect;
+        QVERIFY2((QRegion{ viewport } - covered).isEmpty(), qPrintable(QString("Test item %1").arg(i)));
+    }
+}
+
+void UnitTesting::paintVectorTiles_draws_raster_placeholders_for_loading_tiles()
+{
+    const int vpWidth = 512;
+    const int vpHeight = 512;
+    const double vpX = 0.5;
+    const double vpY = 0.5;
+    const double vpZoom = 1;
+    const int mapZoom = Bach::calcMapZoomLevelForTileSizePixels(vpWidth, vpHeight, vpZoom);
+    const QMap<TileCoord, QRect> tileRects = Bach::calcTileScreenRects(vpWidth, vpHeight, vpX, vpY, vpZoom, mapZoom);
+    QVERIFY(tileRects.size() >= 3);
+
+    QImage rasterImage { 256, 256, QImage::Format_ARGB32_Premultiplied };
+    rasterImage.fill(Qt::red);
+    QMap<TileCoord, const QImage*> rasterTiles;
+    for (auto it = tileRects.cbegin(); it != tileRects.cend(); it++)
+        rasterTiles.insert(it.key(), &rasterImage);
+
+    // One tile is loaded, one is still being parsed, and the rest are still loading.
+    VectorTile loadedTile;
+    VectorTile partialTile;
+    partialTile.m_partial = true;
+    const TileCoord loadedCoord = tileRects.firstKey();
+    const TileCoord partialCoord = std::next(tileRects.begin()).key();
+    QMap<TileCoord, const VectorTile*> vectorTiles;
+    vectorTiles.insert(loadedCoord, &loadedTile);
+    vectorTiles.insert(partialCoord, &partialTile);
+
+    QImage canvas { vpWidth, vpHeight, QImage::Format_ARGB32_Premultiplied };
+    canvas.fill(Qt::white);
+    {
+        QPainter painter { &canvas };
+        const StyleSheet styleSheet;
+        Bach::paintVectorTiles(
+            painter,
+            vpX,
+            vpY,
+            vpZoom,
+            mapZoom,
+            vectorTiles,
+            styleSheet,
+            Bach::PaintVectorTileSettings::getDefault(),
+            false,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr,
+            nullptr,
+            &rasterTiles);
+    }
+
+    const QRect viewport { 0, 0, vpWidth, vpHeight };
+    for (auto it = tileRects.cbegin(); it != tileRects.cend(); it++) {
+        const QRect visibleRect = it.value().intersected(viewport);
+        if (visibleRect.isEmpty())
+            continue;
+        const QColor expected = it.key() == loadedCoord ? QColor(Qt::white) : QColor(Qt::red);
+        QCOMPARE(canvas.pixelColor(visibleRect.center()), expected);
+    }
+}
+
+void UnitTesting::tileBitmapCache_evicts_least_recently_used()
+{
+    auto makeImage = []() {
+        QImage image(64, 64, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        return image;
+    };
+    auto makeKey = [](int x) {
+        Bach::TileBitmapCache::Key key;
+        key.coord = {1, x, 0};
+        key.pixelSize = 64;
+        key.drawFill = true;
+        key.drawLines = true;
+        return key;
+    };
+    const qsizetype imageBytes = makeImage().sizeInBytes();
+
+    // Room for exactly two images.
+    Bach::TileBitmapCache cache { imageBytes * 2 };
+    cache.insert(makeKey(0), makeImage());
+    cache.insert(makeKey(1), makeImage());
+
+    // Touch the first tile so the second one becomes the least recently used.
+    QVERIFY(cache.find(makeKey(0)).has_value());
+    cache.insert(makeKey(2), makeImage());
+
+    QVERIFY(cache.find(makeKey(0)).has_value());
+    QVERIFY(!cache.find(makeKey(1)).has_value());
+    QVERIFY(cache.find(makeKey(2)).has_value());
+    QCOMPARE(cache.sizeInBytes(), imageBytes * 2);
+
+    // A key that differs only in the settings is a different tile.
+    Bach::TileBitmapCache::Key fillOnlyKey = makeKey(0);
+    fillOnlyKey.drawLines = false;
+    QVERIFY(!cache.find(fillOnlyKey).has_value());
+
+    // So is the same tile loaded again, even if its memory ends up at the same address.
+    const VectorTile firstLoad;
+    const VectorTile secondLoad;
+    QVERIFY(firstLoad.uniqueId() != secondLoad.uniqueId());
+    Bach::TileBitmapCache::Key reloadedKey = makeKey(0);
+    reloadedKey.tileDataId = secondLoad.uniqueId();
+    QVERIFY(!cache.find(reloadedKey).has_value());
+
+    cache.clear();
+    QVERIFY(!cache.find(makeKey(0)).has_value());
+    QCOMPARE(cache.sizeInBytes(), 0);
+}
+
+void UnitTesting::labelCollisionIndex_matches_linear_scan()
+{
+    // Boxes of different sizes, some spanning several cells and some at negative coordinates.
+    const QVector<QRect> candidates = {
+        { 0, 0, 40, 10 },
+        { 30, 5, 40, 10 },
+        { 63, 63, 2, 2 },
+        { 64, 64, 10, 10 },
+        { -50, -20, 30, 30 },
+        { -21, 0, 5, 5 },
+        { 100, 0, 300, 12 },
+        { 250, 8, 20, 20 },
+        { 500, 500, 0, 0 },
+        { 500, 500, 10, 10 },
+    };
+
+    // Place every candidate that does not collide, both with the index and a plain linear scan.
+    Bach::LabelCollisionIndex index { 16 };
+    QVector<QRect> placedLinear;
+    for (const QRect &candidate : candidates) {
+        bool overlapsLinear = false;
+        for (const QRect &placed : placedLinear)
+            overlapsLinear = overlapsLinear || placed.intersects(candidate);
+
+        QCOMPARE(index.overlaps(candidate), overlapsLinear);
+        if (!overlapsLinear) {
+            index.insert(candidate);
+            placedLinear.append(candidate);
+        }
+    }
+    QCOMPARE(index.boxes(), placedLinear);
+
+    // A label made of several glyph boxes collides if any of them does.
+    QVERIFY(index.overlapsAny({ { 1000, 1000, 5, 5 }, { 35, 2, 4, 4 } }));
+    QVERIFY(!index.overlapsAny({ { 1000, 1000, 5, 5 }, { 2000, 2000, 5, 5 } }));
+
+    index.clear();
+    QVERIFY(!index.overlaps({ 0, 0, 40, 10 }));
+}
+
+void UnitTesting::frameArena_reuses_memory_after_reset()
+{
+    Bach::FrameArena arena { 64 };
+
+    // Allocations are aligned, and spill into new blocks once the first is full.
+    for (int i = 0; i < 100; i++) {
+        void *ptr = arena.allocate(24, alignof(double));
+        QVERIFY(ptr != nullptr);
+        QCOMPARE((quintptr)ptr % alignof(double), quintptr(0));
+    }
+    QVERIFY(arena.blockAllocations() > 1);
+    QCOMPARE(arena.bytesUsed(), size_t(2400));
+
+    // After a reset, a frame of the same size fits in the memory kept from the last one.
+    arena.reset();
+    QCOMPARE(arena.bytesUsed(), size_t(0));
+    const int blocksAfterReset = arena.blockAllocations();
+    for (int i = 0; i < 100; i++)
+        arena.allocate(24, alignof(double));
+    QCOMPARE(arena.blockAllocations(), blocksAfterReset);
+
+    // Containers can allocate from the arena, and from the heap without one.
+    std::vector<int, Bach::FrameArenaAllocator<int>> fromArena { Bach::FrameArenaAllocator<int>{ &arena } };
+    std::vector<int, Bach::FrameArenaAllocator<int>> fromHeap;
+    for (int i = 0; i < 1000; i++) {
+        fromArena.push_back(i);
+        fromHeap.push_back(i);
+    }
+    QVERIFY(std::equal(fromArena.begin(), fromArena.end(), fromHeap.begin(), fromHeap.end()));
+    QVERIFY(arena.bytesUsed() > 4000);
+
+    // Resetting the label index keeps working like clear.
+    Bach::LabelCollisionIndex index;
+    index.insert(QRect{ 0, 0, 40, 10 });
+    index.reset();
+    QVERIFY(index.boxes().isEmpty());
+    QVERIFY(!index.overlaps({ 0, 0, 40, 10 }));
+}
+
+void UnitTesting::textShapeCache_reuses_shaped_text()
+{
+    Bach::TextShapeCache cache;
+    QFont font;
+    font.setPixelSize(12);
+
+    // A label that is shaped twice is only shaped once.
+    auto first = cache.shapeLabel(font, "Sample label", 10);
+    auto second = cache.shapeLabel(font, "Sample label", 10);
+    QCOMPARE(first.get(), second.get());
+    QCOMPARE(first->lines, QList<QString>{ "Sample label" });
+    QCOMPARE(first->linePaths.size(), 1);
+    QCOMPARE(first->lineLayouts.size(), size_t(1));
+
+    // Any change to the font size or the maximum width is a different label.
+    QFont largerFont = font;
+    largerFont.setPixelSize(24);
+    QVERIFY(cache.shapeLabel(largerFont, "Sample label", 10).get() != first.get());
+
+    // A maximum width of a single em forces one word per line.
+    auto wrapped = cache.shapeLabel(font, "Sample label", 1);
+    QVERIFY(wrapped.get() != first.get());
+    QCOMPARE(wrapped->lines, (QList<QString>{ "Sample", "label" }));
+    QCOMPARE(wrapped->linePaths.size(), 2);
+
+    // Curved text is measured one character at a time.
+    auto curved = cache.shapeCurvedText(font, "AB C", 0);
+    QCOMPARE(curved.get(), cache.shapeCurvedText(font, "AB C", 0).get());
+    QCOMPARE(curved->characterAdvances.size(), 4);
+    QCOMPARE(curved->characterLayouts.size(), size_t(4));
+    QFontMetrics fontMetrics(font);
+    QCOMPARE(curved->height, fontMetrics.height());
+    QCOMPARE(curved->totalAdvance, fontMetrics.horizontalAdvance("AB") + fontMetrics.horizontalAdvance("C") + fontMetrics.horizontalAdvance(" "));
+    QVERIFY(cache.shapeCurvedText(font, "AB C", 2).get() != curved.get());
+
+    // Clearing the cache keeps the shapes that are still in use alive.
+    cache.clear();
+    QCOMPARE(first->lines, QList<QString>{ "Sample label" });
+    QVERIFY(cache.shapeLabel(font, "Sample label", 10).get() != first.get());
+}
+
+void UnitTesting::prepareTileLabels_stores_labels_in_rank_order()
+{
+    const QJsonObject symbolStyle {
+        { "id", "Place" },
+        { "type", "symbol" },
+        { "source-layer", "place" },
+        { "layout", QJsonObject {
+            { "visibility", "visible" },
+            { "text-field", "{name}" },
+            { "text-size", 12 } } },
+    };
+    const QJsonObject styleJson {
+        { "version", 8 },
+        { "id", "labels" },
+        { "name", "Labels" },
+        { "layers", QJsonArray { symbolStyle } },
+    };
+    std::optional<StyleSheet> styleSheetOpt = StyleSheet::fromJson(QJsonDocument { styleJson });
+    QVERIFY(styleSheetOpt.has_value());
+    const auto &layerStyle = *static_cast<const SymbolLayerStyle*>(styleSheetOpt->m_layerStyles.at(0).get());
+    QVERIFY(!Bach::labelsUseViewportZoom(layerStyle));
+
+    auto addPoint = [](TileLayer &layer, QPoint point, const QString &name, std::optional<int> rank) {
+        auto feature = std::make_unique<PointFeature>();
+        feature->addPoint(point);
+        if (!name.isEmpty())
+            feature->featureMetaData.insert("name", name);
+        if (rank.has_value())
+            feature->featureMetaData.insert("rank", *rank);
+        layer.m_features.push_back(std::move(feature));
+    };
+    auto layer = std::make_shared<TileLayer>(2, "place", 4096);
+    addPoint(*layer, { 100, 100 }, "Town", std::nullopt);
+    addPoint(*layer, { 200, 200 }, "Village", 10);
+    // Features without any text don't get a label.
+    addPoint(*layer, { 300, 300 }, "", 1);
+    addPoint(*layer, { 400, 400 }, "Capital", 1);
+    VectorTile tile;
+    tile.m_layers.insert({ "place", layer });
+
+    const int mapZoom = 5;
+    Bach::prepareTileLabels(tile, *styleSheetOpt, mapZoom);
+    auto labels = layer->labelCache().find(layerStyle.uniqueId(), mapZoom);
+    QVERIFY(labels != nullptr);
+    QCOMPARE(labels->pointLabels.size(), (size_t)3);
+    QCOMPARE(labels->pointLabels[0].shape->lines, QList<QString>{ "Capital" });
+    QCOMPARE(labels->pointLabels[0].anchor, QPoint(400, 400));
+    QCOMPARE(labels->pointLabels[1].shape->lines, QList<QString>{ "Village" });
+    QCOMPARE(labels->pointLabels[2].shape->lines, QList<QString>{ "Town" });
+    QCOMPARE(labels->pointLabels[2].font.pixelSize(), 12);
+    QVERIFY(labels->curvedLabels.empty());
+    // The candidates can be used on any thread, so they hold no layouts.
+    for (const Bach::TileLabelCandidates::PointLabel &label : labels->pointLabels)
+        QVERIFY(label.shape->lineLayouts.empty());
+
+    // Labels that are already prepared are kept, and only one map zoom level is stored.
+    Bach::prepareTileLabels(tile, *styleSheetOpt, mapZoom);
+    QCOMPARE(layer->labelCache().find(layerStyle.uniqueId(), mapZoom).get(), labels.get());
+    QVERIFY(layer->labelCache().find(layerStyle.uniqueId(), mapZoom + 1) == nullptr);
+
+    // Placing the labels of the tile only keeps the ones that don't overlap.
+    Bach::LabelCollisionIndex labelCollisions;
+    QVector<Bach::vpGlobalText> texts;
+    for (const Bach::TileLabelCandidates::PointLabel &label : labels->pointLabels)
+        Bach::placeLabel_Point(label, labels->outlineSize, labels->outlineColor, 1, {}, 4096, 0, 0, labelCollisions, texts);
+    QCOMPARE(texts.size(), 3);
+    // The placed labels are laid out on the thread that places them.
+    QCOMPARE(texts[0].shape->lineLayouts.size(), size_t(1));
+    QCOMPARE(texts[0].shape.get(), Bach::TextShapeCache::global().shapeLabel(texts[0].font, "Capital", labels->pointLabels[0].maxWidthEms).get());
+    Bach::placeLabel_Point(labels->pointLabels[0], labels->outlineSize, labels->outlineColor, 1, {}, 4096, 0, 0, labelCollisions, texts);
+    QCOMPARE(texts.size(), 3);
+}
+
+void UnitTesting::tracing_keeps_latest_events()
+{
+    const bool wasEnabled = Bach::Tracing::isEnabled();
+    const int oldCapacity = Bach::Tracing::capacity();
+    Bach::Tracing::setEnabled(true);
+    Bach::Tracing::setCapacity(2);
+    Bach::Tracing::clear();
+
+    const char *names[] = { "first", "second", "third" };
+    for (const char *name : names)
+        Bach::Tracing::ScopedTimer timer { name };
+
+    // Only the latest events fit, oldest first.
+    const std::vector<Bach::Tracing::Event> events = Bach::Tracing::recentEvents();
+    QCOMPARE((int)events.size(), 2);
+    QCOMPARE(QString(events[0].name), QString("second"));
+    QCOMPARE(QString(events[1].name), QString("third"));
+    QVERIFY(events[0].startNs <= events[1].startNs);
+    QVERIFY(events[0].durationNs >= 0);
+
+    const QJsonDocument trace = QJsonDocument::fromJson(Bach::Tracing::toChromeTraceJson(events));
+    QCOMPARE((int)trace["traceEvents"].toArray().size(), 2);
+    QCOMPARE(trace["traceEvents"][0]["ph"].toString(), QString("X"));
+
+    // The totals of the scopes keep counting the events that were overwritten.
+    for (const char *name : names)
+        Bach::Tracing::ScopedTimer timer { name };
+    QCOMPARE(Bach::Tracing::scopeTotal("first").count, qint64(2));
+    QCOMPARE(Bach::Tracing::scopeTotal("third").count, qint64(2));
+    QVERIFY(Bach::Tracing::scopeTotal("first").durationNs >= 0);
+    QCOMPARE(Bach::Tracing::scopeTotal("unknown").count, qint64(0));
+
+    // Nothing is recorded while disabled.
+    Bach::Tracing::setEnabled(false);
+    Bach::Tracing::clear();
+    {
+        Bach::Tracing::ScopedTimer timer { "disabled" };
+    }
+    QVERIFY(Bach::Tracing::recentEvents().empty());
+    QCOMPARE(Bach::Tracing::scopeTotal("first").count, qint64(0));
+
+    Bach::Tracing::setCapacity(oldCapacity);
+    Bach::Tracing::setEnabled(wasEnabled);
+}
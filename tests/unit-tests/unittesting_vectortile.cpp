@@ -2,7 +2,12 @@
 #include <QObject>
 #include <QTest>
 
+// STL header files
+#include <cmath>
+#include <set>
+
 // Other header files
+#include "TileTessellation.h"
 #include "VectorTiles.h"
 
 class UnitTesting : public QObject
@@ -11,6 +16,16 @@ class UnitTesting : public QObject
 
 private slots:
     void tileFromByteArray_returns_basic_values();
+    void tileFromByteArray_matches_qtprotobuf_decoder();
+    void tileFromByteArray_only_reads_within_view();
+    void feature_properties_resolve_through_layer_tables();
+    void filterCache_is_invalidated_by_map_zoom();
+    void triangulatePolygonFeature_covers_polygon_area();
+    void tessellateVectorTile_builds_meshes_for_every_feature();
+    void tileFromByteArray_clips_and_simplifies_geometry();
+    void tileFromByteArray_decodes_selected_layers_lazily();
+    void fromByteArrays_matches_tileFromByteArray();
+    void tileFromByteArray_stores_feature_bounding_boxes();
 };
 
 QTEST_MAIN(UnitTesting)
@@ -91,3 +106,392 @@ void UnitTesting::tileFromByteArray_returns_basic_values()
     QVERIFY2(tile != std::nullopt, readError.toUtf8());
     testTileLayers(tile.value());
 }
+
+// The wire decoder replaced the QtProtobuf based decoder,
+// make sure they produce the exact same tile.
+void UnitTesting::tileFromByteArray_matches_qtprotobuf_decoder()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    QByteArray tileBytes = tileFile.readAll();
+
+    std::optional<VectorTile> wireTileOpt = Bach::tileFromByteArray(tileBytes);
+    std::optional<VectorTile> protobufTileOpt = Bach::tileFromByteArray_QtProtobuf(tileBytes);
+    QVERIFY(wireTileOpt.has_value());
+    QVERIFY(protobufTileOpt.has_value());
+    const VectorTile &wireTile = wireTileOpt.value();
+    const VectorTile &protobufTile = protobufTileOpt.value();
+
+    QCOMPARE(wireTile.m_layers.size(), protobufTile.m_layers.size());
+    for (const auto &[layerName, protobufLayer] : protobufTile.m_layers) {
+        auto wireLayerIt = wireTile.m_layers.find(layerName);
+        QVERIFY2(wireLayerIt != wireTile.m_layers.end(), qPrintable("Missing layer " + layerName));
+        const TileLayer &wireLayer = *wireLayerIt->second;
+
+        QCOMPARE(wireLayer.version(), protobufLayer->version());
+        QCOMPARE(wireLayer.extent(), protobufLayer->extent());
+        QCOMPARE(wireLayer.m_features.size(), protobufLayer->m_features.size());
+
+        for (size_t i = 0; i < wireLayer.m_features.size(); i++) {
+            const AbstractLayerFeature &wireFeature = *wireLayer.m_features[i];
+            const AbstractLayerFeature &protobufFeature = *protobufLayer->m_features[i];
+
+            QCOMPARE(wireFeature.type(), protobufFeature.type());
+            QCOMPARE(wireFeature.tags, protobufFeature.tags);
+            QCOMPARE(wireFeature.properties(), protobufFeature.properties());
+
+            switch (wireFeature.type()) {
+            case AbstractLayerFeature::featureType::polygon:
+                QVERIFY(static_cast<const PolygonFeature&>(wireFeature).polygon() ==
+                        static_cast<const PolygonFeature&>(protobufFeature).polygon());
+                break;
+            case AbstractLayerFeature::featureType::line:
+                QVERIFY(static_cast<const LineFeature&>(wireFeature).line() ==
+                        static_cast<const LineFeature&>(protobufFeature).line());
+                break;
+            case AbstractLayerFeature::featureType::point:
+                QCOMPARE(static_cast<const PointFeature&>(wireFeature).points(),
+                         static_cast<const PointFeature&>(protobufFeature).points());
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+// Cached tiles are parsed straight out of memory-mapped files,
+// make sure the decoder stays within the bytes it is given.
+void UnitTesting::tileFromByteArray_only_reads_within_view()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    const QByteArray tileBytes = tileFile.readAll();
+
+    // Trailing bytes that are not a valid protocol buffer.
+    QByteArray buffer = tileBytes;
+    buffer.append(QByteArray(16, char(0xFF)));
+    const QByteArrayView tileView = QByteArrayView{ buffer }.first(tileBytes.size());
+
+    std::optional<VectorTile> viewTileOpt = Bach::tileFromByteArray(tileView);
+    std::optional<VectorTile> tileOpt = Bach::tileFromByteArray(tileBytes);
+    QVERIFY(viewTileOpt.has_value());
+    QVERIFY(tileOpt.has_value());
+    QCOMPARE(viewTileOpt->m_layers.size(), tileOpt->m_layers.size());
+    for (const auto &[layerName, layer] : tileOpt->m_layers) {
+        auto viewLayerIt = viewTileOpt->m_layers.find(layerName);
+        QVERIFY2(viewLayerIt != viewTileOpt->m_layers.end(), qPrintable("Missing layer " + layerName));
+        QCOMPARE(viewLayerIt->second->m_features.size(), layer->m_features.size());
+    }
+
+    QVERIFY(!Bach::tileFromByteArray(buffer).has_value());
+}
+
+// Checks that a feature that refers to its layer's property tables
+// resolves its properties through its tags.
+void UnitTesting::feature_properties_resolve_through_layer_tables()
+{
+    TileLayerProperties properties;
+    properties.keys = { "class", "rank", "name" };
+    properties.values = { QVariant("grass"), QVariant(3), QVariant(), QVariant("farm") };
+    properties.rebuildKeyIds();
+
+    PolygonFeature feature;
+    // class = grass, rank = 3, name = <no value>, class = farm
+    feature.tags = { 0, 0, 1, 1, 2, 2, 0, 3 };
+    feature.setLayerProperties(&properties);
+
+    // A repeated key resolves to its last value.
+    QCOMPARE(feature.property("class").toString(), QString("farm"));
+    QCOMPARE(feature.property("rank").toInt(), 3);
+    QVERIFY(feature.hasProperty("rank"));
+
+    // Values without any known type are treated as missing.
+    QVERIFY(!feature.hasProperty("name"));
+    QVERIFY(!feature.hasProperty("subclass"));
+    QVERIFY(!feature.property("subclass").isValid());
+
+    QMap<QString, QVariant> expected;
+    expected.insert("class", "farm");
+    expected.insert("rank", 3);
+    QCOMPARE(feature.properties(), expected);
+
+    // A key listed twice in the layer's keys is looked up by its first index.
+    TileLayerProperties duplicateKeys;
+    duplicateKeys.keys = { "class", "rank", "class" };
+    duplicateKeys.rebuildKeyIds();
+    QCOMPARE(duplicateKeys.keyId("class"), 0);
+    QCOMPARE(duplicateKeys.keyId("rank"), 1);
+    QCOMPARE(duplicateKeys.keyId("name"), -1);
+}
+
+// Checks that the filter cache keeps results per layer style,
+// and drops them when a result for another map zoom level is stored.
+void UnitTesting::filterCache_is_invalidated_by_map_zoom()
+{
+    TileLayerFilterCache cache;
+    QVERIFY(cache.find(1, 5) == nullptr);
+
+    auto indices = std::make_shared<TileLayerFilterCache::FeatureIndices>(TileLayerFilterCache::FeatureIndices{ 0, 2, 3 });
+    cache.insert(1, 5, indices);
+    cache.insert(2, 5, std::make_shared<TileLayerFilterCache::FeatureIndices>());
+
+    QVERIFY(cache.find(1, 5) == indices);
+    QVERIFY(cache.find(2, 5) != nullptr);
+    QVERIFY(cache.find(1, 6) == nullptr);
+
+    cache.insert(2, 6, std::make_shared<TileLayerFilterCache::FeatureIndices>());
+    QVERIFY(cache.find(1, 5) == nullptr);
+    QVERIFY(cache.find(2, 6) != nullptr);
+
+    cache.clear();
+    QVERIFY(cache.find(2, 6) == nullptr);
+}
+
+// Appends a single part to the geometry storage.
+static void appendPart(TileLayerGeometry &geometry, const QVector<QPoint> &points, bool closed)
+{
+    for (QPoint point : points)
+        geometry.vertices.push_back(point);
+    geometry.partVertexOffsets.push_back((quint32)geometry.vertices.size());
+    geometry.partClosed.push_back(closed);
+}
+
+// Sums up the area of every triangle in the mesh.
+static double meshArea(const TileMesh &mesh)
+{
+    double out = 0;
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        const QPointF a = mesh.positions[mesh.indices[i]];
+        const QPointF b = mesh.positions[mesh.indices[i + 1]];
+        const QPointF c = mesh.positions[mesh.indices[i + 2]];
+        out += qAbs((b.x() - a.x()) * (c.y() - a.y()) - (c.x() - a.x()) * (b.y() - a.y())) / 2;
+    }
+    return out;
+}
+
+// The triangles of a polygon should cover exactly its area, leaving out the holes.
+void UnitTesting::triangulatePolygonFeature_covers_polygon_area()
+{
+    using FeatureType = AbstractLayerFeature::featureType;
+    TileLayerGeometry geometry;
+    // A square with a square hole, followed by a second polygon shaped like an L.
+    appendPart(geometry, { { 0, 0 }, { 10, 0 }, { 10, 10 }, { 0, 10 } }, true);
+    appendPart(geometry, { { 2, 2 }, { 2, 8 }, { 8, 8 }, { 8, 2 } }, true);
+    appendPart(geometry, { { 20, 0 }, { 30, 0 }, { 30, 5 }, { 25, 5 }, { 25, 10 }, { 20, 10 } }, true);
+    geometry.featurePartOffsets.push_back(3);
+    geometry.featureTypes.push_back(FeatureType::polygon);
+
+    TileMesh mesh;
+    Bach::triangulatePolygonFeature(geometry, 0, mesh);
+    QCOMPARE(meshArea(mesh), 100.0 - 36.0 + 75.0);
+    for (quint32 index : mesh.indices)
+        QVERIFY(index < mesh.positions.size());
+
+    // A line of width 2 along two sides of a square, joined with a miter.
+    TileLayerGeometry lineGeometry;
+    appendPart(lineGeometry, { { 0, 0 }, { 10, 0 }, { 10, 10 } }, false);
+    lineGeometry.featurePartOffsets.push_back(1);
+    lineGeometry.featureTypes.push_back(FeatureType::line);
+
+    TileMesh lineMesh;
+    Bach::extrudeLineFeature(lineGeometry, 0, lineMesh);
+    QCOMPARE(lineMesh.extrusions.size(), lineMesh.positions.size());
+    for (size_t i = 0; i < lineMesh.positions.size(); i++)
+        lineMesh.positions[i] += lineMesh.extrusions[i];
+    QCOMPARE(meshArea(lineMesh), 40.0);
+}
+
+// Every polygon and line feature of the test tile should end up with its own range of triangles.
+void UnitTesting::tessellateVectorTile_builds_meshes_for_every_feature()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    std::optional<VectorTile> tile = Bach::tileFromByteArray(tileFile.readAll());
+    QVERIFY(tile.has_value());
+
+    Bach::tessellateVectorTile(*tile);
+    bool foundFills = false;
+    bool foundLines = false;
+    for (const auto &[layerName, layer] : tile->m_layers) {
+        const TileLayerMeshes *meshes = layer->meshes();
+        QVERIFY2(meshes != nullptr, qPrintable(layerName));
+        const TileLayerGeometry &geometry = layer->geometry();
+        QCOMPARE(meshes->fillIndexOffsets.size(), (size_t)geometry.featureCount() + 1);
+        QCOMPARE(meshes->lineIndexOffsets.size(), (size_t)geometry.featureCount() + 1);
+        QCOMPARE((size_t)meshes->fillIndexOffsets.back(), meshes->fills.indices.size());
+        QCOMPARE((size_t)meshes->lineIndexOffsets.back(), meshes->lines.indices.size());
+        for (quint32 index : meshes->fills.indices)
+            QVERIFY(index < meshes->fills.positions.size());
+        for (quint32 index : meshes->lines.indices)
+            QVERIFY(index < meshes->lines.positions.size());
+        foundFills |= !meshes->fills.indices.empty();
+        foundLines |= !meshes->lines.indices.empty();
+    }
+    QVERIFY(foundFills);
+    QVERIFY(foundLines);
+}
+
+// Clipping should keep every vertex within the buffer around the extent, and leave the
+// features alone otherwise. The simplified paths should be smaller than the full geometry.
+void UnitTesting::tileFromByteArray_clips_and_simplifies_geometry()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    const QByteArray tileBytes = tileFile.readAll();
+
+    const Bach::TileParseOptions options = Bach::TileParseOptions::forTilePixelSize(256);
+    std::optional<VectorTile> fullTile = Bach::tileFromByteArray(tileBytes);
+    std::optional<VectorTile> clippedTile = Bach::tileFromByteArray(tileBytes, options);
+    QVERIFY(fullTile.has_value());
+    QVERIFY(clippedTile.has_value());
+    QCOMPARE(clippedTile->m_layers.size(), fullTile->m_layers.size());
+
+    bool foundSimplified = false;
+    for (const auto &[layerName, layer] : clippedTile->m_layers) {
+        const TileLayer &fullLayer = *fullTile->m_layers.find(layerName)->second;
+        QCOMPARE(layer->m_features.size(), fullLayer.m_features.size());
+
+        const int buffer = (int)std::ceil(layer->extent() * options.clipBuffer);
+        for (QPoint vertex : layer->geometry().vertices) {
+            QVERIFY2(vertex.x() >= -buffer && vertex.x() <= layer->extent() + buffer, qPrintable(layerName));
+            QVERIFY2(vertex.y() >= -buffer && vertex.y() <= layer->extent() + buffer, qPrintable(layerName));
+        }
+
+        const TileLayerGeometry &geometry = layer->geometry();
+        for (int tilePixelSize : options.simplifiedTilePixelSizes) {
+            int simplifiedElements = 0;
+            int fullElements = 0;
+            for (int i = 0; i < geometry.featureCount(); i++) {
+                const QPainterPath *path = layer->simplifiedPath(i, tilePixelSize);
+                QVERIFY(path != nullptr);
+                simplifiedElements += path->elementCount();
+                fullElements += geometry.buildPath(i).elementCount();
+            }
+            QVERIFY(simplifiedElements <= fullElements);
+            foundSimplified |= simplifiedElements < fullElements;
+        }
+        // Tiles drawn larger than any simplified level use the full geometry.
+        if (geometry.featureCount() > 0)
+            QVERIFY(layer->simplifiedPath(0, options.simplifiedTilePixelSizes.back() + 1) == nullptr);
+    }
+    QVERIFY(foundSimplified);
+}
+
+// Only the selected layers should be decoded, and deferred geometry should
+// come out the same as geometry decoded right away.
+void UnitTesting::tileFromByteArray_decodes_selected_layers_lazily()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    const QByteArray tileBytes = tileFile.readAll();
+
+    Bach::TileParseOptions options;
+    options.layerNames = std::set<QString>{ "boundary", "place", "water" };
+    options.deferGeometry = true;
+    std::optional<VectorTile> fullTile = Bach::tileFromByteArray(tileBytes);
+    std::optional<VectorTile> lazyTile = Bach::tileFromByteArray(tileBytes, options);
+    QVERIFY(fullTile.has_value());
+    QVERIFY(lazyTile.has_value());
+    QCOMPARE(lazyTile->m_layers.size(), options.layerNames->size());
+
+    for (const auto &[layerName, layer] : lazyTile->m_layers) {
+        QVERIFY2(options.layerNames->count(layerName) == 1, qPrintable(layerName));
+        const TileLayer &fullLayer = *fullTile->m_layers.find(layerName)->second;
+        QCOMPARE(layer->m_features.size(), fullLayer.m_features.size());
+
+        const TileLayerGeometry &geometry = layer->geometry();
+        const TileLayerGeometry &fullGeometry = fullLayer.geometry();
+        QCOMPARE(geometry.vertices, fullGeometry.vertices);
+        QCOMPARE(geometry.partVertexOffsets, fullGeometry.partVertexOffsets);
+        QCOMPARE(geometry.featurePartOffsets, fullGeometry.featurePartOffsets);
+        for (size_t i = 0; i < layer->m_features.size(); i++) {
+            const AbstractLayerFeature *feature = layer->m_features[i].get();
+            const AbstractLayerFeature *fullFeature = fullLayer.m_features[i].get();
+            QCOMPARE(feature->type(), fullFeature->type());
+            if (feature->type() == AbstractLayerFeature::featureType::polygon) {
+                QCOMPARE(
+                    static_cast<const PolygonFeature*>(feature)->polygon(),
+                    static_cast<const PolygonFeature*>(fullFeature)->polygon());
+            } else if (feature->type() == AbstractLayerFeature::featureType::point) {
+                QCOMPARE(
+                    static_cast<const PointFeature*>(feature)->points(),
+                    static_cast<const PointFeature*>(fullFeature)->points());
+            }
+        }
+    }
+
+    // A second pass that skips the selected layers decodes exactly the rest of the tile.
+    Bach::TileParseOptions restOptions;
+    restOptions.skippedLayerNames = *options.layerNames;
+    std::optional<VectorTile> restTile = Bach::tileFromByteArray(tileBytes, restOptions);
+    QVERIFY(restTile.has_value());
+    QCOMPARE(restTile->m_layers.size() + lazyTile->m_layers.size(), fullTile->m_layers.size());
+    for (const auto &[layerName, layer] : restTile->m_layers)
+        QVERIFY2(options.layerNames->count(layerName) == 0, qPrintable(layerName));
+}
+
+// Tiles parsed in a batch should come out the same as tiles parsed one by one,
+// and in the same order. Broken tiles should not take the rest of the batch with them.
+void UnitTesting::fromByteArrays_matches_tileFromByteArray()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    const QByteArray tileBytes = tileFile.readAll();
+    const QByteArray brokenBytes = tileBytes.first(tileBytes.size() / 2);
+
+    const std::vector<QByteArray> batch = { tileBytes, brokenBytes, tileBytes, tileBytes };
+    std::vector<std::optional<VectorTile>> tiles = VectorTile::fromByteArrays(batch);
+    QCOMPARE(tiles.size(), batch.size());
+    QCOMPARE(tiles[1].has_value(), Bach::tileFromByteArray(brokenBytes).has_value());
+
+    std::optional<VectorTile> expectedTile = Bach::tileFromByteArray(tileBytes);
+    QVERIFY(expectedTile.has_value());
+    for (size_t i : { 0, 2, 3 }) {
+        QVERIFY(tiles[i].has_value());
+        QCOMPARE(tiles[i]->m_layers.size(), expectedTile->m_layers.size());
+        for (const auto &[layerName, expectedLayer] : expectedTile->m_layers) {
+            const TileLayer &layer = *tiles[i]->m_layers.find(layerName)->second;
+            QCOMPARE(layer.m_features.size(), expectedLayer->m_features.size());
+            QCOMPARE(layer.geometry().vertices, expectedLayer->geometry().vertices);
+            QCOMPARE(layer.geometry().partVertexOffsets, expectedLayer->geometry().partVertexOffsets);
+        }
+    }
+}
+
+// Every polygon and line feature should get a bounding box that holds all of its vertices
+// and is as tight as the geometry. Deferred geometry should get the same boxes.
+void UnitTesting::tileFromByteArray_stores_feature_bounding_boxes()
+{
+    QFile tileFile(":/unitTestResources/000testTile.pbf");
+    QVERIFY2(tileFile.open(QIODevice::ReadOnly), "Could not open file");
+    const QByteArray tileBytes = tileFile.readAll();
+
+    Bach::TileParseOptions lazyOptions;
+    lazyOptions.deferGeometry = true;
+    std::optional<VectorTile> tile = Bach::tileFromByteArray(tileBytes);
+    std::optional<VectorTile> lazyTile = Bach::tileFromByteArray(tileBytes, lazyOptions);
+    QVERIFY(tile.has_value());
+    QVERIFY(lazyTile.has_value());
+
+    for (const auto &[layerName, layer] : tile->m_layers) {
+        const TileLayerGeometry &geometry = layer->geometry();
+        const TileLayerGeometry &lazyGeometry = lazyTile->m_layers.find(layerName)->second->geometry();
+        QCOMPARE((int)geometry.featureBounds.size(), geometry.featureCount());
+        QCOMPARE((int)lazyGeometry.featureBounds.size(), geometry.featureCount());
+
+        for (int i = 0; i < geometry.featureCount(); i++) {
+            const std::optional<QRect> bounds = layer->featureBoundingRect(i);
+            QVERIFY(bounds.has_value());
+            QVERIFY(lazyGeometry.featureBoundingRect(i) == bounds);
+
+            const QPainterPath path = geometry.buildPath(i);
+            if (path.elementCount() == 0) {
+                QVERIFY(bounds->isEmpty());
+                continue;
+            }
+            QCOMPARE(QRectF(bounds->topLeft(), bounds->bottomRight()), path.controlPointRect());
+        }
+        QVERIFY(!layer->featureBoundingRect(geometry.featureCount()).has_value());
+    }
+}
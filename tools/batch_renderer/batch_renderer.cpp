@@ -0,0 +1,305 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+/*
+ * Renders a range of vector tiles into a pyramid of PNG files, using the same
+ * styling as the application, without opening any window.
+ *
+ * Example:
+ *     batch_renderer --style style.json --output out --min-zoom 0 --max-zoom 6 -j 8
+ *
+ * The tiles are read from the tile cache folder, the same one the application
+ * fills while browsing, or from the folder given with '--tiles'. The output is
+ * stored as '<output>/<z>/<x>/<y>.png'.
+ *
+ * The work is done as a streaming pipeline. The TileLoader reads and parses one
+ * window of tiles on its worker threads while the previous window is rendered,
+ * encoded and written by the render threads. Only two windows are ever in memory.
+ */
+
+// Qt header files
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+// STL header files
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <vector>
+
+// Other header files
+#include "Rendering.h"
+#include "TileLoader.h"
+#include "Utilities.h"
+
+using Bach::TileLoader;
+
+// Helper function to let us do early shutdown.
+[[noreturn]] void shutdown(const QString &msg = "")
+{
+    if (msg != "") {
+        qCritical() << msg;
+    }
+    std::exit(EXIT_FAILURE);
+}
+
+/*!
+ * \brief The RenderCounters struct counts the outcome of every tile.
+ * Updated from the render threads.
+ */
+struct RenderCounters {
+    std::atomic<int> written = 0;
+    std::atomic<int> missing = 0;
+    std::atomic<int> failed = 0;
+    std::atomic<qint64> bytesWritten = 0;
+};
+
+/*!
+ * \brief loadWindow
+ * Asks the TileLoader for a window of tiles and waits until none of them are pending anymore.
+ *
+ * \param tileFinished Released by the TileLoader every time a tile is done.
+ * \return The result that holds on to the loaded tiles.
+ */
+static QScopedPointer<Bach::RequestTilesResult> loadWindow(
+    TileLoader &tileLoader,
+    const QVector<TileCoord> &window,
+    QSemaphore &tileFinished)
+{
+    QScopedPointer<Bach::RequestTilesResult> result = tileLoader.requestTiles(window, true);
+    auto isPending = [&](TileCoord coord) {
+        const std::optional<Bach::LoadedTileState> state = tileLoader.getTileState_Vector(coord);
+        return state.has_value() && state.value() == Bach::LoadedTileState::Pending;
+    };
+    while (std::any_of(window.begin(), window.end(), isPending))
+        tileFinished.tryAcquire(1, 100);
+
+    // Ask again, so that the result holds every tile that has loaded.
+    return tileLoader.requestTiles(window, false);
+}
+
+/*!
+ * \brief renderTile
+ * Renders a single tile into an image, encodes it and writes it to the output pyramid.
+ * Runs on the render threads.
+ */
+static void renderTile(
+    TileCoord coord,
+    const VectorTile &tileData,
+    const StyleSheet &styleSheet,
+    int tileSizePixels,
+    const QString &outputPath,
+    RenderCounters &counters)
+{
+    // Every render thread keeps its image, so that it is not allocated again for every tile.
+    thread_local QImage image;
+    if (image.width() != tileSizePixels || image.height() != tileSizePixels)
+        image = QImage(tileSizePixels, tileSizePixels, QImage::Format_ARGB32_Premultiplied);
+
+    {
+        QPainter painter(&image);
+        painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+
+        // At a viewport zoom equal to the map zoom, a single tile covers the whole viewport.
+        const double tileCount = 1 << coord.zoom;
+        QMap<TileCoord, const VectorTile*> tiles;
+        tiles.insert(coord, &tileData);
+        Bach::paintVectorTiles(
+            painter,
+            (coord.x + 0.5) / tileCount,
+            (coord.y + 0.5) / tileCount,
+            coord.zoom,
+            coord.zoom,
+            tiles,
+            styleSheet,
+            Bach::PaintVectorTileSettings::getDefault(),
+            false);
+    }
+
+    QByteArray fileBytes;
+    QBuffer buffer(&fileBytes);
+    if (!buffer.open(QIODevice::WriteOnly) || !image.save(&buffer, "PNG")) {
+        qWarning() << "Unable to encode tile" << coord.toString();
+        counters.failed++;
+        return;
+    }
+
+    const QString path = QString("%1/%2/%3/%4.png")
+        .arg(outputPath)
+        .arg(coord.zoom)
+        .arg(coord.x)
+        .arg(coord.y);
+    QFile::remove(path);
+    if (!Bach::writeNewFileHelper(path, fileBytes)) {
+        qWarning() << "Unable to write" << path;
+        counters.failed++;
+        return;
+    }
+    counters.written++;
+    counters.bytesWritten += fileBytes.size();
+}
+
+int main(int argc, char *argv[])
+{
+    // We never show anything on screen, but text rendering needs a QGuiApplication.
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qt_thesis_app");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders vector tiles into a pyramid of PNG files.");
+    parser.addHelpOption();
+    QCommandLineOption styleOption("style", "The style sheet JSON file to render with.", "path");
+    QCommandLineOption outputOption("output", "The folder to write '<z>/<x>/<y>.png' into.", "path");
+    QCommandLineOption tilesOption(
+        "tiles",
+        "The tile cache folder to read vector tiles from. Defaults to the one of the application.",
+        "path");
+    QCommandLineOption minZoomOption("min-zoom", "The lowest zoom level to render.", "zoom", "0");
+    QCommandLineOption maxZoomOption("max-zoom", "The highest zoom level to render.", "zoom", "0");
+    QCommandLineOption boundsOption(
+        "bbox",
+        "The area to render, in degrees. Defaults to the whole world.",
+        "minLon,minLat,maxLon,maxLat");
+    QCommandLineOption tileSizeOption("tile-size", "The width and height of the output tiles, in pixels.", "pixels", "512");
+    QCommandLineOption jobsOption(
+        QStringList{ "j", "jobs" },
+        "The amount of render threads. Defaults to the amount of cores.",
+        "count");
+    parser.addOptions({
+        styleOption,
+        outputOption,
+        tilesOption,
+        minZoomOption,
+        maxZoomOption,
+        boundsOption,
+        tileSizeOption,
+        jobsOption });
+    parser.process(app);
+
+    if (!parser.isSet(styleOption) || !parser.isSet(outputOption))
+        shutdown("Both --style and --output are required. See --help.");
+    const QString outputPath = QDir(parser.value(outputOption)).absolutePath();
+
+    bool minZoomOk = false;
+    bool maxZoomOk = false;
+    bool tileSizeOk = false;
+    const int minZoom = parser.value(minZoomOption).toInt(&minZoomOk);
+    const int maxZoom = parser.value(maxZoomOption).toInt(&maxZoomOk);
+    const int tileSizePixels = parser.value(tileSizeOption).toInt(&tileSizeOk);
+    if (!minZoomOk || !maxZoomOk || minZoom < 0 || maxZoom > Bach::maxZoomLevel || minZoom > maxZoom)
+        shutdown(QString("The zoom range has to be within [0, %1].").arg(Bach::maxZoomLevel));
+    if (!tileSizeOk || tileSizePixels <= 0)
+        shutdown("The tile size has to be a positive amount of pixels.");
+
+    Bach::TileRegion region;
+    region.minZoom = minZoom;
+    region.maxZoom = maxZoom;
+    if (parser.isSet(boundsOption) && !Bach::parseTileRegionBounds(parser.value(boundsOption), region))
+        shutdown("Unable to parse --bbox, expected 'minLon,minLat,maxLon,maxLat'.");
+
+    int renderThreadCount = QThread::idealThreadCount();
+    if (parser.isSet(jobsOption)) {
+        bool jobsOk = false;
+        renderThreadCount = parser.value(jobsOption).toInt(&jobsOk);
+        if (!jobsOk || renderThreadCount <= 0)
+            shutdown("The amount of jobs has to be a positive number.");
+    }
+
+    std::optional<StyleSheet> styleSheetOpt = StyleSheet::fromJsonFile(parser.value(styleOption));
+    if (!styleSheetOpt.has_value())
+        shutdown("Unable to parse the style sheet " + parser.value(styleOption));
+
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newLocalOnly(
+        std::move(styleSheetOpt.value()),
+        parser.value(tilesOption),
+        false);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    // Only decode what the style sheet draws.
+    tileLoader.setDecodeStyledLayersOnly(true);
+
+    QSemaphore tileFinished;
+    QObject::connect(
+        &tileLoader,
+        &TileLoader::tileFinished,
+        &tileLoader,
+        [&](TileCoord) { tileFinished.release(); },
+        Qt::DirectConnection);
+
+    const std::vector<TileCoord> tiles = Bach::calcTilesInRegion(region);
+    qInfo() << "Rendering" << tiles.size() << "tiles with" << renderThreadCount << "render threads.";
+
+    // Enough tiles per window to keep every render thread busy while the next window loads.
+    const int windowSize = qMax(16, renderThreadCount * 4);
+    auto windowAt = [&](size_t start) {
+        QVector<TileCoord> window;
+        for (size_t i = start; i < tiles.size() && i < start + windowSize; i++)
+            window.push_back(tiles[i]);
+        return window;
+    };
+
+    // Tiles of finished windows are of no use anymore.
+    Bach::TileMemoryLimits memoryLimits;
+    memoryLimits.maxTileCount = windowSize * 2;
+    tileLoader.setTileMemoryLimits(memoryLimits);
+
+    QThreadPool renderPool;
+    renderPool.setMaxThreadCount(renderThreadCount);
+    RenderCounters counters;
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<TileCoord> window = windowAt(0);
+    QScopedPointer<Bach::RequestTilesResult> loaded = loadWindow(tileLoader, window, tileFinished);
+    for (size_t start = 0; start < tiles.size(); start += windowSize) {
+        // Render the loaded window.
+        const StyleSheet &styleSheet = loaded->styleSheet();
+        const QMap<TileCoord, const VectorTile*> &vectorTiles = loaded->vectorMap();
+        for (TileCoord coord : window) {
+            auto tileIt = vectorTiles.find(coord);
+            if (tileIt == vectorTiles.end()) {
+                counters.missing++;
+                continue;
+            }
+            const VectorTile *tileData = *tileIt;
+            renderPool.start([=, &styleSheet, &counters]() {
+                renderTile(coord, *tileData, styleSheet, tileSizePixels, outputPath, counters);
+            });
+        }
+
+        // Meanwhile, load the next window.
+        QVector<TileCoord> nextWindow = windowAt(start + windowSize);
+        QScopedPointer<Bach::RequestTilesResult> nextLoaded;
+        if (!nextWindow.empty())
+            nextLoaded.reset(loadWindow(tileLoader, nextWindow, tileFinished).take());
+
+        // The rendered tiles must stay loaded until they are done.
+        renderPool.waitForDone();
+        loaded.reset(nextLoaded.take());
+        window = std::move(nextWindow);
+
+        const qint64 doneCount = counters.written + counters.missing + counters.failed;
+        qInfo().noquote() << QString("%1 of %2 tiles done.").arg(doneCount).arg(tiles.size());
+    }
+
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    qInfo().noquote() << QString("Wrote %1 tiles (%2 MB) in %3 s, %4 tiles/s. %5 tiles were missing, %6 failed.")
+        .arg(counters.written.load())
+        .arg(counters.bytesWritten.load() / 1e6, 0, 'f', 1)
+        .arg(seconds, 0, 'f', 2)
+        .arg(counters.written.load() / qMax(seconds, 1e-9), 0, 'f', 1)
+        .arg(counters.missing.load())
+        .arg(counters.failed.load());
+    return counters.failed.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
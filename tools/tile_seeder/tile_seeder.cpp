@@ -0,0 +1,182 @@
+// Copyright (c) 2024 Cecilia Norevik Bratlie, Nils Petter Skålerud, Eimen Oueslati
+// SPDX-License-Identifier: MIT
+
+/*
+ * Downloads every tile of a region into the tile cache, so that the
+ * application can show the region later without any network access.
+ *
+ * Example:
+ *     tile_seeder --bbox 10.6,59.8,10.9,60.0 --min-zoom 0 --max-zoom 14 --rate 512
+ *
+ * The MapTiler key is read the same way as the application does. The tiles
+ * are stored in the tile cache folder of the application, or in the folder
+ * given with '--tiles'. Tiles that are already cached are skipped, so an
+ * interrupted run picks up where it stopped when it is started again.
+ */
+
+// Qt header files
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+
+// STL header files
+#include <optional>
+
+// Other header files
+#include "TileLoader.h"
+#include "Utilities.h"
+
+using Bach::TileLoader;
+
+// Helper function to let us do early shutdown.
+[[noreturn]] void shutdown(const QString &msg = "")
+{
+    if (msg != "") {
+        qCritical() << msg;
+    }
+    std::exit(EXIT_FAILURE);
+}
+
+static QString formatProgress(const Bach::TileSeedProgress &progress, double seconds)
+{
+    return QString("%1 of %2 tiles done, %3 were cached, %4 downloaded (%5 MB, %6 KB/s), %7 failed.")
+        .arg(progress.doneTiles())
+        .arg(progress.totalTiles)
+        .arg(progress.cachedTiles)
+        .arg(progress.downloadedTiles)
+        .arg(progress.downloadedBytes / 1e6, 0, 'f', 1)
+        .arg(progress.downloadedBytes / 1e3 / qMax(seconds, 1e-9), 0, 'f', 1)
+        .arg(progress.failedTiles);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qt_thesis_app");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Downloads the tiles of a region into the tile cache, for offline use.");
+    parser.addHelpOption();
+    QCommandLineOption boundsOption(
+        "bbox",
+        "The area to download, in degrees.",
+        "minLon,minLat,maxLon,maxLat");
+    QCommandLineOption minZoomOption("min-zoom", "The lowest zoom level to download.", "zoom", "0");
+    QCommandLineOption maxZoomOption("max-zoom", "The highest zoom level to download.", "zoom", "0");
+    QCommandLineOption tilesOption(
+        "tiles",
+        "The tile cache folder to download into. Defaults to the one of the application.",
+        "path");
+    QCommandLineOption packOption("pack", "Store the tiles in the packed disk cache instead of one file per tile.");
+    QCommandLineOption rasterOption("raster", "Also download the raster tiles.");
+    QCommandLineOption jobsOption(
+        QStringList{ "j", "jobs" },
+        "The amount of downloads in flight at the same time.",
+        "count",
+        "2");
+    QCommandLineOption rateOption("rate", "The maximum average download rate. Unbounded by default.", "KB/s");
+    QCommandLineOption retriesOption("retries", "The amount of times a tile is retried.", "count", "5");
+    parser.addOptions({
+        boundsOption,
+        minZoomOption,
+        maxZoomOption,
+        tilesOption,
+        packOption,
+        rasterOption,
+        jobsOption,
+        rateOption,
+        retriesOption });
+    parser.process(app);
+
+    // We only download what is asked for, the whole world is far too much at high zoom levels.
+    if (!parser.isSet(boundsOption))
+        shutdown("The --bbox option is required. See --help.");
+
+    bool minZoomOk = false;
+    bool maxZoomOk = false;
+    Bach::TileRegion region;
+    region.minZoom = parser.value(minZoomOption).toInt(&minZoomOk);
+    region.maxZoom = parser.value(maxZoomOption).toInt(&maxZoomOk);
+    if (!minZoomOk || !maxZoomOk || region.minZoom < 0 || region.maxZoom > Bach::maxZoomLevel || region.minZoom > region.maxZoom)
+        shutdown(QString("The zoom range has to be within [0, %1].").arg(Bach::maxZoomLevel));
+    if (!Bach::parseTileRegionBounds(parser.value(boundsOption), region))
+        shutdown("Unable to parse --bbox, expected 'minLon,minLat,maxLon,maxLat'.");
+
+    Bach::TileSeedPolicy policy;
+    policy.includeRaster = parser.isSet(rasterOption);
+    bool jobsOk = false;
+    bool retriesOk = false;
+    policy.maxConcurrentDownloads = parser.value(jobsOption).toInt(&jobsOk);
+    policy.maxRetries = parser.value(retriesOption).toInt(&retriesOk);
+    if (!jobsOk || policy.maxConcurrentDownloads <= 0)
+        shutdown("The amount of jobs has to be a positive number.");
+    if (!retriesOk || policy.maxRetries < 0)
+        shutdown("The amount of retries can not be negative.");
+    if (parser.isSet(rateOption)) {
+        bool rateOk = false;
+        const double kiloBytesPerSecond = parser.value(rateOption).toDouble(&rateOk);
+        if (!rateOk || kiloBytesPerSecond <= 0)
+            shutdown("The download rate has to be a positive amount of KB/s.");
+        policy.maxBytesPerSecond = (qint64)(kiloBytesPerSecond * 1000);
+    }
+
+    // The tile URLs are found the same way as in the application.
+    const std::optional<QString> mapTilerKeyOpt = Bach::readMapTilerKey("key.txt");
+    if (!mapTilerKeyOpt.has_value())
+        shutdown("Unable to read the MapTiler key, which is needed to download tiles.");
+    const MapType mapType = MapType::BasicV2;
+    const HttpResponse styleSheetBytes = Bach::loadStyleSheetBytes(mapType, mapTilerKeyOpt);
+    if (styleSheetBytes.resultType != ResultType::Success)
+        shutdown("Unable to load stylesheet from disk/web.");
+    const ParsedLink pbfUrlTemplateResult = Bach::getPbfUrlTemplate(
+        QJsonDocument::fromJson(styleSheetBytes.response),
+        "maptiler_planet");
+    if (pbfUrlTemplateResult.resultType != ResultType::Success)
+        shutdown("Unable to resolve the vector tile URL.");
+    QString pngUrlTemplate;
+    if (policy.includeRaster) {
+        const ParsedLink rasterUrlTemplateResult = Bach::getRasterUrlTemplate(mapType, mapTilerKeyOpt);
+        if (rasterUrlTemplateResult.resultType != ResultType::Success)
+            shutdown("Unable to resolve the raster tile URL.");
+        pngUrlTemplate = rasterUrlTemplateResult.link;
+    }
+
+    // Tiles are only written to disk, so the TileLoader doesn't need to know how to draw them.
+    std::unique_ptr<TileLoader> tileLoaderPtr = TileLoader::newLocalOnly(
+        StyleSheet{},
+        parser.value(tilesOption),
+        policy.includeRaster);
+    TileLoader &tileLoader = *tileLoaderPtr;
+    if (parser.isSet(packOption) && !tileLoader.enablePackedDiskCache())
+        shutdown("Unable to open the packed disk cache.");
+    tileLoader.setTileUrlTemplates(pbfUrlTemplateResult.link, pngUrlTemplate);
+
+    qInfo() << "Seeding the tile cache in" << (parser.isSet(tilesOption) ?
+        QDir(parser.value(tilesOption)).absolutePath() :
+        TileLoader::getTileCacheFolder());
+
+    QElapsedTimer timer;
+    timer.start();
+    // Print the progress at most twice a second.
+    qint64 lastPrintMs = -1;
+    std::optional<Bach::TileSeedProgress> result = tileLoader.seedRegion(
+        region,
+        policy,
+        [&](const Bach::TileSeedProgress &progress) {
+            if (lastPrintMs < 0 || timer.elapsed() - lastPrintMs >= 500) {
+                lastPrintMs = timer.elapsed();
+                qInfo().noquote() << formatProgress(progress, timer.nsecsElapsed() / 1e9);
+            }
+            return true;
+        });
+    if (!result.has_value())
+        shutdown("Unable to seed the tile cache.");
+
+    qInfo().noquote() << formatProgress(result.value(), timer.nsecsElapsed() / 1e9);
+    if (result->failedTiles > 0)
+        qInfo() << "Run the seeder again to retry the failed tiles.";
+    return result->failedTiles == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}